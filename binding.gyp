@@ -8,12 +8,31 @@
       'target_name': 'webrtcjs',
       'sources': [
         'src/videosink.cc',
+        'src/audiosource.cc',
+        'src/videocapturer.cc',
+        'src/filesource.cc',
+        'src/patternsource.cc',
+        'src/forwarding.cc',
+        'src/sharedencoder.cc',
         'src/mediaconstraints.cc',
         'src/mediastreamtrack.cc',
         'src/mediastream.cc',
+        'src/compactstats.cc',
+        'src/statssampler.cc',
+        'src/eventlogwriter.cc',
+        'src/setuptiming.cc',
         'src/observers.cc',
         'src/peerconnection.cc',
+        'src/peerconnectionpool.cc',
+        'src/rtcconfiguration.cc',
+        'src/certificatepool.cc',
+        'src/udpmux.cc',
+        'src/epollsocketserver.cc',
+        'src/metrics.cc',
+        'src/blockingcall.cc',
+        'src/tracing.cc',
         'src/eventemitter.cc',
+        'src/isolatedata.cc',
         'src/webrtcjs.cc',
         'src/module.cc',
       ],
@@ -0,0 +1,319 @@
+#include "audiosource.h"
+#include "isolatedata.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "webrtc/base/bind.h"
+#include "webrtc/base/timeutils.h"
+
+#include "mediastreamtrack.h"
+
+static const int kFrameDurationMs = 10;
+static const int kMaxLagMs = 100;
+static const int kMaxBufferMs = 10 * 1000;
+
+//
+// PcmAudioSource
+//
+PcmAudioSource::PcmAudioSource(int sample_rate, size_t channels,
+    int buffer_ms) :
+    sample_rate_(sample_rate),
+    channels_(channels),
+    frame_samples_(sample_rate / (1000 / kFrameDurationMs) * channels),
+    running_(false),
+    next_tick_ns_(0),
+    ring_(static_cast<size_t>(sample_rate) * channels * buffer_ms / 1000),
+    frame_(frame_samples_),
+    primed_(false),
+    underruns_(0),
+    overruns_(0) {
+  WebRtcJs::Pin();
+}
+
+PcmAudioSource::~PcmAudioSource() {
+  LOG(LS_INFO) << __FUNCTION__;
+  // Runs as long as a track or the AudioSource holds a reference.
+  Stop();
+  WebRtcJs::Unpin();
+}
+
+void PcmAudioSource::Start() {
+  rtc::Thread* thread = WebRtcJs::GetMediaThreadIfRunning();
+  if(!thread) {
+    LOG(LS_WARNING) << __FUNCTION__ << ": No media thread";
+    return;
+  }
+  if(!thread->IsCurrent()) {
+    return thread->Invoke<void>(rtc::Bind(&PcmAudioSource::Start, this));
+  }
+  if(!running_) {
+    running_ = true;
+    next_tick_ns_ = rtc::TimeNanos();
+    thread->Post(this);
+  }
+}
+
+void PcmAudioSource::Stop() {
+  rtc::Thread* thread = WebRtcJs::GetMediaThreadIfRunning();
+  if(!thread) {
+    // Shut down already, the pending ticks went with the thread.
+    running_ = false;
+    return;
+  }
+  if(!thread->IsCurrent()) {
+    // Binding the method would take a reference, and the destructor calls
+    // this with none left.
+    return thread->Invoke<void>(rtc::Bind(&PcmAudioSource::StopOnMediaThread,
+      this));
+  }
+  StopOnMediaThread(this);
+}
+
+void PcmAudioSource::StopOnMediaThread(PcmAudioSource* source) {
+  source->running_ = false;
+  rtc::Thread* thread = WebRtcJs::GetMediaThreadIfRunning();
+  if(thread) {
+    thread->Clear(source);
+  }
+}
+
+size_t PcmAudioSource::Write(const int16_t* data, size_t samples) {
+  // Only whole sample frames are queued so the channels never get shifted.
+  samples -= samples % channels_;
+  size_t written = ring_.Write(data, samples);
+  if(written < samples) {
+    overruns_++;
+  }
+  primed_ = true;
+  return written;
+}
+
+void PcmAudioSource::OnMessage(rtc::Message* msg) {
+  if(!running_) {
+    return;
+  }
+
+  int64_t now = rtc::TimeNanos();
+  int64_t frame_ns = kFrameDurationMs * rtc::kNumNanosecsPerMillisec;
+
+  // After a long stall skip the missed frames instead of bursting them out.
+  if(now - next_tick_ns_ > kMaxLagMs * rtc::kNumNanosecsPerMillisec) {
+    next_tick_ns_ = now;
+  }
+
+  while(next_tick_ns_ <= now) {
+    DeliverFrame();
+    next_tick_ns_ += frame_ns;
+  }
+
+  int delay = static_cast<int>((next_tick_ns_ - now) /
+    rtc::kNumNanosecsPerMillisec);
+  WebRtcJs::GetMediaThreadIfRunning()->PostDelayed(delay, this);
+}
+
+void PcmAudioSource::DeliverFrame() {
+  size_t read = ring_.Read(&frame_[0], frame_samples_);
+  if(read < frame_samples_) {
+    memset(&frame_[read], 0, (frame_samples_ - read) * sizeof(int16_t));
+    if(primed_) {
+      underruns_++;
+    }
+  }
+
+  rtc::CritScope lock(&sink_lock_);
+  std::vector<webrtc::AudioTrackSinkInterface*>::iterator index;
+  for(index = sinks_.begin(); index != sinks_.end(); index++) {
+    (*index)->OnData(&frame_[0], 16, sample_rate_, channels_,
+      frame_samples_ / channels_);
+  }
+}
+
+webrtc::MediaSourceInterface::SourceState PcmAudioSource::state() const {
+  return webrtc::MediaSourceInterface::kLive;
+}
+
+bool PcmAudioSource::remote() const {
+  return false;
+}
+
+void PcmAudioSource::AddSink(webrtc::AudioTrackSinkInterface* sink) {
+  rtc::CritScope lock(&sink_lock_);
+  if(std::find(sinks_.begin(), sinks_.end(), sink) == sinks_.end()) {
+    sinks_.push_back(sink);
+  }
+}
+
+void PcmAudioSource::RemoveSink(webrtc::AudioTrackSinkInterface* sink) {
+  rtc::CritScope lock(&sink_lock_);
+  std::vector<webrtc::AudioTrackSinkInterface*>::iterator index =
+    std::find(sinks_.begin(), sinks_.end(), sink);
+  if(index != sinks_.end()) {
+    sinks_.erase(index);
+  }
+}
+
+//
+// AudioSource
+//
+NAN_MODULE_INIT(AudioSource::Init) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+  tpl->SetClassName(Nan::New("AudioSource").ToLocalChecked());
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  Nan::SetPrototypeMethod(tpl, "write", AudioSource::Write);
+  Nan::SetPrototypeMethod(tpl, "createTrack", AudioSource::CreateTrack);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("sampleRate").ToLocalChecked(),
+    AudioSource::GetSampleRate);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("channels").ToLocalChecked(),
+    AudioSource::GetChannels);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("buffered").ToLocalChecked(),
+    AudioSource::GetBuffered);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("underruns").ToLocalChecked(),
+    AudioSource::GetUnderruns);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("overruns").ToLocalChecked(),
+    AudioSource::GetOverruns);
+
+  IsolateData::Current()->SetConstructor(IsolateData::kAudioSource,
+    Nan::GetFunction(tpl).ToLocalChecked());
+  Nan::Set(target, Nan::New("AudioSource").ToLocalChecked(),
+    Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+AudioSource::AudioSource(int sample_rate, size_t channels, int buffer_ms,
+    const WebRtcJs::FactoryId& factory) : factory_(factory) {
+  source_ = new rtc::RefCountedObject<PcmAudioSource>(sample_rate, channels,
+    buffer_ms);
+  source_->Start();
+}
+
+NAN_METHOD(AudioSource::New) {
+  if(!info.IsConstructCall()) {
+    return Nan::ThrowError("Use new operator");
+  }
+
+  int sample_rate = 48000;
+  int channels = 1;
+  int buffer_ms = 500;
+  v8::Local<v8::Value> factory_value = Nan::Undefined();
+
+  if(info.Length() >= 1 && info[0]->IsObject()) {
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[0]);
+    v8::Local<v8::Value> sample_rate_value =
+      options->Get(Nan::New("sampleRate").ToLocalChecked());
+    v8::Local<v8::Value> channels_value =
+      options->Get(Nan::New("channels").ToLocalChecked());
+    v8::Local<v8::Value> buffer_value =
+      options->Get(Nan::New("bufferMs").ToLocalChecked());
+    factory_value = options->Get(Nan::New("factory").ToLocalChecked());
+
+    if(sample_rate_value->IsUint32()) {
+      sample_rate = sample_rate_value->Uint32Value();
+    }
+    if(channels_value->IsUint32()) {
+      channels = channels_value->Uint32Value();
+    }
+    if(buffer_value->IsUint32()) {
+      buffer_ms = buffer_value->Uint32Value();
+    }
+  }
+
+  if(sample_rate < 8000 || sample_rate > 48000 || sample_rate % 100) {
+    return Nan::ThrowError("Invalid sampleRate");
+  }
+  if(channels < 1 || channels > 2) {
+    return Nan::ThrowError("Invalid number of channels");
+  }
+  if(buffer_ms < kFrameDurationMs) {
+    return Nan::ThrowError("bufferMs must be at least 10");
+  }
+  buffer_ms = std::min(buffer_ms, kMaxBufferMs);
+  WebRtcJs::FactoryId factory;
+  if(!WebRtcJs::ParseFactory(factory_value, &factory)) {
+    return Nan::ThrowError("Invalid factory");
+  }
+
+  AudioSource* self = new AudioSource(sample_rate, channels, buffer_ms,
+    factory);
+  self->Wrap(info.This());
+  info.GetReturnValue().Set(info.This());
+}
+
+NAN_METHOD(AudioSource::Write) {
+  AudioSource* self = Nan::ObjectWrap::Unwrap<AudioSource>(info.Holder());
+  if(info.Length() == 0 || !info[0]->IsArrayBufferView()) {
+    return Nan::ThrowError("Expected Int16Array or Buffer of PCM samples");
+  }
+  Nan::TypedArrayContents<uint8_t> bytes(info[0]);
+  if(bytes.length() % sizeof(int16_t)) {
+    return Nan::ThrowError("Expected whole 16 bit samples");
+  }
+  const int16_t* samples = reinterpret_cast<const int16_t*>(*bytes);
+  size_t length = bytes.length() / sizeof(int16_t);
+  // A Buffer sliced at an odd offset, e.g. out of a network packet.
+  std::vector<int16_t> aligned;
+  if(length && reinterpret_cast<uintptr_t>(*bytes) % alignof(int16_t)) {
+    aligned.resize(length);
+    memcpy(&aligned[0], *bytes, bytes.length());
+    samples = &aligned[0];
+  }
+  size_t written = self->source_->Write(samples, length);
+  info.GetReturnValue().Set(Nan::New(static_cast<uint32_t>(written)));
+}
+
+NAN_METHOD(AudioSource::CreateTrack) {
+  AudioSource* self = Nan::ObjectWrap::Unwrap<AudioSource>(info.Holder());
+  std::string id("audio");
+  if(info.Length() >= 1 && info[0]->IsString()) {
+    v8::String::Utf8Value id_value(info[0]->ToString());
+    id = *id_value;
+  }
+  webrtc::PeerConnectionFactoryInterface* factory =
+    WebRtcJs::GetPeerConnectionFactory(self->factory_);
+  rtc::scoped_refptr<webrtc::AudioTrackInterface> track;
+  if(factory) {
+    track = factory->CreateAudioTrack(id, self->source_.get());
+  }
+  if(!track.get()) {
+    return Nan::ThrowError("Could not create webrtc::AudioTrackInterface");
+  }
+  info.GetReturnValue().Set(MediaStreamTrack::New(track.get(),
+    self->factory_));
+}
+
+NAN_GETTER(AudioSource::GetSampleRate) {
+  AudioSource* self = Nan::ObjectWrap::Unwrap<AudioSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->source_->sample_rate()));
+}
+
+NAN_GETTER(AudioSource::GetChannels) {
+  AudioSource* self = Nan::ObjectWrap::Unwrap<AudioSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(
+    static_cast<uint32_t>(self->source_->channels())));
+}
+
+NAN_GETTER(AudioSource::GetBuffered) {
+  AudioSource* self = Nan::ObjectWrap::Unwrap<AudioSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(
+    static_cast<uint32_t>(self->source_->buffered())));
+}
+
+NAN_GETTER(AudioSource::GetUnderruns) {
+  AudioSource* self = Nan::ObjectWrap::Unwrap<AudioSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->source_->underruns()));
+}
+
+NAN_GETTER(AudioSource::GetOverruns) {
+  AudioSource* self = Nan::ObjectWrap::Unwrap<AudioSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->source_->overruns()));
+}
@@ -0,0 +1,92 @@
+#ifndef WEBRTCJS_AUDIOSOURCE_H
+#define WEBRTCJS_AUDIOSOURCE_H
+
+#include <nan.h>
+#include <atomic>
+#include <vector>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/api/mediastreaminterface.h"
+#include "webrtc/api/notifier.h"
+#include "webrtc/media/base/mediachannel.h"
+
+#include "webrtcjs.h"
+#include "ringbuffer.h"
+
+// webrtc::AudioSourceInterface fed with interleaved 16 bit PCM from JS. Chunks
+// of any size are queued in a lock-free ring and handed to the sinks in 10 ms
+// frames, clocked by the media thread.
+class PcmAudioSource
+  : public webrtc::Notifier<webrtc::AudioSourceInterface>,
+    public rtc::MessageHandler {
+ public:
+  PcmAudioSource(int sample_rate, size_t channels, int buffer_ms);
+
+  void Start();
+  void Stop();
+
+  size_t Write(const int16_t* data, size_t samples);
+
+  int sample_rate() const { return sample_rate_; }
+  size_t channels() const { return channels_; }
+  uint32_t underruns() const { return underruns_.load(); }
+  uint32_t overruns() const { return overruns_.load(); }
+  size_t buffered() const { return ring_.Size() / channels_; }
+
+  webrtc::MediaSourceInterface::SourceState state() const final;
+  bool remote() const final;
+  const cricket::AudioOptions& options() const { return options_; }
+  void AddSink(webrtc::AudioTrackSinkInterface* sink) final;
+  void RemoveSink(webrtc::AudioTrackSinkInterface* sink) final;
+
+  void OnMessage(rtc::Message* msg) final;
+
+ protected:
+  ~PcmAudioSource() override;
+
+ private:
+  void DeliverFrame();
+  static void StopOnMediaThread(PcmAudioSource* source);
+
+  int sample_rate_;
+  size_t channels_;
+  size_t frame_samples_;
+  bool running_;
+  int64_t next_tick_ns_;
+
+  RingBuffer<int16_t> ring_;
+  std::vector<int16_t> frame_;
+  std::atomic<bool> primed_;
+  std::atomic<uint32_t> underruns_;
+  std::atomic<uint32_t> overruns_;
+
+  cricket::AudioOptions options_;
+  rtc::CriticalSection sink_lock_;
+  std::vector<webrtc::AudioTrackSinkInterface*> sinks_;
+};
+
+class AudioSource : public Nan::ObjectWrap {
+  explicit AudioSource(int sample_rate, size_t channels, int buffer_ms,
+    const WebRtcJs::FactoryId& factory);
+
+  static NAN_METHOD(New);
+  static NAN_METHOD(Write);
+  static NAN_METHOD(CreateTrack);
+
+  static NAN_GETTER(GetSampleRate);
+  static NAN_GETTER(GetChannels);
+  static NAN_GETTER(GetBuffered);
+  static NAN_GETTER(GetUnderruns);
+  static NAN_GETTER(GetOverruns);
+
+  rtc::scoped_refptr<PcmAudioSource> source_;
+  // Tracks are created on this factory.
+  WebRtcJs::FactoryId factory_;
+
+ public:
+  static NAN_MODULE_INIT(Init);
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "blockingcall.h"
+
+#include <string>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/trace_event.h"
+
+std::atomic<int64_t> BlockingCallSite::threshold_ns_(0);
+
+BlockingCallSite::BlockingCallSite(const char* name) :
+    name_(name),
+    histogram_("webrtcjs_blocking_call_seconds",
+      "Time the JS thread waited in calls to other threads.",
+      std::string("site=\"") + name + "\"", Histogram::LatencyBounds()) { }
+
+void BlockingCallSite::Record(int64_t elapsed_ns) {
+  histogram_.Observe(static_cast<double>(elapsed_ns) /
+    rtc::kNumNanosecsPerSec);
+  int64_t threshold_ns = threshold_ns_.load(std::memory_order_relaxed);
+  if(threshold_ns && elapsed_ns >= threshold_ns) {
+    LOG(LS_WARNING) << __FUNCTION__ << ": " << name_ << " blocked the JS "
+      << "thread for " << elapsed_ns / rtc::kNumNanosecsPerMillisec << " ms";
+  }
+}
+
+NAN_MODULE_INIT(BlockingCallSite::Init) {
+  Nan::SetMethod(target, "warnBlockingCalls",
+    BlockingCallSite::WarnBlockingCalls);
+}
+
+// warnBlockingCalls(thresholdMs) logs every call that blocks the JS thread
+// for at least thresholdMs, warnBlockingCalls(0) or with no argument stops.
+NAN_METHOD(BlockingCallSite::WarnBlockingCalls) {
+  double threshold_ms = 0;
+  if(info.Length() >= 1 && !info[0]->IsNullOrUndefined()) {
+    if(!info[0]->IsNumber() || info[0]->NumberValue() < 0) {
+      return Nan::ThrowError("Invalid threshold");
+    }
+    threshold_ms = info[0]->NumberValue();
+  }
+  threshold_ns_ = static_cast<int64_t>(threshold_ms *
+    rtc::kNumNanosecsPerMillisec);
+  info.GetReturnValue().SetUndefined();
+}
+
+BlockingCall::BlockingCall(BlockingCallSite* site) :
+    site_(site),
+    start_ns_(rtc::TimeNanos()) {
+  TRACE_EVENT_BEGIN1("webrtcjs", "BlockingCall", "site", site_->name());
+}
+
+BlockingCall::~BlockingCall() {
+  TRACE_EVENT_END0("webrtcjs", "BlockingCall");
+  site_->Record(rtc::TimeNanos() - start_ns_);
+}
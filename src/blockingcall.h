@@ -0,0 +1,47 @@
+#ifndef WEBRTCJS_BLOCKINGCALL_H
+#define WEBRTCJS_BLOCKINGCALL_H
+
+#include <nan.h>
+#include <atomic>
+
+#include "webrtc/base/timeutils.h"
+
+#include "metrics.h"
+
+// A place on the JS thread that waits for another thread, mostly a proxy
+// call into the signaling thread. Every site has its own histogram in
+// getMetrics() and can log a warning when a call takes too long, see
+// warnBlockingCalls().
+class BlockingCallSite {
+ public:
+  // name must outlive the site, e.g. "RTCPeerConnection.addStream".
+  explicit BlockingCallSite(const char* name);
+
+  void Record(int64_t elapsed_ns);
+
+  const char* name() const { return name_; }
+
+  static NAN_MODULE_INIT(Init);
+
+ private:
+  static NAN_METHOD(WarnBlockingCalls);
+
+  const char* name_;
+  Histogram histogram_;
+
+  // 0 when warnings are off.
+  static std::atomic<int64_t> threshold_ns_;
+};
+
+// Times one call to a site, from construction until it goes out of scope.
+class BlockingCall {
+ public:
+  explicit BlockingCall(BlockingCallSite* site);
+  ~BlockingCall();
+
+ private:
+  BlockingCallSite* site_;
+  int64_t start_ns_;
+};
+
+#endif
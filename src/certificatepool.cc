@@ -0,0 +1,372 @@
+#include "certificatepool.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+
+#include "webrtc/base/helpers.h"
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+
+#include "metrics.h"
+
+static const size_t kMaxPoolSize = 1024;
+static const char kCommonName[] = "WebRTC";
+static const char kCertificateBegin[] = "-----BEGIN CERTIFICATE-----";
+static const char kPemSuffix[] = ".pem";
+
+enum {
+  kMessageLoad,
+  kMessageGenerate,
+};
+
+static int64_t WallTimeMillis() {
+  timespec time;
+  clock_gettime(CLOCK_REALTIME, &time);
+  return time.tv_sec * 1000LL + time.tv_nsec / 1000000;
+}
+
+rtc::CriticalSection CertificatePool::pool_lock_;
+rtc::scoped_ptr<CertificatePool> CertificatePool::pool_;
+CertificatePool::Options CertificatePool::configured_options_;
+bool CertificatePool::configured_ = false;
+bool CertificatePool::started_ = false;
+
+NAN_MODULE_INIT(CertificatePool::Init) {
+  Nan::SetMethod(target, "configureCertificatePool",
+    CertificatePool::ConfigureCertificatePool);
+  Nan::SetMethod(target, "getCertificatePoolStats",
+    CertificatePool::GetCertificatePoolStats);
+}
+
+CertificatePool::CertificatePool(const Options& options) :
+    options_(options),
+    next_(0),
+    generating_(true),
+    generated_(0),
+    loaded_(0),
+    acquired_(0),
+    misses_(0),
+    generation_ms_(0) {
+  thread_.reset(new rtc::Thread());
+  thread_->SetName("WebRTC Certificates", NULL);
+  thread_->Start();
+  if(!options_.directory.empty()) {
+    thread_->Post(this, kMessageLoad);
+  }
+  thread_->Post(this, kMessageGenerate);
+}
+
+CertificatePool::~CertificatePool() {
+  thread_->Clear(this);
+  thread_->Stop();
+  Metrics::Add(Metrics::kPoolCertificates,
+    -static_cast<int64_t>(entries_.size()));
+}
+
+// The old pool goes outside pool_lock_, stopping its thread waits for the
+// key it is generating and Acquire() must not wait for that.
+void CertificatePool::Configure(const Options& options) {
+  rtc::scoped_ptr<CertificatePool> pool;
+  rtc::CritScope lock(&pool_lock_);
+  configured_options_ = options;
+  configured_ = true;
+  if(started_) {
+    pool.reset(new CertificatePool(options));
+  }
+  pool_.swap(pool);
+}
+
+void CertificatePool::Disable() {
+  rtc::scoped_ptr<CertificatePool> pool;
+  rtc::CritScope lock(&pool_lock_);
+  configured_ = false;
+  pool_.swap(pool);
+}
+
+void CertificatePool::Start() {
+  rtc::CritScope lock(&pool_lock_);
+  started_ = true;
+  if(configured_ && !pool_.get()) {
+    pool_.reset(new CertificatePool(configured_options_));
+  }
+}
+
+void CertificatePool::Stop() {
+  rtc::scoped_ptr<CertificatePool> pool;
+  rtc::CritScope lock(&pool_lock_);
+  started_ = false;
+  pool_.swap(pool);
+}
+
+rtc::scoped_refptr<rtc::RTCCertificate> CertificatePool::Acquire() {
+  rtc::CritScope lock(&pool_lock_);
+  if(!pool_.get()) {
+    return nullptr;
+  }
+  return pool_->Take();
+}
+
+bool CertificatePool::IsRetired(const Entry& entry, int64_t now_ms) const {
+  if(options_.max_uses && entry.uses >= options_.max_uses) {
+    return true;
+  }
+  return now_ms - entry.created_ms >= options_.max_age_ms;
+}
+
+rtc::scoped_refptr<rtc::RTCCertificate> CertificatePool::Take() {
+  rtc::CritScope lock(&lock_);
+  int64_t now_ms = WallTimeMillis();
+
+  std::deque<Entry>::iterator index = entries_.begin();
+  while(index != entries_.end()) {
+    if(IsRetired(*index, now_ms)) {
+      if(!index->path.empty()) {
+        unlink(index->path.c_str());
+      }
+      index = entries_.erase(index);
+      Metrics::Add(Metrics::kPoolCertificates, -1);
+    } else {
+      index++;
+    }
+  }
+
+  rtc::scoped_refptr<rtc::RTCCertificate> certificate;
+  if(entries_.empty()) {
+    misses_++;
+  } else {
+    // Round robin spreads the uses when certificates are shared.
+    Entry& entry = entries_[next_++ % entries_.size()];
+    entry.uses++;
+    acquired_++;
+    certificate = entry.certificate;
+  }
+
+  if(entries_.size() < options_.size && !generating_) {
+    generating_ = true;
+    thread_->Post(this, kMessageGenerate);
+  }
+  return certificate;
+}
+
+void CertificatePool::OnMessage(rtc::Message* msg) {
+  switch(msg->message_id) {
+    case kMessageLoad:
+      Load();
+      break;
+    case kMessageGenerate:
+      Generate();
+      break;
+  }
+}
+
+void CertificatePool::Generate() {
+  {
+    rtc::CritScope lock(&lock_);
+    if(entries_.size() >= options_.size) {
+      generating_ = false;
+      return;
+    }
+  }
+
+  int64_t start_ms = rtc::TimeMillis();
+  rtc::scoped_ptr<rtc::SSLIdentity> identity(rtc::SSLIdentity::Generate(
+    kCommonName, rtc::KeyParams(options_.key_type)));
+  if(!identity.get()) {
+    LOG(LS_ERROR) << __FUNCTION__ << ": Could not generate identity";
+    rtc::CritScope lock(&lock_);
+    generating_ = false;
+    return;
+  }
+
+  Entry entry;
+  entry.created_ms = WallTimeMillis();
+  entry.uses = 0;
+  Store(&entry, identity.get());
+  entry.certificate = rtc::RTCCertificate::Create(std::move(identity));
+
+  {
+    rtc::CritScope lock(&lock_);
+    entries_.push_back(entry);
+    Metrics::Add(Metrics::kPoolCertificates);
+    generated_++;
+    generation_ms_ += rtc::TimeMillis() - start_ms;
+  }
+  // One at a time, so reconfiguring does not wait for a whole batch.
+  thread_->Post(this, kMessageGenerate);
+}
+
+void CertificatePool::Store(Entry* entry, const rtc::SSLIdentity* identity) {
+  if(options_.directory.empty()) {
+    return;
+  }
+  // Load() reads the creation time back from the name, the suffix keeps
+  // certificates created in the same millisecond, or by the pool of
+  // another process sharing the directory, apart.
+  std::ostringstream path;
+  path << options_.directory << "/" << entry->created_ms << "-"
+       << rtc::CreateRandomId() << kPemSuffix;
+  std::string pem = identity->PrivateKeyToPEMString() +
+    identity->certificate().ToPEMString();
+
+  // Holds a private key, nobody else gets to read it.
+  int fd = open(path.str().c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if(fd < 0) {
+    LOG(LS_WARNING) << __FUNCTION__ << ": Could not write " << path.str()
+      << ", errno " << errno;
+    return;
+  }
+  ssize_t written = write(fd, pem.data(), pem.size());
+  close(fd);
+  if(written != static_cast<ssize_t>(pem.size())) {
+    unlink(path.str().c_str());
+    return;
+  }
+  entry->path = path.str();
+}
+
+void CertificatePool::Load() {
+  mkdir(options_.directory.c_str(), 0700);
+  DIR* directory = opendir(options_.directory.c_str());
+  if(!directory) {
+    LOG(LS_WARNING) << __FUNCTION__ << ": Could not open "
+      << options_.directory << ", errno " << errno;
+    return;
+  }
+
+  int64_t now_ms = WallTimeMillis();
+  size_t suffix_length = sizeof(kPemSuffix) - 1;
+  dirent* file;
+  while((file = readdir(directory)) != nullptr) {
+    std::string name(file->d_name);
+    if(name.size() <= suffix_length ||
+        name.compare(name.size() - suffix_length, suffix_length,
+          kPemSuffix) != 0) {
+      continue;
+    }
+    std::string path = options_.directory + "/" + name;
+
+    Entry entry;
+    entry.created_ms = strtoll(name.c_str(), nullptr, 10);
+    entry.uses = 0;
+    entry.path = path;
+    if(IsRetired(entry, now_ms)) {
+      unlink(path.c_str());
+      continue;
+    }
+
+    std::ifstream stream(path.c_str());
+    std::stringstream content;
+    content << stream.rdbuf();
+    std::string pem = content.str();
+    size_t split = pem.find(kCertificateBegin);
+    if(split == std::string::npos) {
+      continue;
+    }
+    rtc::scoped_ptr<rtc::SSLIdentity> identity(
+      rtc::SSLIdentity::FromPEMStrings(pem.substr(0, split),
+        pem.substr(split)));
+    if(!identity.get()) {
+      LOG(LS_WARNING) << __FUNCTION__ << ": Could not parse " << path;
+      continue;
+    }
+    entry.certificate = rtc::RTCCertificate::Create(std::move(identity));
+
+    rtc::CritScope lock(&lock_);
+    if(entries_.size() < options_.size) {
+      entries_.push_back(entry);
+      Metrics::Add(Metrics::kPoolCertificates);
+      loaded_++;
+    }
+  }
+  closedir(directory);
+}
+
+NAN_METHOD(CertificatePool::ConfigureCertificatePool) {
+  if(info.Length() == 0 || info[0]->IsNull() || info[0]->IsUndefined() ||
+      (info[0]->IsBoolean() && !info[0]->BooleanValue())) {
+    Disable();
+    return info.GetReturnValue().SetUndefined();
+  }
+  if(!info[0]->IsObject()) {
+    return Nan::ThrowError("Invalid certificate pool options");
+  }
+
+  Options options;
+  v8::Local<v8::Object> object = v8::Local<v8::Object>::Cast(info[0]);
+  v8::Local<v8::Value> size_value =
+    object->Get(Nan::New("size").ToLocalChecked());
+  v8::Local<v8::Value> key_type_value =
+    object->Get(Nan::New("keyType").ToLocalChecked());
+  v8::Local<v8::Value> max_uses_value =
+    object->Get(Nan::New("maxUses").ToLocalChecked());
+  v8::Local<v8::Value> max_age_value =
+    object->Get(Nan::New("maxAge").ToLocalChecked());
+  v8::Local<v8::Value> directory_value =
+    object->Get(Nan::New("directory").ToLocalChecked());
+
+  if(size_value->IsUint32()) {
+    options.size = size_value->Uint32Value();
+  }
+  if(options.size < 1 || options.size > kMaxPoolSize) {
+    return Nan::ThrowError("Invalid size");
+  }
+  if(key_type_value->IsString()) {
+    v8::String::Utf8Value name(key_type_value->ToString());
+    std::string key_type(*name);
+    if(key_type == "ecdsa") {
+      options.key_type = rtc::KT_ECDSA;
+    } else if(key_type == "rsa") {
+      options.key_type = rtc::KT_RSA;
+    } else {
+      return Nan::ThrowError("Invalid keyType");
+    }
+  }
+  if(max_uses_value->IsUint32()) {
+    options.max_uses = max_uses_value->Uint32Value();
+  }
+  if(max_age_value->IsNumber()) {
+    options.max_age_ms = max_age_value->IntegerValue();
+    if(options.max_age_ms <= 0) {
+      return Nan::ThrowError("Invalid maxAge");
+    }
+  }
+  if(directory_value->IsString()) {
+    v8::String::Utf8Value directory(directory_value->ToString());
+    options.directory = *directory;
+  }
+
+  Configure(options);
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(CertificatePool::GetCertificatePoolStats) {
+  rtc::CritScope pool_lock(&pool_lock_);
+  v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+  stats->Set(Nan::New("enabled").ToLocalChecked(), Nan::New(configured_));
+  if(!pool_.get()) {
+    return info.GetReturnValue().Set(stats);
+  }
+
+  rtc::CritScope lock(&pool_->lock_);
+  stats->Set(Nan::New("available").ToLocalChecked(),
+    Nan::New(static_cast<uint32_t>(pool_->entries_.size())));
+  stats->Set(Nan::New("generated").ToLocalChecked(),
+    Nan::New(pool_->generated_));
+  stats->Set(Nan::New("loaded").ToLocalChecked(), Nan::New(pool_->loaded_));
+  stats->Set(Nan::New("acquired").ToLocalChecked(),
+    Nan::New(pool_->acquired_));
+  stats->Set(Nan::New("misses").ToLocalChecked(), Nan::New(pool_->misses_));
+  if(pool_->generated_) {
+    stats->Set(Nan::New("averageGenerationTime").ToLocalChecked(),
+      Nan::New(static_cast<double>(pool_->generation_ms_) /
+        pool_->generated_));
+  }
+  info.GetReturnValue().Set(stats);
+}
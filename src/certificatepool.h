@@ -0,0 +1,94 @@
+#ifndef WEBRTCJS_CERTIFICATEPOOL_H
+#define WEBRTCJS_CERTIFICATEPOOL_H
+
+#include <nan.h>
+#include <deque>
+#include <string>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/rtccertificate.h"
+#include "webrtc/base/scoped_ptr.h"
+#include "webrtc/base/sslidentity.h"
+#include "webrtc/base/thread.h"
+
+// Keeps DTLS certificates generated ahead of time on its own thread, so new
+// PeerConnections do not pay for key generation. A certificate is handed out
+// up to max_uses times and for at most max_age_ms, then it is retired and
+// replaced in the background. With a directory set the certificates are
+// stored as PEM files and reloaded on the next start.
+class CertificatePool : public rtc::MessageHandler {
+ public:
+  struct Options {
+    Options() :
+        size(4),
+        key_type(rtc::KT_ECDSA),
+        max_uses(0),
+        max_age_ms(24 * 60 * 60 * 1000LL) { }
+    size_t size;
+    rtc::KeyType key_type;
+    // 0 shares a certificate without limit until it is too old.
+    uint32_t max_uses;
+    int64_t max_age_ms;
+    std::string directory;
+  };
+
+  // The options last until Disable(). The pool itself only runs between
+  // Start() and Stop(), while the SSL library is initialized, so one
+  // configured before init() or the first use starts with WebRTC.
+  static void Configure(const Options& options);
+  static void Disable();
+  // From init() and shutdown(), the thread must not outlive the SSL library.
+  static void Start();
+  static void Stop();
+
+  // Returns nothing when the pool is disabled or has run dry, WebRTC then
+  // generates a certificate as usual.
+  static rtc::scoped_refptr<rtc::RTCCertificate> Acquire();
+
+  ~CertificatePool() override;
+
+  void OnMessage(rtc::Message* msg) final;
+
+  static NAN_MODULE_INIT(Init);
+
+ private:
+  struct Entry {
+    rtc::scoped_refptr<rtc::RTCCertificate> certificate;
+    int64_t created_ms;
+    uint32_t uses;
+    std::string path;
+  };
+
+  explicit CertificatePool(const Options& options);
+
+  void Load();
+  void Generate();
+  void Store(Entry* entry, const rtc::SSLIdentity* identity);
+  bool IsRetired(const Entry& entry, int64_t now_ms) const;
+  rtc::scoped_refptr<rtc::RTCCertificate> Take();
+
+  static NAN_METHOD(ConfigureCertificatePool);
+  static NAN_METHOD(GetCertificatePoolStats);
+
+  static rtc::CriticalSection pool_lock_;
+  static rtc::scoped_ptr<CertificatePool> pool_;
+  static Options configured_options_;
+  static bool configured_;
+  static bool started_;
+
+  Options options_;
+  rtc::scoped_ptr<rtc::Thread> thread_;
+
+  rtc::CriticalSection lock_;
+  std::deque<Entry> entries_;
+  size_t next_;
+  bool generating_;
+  uint32_t generated_;
+  uint32_t loaded_;
+  uint32_t acquired_;
+  uint32_t misses_;
+  int64_t generation_ms_;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "compactstats.h"
+#include "isolatedata.h"
+
+#include <limits>
+
+rtc::CriticalSection CompactStats::lock_;
+std::unordered_map<const char*, uint16_t> CompactStats::indexes_;
+std::vector<const char*> CompactStats::names_;
+
+uint16_t CompactStats::Intern(const char* name) {
+  rtc::CritScope lock(&lock_);
+  std::unordered_map<const char*, uint16_t>::iterator index =
+    indexes_.find(name);
+  if(index != indexes_.end()) {
+    return index->second;
+  }
+  uint16_t id = static_cast<uint16_t>(names_.size());
+  names_.push_back(name);
+  indexes_[name] = id;
+  return id;
+}
+
+v8::Local<v8::Array> CompactStats::Names() {
+  IsolateData* data = IsolateData::Current();
+  v8::Local<v8::Array> names = data->GetStatNames();
+  if(names.IsEmpty()) {
+    names = Nan::New<v8::Array>();
+    data->SetStatNames(names);
+  }
+
+  // Names are only ever appended, the isolate catches up with the rest.
+  rtc::CritScope lock(&lock_);
+  for(uint32_t index = names->Length(); index < names_.size(); index++) {
+    names->Set(index, Nan::New(names_[index]).ToLocalChecked());
+  }
+  return names;
+}
+
+rtc::scoped_refptr<CompactStats> CompactStats::Create(
+    const webrtc::StatsReports& reports, const std::string& filter) {
+  rtc::scoped_refptr<CompactStats> stats(
+    new rtc::RefCountedObject<CompactStats>());
+
+  webrtc::StatsReports::const_iterator report;
+  for(report = reports.begin(); report != reports.end(); report++) {
+    std::string id = (*report)->id()->ToString();
+    const char* type = (*report)->TypeToString();
+    if(!filter.empty() && filter != id && filter.compare(type) != 0) {
+      continue;
+    }
+
+    stats->ids_.push_back(id);
+    stats->types_.push_back(Intern(type));
+    stats->timestamps_.push_back((*report)->timestamp());
+    stats->offsets_.push_back(static_cast<uint32_t>(stats->values_.size()));
+
+    webrtc::StatsReport::Values::const_iterator value;
+    for(value = (*report)->values().begin();
+        value != (*report)->values().end(); value++) {
+      const webrtc::StatsReport::ValuePtr& entry = value->second;
+      stats->keys_.push_back(Intern(entry->display_name()));
+      switch(entry->type()) {
+        case webrtc::StatsReport::Value::kInt:
+          stats->values_.push_back(entry->int_val());
+          break;
+        case webrtc::StatsReport::Value::kInt64:
+          stats->values_.push_back(static_cast<double>(entry->int64_val()));
+          break;
+        case webrtc::StatsReport::Value::kFloat:
+          stats->values_.push_back(entry->float_val());
+          break;
+        case webrtc::StatsReport::Value::kBool:
+          stats->values_.push_back(entry->bool_val() ? 1 : 0);
+          break;
+        default:
+          stats->strings_.push_back(std::make_pair(
+            static_cast<uint32_t>(stats->values_.size()), entry->ToString()));
+          stats->values_.push_back(
+            std::numeric_limits<double>::quiet_NaN());
+          break;
+      }
+    }
+  }
+  stats->offsets_.push_back(static_cast<uint32_t>(stats->values_.size()));
+
+  return stats;
+}
+
+v8::Local<v8::Object> CompactStats::ToObject() const {
+  Nan::EscapableHandleScope scope;
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+
+  v8::Local<v8::Array> ids = Nan::New<v8::Array>(ids_.size());
+  for(size_t index = 0; index < ids_.size(); index++) {
+    ids->Set(index, Nan::New(ids_[index]).ToLocalChecked());
+  }
+
+  v8::Local<v8::Object> strings = Nan::New<v8::Object>();
+  std::vector<std::pair<uint32_t, std::string>>::const_iterator string;
+  for(string = strings_.begin(); string != strings_.end(); string++) {
+    strings->Set(string->first, Nan::New(string->second).ToLocalChecked());
+  }
+
+  result->Set(Nan::New("names").ToLocalChecked(), Names());
+  result->Set(Nan::New("ids").ToLocalChecked(), ids);
+  result->Set(Nan::New("types").ToLocalChecked(),
+    NewTypedArray<v8::Uint16Array>(types_));
+  result->Set(Nan::New("timestamps").ToLocalChecked(),
+    NewTypedArray<v8::Float64Array>(timestamps_));
+  result->Set(Nan::New("offsets").ToLocalChecked(),
+    NewTypedArray<v8::Uint32Array>(offsets_));
+  result->Set(Nan::New("keys").ToLocalChecked(),
+    NewTypedArray<v8::Uint16Array>(keys_));
+  result->Set(Nan::New("values").ToLocalChecked(),
+    NewTypedArray<v8::Float64Array>(values_));
+  result->Set(Nan::New("strings").ToLocalChecked(), strings);
+
+  return scope.Escape(result);
+}
@@ -0,0 +1,75 @@
+#ifndef WEBRTCJS_COMPACTSTATS_H
+#define WEBRTCJS_COMPACTSTATS_H
+
+#include <nan.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "webrtc/api/statstypes.h"
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/refcount.h"
+#include "webrtc/base/scoped_ref_ptr.h"
+
+// Copies data into a new typed array of the same element type.
+template<class ArrayType, class T>
+v8::Local<ArrayType> NewTypedArray(const std::vector<T>& data) {
+  size_t size = data.size() * sizeof(T);
+  v8::Local<v8::ArrayBuffer> buffer =
+    v8::ArrayBuffer::New(v8::Isolate::GetCurrent(), size);
+  if(size) {
+    memcpy(buffer->GetContents().Data(), &data[0], size);
+  }
+  return ArrayType::New(buffer, 0, data.size());
+}
+
+// StatsReports converted on the signaling thread into flat arrays, so the
+// JS thread only copies them into typed arrays. Report types and value
+// names are interned once per process and reach JS as indexes into the
+// names array, which each isolate builds only once. Values are numbers,
+// except the few that are strings by nature.
+//
+//   names       every interned name, the same array on every call
+//   ids         report ids
+//   types       Uint16Array, index into names per report
+//   timestamps  Float64Array, per report
+//   offsets     Uint32Array, values of report i are [offsets[i],
+//               offsets[i + 1])
+//   keys        Uint16Array, index into names per value
+//   values      Float64Array, NaN for string values
+//   strings     string values by value index
+class CompactStats : public rtc::RefCountInterface {
+ public:
+  // Keeps the reports whose id or type is filter, or all of them when
+  // filter is empty.
+  static rtc::scoped_refptr<CompactStats> Create(
+    const webrtc::StatsReports& reports, const std::string& filter);
+
+  // Must run on the JS thread.
+  v8::Local<v8::Object> ToObject() const;
+
+ protected:
+  CompactStats() { }
+  ~CompactStats() override { }
+
+ private:
+  static uint16_t Intern(const char* name);
+  static v8::Local<v8::Array> Names();
+
+  std::vector<std::string> ids_;
+  std::vector<uint16_t> types_;
+  std::vector<double> timestamps_;
+  std::vector<uint32_t> offsets_;
+  std::vector<uint16_t> keys_;
+  std::vector<double> values_;
+  std::vector<std::pair<uint32_t, std::string>> strings_;
+
+  // Display names are static strings, the pointer identifies them.
+  static rtc::CriticalSection lock_;
+  static std::unordered_map<const char*, uint16_t> indexes_;
+  static std::vector<const char*> names_;
+};
+
+#endif
@@ -0,0 +1,909 @@
+#include "epollsocketserver.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+
+#include "webrtc/base/asyncpacketsocket.h"
+#include "webrtc/base/bind.h"
+#include "webrtc/base/checks.h"
+#include "webrtc/base/logging.h"
+#include "webrtc/base/physicalsocketserver.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/p2p/base/basicpacketsocketfactory.h"
+
+static const size_t kMaxDatagramSize = 65536;
+static const int kMaxEvents = 128;
+static const uint64_t kWakeUpId = 0;
+
+static bool TranslateOption(int family, rtc::Socket::Option option,
+    int* level, int* name) {
+  switch(option) {
+    case rtc::Socket::OPT_DONTFRAGMENT:
+      *level = IPPROTO_IP;
+      *name = IP_MTU_DISCOVER;
+      return true;
+    case rtc::Socket::OPT_RCVBUF:
+      *level = SOL_SOCKET;
+      *name = SO_RCVBUF;
+      return true;
+    case rtc::Socket::OPT_SNDBUF:
+      *level = SOL_SOCKET;
+      *name = SO_SNDBUF;
+      return true;
+    case rtc::Socket::OPT_NODELAY:
+      *level = IPPROTO_TCP;
+      *name = TCP_NODELAY;
+      return true;
+    case rtc::Socket::OPT_DSCP:
+      if(family == AF_INET6) {
+        *level = IPPROTO_IPV6;
+        *name = IPV6_TCLASS;
+      } else {
+        *level = IPPROTO_IP;
+        *name = IP_TOS;
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+//
+// EpollSocket
+//
+
+EpollSocket::EpollSocket(EpollSocketServer* server, int fd, int family,
+    int type) :
+    server_(server),
+    id_(0),
+    fd_(fd),
+    family_(family),
+    type_(type),
+    error_(0),
+    state_(CS_CLOSED),
+    listening_(false),
+    eof_(false),
+    write_blocked_(false),
+    events_(0),
+    read_data_(nullptr),
+    read_size_(0),
+    read_address_(nullptr),
+    outgoing_count_(0) {
+  server_->Add(this);
+}
+
+EpollSocket::~EpollSocket() {
+  Close();
+}
+
+rtc::SocketAddress EpollSocket::GetLocalAddress() const {
+  sockaddr_storage storage;
+  socklen_t length = sizeof(storage);
+  rtc::SocketAddress address;
+  if(getsockname(fd_, reinterpret_cast<sockaddr*>(&storage), &length) == 0) {
+    rtc::SocketAddressFromSockAddrStorage(storage, &address);
+  }
+  return address;
+}
+
+rtc::SocketAddress EpollSocket::GetRemoteAddress() const {
+  sockaddr_storage storage;
+  socklen_t length = sizeof(storage);
+  rtc::SocketAddress address;
+  if(getpeername(fd_, reinterpret_cast<sockaddr*>(&storage), &length) == 0) {
+    rtc::SocketAddressFromSockAddrStorage(storage, &address);
+  }
+  return address;
+}
+
+socklen_t EpollSocket::ToSockAddr(const rtc::SocketAddress& address,
+    sockaddr_storage* storage) const {
+  // IPv6 sockets reach IPv4 peers through mapped addresses.
+  if(family_ == AF_INET6) {
+    return address.ToDualStackSockAddrStorage(storage);
+  }
+  return address.ToSockAddrStorage(storage);
+}
+
+int EpollSocket::Bind(const rtc::SocketAddress& address) {
+  sockaddr_storage storage;
+  socklen_t length = ToSockAddr(address, &storage);
+  if(bind(fd_, reinterpret_cast<sockaddr*>(&storage), length) < 0) {
+    error_ = errno;
+    return -1;
+  }
+  return 0;
+}
+
+int EpollSocket::Connect(const rtc::SocketAddress& address) {
+  if(address.IsUnresolvedIP()) {
+    // Resolving is left to the callers, the packet socket factory does it.
+    LOG(LS_WARNING) << __FUNCTION__ << ": Unresolved " << address.hostname();
+    error_ = EADDRNOTAVAIL;
+    return -1;
+  }
+  sockaddr_storage storage;
+  socklen_t length = ToSockAddr(address, &storage);
+  if(connect(fd_, reinterpret_cast<sockaddr*>(&storage), length) == 0) {
+    state_ = CS_CONNECTED;
+    return 0;
+  }
+  if(errno != EINPROGRESS) {
+    error_ = errno;
+    return -1;
+  }
+  state_ = CS_CONNECTING;
+  SetWritable(true);
+  return 0;
+}
+
+int EpollSocket::Queue(const void* data, size_t size,
+    const sockaddr_storage* address, socklen_t address_length) {
+  if(fd_ < 0) {
+    error_ = EBADF;
+    return -1;
+  }
+  if(write_blocked_) {
+    error_ = EWOULDBLOCK;
+    return -1;
+  }
+  if(outgoing_count_ == outgoing_.size()) {
+    outgoing_.push_back(Datagram());
+  }
+  // Entries keep their capacity, steady state copies without allocating.
+  Datagram& datagram = outgoing_[outgoing_count_++];
+  const char* bytes = static_cast<const char*>(data);
+  datagram.data.assign(bytes, bytes + size);
+  datagram.address_length = address_length;
+  if(address_length) {
+    memcpy(&datagram.address, address, address_length);
+  }
+  server_->MarkDirty(this);
+  if(outgoing_count_ == EpollSocketServer::kBatchSize) {
+    server_->Flush(this);
+  }
+  return size;
+}
+
+int EpollSocket::Send(const void* data, size_t size) {
+  if(IsDatagram()) {
+    return Queue(data, size, nullptr, 0);
+  }
+  ssize_t sent = send(fd_, data, size, MSG_NOSIGNAL);
+  if(sent < 0) {
+    error_ = errno;
+    if(error_ == EAGAIN || error_ == EWOULDBLOCK) {
+      SetWritable(true);
+    }
+    return -1;
+  }
+  return sent;
+}
+
+int EpollSocket::SendTo(const void* data, size_t size,
+    const rtc::SocketAddress& address) {
+  if(!IsDatagram()) {
+    return Send(data, size);
+  }
+  sockaddr_storage storage;
+  socklen_t length = ToSockAddr(address, &storage);
+  if(!length) {
+    error_ = EINVAL;
+    return -1;
+  }
+  return Queue(data, size, &storage, length);
+}
+
+int EpollSocket::Recv(void* buffer, size_t size, int64_t* timestamp) {
+  if(IsDatagram()) {
+    return RecvFrom(buffer, size, nullptr, timestamp);
+  }
+  if(timestamp) {
+    *timestamp = -1;
+  }
+  ssize_t received = recv(fd_, buffer, size, 0);
+  if(received == 0 && size != 0) {
+    // Like PhysicalSocket, report the close event after the read.
+    eof_ = true;
+    error_ = EWOULDBLOCK;
+    return -1;
+  }
+  if(received < 0) {
+    error_ = errno;
+    return -1;
+  }
+  return received;
+}
+
+int EpollSocket::RecvFrom(void* buffer, size_t size,
+    rtc::SocketAddress* address, int64_t* timestamp) {
+  if(!IsDatagram()) {
+    int received = Recv(buffer, size, timestamp);
+    if(received >= 0 && address) {
+      *address = GetRemoteAddress();
+    }
+    return received;
+  }
+  if(timestamp) {
+    *timestamp = -1;
+  }
+  if(!read_data_) {
+    error_ = EWOULDBLOCK;
+    return -1;
+  }
+  size_t copied = std::min(size, read_size_);
+  memcpy(buffer, read_data_, copied);
+  if(address) {
+    rtc::SocketAddressFromSockAddrStorage(*read_address_, address);
+  }
+  read_data_ = nullptr;
+  return copied;
+}
+
+int EpollSocket::Listen(int backlog) {
+  if(listen(fd_, backlog) < 0) {
+    error_ = errno;
+    return -1;
+  }
+  listening_ = true;
+  state_ = CS_CONNECTING;
+  return 0;
+}
+
+EpollSocket* EpollSocket::Accept(rtc::SocketAddress* address) {
+  sockaddr_storage storage;
+  socklen_t length = sizeof(storage);
+  int fd = accept4(fd_, reinterpret_cast<sockaddr*>(&storage), &length,
+    SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if(fd < 0) {
+    error_ = errno;
+    return nullptr;
+  }
+  if(address) {
+    rtc::SocketAddressFromSockAddrStorage(storage, address);
+  }
+  EpollSocket* socket = new EpollSocket(server_, fd, family_, type_);
+  socket->state_ = CS_CONNECTED;
+  return socket;
+}
+
+int EpollSocket::Close() {
+  if(fd_ < 0) {
+    return 0;
+  }
+  server_->Remove(this);
+  close(fd_);
+  fd_ = -1;
+  state_ = CS_CLOSED;
+  outgoing_count_ = 0;
+  return 0;
+}
+
+int EpollSocket::GetError() const {
+  return error_;
+}
+
+void EpollSocket::SetError(int error) {
+  error_ = error;
+}
+
+rtc::AsyncSocket::ConnState EpollSocket::GetState() const {
+  return state_;
+}
+
+int EpollSocket::EstimateMTU(uint16_t* mtu) {
+  int value;
+  socklen_t length = sizeof(value);
+  int level = family_ == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+  int name = family_ == AF_INET6 ? IPV6_MTU : IP_MTU;
+  if(getsockopt(fd_, level, name, &value, &length) < 0) {
+    error_ = errno;
+    return -1;
+  }
+  *mtu = value;
+  return 0;
+}
+
+int EpollSocket::GetOption(Option option, int* value) {
+  int level;
+  int name;
+  if(!TranslateOption(family_, option, &level, &name)) {
+    return -1;
+  }
+  socklen_t length = sizeof(*value);
+  if(getsockopt(fd_, level, name, value, &length) < 0) {
+    error_ = errno;
+    return -1;
+  }
+  if(option == OPT_DONTFRAGMENT) {
+    *value = *value != IP_PMTUDISC_DONT;
+  } else if(option == OPT_DSCP) {
+    *value >>= 2;
+  }
+  return 0;
+}
+
+int EpollSocket::SetOption(Option option, int value) {
+  int level;
+  int name;
+  if(!TranslateOption(family_, option, &level, &name)) {
+    return -1;
+  }
+  if(option == OPT_DONTFRAGMENT) {
+    value = value ? IP_PMTUDISC_DO : IP_PMTUDISC_DONT;
+  } else if(option == OPT_DSCP) {
+    value <<= 2;
+  }
+  if(setsockopt(fd_, level, name, &value, sizeof(value)) < 0) {
+    error_ = errno;
+    return -1;
+  }
+  return 0;
+}
+
+void EpollSocket::SetWritable(bool enabled) {
+  if(IsDatagram()) {
+    write_blocked_ = enabled;
+  }
+  server_->Modify(this, EPOLLIN | (enabled ? EPOLLOUT : 0));
+}
+
+void EpollSocket::OnReadable(uint32_t events) {
+  if(IsDatagram()) {
+    server_->Receive(this);
+    return;
+  }
+
+  EpollSocketServer* server = server_;
+  uint64_t id = id_;
+  if(!listening_ && (events & (EPOLLERR | EPOLLHUP)) &&
+     !(events & EPOLLIN)) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &length);
+    error_ = error;
+    state_ = CS_CLOSED;
+    server_->Modify(this, 0);
+    SignalCloseEvent(this, error);
+    return;
+  }
+
+  SignalReadEvent(this);
+  if(server->sockets_.find(id) == server->sockets_.end()) {
+    return;
+  }
+  if(eof_) {
+    eof_ = false;
+    state_ = CS_CLOSED;
+    // Level triggered, a socket at EOF would be reported forever.
+    server_->Modify(this, 0);
+    SignalCloseEvent(this, 0);
+  }
+}
+
+void EpollSocket::OnWritable() {
+  SetWritable(false);
+  if(state_ == CS_CONNECTING && !listening_) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &length);
+    if(error) {
+      error_ = error;
+      state_ = CS_CLOSED;
+      server_->Modify(this, 0);
+      SignalCloseEvent(this, error);
+      return;
+    }
+    state_ = CS_CONNECTED;
+    SignalConnectEvent(this);
+    return;
+  }
+  SignalWriteEvent(this);
+}
+
+//
+// EpollSocketServer
+//
+
+EpollSocketServer::EpollSocketServer() :
+    next_id_(kWakeUpId + 1),
+    queue_(nullptr),
+    flush_posted_(false),
+    buffers_(kBatchSize * kMaxDatagramSize),
+    headers_(kBatchSize),
+    vectors_(kBatchSize),
+    addresses_(kBatchSize),
+    receive_calls_(0),
+    packets_received_(0),
+    send_calls_(0),
+    packets_sent_(0),
+    packets_dropped_(0) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  RTC_CHECK(epoll_fd_ >= 0) << "epoll_create1 failed, errno " << errno;
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  RTC_CHECK(wakeup_fd_ >= 0) << "eventfd failed, errno " << errno;
+
+  epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = kWakeUpId;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event);
+
+  for(int index = 0; index < kBatchSize; index++) {
+    vectors_[index].iov_base = &buffers_[index * kMaxDatagramSize];
+    vectors_[index].iov_len = kMaxDatagramSize;
+  }
+}
+
+EpollSocketServer::~EpollSocketServer() {
+  // Sockets unregister when they are deleted, they must go first.
+  RTC_DCHECK(sockets_.empty());
+  close(wakeup_fd_);
+  close(epoll_fd_);
+}
+
+rtc::Socket* EpollSocketServer::CreateSocket(int type) {
+  return CreateSocket(AF_INET, type);
+}
+
+rtc::Socket* EpollSocketServer::CreateSocket(int family, int type) {
+  return Create(family, type);
+}
+
+rtc::AsyncSocket* EpollSocketServer::CreateAsyncSocket(int type) {
+  return CreateAsyncSocket(AF_INET, type);
+}
+
+rtc::AsyncSocket* EpollSocketServer::CreateAsyncSocket(int family,
+    int type) {
+  return Create(family, type);
+}
+
+EpollSocket* EpollSocketServer::Create(int family, int type) {
+  int fd = socket(family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    LOG(LS_ERROR) << __FUNCTION__ << ": socket() failed, errno " << errno;
+    return nullptr;
+  }
+  return new EpollSocket(this, fd, family, type);
+}
+
+void EpollSocketServer::Add(EpollSocket* socket) {
+  socket->id_ = next_id_++;
+  sockets_[socket->id_] = socket;
+  Modify(socket, EPOLLIN);
+}
+
+void EpollSocketServer::Modify(EpollSocket* socket, uint32_t events) {
+  if(socket->fd_ < 0 || socket->events_ == events) {
+    return;
+  }
+  epoll_event event;
+  event.events = events;
+  event.data.u64 = socket->id_;
+  int operation = EPOLL_CTL_MOD;
+  if(!socket->events_) {
+    operation = EPOLL_CTL_ADD;
+  } else if(!events) {
+    operation = EPOLL_CTL_DEL;
+  }
+  if(epoll_ctl(epoll_fd_, operation, socket->fd_, &event) < 0) {
+    LOG(LS_ERROR) << __FUNCTION__ << ": epoll_ctl failed, errno " << errno;
+    return;
+  }
+  socket->events_ = events;
+}
+
+void EpollSocketServer::Remove(EpollSocket* socket) {
+  Modify(socket, 0);
+  sockets_.erase(socket->id_);
+  dirty_.erase(std::remove(dirty_.begin(), dirty_.end(), socket),
+    dirty_.end());
+}
+
+void EpollSocketServer::MarkDirty(EpollSocket* socket) {
+  // Sockets flushed early come back here, flushing twice costs nothing.
+  if(socket->outgoing_count_ != 1) {
+    return;
+  }
+  if(dirty_.empty() && !flush_posted_ && queue_) {
+    flush_posted_ = true;
+    queue_->Post(this);
+  }
+  dirty_.push_back(socket);
+}
+
+void EpollSocketServer::OnMessage(rtc::Message* msg) {
+  flush_posted_ = false;
+  Flush();
+}
+
+void EpollSocketServer::Flush() {
+  std::vector<EpollSocket*> dirty;
+  dirty.swap(dirty_);
+  std::vector<EpollSocket*>::iterator socket;
+  for(socket = dirty.begin(); socket != dirty.end(); socket++) {
+    Flush(*socket);
+  }
+}
+
+void EpollSocketServer::Flush(EpollSocket* socket) {
+  size_t count = socket->outgoing_count_;
+  if(!count) {
+    return;
+  }
+  mmsghdr headers[kBatchSize];
+  iovec vectors[kBatchSize];
+  memset(headers, 0, sizeof(headers[0]) * count);
+  for(size_t index = 0; index < count; index++) {
+    EpollSocket::Datagram& datagram = socket->outgoing_[index];
+    vectors[index].iov_base = datagram.data.data();
+    vectors[index].iov_len = datagram.data.size();
+    headers[index].msg_hdr.msg_iov = &vectors[index];
+    headers[index].msg_hdr.msg_iovlen = 1;
+    if(datagram.address_length) {
+      headers[index].msg_hdr.msg_name = &datagram.address;
+      headers[index].msg_hdr.msg_namelen = datagram.address_length;
+    }
+  }
+
+  size_t sent = 0;
+  while(sent < count) {
+    int result = sendmmsg(socket->fd_, headers + sent, count - sent, 0);
+    send_calls_++;
+    if(result < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK) {
+        // UDP semantics, the rest is lost and the socket signals when it
+        // can take more.
+        packets_dropped_ += count - sent;
+        socket->SetWritable(true);
+        break;
+      }
+      // Only the first datagram failed, e.g. for an unreachable network.
+      socket->error_ = errno;
+      packets_dropped_++;
+      sent++;
+      continue;
+    }
+    packets_sent_ += result;
+    sent += result;
+  }
+  socket->outgoing_count_ = 0;
+}
+
+void EpollSocketServer::Receive(EpollSocket* socket) {
+  for(int index = 0; index < kBatchSize; index++) {
+    msghdr& header = headers_[index].msg_hdr;
+    header.msg_name = &addresses_[index];
+    header.msg_namelen = sizeof(addresses_[index]);
+    header.msg_iov = &vectors_[index];
+    header.msg_iovlen = 1;
+    header.msg_control = nullptr;
+    header.msg_controllen = 0;
+    header.msg_flags = 0;
+  }
+  int count = recvmmsg(socket->fd_, headers_.data(), kBatchSize,
+    MSG_DONTWAIT, nullptr);
+  receive_calls_++;
+  if(count < 0) {
+    // Also how ICMP errors queued on the socket get cleared.
+    socket->error_ = errno;
+    return;
+  }
+  packets_received_ += count;
+
+  uint64_t id = socket->id_;
+  for(int index = 0; index < count; index++) {
+    socket->read_data_ = static_cast<const char*>(vectors_[index].iov_base);
+    socket->read_size_ = headers_[index].msg_len;
+    socket->read_address_ = &addresses_[index];
+    socket->SignalReadEvent(socket);
+    if(sockets_.find(id) == sockets_.end()) {
+      return;
+    }
+    socket->read_data_ = nullptr;
+  }
+}
+
+void EpollSocketServer::Dispatch(uint64_t id, uint32_t events) {
+  std::unordered_map<uint64_t, EpollSocket*>::iterator entry =
+    sockets_.find(id);
+  if(entry == sockets_.end()) {
+    return;
+  }
+  EpollSocket* socket = entry->second;
+  if(events & EPOLLOUT) {
+    socket->OnWritable();
+    if(sockets_.find(id) == sockets_.end()) {
+      return;
+    }
+  }
+  if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+    socket->OnReadable(events);
+  }
+}
+
+void EpollSocketServer::SetMessageQueue(rtc::MessageQueue* queue) {
+  queue_ = queue;
+}
+
+bool EpollSocketServer::Wait(int cms, bool process_io) {
+  Flush();
+  int64_t deadline = cms < 0 ? -1 : rtc::TimeMillis() + cms;
+  epoll_event events[kMaxEvents];
+
+  while(true) {
+    int timeout = -1;
+    if(deadline >= 0) {
+      timeout = std::max<int64_t>(0, deadline - rtc::TimeMillis());
+    }
+
+    int count;
+    if(process_io) {
+      count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    } else {
+      // Only a wake up ends this wait, sockets stay untouched.
+      pollfd wakeup;
+      wakeup.fd = wakeup_fd_;
+      wakeup.events = POLLIN;
+      count = poll(&wakeup, 1, timeout);
+      if(count > 0) {
+        events[0].events = EPOLLIN;
+        events[0].data.u64 = kWakeUpId;
+      }
+    }
+    if(count < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      LOG(LS_ERROR) << __FUNCTION__ << ": Wait failed, errno " << errno;
+      return false;
+    }
+
+    bool woken = false;
+    for(int index = 0; index < count; index++) {
+      if(events[index].data.u64 == kWakeUpId) {
+        uint64_t value;
+        if(read(wakeup_fd_, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+          LOG(LS_WARNING) << __FUNCTION__ << ": read failed, errno " << errno;
+        }
+        woken = true;
+      } else {
+        Dispatch(events[index].data.u64, events[index].events);
+      }
+    }
+    Flush();
+
+    if(woken || count == 0 ||
+       (deadline >= 0 && rtc::TimeMillis() >= deadline)) {
+      return true;
+    }
+  }
+}
+
+void EpollSocketServer::WakeUp() {
+  uint64_t value = 1;
+  if(write(wakeup_fd_, &value, sizeof(value)) < 0) {
+    LOG(LS_WARNING) << __FUNCTION__ << ": write failed, errno " << errno;
+  }
+}
+
+void EpollSocketServer::GetStats(Stats* stats) const {
+  stats->receive_calls = receive_calls_;
+  stats->packets_received = packets_received_;
+  stats->send_calls = send_calls_;
+  stats->packets_sent = packets_sent_;
+  stats->packets_dropped = packets_dropped_;
+}
+
+//
+// SocketServerBenchmark
+//
+
+// Floods UDP over loopback between pairs of sockets on one thread, sending a
+// burst per pair every millisecond so the thread also gets to wait for I/O.
+class SocketServerBenchmark : public rtc::MessageHandler,
+    public sigslot::has_slots<> {
+ public:
+  SocketServerBenchmark(rtc::Thread* thread, int pairs, size_t size,
+      int burst) :
+      thread_(thread),
+      factory_(thread),
+      pairs_(pairs),
+      payload_(size),
+      burst_(burst),
+      sent_(0),
+      received_(0) { }
+
+  void Start() {
+    rtc::SocketAddress loopback("127.0.0.1", 0);
+    for(int pair = 0; pair < pairs_; pair++) {
+      std::unique_ptr<rtc::AsyncPacketSocket> sender(
+        factory_.CreateUdpSocket(loopback, 0, 0));
+      std::unique_ptr<rtc::AsyncPacketSocket> receiver(
+        factory_.CreateUdpSocket(loopback, 0, 0));
+      RTC_CHECK(sender.get() && receiver.get());
+      receiver->SetOption(rtc::Socket::OPT_RCVBUF, 4 * 1024 * 1024);
+      receiver->SignalReadPacket.connect(this,
+        &SocketServerBenchmark::OnReadPacket);
+      senders_.push_back(std::move(sender));
+      receivers_.push_back(std::move(receiver));
+    }
+    thread_->Post(this);
+  }
+
+  void Stop() {
+    thread_->Clear(this);
+    senders_.clear();
+    receivers_.clear();
+  }
+
+  void OnMessage(rtc::Message* msg) override {
+    rtc::PacketOptions options;
+    for(int pair = 0; pair < pairs_; pair++) {
+      rtc::SocketAddress address = receivers_[pair]->GetLocalAddress();
+      for(int packet = 0; packet < burst_; packet++) {
+        if(senders_[pair]->SendTo(payload_.data(), payload_.size(), address,
+            options) >= 0) {
+          sent_++;
+        }
+      }
+    }
+    thread_->PostDelayed(1, this);
+  }
+
+  void OnReadPacket(rtc::AsyncPacketSocket* socket, const char* data,
+      size_t size, const rtc::SocketAddress& address,
+      const rtc::PacketTime& time) {
+    received_++;
+  }
+
+  uint64_t sent() const { return sent_; }
+  uint64_t received() const { return received_; }
+
+ private:
+  rtc::Thread* thread_;
+  rtc::BasicPacketSocketFactory factory_;
+  int pairs_;
+  std::vector<char> payload_;
+  int burst_;
+  uint64_t sent_;
+  uint64_t received_;
+  std::vector<std::unique_ptr<rtc::AsyncPacketSocket>> senders_;
+  std::vector<std::unique_ptr<rtc::AsyncPacketSocket>> receivers_;
+};
+
+static double ThreadCpuMillis(rtc::Thread* thread) {
+  clockid_t clock;
+  timespec time;
+  if(pthread_getcpuclockid(thread->GetPThread(), &clock) ||
+     clock_gettime(clock, &time)) {
+    return 0;
+  }
+  return time.tv_sec * 1000.0 + time.tv_nsec / 1e6;
+}
+
+class BenchmarkWorker : public Nan::AsyncWorker {
+ public:
+  BenchmarkWorker(Nan::Callback* callback, bool epoll, int pairs, size_t size,
+      int burst, int duration_ms) :
+      Nan::AsyncWorker(callback),
+      epoll_(epoll),
+      pairs_(pairs),
+      size_(size),
+      burst_(burst),
+      duration_ms_(duration_ms),
+      sent_(0),
+      received_(0),
+      cpu_ms_(0) { }
+
+  void Execute() override {
+    std::unique_ptr<rtc::SocketServer> server;
+    if(epoll_) {
+      server.reset(new EpollSocketServer());
+    } else {
+      server.reset(new rtc::PhysicalSocketServer());
+    }
+    rtc::Thread thread(server.get());
+    thread.Start();
+
+    SocketServerBenchmark benchmark(&thread, pairs_, size_, burst_);
+    thread.Invoke<void>(rtc::Bind(&SocketServerBenchmark::Start,
+      &benchmark));
+    double start_ms = ThreadCpuMillis(&thread);
+    rtc::Thread::SleepMs(duration_ms_);
+    thread.Invoke<void>(rtc::Bind(&SocketServerBenchmark::Stop, &benchmark));
+    cpu_ms_ = ThreadCpuMillis(&thread) - start_ms;
+    thread.Stop();
+
+    sent_ = benchmark.sent();
+    received_ = benchmark.received();
+  }
+
+  void HandleOKCallback() override {
+    Nan::HandleScope scope;
+    v8::Local<v8::Object> result = Nan::New<v8::Object>();
+    result->Set(Nan::New("server").ToLocalChecked(),
+      Nan::New(epoll_ ? "epoll" : "default").ToLocalChecked());
+    result->Set(Nan::New("packetsSent").ToLocalChecked(),
+      Nan::New(static_cast<double>(sent_)));
+    result->Set(Nan::New("packetsReceived").ToLocalChecked(),
+      Nan::New(static_cast<double>(received_)));
+    result->Set(Nan::New("packetsPerSecond").ToLocalChecked(),
+      Nan::New(received_ * 1000.0 / duration_ms_));
+    result->Set(Nan::New("cpuTime").ToLocalChecked(), Nan::New(cpu_ms_));
+    if(received_) {
+      result->Set(Nan::New("cpuPerPacket").ToLocalChecked(),
+        Nan::New(cpu_ms_ * 1000.0 / received_));
+    }
+    v8::Local<v8::Value> argv[] = { Nan::Null(), result };
+    callback->Call(2, argv);
+  }
+
+ private:
+  bool epoll_;
+  int pairs_;
+  size_t size_;
+  int burst_;
+  int duration_ms_;
+  uint64_t sent_;
+  uint64_t received_;
+  double cpu_ms_;
+};
+
+NAN_MODULE_INIT(EpollSocketServer::Init) {
+  Nan::SetMethod(target, "benchmarkSocketServer",
+    EpollSocketServer::BenchmarkSocketServer);
+}
+
+NAN_METHOD(EpollSocketServer::BenchmarkSocketServer) {
+  if(info.Length() < 2 || !info[0]->IsObject() || !info[1]->IsFunction()) {
+    return Nan::ThrowError("Expected options and a callback");
+  }
+  v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[0]);
+  v8::Local<v8::Value> server_value =
+    options->Get(Nan::New("server").ToLocalChecked());
+  v8::Local<v8::Value> pairs_value =
+    options->Get(Nan::New("pairs").ToLocalChecked());
+  v8::Local<v8::Value> size_value =
+    options->Get(Nan::New("size").ToLocalChecked());
+  v8::Local<v8::Value> burst_value =
+    options->Get(Nan::New("burst").ToLocalChecked());
+  v8::Local<v8::Value> duration_value =
+    options->Get(Nan::New("duration").ToLocalChecked());
+
+  bool epoll = false;
+  if(server_value->IsString()) {
+    v8::String::Utf8Value name(server_value->ToString());
+    std::string server(*name);
+    if(server == "epoll") {
+      epoll = true;
+    } else if(server != "default") {
+      return Nan::ThrowError("Invalid server");
+    }
+  }
+  int pairs = pairs_value->IsUint32() ? pairs_value->Uint32Value() : 8;
+  int size = size_value->IsUint32() ? size_value->Uint32Value() : 200;
+  int burst = burst_value->IsUint32() ? burst_value->Uint32Value() : 64;
+  int duration =
+    duration_value->IsUint32() ? duration_value->Uint32Value() : 3000;
+  if(pairs < 1 || pairs > 1024 || size < 1 || size > 1472 || burst < 1 ||
+     burst > 4096 || duration < 1) {
+    return Nan::ThrowError("Invalid benchmark options");
+  }
+
+  v8::Local<v8::Function> callback = v8::Local<v8::Function>::Cast(info[1]);
+  Nan::AsyncQueueWorker(new BenchmarkWorker(new Nan::Callback(callback),
+    epoll, pairs, size, burst, duration));
+  info.GetReturnValue().SetUndefined();
+}
@@ -0,0 +1,162 @@
+#ifndef WEBRTCJS_EPOLLSOCKETSERVER_H
+#define WEBRTCJS_EPOLLSOCKETSERVER_H
+
+#include <nan.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+#include "webrtc/base/asyncsocket.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/messagequeue.h"
+#include "webrtc/base/socketserver.h"
+
+class EpollSocketServer;
+
+// Non-blocking socket driven by EpollSocketServer. Datagrams arrive in
+// batches read with recvmmsg(), RecvFrom() hands out the one that is being
+// signaled. SendTo() queues datagrams until the server sends them with
+// sendmmsg(), at the latest after the messages already queued on the thread
+// ran. Streams use plain recv() and send().
+class EpollSocket : public rtc::AsyncSocket {
+ public:
+  EpollSocket(EpollSocketServer* server, int fd, int family, int type);
+  ~EpollSocket() override;
+
+  rtc::SocketAddress GetLocalAddress() const override;
+  rtc::SocketAddress GetRemoteAddress() const override;
+  int Bind(const rtc::SocketAddress& address) override;
+  int Connect(const rtc::SocketAddress& address) override;
+  int Send(const void* data, size_t size) override;
+  int SendTo(const void* data, size_t size,
+    const rtc::SocketAddress& address) override;
+  int Recv(void* buffer, size_t size, int64_t* timestamp) override;
+  int RecvFrom(void* buffer, size_t size, rtc::SocketAddress* address,
+    int64_t* timestamp) override;
+  int Listen(int backlog) override;
+  EpollSocket* Accept(rtc::SocketAddress* address) override;
+  int Close() override;
+  int GetError() const override;
+  void SetError(int error) override;
+  ConnState GetState() const override;
+  int EstimateMTU(uint16_t* mtu) override;
+  int GetOption(Option option, int* value) override;
+  int SetOption(Option option, int value) override;
+
+ private:
+  friend class EpollSocketServer;
+
+  struct Datagram {
+    std::vector<char> data;
+    sockaddr_storage address;
+    socklen_t address_length;
+  };
+
+  bool IsDatagram() const { return type_ == SOCK_DGRAM; }
+  socklen_t ToSockAddr(const rtc::SocketAddress& address,
+    sockaddr_storage* storage) const;
+  int Queue(const void* data, size_t size, const sockaddr_storage* address,
+    socklen_t address_length);
+  void OnReadable(uint32_t events);
+  void OnWritable();
+  void SetWritable(bool enabled);
+
+  EpollSocketServer* server_;
+  uint64_t id_;
+  int fd_;
+  int family_;
+  int type_;
+  int error_;
+  ConnState state_;
+  bool listening_;
+  bool eof_;
+  bool write_blocked_;
+  // What epoll watches for, 0 once the socket is out of the set.
+  uint32_t events_;
+
+  // The datagram being signaled, it lives in the server's receive batch.
+  const char* read_data_;
+  size_t read_size_;
+  const sockaddr_storage* read_address_;
+
+  std::vector<Datagram> outgoing_;
+  size_t outgoing_count_;
+};
+
+// Linux socket server for the worker threads. One epoll set replaces the
+// select() over every socket of PhysicalSocketServer, and datagrams move in
+// batches of up to kBatchSize per syscall.
+//
+// The thread only waits once its queue is empty, under load that can take
+// long. The first datagram of a batch therefore posts a flush behind the
+// messages queued so far, it sends what they added.
+class EpollSocketServer : public rtc::SocketServer,
+    public rtc::MessageHandler {
+ public:
+  static const int kBatchSize = 32;
+
+  struct Stats {
+    uint64_t receive_calls;
+    uint64_t packets_received;
+    uint64_t send_calls;
+    uint64_t packets_sent;
+    uint64_t packets_dropped;
+  };
+
+  EpollSocketServer();
+  ~EpollSocketServer() override;
+
+  rtc::Socket* CreateSocket(int type) override;
+  rtc::Socket* CreateSocket(int family, int type) override;
+  rtc::AsyncSocket* CreateAsyncSocket(int type) override;
+  rtc::AsyncSocket* CreateAsyncSocket(int family, int type) override;
+
+  void SetMessageQueue(rtc::MessageQueue* queue) override;
+  bool Wait(int cms, bool process_io) override;
+  void WakeUp() override;
+
+  void OnMessage(rtc::Message* msg) override;
+
+  // Safe to call from any thread.
+  void GetStats(Stats* stats) const;
+
+  static NAN_MODULE_INIT(Init);
+
+ private:
+  friend class EpollSocket;
+
+  EpollSocket* Create(int family, int type);
+  void Add(EpollSocket* socket);
+  void Modify(EpollSocket* socket, uint32_t events);
+  void Remove(EpollSocket* socket);
+  void MarkDirty(EpollSocket* socket);
+  void Flush();
+  void Flush(EpollSocket* socket);
+  void Receive(EpollSocket* socket);
+  void Dispatch(uint64_t id, uint32_t events);
+
+  static NAN_METHOD(BenchmarkSocketServer);
+
+  int epoll_fd_;
+  int wakeup_fd_;
+  uint64_t next_id_;
+  std::unordered_map<uint64_t, EpollSocket*> sockets_;
+  std::vector<EpollSocket*> dirty_;
+  rtc::MessageQueue* queue_;
+  bool flush_posted_;
+
+  // Receive batch, reused for every recvmmsg().
+  std::vector<char> buffers_;
+  std::vector<mmsghdr> headers_;
+  std::vector<iovec> vectors_;
+  std::vector<sockaddr_storage> addresses_;
+
+  std::atomic<uint64_t> receive_calls_;
+  std::atomic<uint64_t> packets_received_;
+  std::atomic<uint64_t> send_calls_;
+  std::atomic<uint64_t> packets_sent_;
+  std::atomic<uint64_t> packets_dropped_;
+};
+
+#endif
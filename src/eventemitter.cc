@@ -1,14 +1,27 @@
 #include "eventemitter.h"
 
+#include <nan.h>
+
+#include "webrtc/base/trace_event.h"
+
+#include "isolatedata.h"
+#include "metrics.h"
+
 EventEmitter::EventEmitter(bool notify) : notify_(notify) {
   uv_mutex_init(&list_);
   if(!notify_) {
     uv_mutex_init(&lock_);
     async_ = new uv_async_t();
     async_->data = this;
-    uv_async_init(uv_default_loop(), async_,
+    // The loop of the isolate creating the object, worker_threads have
+    // their own.
+    uv_async_init(Nan::GetCurrentEventLoop(), async_,
       reinterpret_cast<uv_async_cb>(EventEmitter::onAsync));
     EventEmitter::SetReference(false);
+    IsolateData* data = IsolateData::Current();
+    if(data) {
+      data->AddEmitter(this);
+    }
   }
 }
 
@@ -19,15 +32,40 @@ EventEmitter::EventEmitter(EventEmitter* listener) : notify_(true) {
 
 EventEmitter::~EventEmitter() {
   EventEmitter::RemoveAllListeners();
-  EventEmitter::Dispose();
+  EventEmitter::Detach();
   if(!notify_) {
-    async_->data = 0;
-    uv_close(reinterpret_cast<uv_handle_t*>(async_), EventEmitter::onEnded);
+    // Gone once the isolate is disposed.
+    IsolateData* data = IsolateData::Current();
+    if(data) {
+      data->RemoveEmitter(this);
+    }
     uv_mutex_destroy(&lock_);
   }
   uv_mutex_destroy(&list_);
 }
 
+void EventEmitter::Detach() {
+  // Parents lock their list before ours, never hold ours while calling in.
+  uv_mutex_lock(&list_);
+  std::vector<EventEmitter*> parents(parents_);
+  uv_mutex_unlock(&list_);
+  std::vector<EventEmitter*>::iterator index;
+  for(index = parents.begin(); index != parents.end(); index++) {
+    (*index)->RemoveListener(this);
+  }
+
+  if(!notify_) {
+    uv_mutex_lock(&lock_);
+    if(async_) {
+      async_->data = 0;
+      uv_close(reinterpret_cast<uv_handle_t*>(async_), EventEmitter::onEnded);
+      async_ = nullptr;
+    }
+    uv_mutex_unlock(&lock_);
+    EventEmitter::Dispose();
+  }
+}
+
 void EventEmitter::AddListener(EventEmitter *listener) {
   bool found = false;
   std::vector<EventEmitter*>::iterator index;
@@ -67,27 +105,33 @@ void EventEmitter::RemoveAllListeners() {
   uv_mutex_lock(&list_);
   for(index = listeners_.begin(); index < listeners_.end(); index++) {
     (*index)->RemoveParent(this);
-    listeners_.erase(index);
   }
+  listeners_.clear();
   uv_mutex_unlock(&list_);
 }
 
 void EventEmitter::Dispose() {
   if(!notify_) {
+    uv_mutex_lock(&lock_);
     while(!events_.empty()) {
       rtc::scoped_refptr<Event> event = events_.front();
       events_.pop();
+      Metrics::Add(Metrics::kEventsQueued, -1);
     }
+    uv_mutex_unlock(&lock_);
   }
 }
 
 void EventEmitter::SetReference(bool alive) {
   if(!notify_) {
     uv_mutex_lock(&lock_);
-    if(alive) {
-      uv_ref(reinterpret_cast<uv_handle_t*>(async_));
-    } else {
-      uv_unref(reinterpret_cast<uv_handle_t*>(async_));
+    // Null once detached.
+    if(async_) {
+      if(alive) {
+        uv_ref(reinterpret_cast<uv_handle_t*>(async_));
+      } else {
+        uv_unref(reinterpret_cast<uv_handle_t*>(async_));
+      }
     }
     uv_mutex_unlock(&lock_);
   }
@@ -99,10 +143,14 @@ void EventEmitter::Emit(int event) {
 
 void EventEmitter::Emit(rtc::scoped_refptr<Event> event) {
   if(event.get()) {
+    TRACE_EVENT1("webrtcjs", "EventEmitter::Emit", "type", event->event_);
     if(!notify_) {
       uv_mutex_lock(&lock_);
-      events_.push(event);
-      uv_async_send(async_);
+      if(async_) {
+        events_.push(event);
+        Metrics::Add(Metrics::kEventsQueued);
+        uv_async_send(async_);
+      }
       uv_mutex_unlock(&lock_);
     }
     uv_mutex_lock(&list_);
@@ -123,9 +171,10 @@ void EventEmitter::AddParent(EventEmitter *listener) {
 void EventEmitter::RemoveParent(EventEmitter *listener) {
   std::vector<EventEmitter*>::iterator index;
   uv_mutex_lock(&list_);
-  for(index = listeners_.begin(); index < listeners_.end(); index++) {
+  for(index = parents_.begin(); index < parents_.end(); index++) {
     if((*index) == listener) {
-      listeners_.erase(index);
+      parents_.erase(index);
+      break;
     }
   }
   uv_mutex_unlock(&list_);
@@ -146,12 +195,16 @@ void EventEmitter::onEnded(uv_handle_t *handle) {
 }
 
 void EventEmitter::DispatchEvents() {
+  TRACE_EVENT0("webrtcjs", "EventEmitter::DispatchEvents");
   uv_mutex_lock(&lock_);
   while(!events_.empty()) {
     rtc::scoped_refptr<Event> event = events_.front();
     events_.pop();
+    Metrics::Add(Metrics::kEventsQueued, -1);
+    Metrics::Add(Metrics::kEventsDispatched);
     uv_mutex_unlock(&lock_);
     if(event.get()) {
+      TRACE_EVENT1("webrtcjs", "EventEmitter::On", "type", event->event_);
       On(event);
     }
     uv_mutex_lock(&lock_);
@@ -98,6 +98,9 @@ class EventEmitter {
   void RemoveListener(EventEmitter* listener=nullptr);
   void RemoveAllListeners();
   void SetReference(bool alive=true);
+  // Stops receiving events for good: leaves the emitters it listens to and
+  // closes the loop handle. For objects that outlive their isolate.
+  void Detach();
   void Emit(int event=0);
   void Emit(rtc::scoped_refptr<Event> event);
   template <class T> inline void Emit(int event, const T &content) {
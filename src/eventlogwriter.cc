@@ -0,0 +1,182 @@
+#include "eventlogwriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "webrtc/base/logging.h"
+
+static const size_t kReadSize = 64 * 1024;
+static const int kPipeSize = 1024 * 1024;
+
+class CloseEventLogWorker : public Nan::AsyncWorker {
+ public:
+  CloseEventLogWorker(EventLogWriter* writer, Nan::Callback* callback) :
+      Nan::AsyncWorker(callback),
+      writer_(writer),
+      written_(0),
+      dropped_(0),
+      error_(0) { }
+
+  void Execute() override {
+    writer_->Wait();
+    written_ = writer_->written();
+    dropped_ = writer_->dropped();
+    error_ = writer_->error();
+    delete writer_;
+  }
+
+  void HandleOKCallback() override {
+    if(!callback) {
+      return;
+    }
+    Nan::HandleScope scope;
+    v8::Local<v8::Object> result = Nan::New<v8::Object>();
+    result->Set(Nan::New("bytesWritten").ToLocalChecked(),
+      Nan::New(static_cast<double>(written_)));
+    result->Set(Nan::New("bytesDropped").ToLocalChecked(),
+      Nan::New(static_cast<double>(dropped_)));
+    v8::Local<v8::Value> argv[2] = { Nan::Null(), result };
+    if(error_) {
+      argv[0] = Nan::Error(strerror(error_));
+    }
+    callback->Call(2, argv);
+  }
+
+ private:
+  EventLogWriter* writer_;
+  uint64_t written_;
+  uint64_t dropped_;
+  int error_;
+};
+
+EventLogWriter* EventLogWriter::Open(const std::string& path) {
+  int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+    0644);
+  if(file < 0) {
+    return nullptr;
+  }
+  int fds[2];
+  if(pipe2(fds, O_CLOEXEC)) {
+    int error = errno;
+    close(file);
+    errno = error;
+    return nullptr;
+  }
+  // Room for bursts while the reader is not scheduled, best effort.
+  fcntl(fds[1], F_SETPIPE_SZ, kPipeSize);
+  return new EventLogWriter(file, fds[0], fds[1]);
+}
+
+EventLogWriter::EventLogWriter(int file, int read_fd, int write_fd) :
+    file_(file),
+    read_fd_(read_fd),
+    write_fd_(write_fd),
+    buffered_(0),
+    eof_(false),
+    truncated_(false),
+    error_(0),
+    written_(0),
+    dropped_(0) {
+  reader_ = std::thread(&EventLogWriter::Read, this);
+  writer_ = std::thread(&EventLogWriter::Write, this);
+}
+
+EventLogWriter::~EventLogWriter() {
+  Wait();
+  close(read_fd_);
+  close(file_);
+  if(dropped_) {
+    LOG(LS_WARNING) << __FUNCTION__ << ": Dropped " << dropped_
+      << " bytes of the event log";
+  }
+}
+
+int EventLogWriter::TakeFd() {
+  int fd = write_fd_;
+  write_fd_ = -1;
+  return fd;
+}
+
+void EventLogWriter::Wait() {
+  // Nobody took the write end, the reader only sees EOF once it is closed.
+  if(write_fd_ >= 0) {
+    close(write_fd_);
+    write_fd_ = -1;
+  }
+  if(reader_.joinable()) {
+    reader_.join();
+  }
+  if(writer_.joinable()) {
+    writer_.join();
+  }
+}
+
+void EventLogWriter::Read() {
+  std::vector<char> buffer(kReadSize);
+  while(true) {
+    ssize_t size = read(read_fd_, &buffer[0], buffer.size());
+    if(size < 0 && errno == EINTR) {
+      continue;
+    }
+    if(size <= 0) {
+      break;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    // A log with a gap cannot be parsed, everything after it goes.
+    if(truncated_ || error_ || buffered_ + size > kMaxBuffered) {
+      truncated_ = true;
+      dropped_ += size;
+      continue;
+    }
+    buffers_.push_back(std::vector<char>(buffer.begin(),
+      buffer.begin() + size));
+    buffered_ += size;
+    ready_.notify_one();
+  }
+
+  std::lock_guard<std::mutex> lock(lock_);
+  eof_ = true;
+  ready_.notify_one();
+}
+
+void EventLogWriter::Write() {
+  while(true) {
+    std::vector<char> buffer;
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      ready_.wait(lock, [this]() { return eof_ || !buffers_.empty(); });
+      if(buffers_.empty()) {
+        return;
+      }
+      buffer.swap(buffers_.front());
+      buffers_.pop_front();
+    }
+
+    size_t offset = 0;
+    while(!error_ && offset < buffer.size()) {
+      ssize_t size = write(file_, &buffer[offset], buffer.size() - offset);
+      if(size < 0 && errno == EINTR) {
+        continue;
+      }
+      if(size < 0) {
+        error_ = errno;
+        LOG(LS_ERROR) << __FUNCTION__ << ": Could not write event log, errno "
+          << error_;
+        break;
+      }
+      offset += size;
+      written_ += size;
+    }
+    dropped_ += buffer.size() - offset;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    buffered_ -= buffer.size();
+  }
+}
+
+void EventLogWriter::Close(EventLogWriter* writer, Nan::Callback* callback) {
+  Nan::AsyncQueueWorker(new CloseEventLogWorker(writer, callback));
+}
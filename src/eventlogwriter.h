@@ -0,0 +1,66 @@
+#ifndef WEBRTCJS_EVENTLOGWRITER_H
+#define WEBRTCJS_EVENTLOGWRITER_H
+
+#include <nan.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Puts the RtcEventLog of one PeerConnection on disk without the worker
+// thread ever waiting for the disk. WebRTC writes into a pipe, a reader
+// thread drains it into memory and a writer thread writes the file. Once
+// more than kMaxBuffered bytes wait for the disk the rest of the log is
+// dropped, the file then ends early.
+class EventLogWriter {
+ public:
+  static const size_t kMaxBuffered = 8 * 1024 * 1024;
+
+  // Null when the file or the pipe cannot be created, see errno.
+  static EventLogWriter* Open(const std::string& path);
+
+  ~EventLogWriter();
+
+  // Write end of the pipe, for StartRtcEventLog() which takes it over.
+  int TakeFd();
+  // Waits until WebRTC closed the pipe and the file is written.
+  void Wait();
+
+  uint64_t written() const { return written_; }
+  uint64_t dropped() const { return dropped_; }
+  // errno of the first failed write, 0 if there was none.
+  int error() const { return error_; }
+
+  // Completes a log off the JS thread and calls callback(error, stats) once
+  // the file is closed, the log must have been stopped before.
+  static void Close(EventLogWriter* writer, Nan::Callback* callback);
+
+ private:
+  EventLogWriter(int file, int read_fd, int write_fd);
+
+  void Read();
+  void Write();
+
+  int file_;
+  int read_fd_;
+  int write_fd_;
+
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::deque<std::vector<char>> buffers_;
+  size_t buffered_;
+  bool eof_;
+  bool truncated_;
+  std::atomic<int> error_;
+
+  std::atomic<uint64_t> written_;
+  std::atomic<uint64_t> dropped_;
+
+  std::thread reader_;
+  std::thread writer_;
+};
+
+#endif
@@ -0,0 +1,516 @@
+#include "filesource.h"
+#include "isolatedata.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libyuv/planar_functions.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/modules/video_coding/codecs/vp8/include/vp8.h"
+#include "webrtc/modules/video_coding/codecs/vp9/include/vp9.h"
+
+#include "ivf_utils.h"
+#include "mediastreamtrack.h"
+#include "metrics.h"
+
+static const double kDefaultFrameRate = 30;
+static const double kMaxFrameRate = 120;
+
+// 8-bit 4:2:0 chroma tags. C420p10 and friends are 4:2:0 as well, but with
+// two bytes per sample.
+static const char* const kY4mColorSpaces[] = {
+  "C420", "C420jpeg", "C420paldv", "C420mpeg2",
+};
+
+static bool IsY4mColorSpace(const std::string& token) {
+  for(size_t index = 0;
+      index < sizeof(kY4mColorSpaces) / sizeof(kY4mColorSpaces[0]); index++) {
+    if(token == kY4mColorSpaces[index]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//
+// MappedMediaFile
+//
+rtc::CriticalSection MappedMediaFile::cache_lock_;
+std::map<std::string, MappedMediaFile*> MappedMediaFile::cache_;
+
+MappedMediaFile::MappedMediaFile(const std::string& path) :
+    ref_count_(0),
+    path_(path),
+    data_(nullptr),
+    size_(0),
+    format_(kFormatY4m),
+    fourcc_(0),
+    width_(0),
+    height_(0),
+    frame_rate_(kDefaultFrameRate) { }
+
+MappedMediaFile::~MappedMediaFile() {
+  LOG(LS_INFO) << __FUNCTION__ << ": " << path_;
+  if(data_) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+}
+
+rtc::scoped_refptr<MappedMediaFile> MappedMediaFile::Open(
+    const std::string& path, std::string* error) {
+  {
+    rtc::CritScope lock(&cache_lock_);
+    std::map<std::string, MappedMediaFile*>::iterator index =
+      cache_.find(path);
+    if(index != cache_.end()) {
+      return index->second;
+    }
+  }
+
+  MappedMediaFile* file = new MappedMediaFile(path);
+  if(!file->Map(error)) {
+    delete file;
+    return nullptr;
+  }
+
+  bool parsed = memcmp(file->data_, "DKIF", 4) == 0 ?
+    file->ParseIvf(error) : file->ParseY4m(error);
+  if(!parsed || file->frames_.empty()) {
+    if(error->empty()) {
+      *error = "No frames in " + path;
+    }
+    delete file;
+    return nullptr;
+  }
+
+  rtc::CritScope lock(&cache_lock_);
+  std::map<std::string, MappedMediaFile*>::iterator index = cache_.find(path);
+  if(index != cache_.end()) {
+    // Somebody else mapped the same path meanwhile, keep theirs.
+    delete file;
+    return index->second;
+  }
+  cache_[path] = file;
+  return file;
+}
+
+int MappedMediaFile::AddRef() const {
+  rtc::CritScope lock(&cache_lock_);
+  return ++ref_count_;
+}
+
+int MappedMediaFile::Release() const {
+  rtc::CritScope lock(&cache_lock_);
+  int count = --ref_count_;
+  if(!count) {
+    std::map<std::string, MappedMediaFile*>::iterator index =
+      cache_.find(path_);
+    if(index != cache_.end() && index->second == this) {
+      cache_.erase(index);
+    }
+    delete this;
+  }
+  return count;
+}
+
+bool MappedMediaFile::Map(std::string* error) {
+  int fd = open(path_.c_str(), O_RDONLY);
+  if(fd < 0) {
+    *error = "Could not open " + path_;
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(
+      kIvfFileHeaderSize)) {
+    close(fd);
+    *error = "File too short: " + path_;
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    *error = "Could not map " + path_;
+    return false;
+  }
+  madvise(data, st.st_size, MADV_WILLNEED);
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = st.st_size;
+  return true;
+}
+
+bool MappedMediaFile::ParseIvf(std::string* error) {
+  IvfFileHeader header;
+  if(!read_ivf_file_header(data_, size_, &header)) {
+    *error = "Invalid IVF header in " + path_;
+    return false;
+  }
+
+  format_ = kFormatIvf;
+  fourcc_ = header.fourcc;
+  width_ = header.width;
+  height_ = header.height;
+  if(header.scale && header.rate) {
+    frame_rate_ = static_cast<double>(header.rate) / header.scale;
+  }
+
+  size_t offset = header.header_size;
+  IvfFrameHeader frame_header;
+  while(read_ivf_frame_header(data_ + offset, size_ - offset,
+      &frame_header)) {
+    Frame frame;
+    frame.offset = offset + kIvfFrameHeaderSize;
+    frame.size = frame_header.frame_size;
+    frames_.push_back(frame);
+    offset = frame.offset + frame.size;
+  }
+  return true;
+}
+
+bool MappedMediaFile::ParseY4m(std::string* error) {
+  const char* begin = reinterpret_cast<const char*>(data_);
+  const char* end = begin + size_;
+  const char* eol = static_cast<const char*>(memchr(begin, '\n', size_));
+  if(size_ < 10 || memcmp(begin, "YUV4MPEG2 ", 10) != 0 || !eol) {
+    *error = "Unknown file format: " + path_;
+    return false;
+  }
+
+  format_ = kFormatY4m;
+  fourcc_ = cricket::FOURCC_I420;
+
+  std::string line(begin + 10, eol);
+  size_t pos = 0;
+  while(pos < line.size()) {
+    size_t next = line.find(' ', pos);
+    if(next == std::string::npos) {
+      next = line.size();
+    }
+    std::string token = line.substr(pos, next - pos);
+    pos = next + 1;
+    if(token.empty()) {
+      continue;
+    }
+    switch(token[0]) {
+      case 'W':
+        width_ = atoi(token.c_str() + 1);
+        break;
+      case 'H':
+        height_ = atoi(token.c_str() + 1);
+        break;
+      case 'F': {
+        int num = 0, den = 0;
+        if(sscanf(token.c_str() + 1, "%d:%d", &num, &den) == 2 && num > 0 &&
+            den > 0) {
+          frame_rate_ = static_cast<double>(num) / den;
+        }
+        break;
+      }
+      case 'C':
+        if(!IsY4mColorSpace(token)) {
+          *error = "Only 8-bit 4:2:0 Y4M files are supported: " + path_;
+          return false;
+        }
+        break;
+    }
+  }
+
+  if(width_ <= 0 || height_ <= 0) {
+    *error = "Invalid Y4M dimensions in " + path_;
+    return false;
+  }
+
+  size_t chroma = ((width_ + 1) / 2) * ((height_ + 1) / 2);
+  size_t image_size = width_ * height_ + 2 * chroma;
+  const char* cur = eol + 1;
+  while(cur + 5 <= end && memcmp(cur, "FRAME", 5) == 0) {
+    const char* frame_eol =
+      static_cast<const char*>(memchr(cur, '\n', end - cur));
+    if(!frame_eol || static_cast<size_t>(end - frame_eol - 1) < image_size) {
+      break;
+    }
+    Frame frame;
+    frame.offset = frame_eol + 1 - begin;
+    frame.size = image_size;
+    frames_.push_back(frame);
+    cur = frame_eol + 1 + image_size;
+  }
+  return true;
+}
+
+//
+// FileVideoCapturer
+//
+FileVideoCapturer::FileVideoCapturer(rtc::scoped_refptr<MappedMediaFile> file,
+    double frame_rate, bool loop) :
+    PushVideoCapturer(file->width(), file->height(), frame_rate),
+    file_(file),
+    time_ns_(0),
+    position_(0),
+    loop_(loop) { }
+
+FileVideoCapturer::~FileVideoCapturer() {
+  Halt();
+  if(decoder_.get()) {
+    decoder_->Release();
+  }
+}
+
+bool FileVideoCapturer::Init(std::string* error) {
+  if(file_->format() == MappedMediaFile::kFormatIvf) {
+    return InitDecoder(error);
+  }
+  return true;
+}
+
+bool FileVideoCapturer::InitDecoder(std::string* error) {
+  webrtc::VideoCodec codec;
+  memset(&codec, 0, sizeof(codec));
+  codec.width = file_->width();
+  codec.height = file_->height();
+
+  if(file_->fourcc() == 0x30385056) {  // VP80
+    codec.codecType = webrtc::kVideoCodecVP8;
+    decoder_.reset(webrtc::VP8Decoder::Create());
+  } else if(file_->fourcc() == 0x30395056) {  // VP90
+    codec.codecType = webrtc::kVideoCodecVP9;
+    decoder_.reset(webrtc::VP9Decoder::Create());
+  } else {
+    LOG(LS_ERROR) << __FUNCTION__ << ": Unsupported IVF fourcc " <<
+      file_->fourcc();
+    *error = "Unsupported IVF codec, expected VP8 or VP9";
+    return false;
+  }
+
+  if(decoder_->InitDecode(&codec, 1) != WEBRTC_VIDEO_CODEC_OK) {
+    decoder_.reset();
+    *error = "Could not initialize the IVF decoder";
+    return false;
+  }
+  decoder_->RegisterDecodeCompleteCallback(this);
+  return true;
+}
+
+void FileVideoCapturer::OnTick(int64_t time_ns) {
+  // Only this thread moves the position.
+  size_t index = position_.load();
+  if(index >= file_->frame_count()) {
+    if(!loop_) {
+      return;
+    }
+    index = 0;
+  }
+  position_ = index + 1;
+
+  const uint8_t* data = file_->frame_data(index);
+  size_t size = file_->frame_size(index);
+
+  if(file_->format() == MappedMediaFile::kFormatY4m) {
+    return DeliverFrame(data, size, time_ns);
+  }
+
+  if(!decoder_.get()) {
+    return;
+  }
+
+  // Frame types only matter to the decoder after a (re)start.
+  bool key = index == 0 || (file_->fourcc() == 0x30385056 && !(data[0] & 1));
+  webrtc::EncodedImage image(const_cast<uint8_t*>(data), size, size);
+  image._frameType = key ? webrtc::kVideoFrameKey : webrtc::kVideoFrameDelta;
+  image._completeFrame = true;
+  image._timeStamp = static_cast<uint32_t>(time_ns / 11111);  // 90 kHz
+  image._encodedWidth = width_;
+  image._encodedHeight = height_;
+
+  time_ns_ = time_ns;
+  int64_t start_ns = rtc::TimeNanos();
+  decoder_->Decode(image, false, nullptr);
+  Metrics::decode_time.Observe(
+    static_cast<double>(rtc::TimeNanos() - start_ns) /
+    rtc::kNumNanosecsPerSec);
+}
+
+int32_t FileVideoCapturer::Decoded(webrtc::VideoFrame& frame) {
+  if(frame.width() != width_ || frame.height() != height_) {
+    LOG(LS_WARNING) << __FUNCTION__ << ": Dropping " << frame.width() << "x" <<
+      frame.height() << " frame, expected " << width_ << "x" << height_;
+    return 0;
+  }
+
+  int chroma_width = (width_ + 1) / 2;
+  int chroma_height = (height_ + 1) / 2;
+  image_.resize(width_ * height_ + 2 * chroma_width * chroma_height);
+  uint8_t* y = &image_[0];
+  uint8_t* u = y + width_ * height_;
+  uint8_t* v = u + chroma_width * chroma_height;
+
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+    frame.video_frame_buffer();
+  libyuv::I420Copy(buffer->data(webrtc::kYPlane),
+    buffer->stride(webrtc::kYPlane),
+    buffer->data(webrtc::kUPlane), buffer->stride(webrtc::kUPlane),
+    buffer->data(webrtc::kVPlane), buffer->stride(webrtc::kVPlane),
+    y, width_, u, chroma_width, v, chroma_width, width_, height_);
+
+  DeliverFrame(&image_[0], image_.size(), time_ns_);
+  return 0;
+}
+
+//
+// FileSource
+//
+NAN_MODULE_INIT(FileSource::Init) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+  tpl->SetClassName(Nan::New("FileSource").ToLocalChecked());
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  Nan::SetPrototypeMethod(tpl, "createTrack", FileSource::CreateTrack);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("width").ToLocalChecked(),
+    FileSource::GetWidth);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("height").ToLocalChecked(),
+    FileSource::GetHeight);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("frameRate").ToLocalChecked(),
+    FileSource::GetFrameRate);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("frames").ToLocalChecked(),
+    FileSource::GetFrames);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("position").ToLocalChecked(),
+    FileSource::GetPosition);
+
+  IsolateData::Current()->SetConstructor(IsolateData::kFileSource,
+    Nan::GetFunction(tpl).ToLocalChecked());
+  Nan::Set(target, Nan::New("FileSource").ToLocalChecked(),
+    Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+FileSource::FileSource(
+    rtc::scoped_refptr<webrtc::VideoSourceInterface> source,
+    FileVideoCapturer* capturer, const WebRtcJs::FactoryId& factory) :
+    source_(source), capturer_(capturer), factory_(factory) { }
+
+FileSource::~FileSource() { }
+
+NAN_METHOD(FileSource::New) {
+  if(!info.IsConstructCall()) {
+    return Nan::ThrowError("Use new operator");
+  }
+  if(info.Length() == 0 || !info[0]->IsString()) {
+    return Nan::ThrowError("Expected path to an IVF or Y4M file");
+  }
+
+  v8::String::Utf8Value path(info[0]->ToString());
+  double frame_rate = 0;
+  bool loop = true;
+  v8::Local<v8::Value> factory_value = Nan::Undefined();
+
+  if(info.Length() >= 2 && info[1]->IsObject()) {
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+    v8::Local<v8::Value> frame_rate_value =
+      options->Get(Nan::New("frameRate").ToLocalChecked());
+    v8::Local<v8::Value> loop_value =
+      options->Get(Nan::New("loop").ToLocalChecked());
+    if(frame_rate_value->IsNumber()) {
+      frame_rate = frame_rate_value->NumberValue();
+    }
+    if(loop_value->IsBoolean()) {
+      loop = loop_value->BooleanValue();
+    }
+    factory_value = options->Get(Nan::New("factory").ToLocalChecked());
+  }
+  WebRtcJs::FactoryId factory;
+  if(!WebRtcJs::ParseFactory(factory_value, &factory)) {
+    return Nan::ThrowError("Invalid factory");
+  }
+
+  std::string error;
+  rtc::scoped_refptr<MappedMediaFile> file =
+    MappedMediaFile::Open(*path, &error);
+  if(!file.get()) {
+    return Nan::ThrowError(error.c_str());
+  }
+
+  if(frame_rate <= 0) {
+    frame_rate = file->frame_rate();
+  }
+  if(frame_rate <= 0 || frame_rate > kMaxFrameRate) {
+    frame_rate = kDefaultFrameRate;
+  }
+
+  std::unique_ptr<FileVideoCapturer> capturer(
+    new FileVideoCapturer(file, frame_rate, loop));
+  if(!capturer->Init(&error)) {
+    return Nan::ThrowError(error.c_str());
+  }
+  webrtc::PeerConnectionFactoryInterface* pc_factory =
+    WebRtcJs::GetPeerConnectionFactory(factory);
+  rtc::scoped_refptr<webrtc::VideoSourceInterface> source;
+  if(pc_factory) {
+    source = pc_factory->CreateVideoSource(capturer.get(), nullptr);
+  }
+  if(!source.get()) {
+    return Nan::ThrowError("Could not create webrtc::VideoSourceInterface");
+  }
+
+  // The source owns the capturer from here on.
+  FileSource* self = new FileSource(source, capturer.release(), factory);
+  self->Wrap(info.This());
+  info.GetReturnValue().Set(info.This());
+}
+
+NAN_METHOD(FileSource::CreateTrack) {
+  FileSource* self = Nan::ObjectWrap::Unwrap<FileSource>(info.Holder());
+  std::string id("video");
+  if(info.Length() >= 1 && info[0]->IsString()) {
+    v8::String::Utf8Value id_value(info[0]->ToString());
+    id = *id_value;
+  }
+  webrtc::PeerConnectionFactoryInterface* factory =
+    WebRtcJs::GetPeerConnectionFactory(self->factory_);
+  rtc::scoped_refptr<webrtc::VideoTrackInterface> track;
+  if(factory) {
+    track = factory->CreateVideoTrack(id, self->source_.get());
+  }
+  if(!track.get()) {
+    return Nan::ThrowError("Could not create webrtc::VideoTrackInterface");
+  }
+  info.GetReturnValue().Set(MediaStreamTrack::New(track.get(),
+    self->factory_));
+}
+
+NAN_GETTER(FileSource::GetWidth) {
+  FileSource* self = Nan::ObjectWrap::Unwrap<FileSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->capturer_->width()));
+}
+
+NAN_GETTER(FileSource::GetHeight) {
+  FileSource* self = Nan::ObjectWrap::Unwrap<FileSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->capturer_->height()));
+}
+
+NAN_GETTER(FileSource::GetFrameRate) {
+  FileSource* self = Nan::ObjectWrap::Unwrap<FileSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->capturer_->frame_rate()));
+}
+
+NAN_GETTER(FileSource::GetFrames) {
+  FileSource* self = Nan::ObjectWrap::Unwrap<FileSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->capturer_->frames()));
+}
+
+NAN_GETTER(FileSource::GetPosition) {
+  FileSource* self = Nan::ObjectWrap::Unwrap<FileSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(
+    static_cast<uint32_t>(self->capturer_->position())));
+}
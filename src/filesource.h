@@ -0,0 +1,127 @@
+#ifndef WEBRTCJS_FILESOURCE_H
+#define WEBRTCJS_FILESOURCE_H
+
+#include <nan.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/refcount.h"
+#include "webrtc/base/scoped_ptr.h"
+#include "webrtc/api/videosourceinterface.h"
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+
+#include "videocapturer.h"
+
+// Read-only mapping of an IVF or Y4M file together with its frame index. All
+// capturers that play the same path share one mapping.
+class MappedMediaFile : public rtc::RefCountInterface {
+ public:
+  enum Format {
+    kFormatIvf,
+    kFormatY4m,
+  };
+
+  struct Frame {
+    size_t offset;
+    size_t size;
+  };
+
+  static rtc::scoped_refptr<MappedMediaFile> Open(const std::string& path,
+    std::string* error);
+
+  int AddRef() const final;
+  int Release() const final;
+
+  Format format() const { return format_; }
+  uint32_t fourcc() const { return fourcc_; }
+  int width() const { return width_; }
+  int height() const { return height_; }
+  double frame_rate() const { return frame_rate_; }
+  size_t frame_count() const { return frames_.size(); }
+  const uint8_t* frame_data(size_t index) const {
+    return data_ + frames_[index].offset;
+  }
+  size_t frame_size(size_t index) const { return frames_[index].size; }
+
+ private:
+  explicit MappedMediaFile(const std::string& path);
+  ~MappedMediaFile();
+
+  bool Map(std::string* error);
+  bool ParseIvf(std::string* error);
+  bool ParseY4m(std::string* error);
+
+  static rtc::CriticalSection cache_lock_;
+  static std::map<std::string, MappedMediaFile*> cache_;
+
+  mutable int ref_count_;
+  std::string path_;
+  const uint8_t* data_;
+  size_t size_;
+  Format format_;
+  uint32_t fourcc_;
+  int width_;
+  int height_;
+  double frame_rate_;
+  std::vector<Frame> frames_;
+};
+
+// Plays a MappedMediaFile in a loop at the file's frame rate. IVF payloads
+// are decoded natively, Y4M frames are handed out straight from the mapping.
+// Init() must succeed before the capturer is started.
+class FileVideoCapturer
+  : public PushVideoCapturer,
+    public webrtc::DecodedImageCallback {
+ public:
+  FileVideoCapturer(rtc::scoped_refptr<MappedMediaFile> file,
+    double frame_rate, bool loop);
+  ~FileVideoCapturer() override;
+
+  bool Init(std::string* error);
+
+  int32_t Decoded(webrtc::VideoFrame& frame) final;
+
+  // Read from the JS thread while the capturer thread plays.
+  size_t position() const { return position_.load(); }
+
+ protected:
+  void OnTick(int64_t time_ns) final;
+
+ private:
+  bool InitDecoder(std::string* error);
+
+  rtc::scoped_refptr<MappedMediaFile> file_;
+  rtc::scoped_ptr<webrtc::VideoDecoder> decoder_;
+  std::vector<uint8_t> image_;
+  int64_t time_ns_;
+  std::atomic<size_t> position_;
+  bool loop_;
+};
+
+class FileSource : public Nan::ObjectWrap {
+  explicit FileSource(rtc::scoped_refptr<webrtc::VideoSourceInterface> source,
+    FileVideoCapturer* capturer, const WebRtcJs::FactoryId& factory);
+  ~FileSource();
+
+  static NAN_METHOD(New);
+  static NAN_METHOD(CreateTrack);
+
+  static NAN_GETTER(GetWidth);
+  static NAN_GETTER(GetHeight);
+  static NAN_GETTER(GetFrameRate);
+  static NAN_GETTER(GetFrames);
+  static NAN_GETTER(GetPosition);
+
+  rtc::scoped_refptr<webrtc::VideoSourceInterface> source_;
+  FileVideoCapturer* capturer_;
+  // The source and its tracks live on this factory.
+  WebRtcJs::FactoryId factory_;
+
+ public:
+  static NAN_MODULE_INIT(Init);
+};
+
+#endif
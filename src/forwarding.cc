@@ -0,0 +1,647 @@
+#include "forwarding.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/common_video/include/video_frame_buffer.h"
+#include "webrtc/modules/video_coding/codecs/vp8/include/vp8.h"
+
+#include "sharedencoder.h"
+
+// Used until the size of the stream is known, also the smallest frame that
+// can carry the magic, the route and its complement.
+static const int kPlaceholderSize = 16;
+static const uint8_t kPlaceholderMagic[4] = { 'W', 'J', 'S', 'R' };
+
+// Width and height from the frame header of a VP8 key frame.
+static bool ParseVp8Size(const webrtc::EncodedImage& image, int* width,
+    int* height) {
+  const uint8_t* data = image._buffer;
+  if(image._length < 10 || (data[0] & 0x01) || data[3] != 0x9d ||
+      data[4] != 0x01 || data[5] != 0x2a) {
+    return false;
+  }
+  *width = (data[6] | (data[7] << 8)) & 0x3fff;
+  *height = (data[8] | (data[9] << 8)) & 0x3fff;
+  return *width > 0 && *height > 0;
+}
+
+//
+// ForwardingRouter
+//
+rtc::CriticalSection ForwardingRouter::lock_;
+std::map<uint32_t, ForwardingRouter::Route> ForwardingRouter::routes_;
+uint32_t ForwardingRouter::next_route_ = 1;
+std::atomic<uint32_t> ForwardingRouter::frames_forwarded_(0);
+std::atomic<uint32_t> ForwardingRouter::key_frame_requests_(0);
+rtc::CriticalSection ForwardingRouter::outputs_lock_;
+std::map<const webrtc::VideoFrameBuffer*, uint32_t>
+  ForwardingRouter::outputs_;
+
+NAN_MODULE_INIT(ForwardingRouter::Init) {
+  Nan::SetMethod(target, "getForwardingStats",
+    ForwardingRouter::GetForwardingStats);
+}
+
+uint32_t ForwardingRouter::AddRoute(RelayDecoder* decoder) {
+  rtc::CritScope lock(&lock_);
+  uint32_t route = next_route_++;
+  routes_[route].decoder = decoder;
+  return route;
+}
+
+void ForwardingRouter::RemoveRoute(uint32_t route) {
+  rtc::CritScope lock(&lock_);
+  routes_.erase(route);
+}
+
+uint32_t ForwardingRouter::FindRoute(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer) {
+  if(!buffer.get()) {
+    return 0;
+  }
+  rtc::CritScope lock(&outputs_lock_);
+  std::map<const webrtc::VideoFrameBuffer*, uint32_t>::iterator index =
+    outputs_.find(buffer.get());
+  return index != outputs_.end() ? index->second : 0;
+}
+
+void ForwardingRouter::SetLastOutput(uint32_t route,
+    const webrtc::VideoFrameBuffer* previous,
+    const webrtc::VideoFrameBuffer* buffer) {
+  rtc::CritScope lock(&outputs_lock_);
+  if(previous) {
+    outputs_.erase(previous);
+  }
+  if(buffer && route) {
+    outputs_[buffer] = route;
+  }
+}
+
+void ForwardingRouter::SetForwarding(uint32_t route, bool forwarding) {
+  rtc::CritScope lock(&lock_);
+  std::map<uint32_t, Route>::iterator index = routes_.find(route);
+  if(index == routes_.end()) {
+    return;
+  }
+  index->second.forwarding = forwarding;
+  if(index->second.decoder) {
+    index->second.decoder->SetForwarding(forwarding);
+  }
+}
+
+void ForwardingRouter::Subscribe(uint32_t route, RelayEncoder* encoder) {
+  rtc::CritScope lock(&lock_);
+  std::map<uint32_t, Route>::iterator index = routes_.find(route);
+  if(index == routes_.end()) {
+    return;
+  }
+  index->second.subscribers.push_back(
+    new rtc::RefCountedObject<Subscriber>(encoder));
+  // A new viewer can only start decoding at a key frame.
+  if(index->second.decoder) {
+    index->second.decoder->RequestKeyFrame();
+    key_frame_requests_++;
+  }
+}
+
+void ForwardingRouter::Unsubscribe(uint32_t route, RelayEncoder* encoder) {
+  rtc::scoped_refptr<Subscriber> subscriber;
+  {
+    rtc::CritScope lock(&lock_);
+    std::map<uint32_t, Route>::iterator index = routes_.find(route);
+    if(index == routes_.end()) {
+      return;
+    }
+    std::vector<rtc::scoped_refptr<Subscriber>>& subscribers =
+      index->second.subscribers;
+    std::vector<rtc::scoped_refptr<Subscriber>>::iterator entry;
+    for(entry = subscribers.begin(); entry != subscribers.end(); entry++) {
+      if((*entry)->encoder == encoder) {
+        subscriber = *entry;
+        subscribers.erase(entry);
+        break;
+      }
+    }
+  }
+  if(subscriber.get()) {
+    // Waits for a Deliver() still sending to the encoder.
+    rtc::CritScope lock(&subscriber->lock);
+    subscriber->encoder = nullptr;
+  }
+}
+
+void ForwardingRouter::RequestKeyFrame(uint32_t route) {
+  rtc::CritScope lock(&lock_);
+  std::map<uint32_t, Route>::iterator index = routes_.find(route);
+  if(index != routes_.end() && index->second.decoder) {
+    index->second.decoder->RequestKeyFrame();
+    key_frame_requests_++;
+  }
+}
+
+void ForwardingRouter::Deliver(uint32_t route,
+    const webrtc::EncodedImage& image) {
+  // Sending runs the packetizer of every subscriber, other routes and
+  // subscribers must not wait for that.
+  std::vector<rtc::scoped_refptr<Subscriber>> subscribers;
+  {
+    rtc::CritScope lock(&lock_);
+    std::map<uint32_t, Route>::iterator index = routes_.find(route);
+    if(index == routes_.end()) {
+      return;
+    }
+    subscribers = index->second.subscribers;
+  }
+  std::vector<rtc::scoped_refptr<Subscriber>>::iterator subscriber;
+  for(subscriber = subscribers.begin(); subscriber != subscribers.end();
+      subscriber++) {
+    rtc::CritScope lock(&(*subscriber)->lock);
+    if((*subscriber)->encoder) {
+      (*subscriber)->encoder->OnForwardedFrame(image);
+      frames_forwarded_++;
+    }
+  }
+}
+
+bool ForwardingRouter::IsPlaceholder(const webrtc::VideoFrame& frame,
+    uint32_t* route) {
+  return IsPlaceholder(frame.video_frame_buffer(), route);
+}
+
+bool ForwardingRouter::IsPlaceholder(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+    uint32_t* route) {
+  // Any frame can be a placeholder, the first row tells.
+  if(!buffer.get() || buffer->width() < kPlaceholderSize ||
+      buffer->height() < 1) {
+    return false;
+  }
+  const uint8_t* y = buffer->data(webrtc::kYPlane);
+  if(memcmp(y, kPlaceholderMagic, sizeof(kPlaceholderMagic)) != 0) {
+    return false;
+  }
+  uint32_t value;
+  uint32_t check;
+  memcpy(&value, y + sizeof(kPlaceholderMagic), sizeof(value));
+  memcpy(&check, y + sizeof(kPlaceholderMagic) + sizeof(value),
+    sizeof(check));
+  if(check != ~value) {
+    return false;
+  }
+  *route = value;
+  return true;
+}
+
+rtc::scoped_refptr<webrtc::VideoFrameBuffer> ForwardingRouter::Placeholder(
+    uint32_t route, int width, int height) {
+  rtc::scoped_refptr<webrtc::I420Buffer> buffer =
+    new rtc::RefCountedObject<webrtc::I420Buffer>(width, height);
+  int chroma_height = (height + 1) / 2;
+  uint8_t* y = buffer->MutableData(webrtc::kYPlane);
+  memset(y, 0, buffer->stride(webrtc::kYPlane) * height);
+  memset(buffer->MutableData(webrtc::kUPlane), 128,
+    buffer->stride(webrtc::kUPlane) * chroma_height);
+  memset(buffer->MutableData(webrtc::kVPlane), 128,
+    buffer->stride(webrtc::kVPlane) * chroma_height);
+  uint32_t check = ~route;
+  memcpy(y, kPlaceholderMagic, sizeof(kPlaceholderMagic));
+  memcpy(y + sizeof(kPlaceholderMagic), &route, sizeof(route));
+  memcpy(y + sizeof(kPlaceholderMagic) + sizeof(route), &check,
+    sizeof(check));
+  return buffer;
+}
+
+NAN_METHOD(ForwardingRouter::GetForwardingStats) {
+  uint32_t routes = 0;
+  uint32_t forwarding = 0;
+  uint32_t subscribers = 0;
+  {
+    rtc::CritScope lock(&lock_);
+    std::map<uint32_t, Route>::iterator index;
+    for(index = routes_.begin(); index != routes_.end(); index++) {
+      routes++;
+      if(index->second.forwarding) {
+        forwarding++;
+      }
+      subscribers += index->second.subscribers.size();
+    }
+  }
+
+  v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+  stats->Set(Nan::New("routes").ToLocalChecked(), Nan::New(routes));
+  stats->Set(Nan::New("forwarding").ToLocalChecked(), Nan::New(forwarding));
+  stats->Set(Nan::New("subscribers").ToLocalChecked(), Nan::New(subscribers));
+  stats->Set(Nan::New("framesForwarded").ToLocalChecked(),
+    Nan::New(frames_forwarded_.load()));
+  stats->Set(Nan::New("keyFrameRequests").ToLocalChecked(),
+    Nan::New(key_frame_requests_.load()));
+  info.GetReturnValue().Set(stats);
+}
+
+//
+// RelayDecoder
+//
+RelayDecoder::RelayDecoder() :
+    route_(0),
+    forwarding_(false),
+    key_frame_requested_(false),
+    needs_key_frame_(false),
+    callback_(nullptr),
+    width_(kPlaceholderSize),
+    height_(kPlaceholderSize) { }
+
+RelayDecoder::~RelayDecoder() {
+  Release();
+}
+
+int32_t RelayDecoder::InitDecode(const webrtc::VideoCodec* codec_settings,
+    int32_t number_of_cores) {
+  decoder_.reset(webrtc::VP8Decoder::Create());
+  int32_t result = decoder_->InitDecode(codec_settings, number_of_cores);
+  if(result != WEBRTC_VIDEO_CODEC_OK) {
+    decoder_.reset();
+    return result;
+  }
+  decoder_->RegisterDecodeCompleteCallback(this);
+  if(!route_) {
+    route_ = ForwardingRouter::AddRoute(this);
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RelayDecoder::Decode(const webrtc::EncodedImage& input_image,
+    bool missing_frames,
+    const webrtc::RTPFragmentationHeader* fragmentation,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    int64_t render_time_ms) {
+  if(!route_ || !callback_ || !decoder_.get()) {
+    return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+  }
+
+  if(!forwarding_) {
+    if(needs_key_frame_) {
+      if(input_image._frameType != webrtc::kVideoFrameKey) {
+        return WEBRTC_VIDEO_CODEC_ERROR;
+      }
+      needs_key_frame_ = false;
+    }
+    return decoder_->Decode(input_image, missing_frames, fragmentation,
+      codec_specific_info, render_time_ms);
+  }
+
+  needs_key_frame_ = true;
+  bool key = input_image._frameType == webrtc::kVideoFrameKey;
+  if(key) {
+    ParseVp8Size(input_image, &width_, &height_);
+  }
+  ForwardingRouter::Deliver(route_, input_image);
+
+  // One buffer for all of them, it never changes.
+  if(!placeholder_.get() || placeholder_->width() != width_ ||
+      placeholder_->height() != height_) {
+    placeholder_ = ForwardingRouter::Placeholder(route_, width_, height_);
+  }
+  webrtc::VideoFrame placeholder(placeholder_, input_image._timeStamp,
+    render_time_ms, webrtc::kVideoRotation_0);
+  callback_->Decoded(placeholder);
+
+  // This WebRTC release gives decoders no way to ask for a key frame but a
+  // failed decode. The frame is already out to the subscribers and sinks,
+  // the result only makes the receiver send a PLI.
+  if(key_frame_requested_.exchange(false) && !key) {
+    return WEBRTC_VIDEO_CODEC_ERROR;
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RelayDecoder::RegisterDecodeCompleteCallback(
+    webrtc::DecodedImageCallback* callback) {
+  callback_ = callback;
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RelayDecoder::Release() {
+  ForwardingRouter::SetLastOutput(route_, last_output_.get(), nullptr);
+  last_output_ = nullptr;
+  placeholder_ = nullptr;
+  if(route_) {
+    ForwardingRouter::RemoveRoute(route_);
+    route_ = 0;
+  }
+  if(decoder_.get()) {
+    decoder_->Release();
+    decoder_.reset();
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+const char* RelayDecoder::ImplementationName() const {
+  return "RelayDecoder";
+}
+
+int32_t RelayDecoder::Decoded(webrtc::VideoFrame& frame) {
+  // Runs inside decoder_->Decode(), on the decoding thread.
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+    frame.video_frame_buffer();
+  ForwardingRouter::SetLastOutput(route_, last_output_.get(), buffer.get());
+  last_output_ = buffer;
+  width_ = frame.width();
+  height_ = frame.height();
+  return callback_->Decoded(frame);
+}
+
+void RelayDecoder::RequestKeyFrame() {
+  key_frame_requested_ = true;
+}
+
+void RelayDecoder::SetForwarding(bool forwarding) {
+  forwarding_ = forwarding;
+}
+
+//
+// ForwardingSink
+//
+ForwardingSink::ForwardingSink() : route_(0) { }
+
+ForwardingSink::~ForwardingSink() {
+  if(route_) {
+    ForwardingRouter::SetForwarding(route_, false);
+  }
+}
+
+void ForwardingSink::OnFrame(const cricket::VideoFrame& frame) {
+  // Placeholders mean the route is on, other frames name the decoder.
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+    frame.video_frame_buffer();
+  uint32_t route = 0;
+  if(ForwardingRouter::IsPlaceholder(buffer, &route)) {
+    return;
+  }
+  route = ForwardingRouter::FindRoute(buffer);
+  if(route && route != route_) {
+    route_ = route;
+    ForwardingRouter::SetForwarding(route, true);
+  }
+}
+
+//
+// RelayEncoder
+//
+RelayEncoder::RelayEncoder(webrtc::VideoCodecType type) :
+    type_(type),
+    number_of_cores_(1),
+    max_payload_size_(0),
+    bitrate_(0),
+    framerate_(0),
+    callback_(nullptr),
+    route_(0),
+    waiting_for_key_frame_(true),
+    picture_id_(0) {
+  memset(&codec_settings_, 0, sizeof(codec_settings_));
+}
+
+RelayEncoder::~RelayEncoder() {
+  Release();
+}
+
+int32_t RelayEncoder::InitEncode(const webrtc::VideoCodec* codec_settings,
+    int32_t number_of_cores, size_t max_payload_size) {
+  codec_settings_ = *codec_settings;
+  number_of_cores_ = number_of_cores;
+  max_payload_size_ = max_payload_size;
+  LeaveGroup();
+  if(encoder_.get()) {
+    return encoder_->InitEncode(codec_settings, number_of_cores,
+      max_payload_size);
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RelayEncoder::RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) {
+  rtc::CritScope lock(&callback_lock_);
+  callback_ = callback;
+  if(encoder_.get()) {
+    encoder_->RegisterEncodeCompleteCallback(callback);
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RelayEncoder::Release() {
+  if(route_) {
+    ForwardingRouter::Unsubscribe(route_, this);
+    route_ = 0;
+  }
+  LeaveGroup();
+  if(encoder_.get()) {
+    encoder_->Release();
+    encoder_.reset();
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+void RelayEncoder::LeaveGroup() {
+  if(shared_.get()) {
+    shared_->Leave(this);
+    shared_ = nullptr;
+  }
+}
+
+int32_t RelayEncoder::Encode(const webrtc::VideoFrame& frame,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const std::vector<webrtc::FrameType>* frame_types) {
+  uint32_t route = 0;
+  if(ForwardingRouter::IsPlaceholder(frame, &route)) {
+    LeaveGroup();
+    if(route != route_) {
+      if(route_) {
+        ForwardingRouter::Unsubscribe(route_, this);
+      }
+      waiting_for_key_frame_ = true;
+      route_ = route;
+      ForwardingRouter::Subscribe(route_, this);
+    } else if(frame_types && std::find(frame_types->begin(),
+        frame_types->end(), webrtc::kVideoFrameKey) != frame_types->end()) {
+      waiting_for_key_frame_ = true;
+      ForwardingRouter::RequestKeyFrame(route_);
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  if(route_) {
+    ForwardingRouter::Unsubscribe(route_, this);
+    route_ = 0;
+  }
+  return EncodeFrame(frame, codec_specific_info, frame_types);
+}
+
+int32_t RelayEncoder::EncodeFrame(const webrtc::VideoFrame& frame,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const std::vector<webrtc::FrameType>* frame_types) {
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+    frame.video_frame_buffer();
+  if(!shared_.get()) {
+    shared_ = SharedEncoderSource::Find(buffer);
+    if(shared_.get() && shared_->Join(this, codec_settings_,
+        number_of_cores_, max_payload_size_, bitrate_, framerate_)) {
+      waiting_for_key_frame_ = true;
+      if(encoder_.get()) {
+        encoder_->Release();
+        encoder_.reset();
+      }
+    } else {
+      shared_ = nullptr;
+    }
+  }
+
+  if(shared_.get()) {
+    // The source encodes its own frames and sends them with
+    // OnSharedFrame(), this one only tells which source to follow.
+    if(shared_->HasBuffer(buffer)) {
+      if(frame_types && std::find(frame_types->begin(), frame_types->end(),
+          webrtc::kVideoFrameKey) != frame_types->end()) {
+        shared_->RequestKeyFrame(this);
+      }
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    // Another source, or shared encoding went off.
+    LeaveGroup();
+  }
+
+  if(!encoder_.get()) {
+    encoder_.reset(webrtc::VP8Encoder::Create());
+    int32_t result = encoder_->InitEncode(&codec_settings_, number_of_cores_,
+      max_payload_size_);
+    if(result != WEBRTC_VIDEO_CODEC_OK) {
+      encoder_.reset();
+      return result;
+    }
+    encoder_->RegisterEncodeCompleteCallback(callback_);
+    if(bitrate_) {
+      encoder_->SetRates(bitrate_, framerate_);
+    }
+  }
+  return encoder_->Encode(frame, codec_specific_info, frame_types);
+}
+
+int32_t RelayEncoder::SetChannelParameters(uint32_t packet_loss,
+    int64_t rtt) {
+  if(encoder_.get()) {
+    return encoder_->SetChannelParameters(packet_loss, rtt);
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+int32_t RelayEncoder::SetRates(uint32_t bitrate, uint32_t framerate) {
+  // Forwarded frames keep the upstream bitrate.
+  bitrate_ = bitrate;
+  framerate_ = framerate;
+  if(shared_.get() && shared_->SetRates(this, bitrate, framerate)) {
+    waiting_for_key_frame_ = true;
+  }
+  if(encoder_.get()) {
+    return encoder_->SetRates(bitrate, framerate);
+  }
+  return WEBRTC_VIDEO_CODEC_OK;
+}
+
+const char* RelayEncoder::ImplementationName() const {
+  return "RelayEncoder";
+}
+
+void RelayEncoder::OnForwardedFrame(const webrtc::EncodedImage& image) {
+  webrtc::EncodedImage output(image);
+  output.capture_time_ms_ = rtc::TimeMillis();
+
+  webrtc::CodecSpecificInfo info;
+  memset(&info, 0, sizeof(info));
+  info.codecType = webrtc::kVideoCodecVP8;
+  info.codecSpecific.VP8.nonReference = false;
+  info.codecSpecific.VP8.simulcastIdx = 0;
+  info.codecSpecific.VP8.temporalIdx = webrtc::kNoTemporalIdx;
+  info.codecSpecific.VP8.layerSync = false;
+  info.codecSpecific.VP8.tl0PicIdx = webrtc::kNoTl0PicIdx;
+  info.codecSpecific.VP8.keyIdx = webrtc::kNoKeyIdx;
+
+  webrtc::RTPFragmentationHeader fragmentation;
+  fragmentation.VerifyAndAllocateFragmentationHeader(1);
+  fragmentation.fragmentationOffset[0] = 0;
+  fragmentation.fragmentationLength[0] = image._length;
+  fragmentation.fragmentationPlType[0] = 0;
+  fragmentation.fragmentationTimeDiff[0] = 0;
+
+  SendFrame(output, info, fragmentation);
+}
+
+void RelayEncoder::OnSharedFrame(const webrtc::EncodedImage& image,
+    const webrtc::CodecSpecificInfo& info,
+    const webrtc::RTPFragmentationHeader& fragmentation) {
+  SendFrame(image, info, fragmentation);
+}
+
+void RelayEncoder::SendFrame(const webrtc::EncodedImage& image,
+    const webrtc::CodecSpecificInfo& info,
+    const webrtc::RTPFragmentationHeader& fragmentation) {
+  rtc::CritScope lock(&callback_lock_);
+  bool key = image._frameType == webrtc::kVideoFrameKey;
+  if(waiting_for_key_frame_ && !key) {
+    return;
+  }
+  waiting_for_key_frame_ = false;
+
+  // The receiver expects picture ids without gaps from this stream, no
+  // matter where the frames come from.
+  webrtc::CodecSpecificInfo output_info(info);
+  if(output_info.codecType == webrtc::kVideoCodecVP8) {
+    output_info.codecSpecific.VP8.pictureId = picture_id_;
+    picture_id_ = (picture_id_ + 1) & 0x7FFF;
+  }
+
+  if(callback_) {
+    callback_->Encoded(image, &output_info, &fragmentation);
+  }
+}
+
+//
+// RelayEncoderFactory
+//
+RelayEncoderFactory::RelayEncoderFactory() {
+  codecs_.push_back(cricket::WebRtcVideoEncoderFactory::VideoCodec(
+    webrtc::kVideoCodecVP8, "VP8", 1920, 1080, 60));
+}
+
+webrtc::VideoEncoder* RelayEncoderFactory::CreateVideoEncoder(
+    webrtc::VideoCodecType type) {
+  if(type != webrtc::kVideoCodecVP8) {
+    return nullptr;
+  }
+  return new RelayEncoder(type);
+}
+
+const std::vector<cricket::WebRtcVideoEncoderFactory::VideoCodec>&
+    RelayEncoderFactory::codecs() const {
+  return codecs_;
+}
+
+void RelayEncoderFactory::DestroyVideoEncoder(webrtc::VideoEncoder* encoder) {
+  delete encoder;
+}
+
+//
+// RelayDecoderFactory
+//
+webrtc::VideoDecoder* RelayDecoderFactory::CreateVideoDecoder(
+    webrtc::VideoCodecType type) {
+  // Returning nothing makes WebRTC fall back to its own decoders.
+  if(type != webrtc::kVideoCodecVP8) {
+    return nullptr;
+  }
+  return new RelayDecoder();
+}
+
+void RelayDecoderFactory::DestroyVideoDecoder(webrtc::VideoDecoder* decoder) {
+  delete decoder;
+}
@@ -0,0 +1,223 @@
+#ifndef WEBRTCJS_FORWARDING_H
+#define WEBRTCJS_FORWARDING_H
+
+#include <nan.h>
+#include <atomic>
+#include <map>
+#include <vector>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/refcount.h"
+#include "webrtc/base/scoped_ptr.h"
+#include "webrtc/base/scoped_ref_ptr.h"
+#include "webrtc/media/base/videoframe.h"
+#include "webrtc/media/base/videosinkinterface.h"
+#include "webrtc/media/engine/webrtcvideodecoderfactory.h"
+#include "webrtc/media/engine/webrtcvideoencoderfactory.h"
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+
+class RelayEncoder;
+class RelayDecoder;
+class SharedEncoderSource;
+
+// Routes encoded VP8 frames from the decoder of a remote track straight to
+// the encoders of every PeerConnection that sends that track, SFU style.
+//
+// Every remote VP8 track gets a RelayDecoder and a route, and decodes as
+// usual. Once track.setEncodedForwarding(true) turns its route on the
+// decoder stops decoding. It publishes each payload on the route and
+// outputs a placeholder frame that carries the route id. The placeholder
+// has the resolution of the stream, so the send streams size their
+// bitrates for it, and travels along the normal track plumbing:
+// pc.addStream(remoteStream) is all it takes to configure a subscriber.
+// When a RelayEncoder sees a placeholder it subscribes to the route and
+// sends the published payloads instead of encoding. Key frame requests from
+// any subscriber are passed upstream, see RelayDecoder::Decode().
+class ForwardingRouter {
+ public:
+  static uint32_t AddRoute(RelayDecoder* decoder);
+  static void RemoveRoute(uint32_t route);
+  // The route whose decoder output buffer last, 0 if none did.
+  static uint32_t FindRoute(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer);
+  // Makes buffer the last output of route in place of previous, either may
+  // be null. The decoder keeps it alive until it replaces it.
+  static void SetLastOutput(uint32_t route,
+    const webrtc::VideoFrameBuffer* previous,
+    const webrtc::VideoFrameBuffer* buffer);
+  static void SetForwarding(uint32_t route, bool forwarding);
+  static void Subscribe(uint32_t route, RelayEncoder* encoder);
+  static void Unsubscribe(uint32_t route, RelayEncoder* encoder);
+  static void RequestKeyFrame(uint32_t route);
+  static void Deliver(uint32_t route, const webrtc::EncodedImage& image);
+
+  static bool IsPlaceholder(const webrtc::VideoFrame& frame, uint32_t* route);
+  static bool IsPlaceholder(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer,
+    uint32_t* route);
+  static rtc::scoped_refptr<webrtc::VideoFrameBuffer> Placeholder(
+    uint32_t route, int width, int height);
+
+  static NAN_MODULE_INIT(Init);
+
+ private:
+  // Deliver() calls the encoders outside lock_. Unsubscribe() clears the
+  // encoder under the subscriber's own lock, after any delivery into it.
+  class Subscriber : public rtc::RefCountInterface {
+   public:
+    explicit Subscriber(RelayEncoder* encoder) : encoder(encoder) { }
+    rtc::CriticalSection lock;
+    RelayEncoder* encoder;
+  };
+
+  struct Route {
+    Route() : decoder(nullptr), forwarding(false) { }
+    RelayDecoder* decoder;
+    bool forwarding;
+    std::vector<rtc::scoped_refptr<Subscriber>> subscribers;
+  };
+
+  static NAN_METHOD(GetForwardingStats);
+
+  static rtc::CriticalSection lock_;
+  static std::map<uint32_t, Route> routes_;
+  static uint32_t next_route_;
+  // Last decoder outputs, ForwardingSink looks up every frame it gets.
+  static rtc::CriticalSection outputs_lock_;
+  static std::map<const webrtc::VideoFrameBuffer*, uint32_t> outputs_;
+  static std::atomic<uint32_t> frames_forwarded_;
+  static std::atomic<uint32_t> key_frame_requests_;
+};
+
+// A plain VP8 decoder until the router turns its route on.
+class RelayDecoder : public webrtc::VideoDecoder,
+    public webrtc::DecodedImageCallback {
+ public:
+  RelayDecoder();
+  ~RelayDecoder() override;
+
+  int32_t InitDecode(const webrtc::VideoCodec* codec_settings,
+    int32_t number_of_cores) override;
+  int32_t Decode(const webrtc::EncodedImage& input_image,
+    bool missing_frames,
+    const webrtc::RTPFragmentationHeader* fragmentation,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    int64_t render_time_ms) override;
+  int32_t RegisterDecodeCompleteCallback(
+    webrtc::DecodedImageCallback* callback) override;
+  int32_t Release() override;
+  const char* ImplementationName() const override;
+
+  // Output of the wrapped decoder.
+  int32_t Decoded(webrtc::VideoFrame& frame) override;
+
+  void RequestKeyFrame();
+  void SetForwarding(bool forwarding);
+
+ private:
+  uint32_t route_;
+  std::atomic<bool> forwarding_;
+  std::atomic<bool> key_frame_requested_;
+  // The wrapped decoder missed the frames forwarded meanwhile.
+  bool needs_key_frame_;
+  webrtc::DecodedImageCallback* callback_;
+  rtc::scoped_ptr<webrtc::VideoDecoder> decoder_;
+
+  // Size of the stream, from the decoded frames and the key frames
+  // forwarded. The placeholder is made again when it changes.
+  int width_;
+  int height_;
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> placeholder_;
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> last_output_;
+};
+
+// Behaves like a plain VP8 encoder unless it is fed placeholders, in which
+// case it relays the frames published on the placeholder's route. Fed the
+// frames of a source with shared encoding on, it joins the source and sends
+// what the source encodes instead, see SharedEncoderSource.
+class RelayEncoder : public webrtc::VideoEncoder {
+ public:
+  explicit RelayEncoder(webrtc::VideoCodecType type);
+  ~RelayEncoder() override;
+
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+    int32_t number_of_cores, size_t max_payload_size) override;
+  int32_t RegisterEncodeCompleteCallback(
+    webrtc::EncodedImageCallback* callback) override;
+  int32_t Release() override;
+  int32_t Encode(const webrtc::VideoFrame& frame,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const std::vector<webrtc::FrameType>* frame_types) override;
+  int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override;
+  int32_t SetRates(uint32_t bitrate, uint32_t framerate) override;
+  const char* ImplementationName() const override;
+
+  void OnForwardedFrame(const webrtc::EncodedImage& image);
+  void OnSharedFrame(const webrtc::EncodedImage& image,
+    const webrtc::CodecSpecificInfo& info,
+    const webrtc::RTPFragmentationHeader& fragmentation);
+
+ protected:
+  int32_t EncodeFrame(const webrtc::VideoFrame& frame,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const std::vector<webrtc::FrameType>* frame_types);
+
+  webrtc::VideoCodecType type_;
+  webrtc::VideoCodec codec_settings_;
+  int32_t number_of_cores_;
+  size_t max_payload_size_;
+  uint32_t bitrate_;
+  uint32_t framerate_;
+
+  // Also guards picture_id_, forwarded, shared and encoded frames are sent
+  // from different threads.
+  rtc::CriticalSection callback_lock_;
+  webrtc::EncodedImageCallback* callback_;
+
+ private:
+  void SendFrame(const webrtc::EncodedImage& image,
+    const webrtc::CodecSpecificInfo& info,
+    const webrtc::RTPFragmentationHeader& fragmentation);
+  void LeaveGroup();
+
+  uint32_t route_;
+  std::atomic<bool> waiting_for_key_frame_;
+  uint16_t picture_id_;
+  rtc::scoped_ptr<webrtc::VideoEncoder> encoder_;
+  rtc::scoped_refptr<SharedEncoderSource> shared_;
+};
+
+class RelayEncoderFactory : public cricket::WebRtcVideoEncoderFactory {
+ public:
+  RelayEncoderFactory();
+  webrtc::VideoEncoder* CreateVideoEncoder(webrtc::VideoCodecType type)
+    override;
+  const std::vector<VideoCodec>& codecs() const override;
+  void DestroyVideoEncoder(webrtc::VideoEncoder* encoder) override;
+
+ private:
+  std::vector<VideoCodec> codecs_;
+};
+
+// Attached to a remote video track by setEncodedForwarding(true). Learns
+// the route of the track from the frames decoded for it and turns it on,
+// again if the decoder is replaced. Turns it off when it goes.
+class ForwardingSink : public rtc::VideoSinkInterface<cricket::VideoFrame> {
+ public:
+  ForwardingSink();
+  ~ForwardingSink() override;
+
+  void OnFrame(const cricket::VideoFrame& frame) override;
+
+ private:
+  std::atomic<uint32_t> route_;
+};
+
+class RelayDecoderFactory : public cricket::WebRtcVideoDecoderFactory {
+ public:
+  webrtc::VideoDecoder* CreateVideoDecoder(webrtc::VideoCodecType type)
+    override;
+  void DestroyVideoDecoder(webrtc::VideoDecoder* decoder) override;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "isolatedata.h"
+#include "eventemitter.h"
+
+rtc::CriticalSection IsolateData::lock_;
+std::map<v8::Isolate*, IsolateData*> IsolateData::isolates_;
+
+IsolateData::~IsolateData() {
+  for(int index = 0; index < kConstructorCount; index++) {
+    constructors_[index].Reset();
+  }
+  stat_names_.Reset();
+}
+
+IsolateData* IsolateData::Create(v8::Isolate* isolate) {
+  rtc::CritScope lock(&lock_);
+  IsolateData*& data = isolates_[isolate];
+  if(!data) {
+    data = new IsolateData();
+  }
+  return data;
+}
+
+void IsolateData::Dispose(v8::Isolate* isolate) {
+  IsolateData* data = nullptr;
+  {
+    rtc::CritScope lock(&lock_);
+    std::map<v8::Isolate*, IsolateData*>::iterator index =
+      isolates_.find(isolate);
+    if(index == isolates_.end()) {
+      return;
+    }
+    data = index->second;
+    isolates_.erase(index);
+  }
+  std::unordered_set<EventEmitter*>::iterator emitter;
+  for(emitter = data->emitters_.begin(); emitter != data->emitters_.end();
+      emitter++) {
+    (*emitter)->Detach();
+  }
+  delete data;
+}
+
+IsolateData* IsolateData::Current() {
+  rtc::CritScope lock(&lock_);
+  std::map<v8::Isolate*, IsolateData*>::iterator index =
+    isolates_.find(v8::Isolate::GetCurrent());
+  return index == isolates_.end() ? nullptr : index->second;
+}
+
+void IsolateData::SetConstructor(Constructor index,
+    v8::Local<v8::Function> function) {
+  constructors_[index].Reset(function);
+}
+
+v8::Local<v8::Function> IsolateData::GetConstructor(Constructor index) const {
+  return Nan::New(constructors_[index]);
+}
+
+void IsolateData::SetStatNames(v8::Local<v8::Array> names) {
+  stat_names_.Reset(names);
+}
+
+v8::Local<v8::Array> IsolateData::GetStatNames() const {
+  if(stat_names_.IsEmpty()) {
+    return v8::Local<v8::Array>();
+  }
+  return Nan::New(stat_names_);
+}
+
+Nan::ObjectWrap* IsolateData::GetWrapper(const void* native) const {
+  std::unordered_map<const void*, Nan::ObjectWrap*>::const_iterator index =
+    wrappers_.find(native);
+  return index == wrappers_.end() ? nullptr : index->second;
+}
+
+void IsolateData::SetWrapper(const void* native, Nan::ObjectWrap* wrapper) {
+  wrappers_[native] = wrapper;
+}
+
+void IsolateData::RemoveWrapper(const void* native, Nan::ObjectWrap* wrapper) {
+  std::unordered_map<const void*, Nan::ObjectWrap*>::iterator index =
+    wrappers_.find(native);
+  if(index != wrappers_.end() && index->second == wrapper) {
+    wrappers_.erase(index);
+  }
+}
+
+void IsolateData::AddEmitter(EventEmitter* emitter) {
+  emitters_.insert(emitter);
+}
+
+void IsolateData::RemoveEmitter(EventEmitter* emitter) {
+  emitters_.erase(emitter);
+}
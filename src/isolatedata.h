@@ -0,0 +1,67 @@
+#ifndef WEBRTCJS_ISOLATEDATA_H
+#define WEBRTCJS_ISOLATEDATA_H
+
+#include <nan.h>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "webrtc/base/criticalsection.h"
+
+class EventEmitter;
+
+// State of the addon that belongs to one isolate, i.e. the main thread or a
+// worker_thread that loaded the module. The WebRTC factories underneath are
+// shared by all of them.
+class IsolateData {
+ public:
+  enum Constructor {
+    kPeerConnection,
+    kMediaStream,
+    kMediaStreamTrack,
+    kVideoSink,
+    kAudioSource,
+    kFileSource,
+    kPatternSource,
+    kConstructorCount,
+  };
+
+  // Module init runs once per isolate, later calls return the same data.
+  static IsolateData* Create(v8::Isolate* isolate);
+  static void Dispose(v8::Isolate* isolate);
+  // The data of the isolate running on this thread.
+  static IsolateData* Current();
+
+  void SetConstructor(Constructor index, v8::Local<v8::Function> function);
+  v8::Local<v8::Function> GetConstructor(Constructor index) const;
+
+  // Interned stat names already turned into strings, see CompactStats.
+  void SetStatNames(v8::Local<v8::Array> names);
+  v8::Local<v8::Array> GetStatNames() const;
+
+  // The wrapper handed out for a native object, so that the same native
+  // object always shows up as the same JS object. Entries do not keep the
+  // wrapper alive, wrappers remove themselves when they are collected.
+  Nan::ObjectWrap* GetWrapper(const void* native) const;
+  void SetWrapper(const void* native, Nan::ObjectWrap* wrapper);
+  void RemoveWrapper(const void* native, Nan::ObjectWrap* wrapper);
+
+  // EventEmitters with a loop handle of this isolate. Dispose() detaches the
+  // ones never collected, the WebRTC threads may still emit to them.
+  void AddEmitter(EventEmitter* emitter);
+  void RemoveEmitter(EventEmitter* emitter);
+
+ private:
+  IsolateData() { }
+  ~IsolateData();
+
+  static rtc::CriticalSection lock_;
+  static std::map<v8::Isolate*, IsolateData*> isolates_;
+
+  Nan::Persistent<v8::Function> constructors_[kConstructorCount];
+  Nan::Persistent<v8::Array> stat_names_;
+  std::unordered_map<const void*, Nan::ObjectWrap*> wrappers_;
+  std::unordered_set<EventEmitter*> emitters_;
+};
+
+#endif
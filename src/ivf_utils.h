@@ -1,6 +1,10 @@
 #ifndef WEBRTCJS_IVF_UTILS_H
 #define WEBRTCJS_IVF_UTILS_H
 
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
 static void mem_put_le16(char* mem, unsigned int val) {
   mem[0] = val;
   mem[1] = val>>8;
@@ -43,4 +47,58 @@ void write_ivf_frame_header(FILE *outfile, uint32_t time_stamp,
   (void) fwrite(header, 1, 12, outfile);
 }
 
-#endif
\ No newline at end of file
+static inline uint16_t mem_get_le16(const uint8_t* mem) {
+  return mem[0] | (mem[1] << 8);
+}
+
+static inline uint32_t mem_get_le32(const uint8_t* mem) {
+  return mem[0] | (mem[1] << 8) | (mem[2] << 16) |
+    (static_cast<uint32_t>(mem[3]) << 24);
+}
+
+struct IvfFileHeader {
+  uint32_t fourcc;
+  uint16_t header_size;
+  uint16_t width;
+  uint16_t height;
+  uint32_t rate;
+  uint32_t scale;
+  uint32_t frame_cnt;
+};
+
+struct IvfFrameHeader {
+  uint32_t frame_size;
+  uint64_t time_stamp;
+};
+
+static const size_t kIvfFileHeaderSize = 32;
+static const size_t kIvfFrameHeaderSize = 12;
+
+static inline bool read_ivf_file_header(const uint8_t* mem, size_t size,
+    IvfFileHeader* header) {
+  if(size < kIvfFileHeaderSize || memcmp(mem, "DKIF", 4) != 0) {
+    return false;
+  }
+  header->header_size = mem_get_le16(mem+6);
+  header->fourcc = mem_get_le32(mem+8);
+  header->width = mem_get_le16(mem+12);
+  header->height = mem_get_le16(mem+14);
+  header->rate = mem_get_le32(mem+16);
+  header->scale = mem_get_le32(mem+20);
+  header->frame_cnt = mem_get_le32(mem+24);
+  return header->header_size >= kIvfFileHeaderSize &&
+    header->header_size <= size;
+}
+
+static inline bool read_ivf_frame_header(const uint8_t* mem, size_t size,
+    IvfFrameHeader* header) {
+  if(size < kIvfFrameHeaderSize) {
+    return false;
+  }
+  header->frame_size = mem_get_le32(mem);
+  header->time_stamp = mem_get_le32(mem+4) |
+    (static_cast<uint64_t>(mem_get_le32(mem+8)) << 32);
+  return header->frame_size <= size - kIvfFrameHeaderSize;
+}
+
+#endif
@@ -1,6 +1,11 @@
 #include "mediastream.h"
+#include "blockingcall.h"
+#include "isolatedata.h"
 
-Nan::Persistent<v8::Function> MediaStream::constructor;
+// Stream proxy calls, they wait for the signaling thread.
+static BlockingCallSite add_track_call("MediaStream.addTrack");
+static BlockingCallSite remove_track_call("MediaStream.removeTrack");
+static BlockingCallSite track_id_call("MediaStream.trackId");
 
 NAN_MODULE_INIT(MediaStream::Init) {
   v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
@@ -30,49 +35,106 @@ NAN_MODULE_INIT(MediaStream::Init) {
     MediaStream::GetOnRemoveTrack,
     MediaStream::SetOnRemoveTrack);
 
-  constructor.Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  IsolateData::Current()->SetConstructor(IsolateData::kMediaStream,
+    Nan::GetFunction(tpl).ToLocalChecked());
   Nan::Set(target, Nan::New("MediaStream").ToLocalChecked(),
     Nan::GetFunction(tpl).ToLocalChecked());
 }
 
-MediaStream::MediaStream() : active_(false) {
+MediaStream::MediaStream() : active_(false), synced_(false) {
+  WebRtcJs::Pin();
   observer_ = new rtc::RefCountedObject<MediaStreamObserver>(this);
 }
 
 MediaStream::~MediaStream() {
   if(stream_.get()) {
+    // Gone once the isolate is disposed.
+    IsolateData* data = IsolateData::Current();
+    if(data) {
+      data->RemoveWrapper(stream_.get(), this);
+    }
     stream_->UnregisterObserver(observer_.get());
     observer_->RemoveListener(this);
   }
+  // The proxies release on the signaling thread, before it may go away.
+  tracks_.clear();
+  track_ids_.clear();
+  stream_ = nullptr;
+  WebRtcJs::Unpin();
 }
 
 v8::Local<v8::Value> MediaStream::New(
-    rtc::scoped_refptr<webrtc::MediaStreamInterface> media_stream) {
+    rtc::scoped_refptr<webrtc::MediaStreamInterface> media_stream,
+    const WebRtcJs::FactoryId& factory) {
   Nan::EscapableHandleScope scope;
   v8::Local<v8::Value> empty;
-  v8::Local<v8::Function> instance = Nan::New(MediaStream::constructor);
+  IsolateData* data = IsolateData::Current();
+  v8::Local<v8::Function> instance =
+    data->GetConstructor(IsolateData::kMediaStream);
   if(instance.IsEmpty() || !media_stream.get()) {
     return scope.Escape(Nan::Null());
   }
 
-  v8::Local<v8::Object> ret = instance->NewInstance();
-  MediaStream* self = Nan::ObjectWrap::Unwrap<MediaStream>(ret); //info.Holder());
-  if(self) {
-    self->stream_ = media_stream;
-    self->stream_->RegisterObserver(self->observer_.get());
-    self->Emit(kMediaStreamChanged);
-    return scope.Escape(ret);
+  Nan::ObjectWrap* wrapper = data->GetWrapper(media_stream.get());
+  if(wrapper) {
+    return scope.Escape(wrapper->handle());
   }
 
-  return scope.Escape(Nan::Null());
+  v8::Local<v8::Value> argv[1] = {
+    Nan::New<v8::External>(media_stream.get())
+  };
+  v8::Local<v8::Object> ret = instance->NewInstance(1, argv);
+  if(!ret.IsEmpty()) {
+    Nan::ObjectWrap::Unwrap<MediaStream>(ret)->factory_ = factory;
+  }
+  return scope.Escape(ret);
 }
 
 NAN_METHOD(MediaStream::New) {
   if(!info.IsConstructCall()) {
     return Nan::ThrowError("Use new operator");
   }
+
+  // Pins the factory before it is used.
   MediaStream* self = new MediaStream();
+  rtc::scoped_refptr<webrtc::MediaStreamInterface> media_stream;
+  if(info.Length() >= 1 && info[0]->IsExternal()) {
+    media_stream = static_cast<webrtc::MediaStreamInterface*>(
+      v8::Local<v8::External>::Cast(info[0])->Value());
+  } else {
+    // new MediaStream([label][, options]) from JS creates an empty local
+    // stream that tracks from AudioSource and friends can be added to.
+    std::string label("stream");
+    v8::Local<v8::Value> factory_value = Nan::Undefined();
+    if(info.Length() >= 1 && info[0]->IsString()) {
+      v8::String::Utf8Value label_value(info[0]->ToString());
+      label = *label_value;
+    }
+    if(info.Length() >= 2 && info[1]->IsObject()) {
+      factory_value = v8::Local<v8::Object>::Cast(info[1])->Get(
+        Nan::New("factory").ToLocalChecked());
+    }
+    if(!WebRtcJs::ParseFactory(factory_value, &self->factory_)) {
+      delete self;
+      return Nan::ThrowError("Invalid factory");
+    }
+    webrtc::PeerConnectionFactoryInterface* factory =
+      WebRtcJs::GetPeerConnectionFactory(self->factory_);
+    if(factory) {
+      media_stream = factory->CreateLocalMediaStream(label);
+    }
+  }
+
+  if(!media_stream.get()) {
+    delete self;
+    return Nan::ThrowError("Could not create webrtc::MediaStreamInterface");
+  }
+
   self->Wrap(info.This());
+  self->stream_ = media_stream;
+  self->stream_->RegisterObserver(self->observer_.get());
+  IsolateData::Current()->SetWrapper(self->stream_.get(), self);
+  self->Emit(kMediaStreamChanged);
   info.GetReturnValue().Set(info.This());
 }
 
@@ -99,7 +161,13 @@ NAN_METHOD(MediaStream::AddTrack) {
   if(!track.get()) {
     return Nan::ThrowError("Bad MediaStreamTrackInterface pointer");
   }
+  // Proxies of another factory run on another signaling thread.
+  if(media_stream_track->factory_ != self->factory_) {
+    return Nan::ThrowError(
+      "The track was created on another factory than the stream");
+  }
 
+  BlockingCall call(&add_track_call);
   std::string kind = track->kind();
   if(kind.compare("audio") == 0) {
     rtc::scoped_refptr<webrtc::AudioTrackInterface>
@@ -137,6 +205,7 @@ NAN_METHOD(MediaStream::RemoveTrack) {
     return Nan::ThrowError("Bad MediaStreamTrackInterface pointer");
   }
 
+  BlockingCall call(&remove_track_call);
   std::string kind = track->kind();
   if(kind.compare("audio") == 0) {
     rtc::scoped_refptr<webrtc::AudioTrackInterface>
@@ -152,14 +221,15 @@ NAN_METHOD(MediaStream::RemoveTrack) {
 }
 
 NAN_METHOD(MediaStream::Clone) {
+  WebRtcJs::FactoryId factory_id;
   rtc::scoped_refptr<webrtc::MediaStreamInterface> self =
-    MediaStream::Unwrap(info.This());
+    MediaStream::Unwrap(info.This(), &factory_id);
   if(!self.get()) {
     Nan::ThrowError("Bad pointer to webrtc::MediaStreamInterface");
   }
 
   rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory =
-    WebRtcJs::GetPeerConnectionFactory();
+    WebRtcJs::GetPeerConnectionFactory(factory_id);
   if(!factory.get()) {
     Nan::ThrowError("Bad pointer to webrtc::PeerConnectionFactoryInterface");
   }
@@ -190,12 +260,13 @@ NAN_METHOD(MediaStream::Clone) {
     }
   }
 
-  info.GetReturnValue().Set(MediaStream::New(stream));
+  info.GetReturnValue().Set(MediaStream::New(stream, factory_id));
 }
 
 NAN_METHOD(MediaStream::GetTrackById) {
+  WebRtcJs::FactoryId factory;
   rtc::scoped_refptr<webrtc::MediaStreamInterface> self =
-    MediaStream::Unwrap(info.This());
+    MediaStream::Unwrap(info.This(), &factory);
   info.GetReturnValue().SetUndefined();
   if(!self.get()) {
     return Nan::ThrowError("Internal Error");
@@ -208,18 +279,21 @@ NAN_METHOD(MediaStream::GetTrackById) {
   rtc::scoped_refptr<webrtc::AudioTrackInterface> audio =
     self->FindAudioTrack(id);
   if(audio.get()) {
-    return info.GetReturnValue().Set(MediaStreamTrack::New(audio.get()));
+    return info.GetReturnValue().Set(MediaStreamTrack::New(audio.get(),
+      factory));
   }
   rtc::scoped_refptr<webrtc::VideoTrackInterface> video =
     self->FindVideoTrack(id);
   if(video.get()) {
-    return info.GetReturnValue().Set(MediaStreamTrack::New(video.get()));
+    return info.GetReturnValue().Set(MediaStreamTrack::New(video.get(),
+      factory));
   }
 }
 
 NAN_METHOD(MediaStream::GetAudioTracks) {
+  WebRtcJs::FactoryId factory;
   rtc::scoped_refptr<webrtc::MediaStreamInterface> self =
-    MediaStream::Unwrap(info.This());
+    MediaStream::Unwrap(info.This(), &factory);
   info.GetReturnValue().SetUndefined();
   if(!self.get()) {
     return Nan::ThrowError("Internal Error");
@@ -232,7 +306,7 @@ NAN_METHOD(MediaStream::GetAudioTracks) {
   for(audio_it = audio_list.begin(); audio_it != audio_list.end(); audio_it++) {
     rtc::scoped_refptr<webrtc::AudioTrackInterface> track(*audio_it);
     if(track.get()) {
-      list->Set(index, MediaStreamTrack::New(track.get()));
+      list->Set(index, MediaStreamTrack::New(track.get(), factory));
       index++;
     }
   }
@@ -240,8 +314,9 @@ NAN_METHOD(MediaStream::GetAudioTracks) {
 }
 
 NAN_METHOD(MediaStream::GetVideoTracks) {
+  WebRtcJs::FactoryId factory;
   rtc::scoped_refptr<webrtc::MediaStreamInterface> self =
-    MediaStream::Unwrap(info.This());
+    MediaStream::Unwrap(info.This(), &factory);
   info.GetReturnValue().SetUndefined();
   if(!self.get()) {
     return Nan::ThrowError("Internal Error");
@@ -254,7 +329,7 @@ NAN_METHOD(MediaStream::GetVideoTracks) {
   for(video_it = video_list.begin(); video_it != video_list.end(); video_it++) {
     rtc::scoped_refptr<webrtc::VideoTrackInterface> track(*video_it);
     if(track.get()) {
-      list->Set(index, MediaStreamTrack::New(track.get()));
+      list->Set(index, MediaStreamTrack::New(track.get(), factory));
       index++;
     }
   }
@@ -262,21 +337,24 @@ NAN_METHOD(MediaStream::GetVideoTracks) {
 }
 
 rtc::scoped_refptr<webrtc::MediaStreamInterface> MediaStream::Unwrap(
-    v8::Local<v8::Object> value) {
+    v8::Local<v8::Object> value, WebRtcJs::FactoryId* factory) {
   if(value.IsEmpty()) {
     return nullptr;
   }
   MediaStream* self = Nan::ObjectWrap::Unwrap<MediaStream>(value);
+  if(factory) {
+    *factory = self->factory_;
+  }
   return self->stream_;
 }
 
 rtc::scoped_refptr<webrtc::MediaStreamInterface> MediaStream::Unwrap(
-    v8::Local<v8::Value> value) {
+    v8::Local<v8::Value> value, WebRtcJs::FactoryId* factory) {
   if(value.IsEmpty() || !value->IsObject()) {
     return nullptr;
   }
   v8::Local<v8::Object> stream = v8::Local<v8::Object>::Cast(value);
-  return MediaStream::Unwrap(stream);
+  return MediaStream::Unwrap(stream, factory);
 }
 
 NAN_GETTER(MediaStream::GetActive) {
@@ -341,167 +419,94 @@ void MediaStream::On(Event* event) {
   LOG(LS_INFO) << __FUNCTION__ << ": There are " << video_list.size() <<
     " video tracks and " << audio_list.size() << " audio tracks";
 
-  if(!audio_list.empty() || !video_list.empty()) {
-    LOG(LS_INFO) << __FUNCTION__ << ": Setting stream active";
-    active_ = true;
+  TrackMap tracks;
+  tracks.reserve(audio_list.size() + video_list.size());
+  std::vector<rtc::scoped_refptr<webrtc::MediaStreamTrackInterface>> added;
+
+  webrtc::AudioTrackVector::iterator audio_it;
+  for(audio_it = audio_list.begin(); audio_it != audio_list.end();
+      audio_it++) {
+    Diff(audio_it->get(), &tracks, &added);
+  }
+  webrtc::VideoTrackVector::iterator video_it;
+  for(video_it = video_list.begin(); video_it != video_list.end();
+      video_it++) {
+    Diff(video_it->get(), &tracks, &added);
+  }
+
+  // What is left of the last change are the tracks that went away.
+  TrackMap removed;
+  removed.swap(tracks_);
+  tracks_.swap(tracks);
+  TrackMap::iterator track;
+  for(track = removed.begin(); track != removed.end(); track++) {
+    track_ids_.erase(track->second.get());
+  }
+
+  active_ = !tracks_.empty();
+  LOG(LS_INFO) << __FUNCTION__ << ": Stream is " <<
+    (active_ ? "active" : "inactive");
+
+  // The tracks a stream starts with are not announced.
+  if(!synced_) {
+    synced_ = true;
+    return;
+  }
+
+  for(track = removed.begin(); track != removed.end(); track++) {
+    v8::Local<v8::Function> fn = Nan::New<v8::Function>(onremovetrack_);
+    if(!fn.IsEmpty() && fn->IsFunction()) {
+      v8::Local<v8::Value> argv[] = {
+        MediaStreamTrack::New(track->second, factory_)
+      };
+      Nan::Callback cb(fn);
+      cb.Call(1, argv);
+    }
+  }
+
+  std::vector<rtc::scoped_refptr<webrtc::MediaStreamTrackInterface>>::iterator
+    added_it;
+  for(added_it = added.begin(); added_it != added.end(); added_it++) {
+    v8::Local<v8::Function> fn = Nan::New<v8::Function>(onaddtrack_);
+    if(!fn.IsEmpty() && fn->IsFunction()) {
+      v8::Local<v8::Value> argv[] = {
+        MediaStreamTrack::New(*added_it, factory_)
+      };
+      Nan::Callback cb(fn);
+      cb.Call(1, argv);
+    }
+  }
+}
+
+void MediaStream::Diff(webrtc::MediaStreamTrackInterface* track,
+    TrackMap* tracks,
+    std::vector<rtc::scoped_refptr<webrtc::MediaStreamTrackInterface>>* added) {
+  if(!track) {
+    return;
+  }
+  std::string id;
+  std::unordered_map<const webrtc::MediaStreamTrackInterface*,
+    std::string>::iterator known = track_ids_.find(track);
+  if(known != track_ids_.end()) {
+    id = known->second;
   } else {
-    LOG(LS_INFO) << __PRETTY_FUNCTION__ << ": Setting stream inactive";
-    active_ = false;
-  }
-
-  if(audio_list.size() != audio_tracks_.size()) {
-    // std::vector<rtc::scoped_refptr<webrtc::AudioTrackInterface>>::iterator
-    //   last_audio, cur_audio;
-
-    // if(audio_list.size() > audio_tracks_.size()) {
-    //   for(cur_audio = audio_list.begin(); cur_audio != audio_list.end();
-    //       cur_audio++) {
-    //     rtc::scoped_refptr<webrtc::AudioTrackInterface> cur_track(*cur_audio);
-    //     std::string cur_id;
-    //     bool found = false;
-    //     if(cur_track.get()) {
-    //       cur_id = cur_track->id();
-    //     }
-    //     if(audio_tracks_.size()) {
-    //       for(last_audio = audio_tracks_.begin();
-    //           last_audio != audio_tracks_.end(); last_audio++) {
-    //         rtc::scoped_refptr<webrtc::AudioTrackInterface>
-    //           last_track(*last_audio);
-    //         std::string last_id;
-    //         if(last_track.get()) {
-    //           last_id = last_track->id();
-    //         }
-    //         if(cur_id.compare(last_id) == 0) {
-    //           found = true;
-    //           break;
-    //         }
-    //       }
-    //     }
-    //     if(!found) {
-    //       v8::Local<v8::Function> fn = Nan::New<v8::Function>(onaddtrack_);
-    //       v8::Local<v8::Value> argv[] = {
-    //         MediaStreamTrack::New(cur_track.get())
-    //       };
-    //       if(!fn.IsEmpty() && fn->IsFunction()) {
-    //         Nan::Callback cb(fn);
-    //         cb.Call(1, argv);
-    //       }
-    //     }
-    //   }
-    // } else {
-    //   for(cur_audio = audio_tracks_.begin(); cur_audio != audio_tracks_.end();
-    //       cur_audio++) {
-    //     rtc::scoped_refptr<webrtc::AudioTrackInterface> cur_track(*cur_audio);
-    //     std::string cur_id;
-    //     bool found = false;
-    //     if(cur_track.get()) {
-    //       cur_id = cur_track->id();
-    //     }
-    //     if(audio_list.size()) {
-    //       for(last_audio = audio_list.begin(); last_audio != audio_list.end();
-    //           last_audio++) {
-    //         rtc::scoped_refptr<webrtc::AudioTrackInterface>
-    //           last_track(*last_audio);
-    //         std::string last_id;
-    //         if(last_track.get()) {
-    //           last_id = last_track->id();
-    //         }
-    //         if(cur_id.compare(last_id) == 0) {
-    //           found = true;
-    //           break;
-    //         }
-    //       }
-    //     }
-    //     if(!found) {
-    //       v8::Local<v8::Function> fn = Nan::New<v8::Function>(onremovetrack_);
-    //       v8::Local<v8::Value> argv[] = {
-    //         MediaStreamTrack::New(cur_track.get())
-    //       };
-    //       if(!fn.IsEmpty() && fn->IsFunction()) {
-    //         Nan::Callback cb(fn);
-    //         cb.Call(1, argv);
-    //       }
-    //     }
-    //   }
-    // }
-    audio_tracks_ = audio_list;
-  }
-
-  if(video_list.size() != video_tracks_.size()) {
-    // std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface> >::iterator
-    //   last_video, cur_video;
-
-    // if(video_list.size() > video_tracks_.size()) {
-    //   for(cur_video = video_list.begin(); cur_video != video_list.end();
-    //       cur_video++) {
-    //     rtc::scoped_refptr<webrtc::VideoTrackInterface> cur_track(*cur_video);
-    //     std::string cur_id;
-    //     bool found = false;
-    //     if(cur_track.get()) {
-    //       cur_id = cur_track->id();
-    //     }
-    //     if(video_tracks_.size()) {
-    //       for(last_video = video_tracks_.begin();
-    //           last_video != video_tracks_.end(); last_video++) {
-    //         rtc::scoped_refptr<webrtc::VideoTrackInterface>
-    //           last_track(*last_video);
-    //         std::string last_id;
-    //         if(last_track.get()) {
-    //           last_id = last_track->id();
-    //         }
-    //         if(cur_id.compare(last_id) == 0) {
-    //           found = true;
-    //           break;
-    //         }
-    //       }
-    //     }
-    //     if(!found) {
-    //       v8::Local<v8::Function> fn = Nan::New<v8::Function>(onaddtrack_);
-    //       v8::Local<v8::Value> argv[] = {
-    //         MediaStreamTrack::New(cur_track.get())
-    //       };
-    //       if(!fn.IsEmpty() && fn->IsFunction()) {
-    //         Nan::Callback cb(fn);
-    //         cb.Call(1, argv);
-    //       }
-    //     }
-    //   }
-    // } else {
-    //   for(cur_video = video_tracks_.begin(); cur_video != video_tracks_.end();
-    //       cur_video++) {
-    //     rtc::scoped_refptr<webrtc::VideoTrackInterface> cur_track(*cur_video);
-    //     std::string cur_id;
-    //     bool found = false;
-    //     if(cur_track.get()) {
-    //       cur_id = cur_track->id();
-    //     }
-    //     if(video_list.size()) {
-    //       for(last_video = video_list.begin(); last_video != video_list.end();
-    //           last_video++) {
-    //         rtc::scoped_refptr<webrtc::VideoTrackInterface>
-    //           last_track(*last_video);
-    //         std::string last_id;
-    //         if(last_track.get()) {
-    //           last_id = last_track->id();
-    //         }
-    //         if(cur_id.compare(last_id) == 0) {
-    //           found = true;
-    //           break;
-    //         }
-    //       }
-    //     }
-    //     if(!found) {
-    //       v8::Local<v8::Function> fn = Nan::New<v8::Function>(onremovetrack_);
-    //       v8::Local<v8::Value> argv[] = {
-    //         MediaStreamTrack::New(cur_track.get())
-    //       };
-    //       if(!fn.IsEmpty() && fn->IsFunction()) {
-    //         Nan::Callback cb(fn);
-    //         cb.Call(1, argv);
-    //       }
-    //     }
-    //   }
-    // }
-    video_tracks_ = video_list;
-  }
-}
\ No newline at end of file
+    BlockingCall call(&track_id_call);
+    id = track->id();
+  }
+  // The first of two tracks with the same id wins.
+  if(tracks->count(id)) {
+    return;
+  }
+  track_ids_[track] = id;
+  (*tracks)[id] = track;
+
+  TrackMap::iterator last = tracks_.find(id);
+  if(last == tracks_.end()) {
+    added->push_back(track);
+    return;
+  }
+  if(last->second.get() != track) {
+    track_ids_.erase(last->second.get());
+  }
+  tracks_.erase(last);
+}
@@ -2,6 +2,9 @@
 #define WEBRTCJS_MEDIASTREAM_H
 
 #include <nan.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "webrtc/base/scoped_ptr.h"
 
@@ -13,7 +16,6 @@
 class MediaStream : public Nan::ObjectWrap, public EventEmitter {
   explicit MediaStream();
   ~MediaStream();
-  static Nan::Persistent<v8::Function> constructor;
 
   void On(Event* event) final;
 
@@ -38,23 +40,44 @@ class MediaStream : public Nan::ObjectWrap, public EventEmitter {
 
   rtc::scoped_refptr<MediaStreamObserver> observer_;
   rtc::scoped_refptr<webrtc::MediaStreamInterface> stream_;
-
-  webrtc::AudioTrackVector audio_tracks_;
-  webrtc::VideoTrackVector video_tracks_;
+  // Local streams of one factory can only be sent by its PeerConnections,
+  // remote ones belong to the factory of their PeerConnection.
+  WebRtcJs::FactoryId factory_;
+
+  // Tracks as of the last change, keyed by id, so a change costs one
+  // lookup per track instead of comparing every pair.
+  typedef std::unordered_map<std::string,
+    rtc::scoped_refptr<webrtc::MediaStreamTrackInterface>> TrackMap;
+
+  // Moves track from tracks_ to tracks, or adds it to added when it is new.
+  void Diff(webrtc::MediaStreamTrackInterface* track, TrackMap* tracks,
+    std::vector<rtc::scoped_refptr<webrtc::MediaStreamTrackInterface>>*
+      added);
+
+  TrackMap tracks_;
+  // Ids of the tracks in tracks_ by pointer, every id() waits for the
+  // signaling thread so it is asked once per track.
+  std::unordered_map<const webrtc::MediaStreamTrackInterface*, std::string>
+    track_ids_;
 
   bool active_;
+  // Set once the first change recorded the tracks the stream started with.
+  bool synced_;
 
  public:
   static NAN_MODULE_INIT(Init);
 
   static v8::Local<v8::Value>
-    New(rtc::scoped_refptr<webrtc::MediaStreamInterface> media_stream);
+    New(rtc::scoped_refptr<webrtc::MediaStreamInterface> media_stream,
+      const WebRtcJs::FactoryId& factory);
 
   static rtc::scoped_refptr<webrtc::MediaStreamInterface>
-    Unwrap(v8::Local<v8::Object> value);
+    Unwrap(v8::Local<v8::Object> value,
+      WebRtcJs::FactoryId* factory=nullptr);
 
   static rtc::scoped_refptr<webrtc::MediaStreamInterface>
-    Unwrap(v8::Local<v8::Value> value);
+    Unwrap(v8::Local<v8::Value> value,
+      WebRtcJs::FactoryId* factory=nullptr);
 };
 
 #endif
\ No newline at end of file
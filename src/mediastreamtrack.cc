@@ -1,6 +1,38 @@
 #include "mediastreamtrack.h"
+#include "isolatedata.h"
 
-Nan::Persistent<v8::Function> MediaStreamTrack::constructor;
+#include "webrtc/base/helpers.h"
+#include "webrtc/base/timeutils.h"
+
+#include "blockingcall.h"
+
+// Handles are single use, one that is not imported in time is dropped.
+static const int64_t kExportTimeoutMs = 60 * 1000;
+static const size_t kHandleLength = 24;
+
+// Track proxy calls, they wait for the signaling thread.
+static BlockingCallSite id_call("MediaStreamTrack.id");
+static BlockingCallSite kind_call("MediaStreamTrack.kind");
+static BlockingCallSite ready_state_call("MediaStreamTrack.readyState");
+static BlockingCallSite enabled_call("MediaStreamTrack.enabled");
+
+rtc::CriticalSection MediaStreamTrack::exports_lock_;
+std::map<std::string, MediaStreamTrack::Export> MediaStreamTrack::exports_;
+
+// Expires the handles nobody imports on the media thread, a process that
+// stops exporting would keep them otherwise.
+class MediaStreamTrack::ExportExpirer : public rtc::MessageHandler {
+ public:
+  void OnMessage(rtc::Message* msg) override {
+    rtc::CritScope lock(&exports_lock_);
+    ExpireExports(rtc::TimeMillis());
+  }
+};
+
+rtc::MessageHandler* MediaStreamTrack::export_expirer() {
+  static ExportExpirer* expirer = new ExportExpirer();
+  return expirer;
+}
 
 NAN_MODULE_INIT(MediaStreamTrack::Init) {
   v8::Local<v8::FunctionTemplate> tpl =
@@ -10,6 +42,10 @@ NAN_MODULE_INIT(MediaStreamTrack::Init) {
 
   Nan::SetPrototypeMethod(tpl, "addSink", MediaStreamTrack::AddSink);
   Nan::SetPrototypeMethod(tpl, "removeSink", MediaStreamTrack::RemoveSink);
+  Nan::SetPrototypeMethod(tpl, "setEncodedForwarding",
+    MediaStreamTrack::SetEncodedForwarding);
+  Nan::SetPrototypeMethod(tpl, "setSharedEncoding",
+    MediaStreamTrack::SetSharedEncoding);
 
   Nan::SetAccessor(tpl->InstanceTemplate(),
     Nan::New("enabled").ToLocalChecked(),
@@ -28,39 +64,91 @@ NAN_MODULE_INIT(MediaStreamTrack::Init) {
     Nan::New("readyState").ToLocalChecked(),
     MediaStreamTrack::GetReadyState);
 
-  constructor.Reset<v8::Function>(tpl->GetFunction());
+  IsolateData::Current()->SetConstructor(IsolateData::kMediaStreamTrack,
+    Nan::GetFunction(tpl).ToLocalChecked());
   Nan::Set(target, Nan::New("MediaStreamTrack").ToLocalChecked(),
     Nan::GetFunction(tpl).ToLocalChecked());
+
+  Nan::SetMethod(target, "exportTrack", MediaStreamTrack::ExportTrack);
+  Nan::SetMethod(target, "importTrack", MediaStreamTrack::ImportTrack);
 }
 
 v8::Local<v8::Value> MediaStreamTrack::New(
-    rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> media_stream_track) {
+    rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> media_stream_track,
+    const WebRtcJs::FactoryId& factory) {
   Nan::EscapableHandleScope scope;
   v8::Local<v8::Value> argv[1];
-  v8::Local<v8::Function> instance = Nan::New(MediaStreamTrack::constructor);
+  IsolateData* data = IsolateData::Current();
+  v8::Local<v8::Function> instance =
+    data->GetConstructor(IsolateData::kMediaStreamTrack);
   if(instance.IsEmpty() || !media_stream_track.get()) {
     return scope.Escape(Nan::Null());
   }
 
+  Nan::ObjectWrap* wrapper = data->GetWrapper(media_stream_track.get());
+  if(wrapper) {
+    return scope.Escape(wrapper->handle());
+  }
+
   v8::Local<v8::Object> ret = instance->NewInstance(0, argv);
   MediaStreamTrack* self = Nan::ObjectWrap::Unwrap<MediaStreamTrack>(ret);
 
   self->track_ = media_stream_track;
+  self->factory_ = factory;
   self->track_->RegisterObserver(self->observer_.get());
+  data->SetWrapper(self->track_.get(), self);
   self->Emit(kMediaStreamTrackChanged);
 
   return scope.Escape(ret);
 }
 
+rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> MediaStreamTrack::Unwrap(
+    v8::Local<v8::Value> value, WebRtcJs::FactoryId* factory) {
+  if(value.IsEmpty() || !value->IsObject()) {
+    return nullptr;
+  }
+  v8::Local<v8::Object> object = v8::Local<v8::Object>::Cast(value);
+  v8::Local<v8::Function> constructor =
+    IsolateData::Current()->GetConstructor(IsolateData::kMediaStreamTrack);
+  if(!object->InstanceOf(Nan::GetCurrentContext(), constructor)
+      .FromMaybe(false)) {
+    return nullptr;
+  }
+  MediaStreamTrack* self = Nan::ObjectWrap::Unwrap<MediaStreamTrack>(object);
+  if(factory) {
+    *factory = self->factory_;
+  }
+  return self->track_;
+}
+
 MediaStreamTrack::MediaStreamTrack() {
+  WebRtcJs::Pin();
   observer_ = new rtc::RefCountedObject<MediaStreamTrackObserver>(this);
 }
 
 MediaStreamTrack::~MediaStreamTrack() {
+  if(forwarding_.get()) {
+    static_cast<webrtc::VideoTrackInterface*>(track_.get())->RemoveSink(
+      forwarding_.get());
+    forwarding_.reset();
+  }
+  if(shared_encoding_.get()) {
+    static_cast<webrtc::VideoTrackInterface*>(track_.get())->RemoveSink(
+      shared_encoding_.get());
+    SharedEncoderSource::Detach(shared_encoding_);
+    shared_encoding_ = nullptr;
+  }
   if(track_.get()) {
+    // Gone once the isolate is disposed.
+    IsolateData* data = IsolateData::Current();
+    if(data) {
+      data->RemoveWrapper(track_.get(), this);
+    }
     track_->UnregisterObserver(observer_.get());
     observer_->RemoveListener(this);
   }
+  track_ = nullptr;
+  WebRtcJs::Unpin();
 }
 
 NAN_METHOD(MediaStreamTrack::New) {
@@ -96,12 +184,155 @@ NAN_METHOD(MediaStreamTrack::RemoveSink) {
   LOG(LS_INFO) << __PRETTY_FUNCTION__;
 }
 
+// setEncodedForwarding(enabled) relays the VP8 payloads received for this
+// remote video track to the PeerConnections sending it instead of decoding
+// and encoding them again, see ForwardingRouter. Sinks of the track only
+// get placeholders meanwhile. Lasts as long as this object.
+NAN_METHOD(MediaStreamTrack::SetEncodedForwarding) {
+  MediaStreamTrack* self =
+    Nan::ObjectWrap::Unwrap<MediaStreamTrack>(info.Holder());
+  if(info.Length() == 0 || !info[0]->IsBoolean()) {
+    return Nan::ThrowError("Expected boolean");
+  }
+  if(!self->track_.get() || self->track_->kind().compare("video") != 0) {
+    return Nan::ThrowError("Only video tracks can be forwarded");
+  }
+
+  webrtc::VideoTrackInterface* video =
+    static_cast<webrtc::VideoTrackInterface*>(self->track_.get());
+  if(info[0]->BooleanValue()) {
+    if(!self->forwarding_.get()) {
+      self->forwarding_.reset(new ForwardingSink());
+      video->AddOrUpdateSink(self->forwarding_.get(), rtc::VideoSinkWants());
+    }
+  } else if(self->forwarding_.get()) {
+    video->RemoveSink(self->forwarding_.get());
+    self->forwarding_.reset();
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+// setSharedEncoding(enabled) makes the PeerConnections sending the source of
+// this video track use one encoder between them, see SharedEncoderSource.
+// Lasts as long as this object.
+NAN_METHOD(MediaStreamTrack::SetSharedEncoding) {
+  MediaStreamTrack* self =
+    Nan::ObjectWrap::Unwrap<MediaStreamTrack>(info.Holder());
+  if(info.Length() == 0 || !info[0]->IsBoolean()) {
+    return Nan::ThrowError("Expected boolean");
+  }
+  if(!self->track_.get() || self->track_->kind().compare("video") != 0) {
+    return Nan::ThrowError("Only video tracks can share an encoder");
+  }
+
+  webrtc::VideoTrackInterface* video =
+    static_cast<webrtc::VideoTrackInterface*>(self->track_.get());
+  if(info[0]->BooleanValue()) {
+    if(!self->shared_encoding_.get()) {
+      self->shared_encoding_ = SharedEncoderSource::Attach(video);
+      if(!self->shared_encoding_.get()) {
+        return Nan::ThrowError("The track has no source");
+      }
+      video->AddOrUpdateSink(self->shared_encoding_.get(),
+        rtc::VideoSinkWants());
+    }
+  } else if(self->shared_encoding_.get()) {
+    video->RemoveSink(self->shared_encoding_.get());
+    SharedEncoderSource::Detach(self->shared_encoding_);
+    self->shared_encoding_ = nullptr;
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+void MediaStreamTrack::ClearExports() {
+  std::map<std::string, Export> exports;
+  {
+    rtc::CritScope lock(&exports_lock_);
+    exports.swap(exports_);
+  }
+}
+
+void MediaStreamTrack::ExpireExports(int64_t now_ms) {
+  std::map<std::string, Export>::iterator it = exports_.begin();
+  while(it != exports_.end()) {
+    if(it->second.expires_ms <= now_ms) {
+      LOG(LS_WARNING) << __FUNCTION__ << ": Track " <<
+        it->second.track->id() << " was exported but never imported";
+      it = exports_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Only the handle string crosses the isolates, e.g. with postMessage(). The
+// track imported from it shares the source, and the frames, with this one.
+NAN_METHOD(MediaStreamTrack::ExportTrack) {
+  if(info.Length() == 0 || !info[0]->IsObject()) {
+    return Nan::ThrowError("Argument must be a MediaStreamTrack");
+  }
+
+  Export entry;
+  entry.track = MediaStreamTrack::Unwrap(info[0], &entry.factory);
+  if(!entry.track.get()) {
+    return Nan::ThrowError("Argument must be a MediaStreamTrack");
+  }
+  entry.expires_ms = rtc::TimeMillis() + kExportTimeoutMs;
+
+  std::string handle;
+  {
+    rtc::CritScope lock(&exports_lock_);
+    ExpireExports(rtc::TimeMillis());
+    do {
+      handle = rtc::CreateRandomString(kHandleLength);
+    } while(exports_.find(handle) != exports_.end());
+    exports_[handle] = entry;
+  }
+  rtc::Thread* thread = WebRtcJs::GetMediaThreadIfRunning();
+  if(thread) {
+    thread->PostDelayed(static_cast<int>(kExportTimeoutMs),
+      export_expirer());
+  }
+
+  info.GetReturnValue().Set(Nan::New(handle).ToLocalChecked());
+}
+
+NAN_METHOD(MediaStreamTrack::ImportTrack) {
+  if(info.Length() == 0 || !info[0]->IsString()) {
+    return Nan::ThrowError("Argument must be a track handle");
+  }
+
+  v8::String::Utf8Value handle_value(info[0]->ToString());
+  std::string handle(*handle_value);
+  Export entry;
+  {
+    rtc::CritScope lock(&exports_lock_);
+    ExpireExports(rtc::TimeMillis());
+    std::map<std::string, Export>::iterator it = exports_.find(handle);
+    if(it != exports_.end()) {
+      entry = it->second;
+      exports_.erase(it);
+    }
+  }
+
+  if(!entry.track.get()) {
+    return Nan::ThrowError("Unknown or expired track handle");
+  }
+
+  info.GetReturnValue().Set(MediaStreamTrack::New(entry.track,
+    entry.factory));
+}
+
 
 
 NAN_GETTER(MediaStreamTrack::GetId) {
   MediaStreamTrack* self =
     Nan::ObjectWrap::Unwrap<MediaStreamTrack>(info.Holder());
-  std::string id = self->track_->id();
+  std::string id;
+  {
+    BlockingCall call(&id_call);
+    id = self->track_->id();
+  }
   info.GetReturnValue().Set(v8::String::NewFromUtf8(v8::Isolate::GetCurrent(),
     id.c_str()));
 }
@@ -109,7 +340,11 @@ NAN_GETTER(MediaStreamTrack::GetId) {
 NAN_GETTER(MediaStreamTrack::GetKind) {
   MediaStreamTrack* self =
     Nan::ObjectWrap::Unwrap<MediaStreamTrack>(info.Holder());
-  std::string kind = self->track_->kind();
+  std::string kind;
+  {
+    BlockingCall call(&kind_call);
+    kind = self->track_->kind();
+  }
   info.GetReturnValue().Set(v8::String::NewFromUtf8(v8::Isolate::GetCurrent(),
     kind.c_str()));
 }
@@ -117,21 +352,31 @@ NAN_GETTER(MediaStreamTrack::GetKind) {
 NAN_GETTER(MediaStreamTrack::GetReadyState) {
   MediaStreamTrack* self =
     Nan::ObjectWrap::Unwrap<MediaStreamTrack>(info.Holder());
-  info.GetReturnValue().Set(Nan::New(
-    static_cast<int32_t>(self->track_->state())));
+  webrtc::MediaStreamTrackInterface::TrackState state;
+  {
+    BlockingCall call(&ready_state_call);
+    state = self->track_->state();
+  }
+  info.GetReturnValue().Set(Nan::New(static_cast<int32_t>(state)));
 }
 
 
 NAN_GETTER(MediaStreamTrack::GetEnabled) {
   MediaStreamTrack* self =
     Nan::ObjectWrap::Unwrap<MediaStreamTrack>(info.Holder());
-  info.GetReturnValue().Set(Nan::New(self->track_->enabled()));
+  bool enabled;
+  {
+    BlockingCall call(&enabled_call);
+    enabled = self->track_->enabled();
+  }
+  info.GetReturnValue().Set(Nan::New(enabled));
 }
 
 NAN_SETTER(MediaStreamTrack::SetEnabled) {
   MediaStreamTrack* self =
     Nan::ObjectWrap::Unwrap<MediaStreamTrack>(info.Holder());
   if(!value.IsEmpty() && value->IsBoolean()) {
+    BlockingCall call(&enabled_call);
     self->track_->set_enabled(value->BooleanValue());
   }
 }
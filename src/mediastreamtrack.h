@@ -2,11 +2,19 @@
 #define WEBRTCJS_MEDIASTREAMTRACK_H
 
 #include <nan.h>
+#include <map>
+#include <memory>
+#include <string>
 
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/messagehandler.h"
 #include "webrtc/media/base/videosourceinterface.h"
 
+#include "webrtcjs.h"
 #include "observers.h"
 #include "eventemitter.h"
+#include "forwarding.h"
+#include "sharedencoder.h"
 #include "videosink.h"
 
 class MediaStreamTrack : public Nan::ObjectWrap, public EventEmitter {
@@ -14,20 +22,35 @@ class MediaStreamTrack : public Nan::ObjectWrap, public EventEmitter {
  public:
   static NAN_MODULE_INIT(Init);
 
+  // factory is the one the track was created on, a track can only be added
+  // to streams of the same factory.
   static v8::Local<v8::Value>
     New(rtc::scoped_refptr<webrtc::MediaStreamTrackInterface>
-      media_stream_track);
+      media_stream_track, const WebRtcJs::FactoryId& factory);
+
+  // Empty unless value is a MediaStreamTrack of this isolate.
+  static rtc::scoped_refptr<webrtc::MediaStreamTrackInterface>
+    Unwrap(v8::Local<v8::Value> value,
+      WebRtcJs::FactoryId* factory=nullptr);
+
+  // Drops the handles not imported yet, before shutdown() takes the threads
+  // of their tracks down.
+  static void ClearExports();
 
  private:
   explicit MediaStreamTrack();
   ~MediaStreamTrack();
-  static Nan::Persistent<v8::Function> constructor;
 
   void On(Event* event) final;
 
   static NAN_METHOD(New);
   static NAN_METHOD(AddSink);
   static NAN_METHOD(RemoveSink);
+  static NAN_METHOD(SetEncodedForwarding);
+  static NAN_METHOD(SetSharedEncoding);
+
+  static NAN_METHOD(ExportTrack);
+  static NAN_METHOD(ImportTrack);
 
 
   static NAN_GETTER(GetId);
@@ -59,6 +82,26 @@ class MediaStreamTrack : public Nan::ObjectWrap, public EventEmitter {
 
   rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> track_;
   rtc::scoped_refptr<MediaStreamTrackObserver> observer_;
+  WebRtcJs::FactoryId factory_;
+  // Set by setEncodedForwarding(true), only on video tracks.
+  std::unique_ptr<ForwardingSink> forwarding_;
+  // Set by setSharedEncoding(true), only on video tracks.
+  rtc::scoped_refptr<SharedEncoderSource> shared_encoding_;
+
+  // Tracks handed out by exportTrack(), shared by all isolates. Every handle
+  // holds a reference until it is imported once or expires.
+  struct Export {
+    rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> track;
+    WebRtcJs::FactoryId factory;
+    int64_t expires_ms;
+  };
+
+  class ExportExpirer;
+  static rtc::MessageHandler* export_expirer();
+  static void ExpireExports(int64_t now_ms);
+
+  static rtc::CriticalSection exports_lock_;
+  static std::map<std::string, Export> exports_;
 };
 
 #endif
\ No newline at end of file
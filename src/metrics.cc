@@ -0,0 +1,217 @@
+#include "metrics.h"
+
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include "webrtcjs.h"
+
+struct CounterInfo {
+  const char* name;
+  const char* type;
+  const char* help;
+  const char* labels;
+};
+
+// Same order as Metrics::Counter, samples of a name are adjacent.
+static const CounterInfo kCounters[] = {
+  { "webrtcjs_peer_connections", "gauge",
+    "PeerConnections by ICE connection state.", "state=\"new\"" },
+  { "webrtcjs_peer_connections", "gauge",
+    "PeerConnections by ICE connection state.", "state=\"checking\"" },
+  { "webrtcjs_peer_connections", "gauge",
+    "PeerConnections by ICE connection state.", "state=\"connected\"" },
+  { "webrtcjs_peer_connections", "gauge",
+    "PeerConnections by ICE connection state.", "state=\"completed\"" },
+  { "webrtcjs_peer_connections", "gauge",
+    "PeerConnections by ICE connection state.", "state=\"failed\"" },
+  { "webrtcjs_peer_connections", "gauge",
+    "PeerConnections by ICE connection state.", "state=\"disconnected\"" },
+  { "webrtcjs_peer_connections", "gauge",
+    "PeerConnections by ICE connection state.", "state=\"closed\"" },
+  { "webrtcjs_events_queued", "gauge",
+    "Events waiting for the JS thread.", "" },
+  { "webrtcjs_events_dispatched_total", "counter",
+    "Events delivered on the JS thread.", "" },
+  { "webrtcjs_frames_total", "counter",
+    "Video frames captured by sources and rendered to sinks.",
+    "direction=\"out\"" },
+  { "webrtcjs_frames_total", "counter",
+    "Video frames captured by sources and rendered to sinks.",
+    "direction=\"in\"" },
+  { "webrtcjs_bytes_total", "counter",
+    "RTP bytes of sampled PeerConnections, only grows while "
+    "configureStatsSampler() is on.", "direction=\"out\"" },
+  { "webrtcjs_bytes_total", "counter",
+    "RTP bytes of sampled PeerConnections, only grows while "
+    "configureStatsSampler() is on.", "direction=\"in\"" },
+  { "webrtcjs_pool_peer_connections", "gauge",
+    "PeerConnections of prewarmed pools.", "state=\"ready\"" },
+  { "webrtcjs_pool_peer_connections", "gauge",
+    "PeerConnections of prewarmed pools.", "state=\"pending\"" },
+  { "webrtcjs_pool_certificates", "gauge",
+    "Certificates available in the certificate pool.", "" },
+};
+
+// Doubles hold integers exactly up to 2^53.
+static const double kMaxInteger = 9007199254740992.0;
+
+static_assert(sizeof(kCounters) / sizeof(kCounters[0]) ==
+  Metrics::kCounterCount, "kCounters must match Metrics::Counter");
+
+static std::string Labels(const std::string& labels,
+    const std::string& more) {
+  if(labels.empty()) {
+    return more;
+  }
+  return more.empty() ? labels : labels + "," + more;
+}
+
+//
+// MetricsWriter
+//
+void MetricsWriter::Write(const char* name, const char* type,
+    const char* help, const std::string& labels, double value,
+    const char* suffix) {
+  if(last_name_ != name) {
+    out_ << "# HELP " << name << " " << help << "\n";
+    out_ << "# TYPE " << name << " " << type << "\n";
+    last_name_ = name;
+  }
+  out_ << name << suffix;
+  if(!labels.empty()) {
+    out_ << "{" << labels << "}";
+  }
+  out_ << " ";
+  // Counters pass the 6 significant digits of the default precision soon,
+  // integral values go out as integers and the rest round-trip.
+  if(std::isinf(value)) {
+    out_ << (value > 0 ? "+Inf" : "-Inf");
+  } else if(std::isnan(value)) {
+    out_ << "NaN";
+  } else if(value == std::floor(value) && std::fabs(value) < kMaxInteger) {
+    out_ << static_cast<int64_t>(value);
+  } else {
+    out_ << std::setprecision(17) << value;
+  }
+  out_ << "\n";
+}
+
+//
+// Histogram
+//
+Histogram::Histogram(const char* name, const char* help,
+    const std::string& labels, const std::vector<double>& bounds) :
+    name_(name),
+    help_(help),
+    labels_(labels),
+    bounds_(bounds),
+    buckets_(new std::atomic<uint64_t>[bounds.size() + 1]),
+    count_(0),
+    sum_(0) {
+  for(size_t index = 0; index <= bounds_.size(); index++) {
+    buckets_[index] = 0;
+  }
+  rtc::CritScope lock(&Lock());
+  Histograms().push_back(this);
+}
+
+Histogram::~Histogram() {
+  rtc::CritScope lock(&Lock());
+  std::vector<Histogram*>& histograms = Histograms();
+  histograms.erase(std::remove(histograms.begin(), histograms.end(), this),
+    histograms.end());
+}
+
+rtc::CriticalSection& Histogram::Lock() {
+  static rtc::CriticalSection lock;
+  return lock;
+}
+
+std::vector<Histogram*>& Histogram::Histograms() {
+  static std::vector<Histogram*> histograms;
+  return histograms;
+}
+
+std::vector<double> Histogram::LatencyBounds() {
+  static const double kBounds[] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+    0.25, 0.5, 1, 2.5, 5, 10,
+  };
+  return std::vector<double>(kBounds,
+    kBounds + sizeof(kBounds) / sizeof(kBounds[0]));
+}
+
+void Histogram::Observe(double value) {
+  size_t bucket = std::lower_bound(bounds_.begin(), bounds_.end(), value) -
+    bounds_.begin();
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  double sum = sum_.load(std::memory_order_relaxed);
+  while(!sum_.compare_exchange_weak(sum, sum + value,
+      std::memory_order_relaxed)) { }
+}
+
+void Histogram::Write(MetricsWriter* writer) const {
+  uint64_t cumulative = 0;
+  for(size_t index = 0; index <= bounds_.size(); index++) {
+    cumulative += buckets_[index].load(std::memory_order_relaxed);
+    std::ostringstream le;
+    le << "le=\"";
+    if(index < bounds_.size()) {
+      le << bounds_[index];
+    } else {
+      le << "+Inf";
+    }
+    le << "\"";
+    writer->Write(name_, "histogram", help_, Labels(labels_, le.str()),
+      static_cast<double>(cumulative), "_bucket");
+  }
+  writer->Write(name_, "histogram", help_, labels_,
+    sum_.load(std::memory_order_relaxed), "_sum");
+  writer->Write(name_, "histogram", help_, labels_,
+    static_cast<double>(count_.load(std::memory_order_relaxed)), "_count");
+}
+
+void Histogram::WriteAll(MetricsWriter* writer) {
+  rtc::CritScope lock(&Lock());
+  std::vector<Histogram*> histograms(Histograms());
+  std::stable_sort(histograms.begin(), histograms.end(),
+    [](const Histogram* a, const Histogram* b) {
+      return strcmp(a->name(), b->name()) < 0;
+    });
+
+  // Sorted by name, so the writer emits HELP and TYPE once per family.
+  std::vector<Histogram*>::iterator index;
+  for(index = histograms.begin(); index != histograms.end(); index++) {
+    (*index)->Write(writer);
+  }
+}
+
+//
+// Metrics
+//
+std::atomic<int64_t> Metrics::counters_[Metrics::kCounterCount];
+Histogram Metrics::encode_time("webrtcjs_codec_seconds",
+  "Time spent in encoders and decoders run by the addon.",
+  "operation=\"encode\"", Histogram::LatencyBounds());
+Histogram Metrics::decode_time("webrtcjs_codec_seconds",
+  "Time spent in encoders and decoders run by the addon.",
+  "operation=\"decode\"", Histogram::LatencyBounds());
+
+NAN_MODULE_INIT(Metrics::Init) {
+  Nan::SetMethod(target, "getMetrics", Metrics::GetMetrics);
+}
+
+NAN_METHOD(Metrics::GetMetrics) {
+  MetricsWriter writer;
+  for(int index = 0; index < kCounterCount; index++) {
+    writer.Write(kCounters[index].name, kCounters[index].type,
+      kCounters[index].help, kCounters[index].labels,
+      static_cast<double>(counters_[index].load(std::memory_order_relaxed)));
+  }
+  WebRtcJs::WriteMetrics(&writer);
+  Histogram::WriteAll(&writer);
+  info.GetReturnValue().Set(Nan::New(writer.str()).ToLocalChecked());
+}
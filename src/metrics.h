@@ -0,0 +1,104 @@
+#ifndef WEBRTCJS_METRICS_H
+#define WEBRTCJS_METRICS_H
+
+#include <nan.h>
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "webrtc/base/criticalsection.h"
+
+// Formats metrics in the Prometheus text exposition format. Samples of one
+// metric must be written one after the other, suffix names the samples of a
+// histogram, e.g. "_bucket".
+class MetricsWriter {
+ public:
+  void Write(const char* name, const char* type, const char* help,
+    const std::string& labels, double value, const char* suffix = "");
+  std::string str() const { return out_.str(); }
+
+ private:
+  std::ostringstream out_;
+  std::string last_name_;
+};
+
+// Cumulative histogram, Observe() is a handful of relaxed atomic adds so it
+// can sit on the media paths. Every histogram that exists is part of the
+// getMetrics() output.
+class Histogram {
+ public:
+  // bounds are the upper bounds of the buckets in ascending order, labels
+  // tell histograms of the same name apart, e.g. kind="encode".
+  Histogram(const char* name, const char* help, const std::string& labels,
+    const std::vector<double>& bounds);
+  ~Histogram();
+
+  void Observe(double value);
+  void Write(MetricsWriter* writer) const;
+
+  const char* name() const { return name_; }
+
+  // Bounds for durations in seconds, from 100us to 10s.
+  static std::vector<double> LatencyBounds();
+  // Writes all histograms, grouped by name.
+  static void WriteAll(MetricsWriter* writer);
+
+ private:
+  static rtc::CriticalSection& Lock();
+  static std::vector<Histogram*>& Histograms();
+
+  const char* name_;
+  const char* help_;
+  std::string labels_;
+  std::vector<double> bounds_;
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<uint64_t> count_;
+  std::atomic<double> sum_;
+};
+
+// Process-wide counters and gauges, kept up to date by the code that
+// changes them so a scrape only reads them.
+class Metrics {
+ public:
+  enum Counter {
+    // One gauge per IceConnectionState, in the order of the enum.
+    kPeerConnectionsNew,
+    kPeerConnectionsChecking,
+    kPeerConnectionsConnected,
+    kPeerConnectionsCompleted,
+    kPeerConnectionsFailed,
+    kPeerConnectionsDisconnected,
+    kPeerConnectionsClosed,
+    kEventsQueued,
+    kEventsDispatched,
+    kFramesCaptured,
+    kFramesRendered,
+    // Fed by the stats sampler from the stats of each PeerConnection, they
+    // stand still while configureStatsSampler() is off.
+    kBytesSent,
+    kBytesReceived,
+    kPoolPeerConnectionsReady,
+    kPoolPeerConnectionsPending,
+    kPoolCertificates,
+    kCounterCount,
+  };
+
+  static void Add(Counter counter, int64_t value = 1) {
+    counters_[counter].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  // Time spent in the encoders and decoders the addon runs itself.
+  static Histogram encode_time;
+  static Histogram decode_time;
+
+  static NAN_MODULE_INIT(Init);
+
+ private:
+  static NAN_METHOD(GetMetrics);
+
+  static std::atomic<int64_t> counters_[kCounterCount];
+};
+
+#endif
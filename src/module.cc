@@ -1,17 +1,60 @@
 #include <nan.h>
+#include <node.h>
 
+#include "isolatedata.h"
 #include "webrtcjs.h"
 #include "peerconnection.h"
+#include "peerconnectionpool.h"
+#include "certificatepool.h"
+#include "statssampler.h"
+#include "metrics.h"
+#include "blockingcall.h"
+#include "tracing.h"
+#include "epollsocketserver.h"
 
 #include "videosink.h"
+#include "audiosource.h"
+#include "filesource.h"
+#include "patternsource.h"
+#include "forwarding.h"
+#include "sharedencoder.h"
+
+// Runs when the isolate goes away, e.g. a worker_thread that exits. Its
+// objects are not collected, Dispose() cuts them off from the observers and
+// closes their loop handles. They keep their factory pins, shutdown() from
+// another isolate refuses while they exist.
+static void Cleanup(void* arg) {
+  v8::Isolate* isolate = static_cast<v8::Isolate*>(arg);
+  PeerConnectionPool::Clear(isolate);
+  IsolateData::Dispose(isolate);
+}
 
 NAN_MODULE_INIT(InitAll) {
-  WebRtcJs::Init();
+  v8::Isolate* isolate = v8::Isolate::GetCurrent();
+  IsolateData::Create(isolate);
+  node::AddEnvironmentCleanupHook(isolate, Cleanup, isolate);
+
+  // Before anything starts a WebRTC thread.
+  Tracing::Init(target);
+  WebRtcJs::InitBindings(target);
   PeerConnection::Init(target);
+  PeerConnectionPool::Init(target);
+  CertificatePool::Init(target);
+  StatsSampler::Init(target);
+  Metrics::Init(target);
+  BlockingCallSite::Init(target);
+  EpollSocketServer::Init(target);
   MediaStream::Init(target);
   MediaStreamTrack::Init(target);
 
   VideoSink::Init(target);
+  AudioSource::Init(target);
+  FileSource::Init(target);
+  PatternSource::Init(target);
+  ForwardingRouter::Init(target);
+  SharedEncoderSource::Init(target);
 }
 
-NODE_MODULE(addon, InitAll)
+// Loadable from worker_threads, each isolate gets its own constructors and
+// event loop handles on top of the shared WebRTC factories.
+NAN_MODULE_WORKER_ENABLED(addon, InitAll)
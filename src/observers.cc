@@ -1,5 +1,7 @@
 #include "observers.h"
 
+#include "webrtc/base/trace_event.h"
+
 //
 // LocalDescriptionObserver
 //
@@ -11,10 +13,13 @@ void LocalDescriptionObserver::On(Event* event) {
 }
 
 void LocalDescriptionObserver::OnSuccess() {
+  TRACE_EVENT0("webrtcjs", "LocalDescriptionObserver::OnSuccess");
+  Mark(SetupTiming::kLocalDescription);
   Emit(kPeerConnectionSetLocalDescription);
 }
 
 void LocalDescriptionObserver::OnFailure(const std::string &error) {
+  TRACE_EVENT0("webrtcjs", "LocalDescriptionObserver::OnFailure");
   Emit(kPeerConnectionSetLocalDescriptionError, error);
 }
 
@@ -29,10 +34,13 @@ void RemoteDescriptionObserver::On(Event* event) {
 }
 
 void RemoteDescriptionObserver::OnSuccess() {
+  TRACE_EVENT0("webrtcjs", "RemoteDescriptionObserver::OnSuccess");
+  Mark(SetupTiming::kRemoteDescription);
   Emit(kPeerConnectionSetRemoteDescription);
 }
 
 void RemoteDescriptionObserver::OnFailure(const std::string &error) {
+  TRACE_EVENT0("webrtcjs", "RemoteDescriptionObserver::OnFailure");
   Emit(kPeerConnectionSetRemoteDescriptionError, error);
 }
 
@@ -45,6 +53,8 @@ OfferObserver::OfferObserver(EventEmitter* listener) :
 void OfferObserver::On(Event* event) { }
 
 void OfferObserver::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
+  TRACE_EVENT0("webrtcjs", "OfferObserver::OnSuccess");
+  Mark(SetupTiming::kOfferCreated);
   Json::FastWriter writer;
   Json::Value msg;
   std::string sdp;
@@ -56,6 +66,7 @@ void OfferObserver::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
 }
 
 void OfferObserver::OnFailure(const std::string& error) {
+  TRACE_EVENT0("webrtcjs", "OfferObserver::OnFailure");
   Emit(kPeerConnectionCreateOfferError, error);
 }
 
@@ -68,6 +79,8 @@ AnswerObserver::AnswerObserver(EventEmitter* listener) :
 void AnswerObserver::On(Event* event) { }
 
 void AnswerObserver::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
+  TRACE_EVENT0("webrtcjs", "AnswerObserver::OnSuccess");
+  Mark(SetupTiming::kAnswerCreated);
   Json::FastWriter writer;
   Json::Value msg;
   std::string sdp;
@@ -79,6 +92,7 @@ void AnswerObserver::OnSuccess(webrtc::SessionDescriptionInterface* desc) {
 }
 
 void AnswerObserver::OnFailure(const std::string& error) {
+  TRACE_EVENT0("webrtcjs", "AnswerObserver::OnFailure");
   Emit(kPeerConnectionCreateAnswerError, error);
 }
 
@@ -91,29 +105,73 @@ StatsObserver::StatsObserver(EventEmitter* listener) :
 void StatsObserver::On(Event* event) { }
 
 void StatsObserver::OnComplete(const webrtc::StatsReports& reports) {
-  Emit(kPeerConnectionStats, reports);
+  TRACE_EVENT0("webrtcjs", "StatsObserver::OnComplete");
+  std::string filter;
+  {
+    rtc::CritScope lock(&filters_lock_);
+    if(!filters_.empty()) {
+      filter = filters_.front();
+      filters_.pop_front();
+    }
+  }
+  Emit(kPeerConnectionStats, CompactStats::Create(reports, filter));
+}
+
+void StatsObserver::Request(const std::string& filter) {
+  rtc::CritScope lock(&filters_lock_);
+  filters_.push_back(filter);
+}
+
+void StatsObserver::Cancel() {
+  rtc::CritScope lock(&filters_lock_);
+  if(!filters_.empty()) {
+    filters_.pop_back();
+  }
 }
 
 //
 // PeerConnectionObserver
 //
 PeerConnectionObserver::PeerConnectionObserver(EventEmitter *listener) :
-    EventEmitter(listener) {
+    EventEmitter(listener),
+    tracked_(false),
+    signaling_state_(webrtc::PeerConnectionInterface::kStable),
+    ice_connection_state_(
+      webrtc::PeerConnectionInterface::kIceConnectionNew),
+    ice_gathering_state_(
+      webrtc::PeerConnectionInterface::kIceGatheringNew) {
   LOG(LS_INFO) << __FUNCTION__;
 }
 
+PeerConnectionObserver::~PeerConnectionObserver() {
+  if(tracked_) {
+    Metrics::Add(static_cast<Metrics::Counter>(
+      Metrics::kPeerConnectionsNew + ice_connection_state_), -1);
+  }
+}
+
+void PeerConnectionObserver::Track() {
+  if(!tracked_.exchange(true)) {
+    Metrics::Add(static_cast<Metrics::Counter>(
+      Metrics::kPeerConnectionsNew + ice_connection_state_));
+  }
+}
+
 void PeerConnectionObserver::On(Event* event) {
   LOG(LS_INFO) << __FUNCTION__;
 }
 
 void PeerConnectionObserver::OnStateChange(
     webrtc::PeerConnectionObserver::StateType state) {
+  TRACE_EVENT0("webrtcjs", "PeerConnectionObserver::OnStateChange");
   LOG(LS_INFO) << __FUNCTION__;
 }
 
 void PeerConnectionObserver::OnSignalingChange(
     webrtc::PeerConnectionInterface::SignalingState state) {
+  TRACE_EVENT0("webrtcjs", "PeerConnectionObserver::OnSignalingChange");
   LOG(LS_INFO) << __FUNCTION__;
+  signaling_state_ = state;
   Emit(kPeerConnectionSignalChange);
   if(state == webrtc::PeerConnectionInterface::kClosed) {
     Emit(kPeerConnectionCreateClosed);
@@ -122,18 +180,41 @@ void PeerConnectionObserver::OnSignalingChange(
 
 void PeerConnectionObserver::OnIceConnectionChange(
     webrtc::PeerConnectionInterface::IceConnectionState state) {
+  TRACE_EVENT0("webrtcjs", "PeerConnectionObserver::OnIceConnectionChange");
   LOG(LS_INFO) << __FUNCTION__;
-  Emit(kPeerConnectionIceChange);
+  if(state == webrtc::PeerConnectionInterface::kIceConnectionChecking) {
+    Mark(SetupTiming::kIceChecking);
+  } else if(
+      state == webrtc::PeerConnectionInterface::kIceConnectionConnected ||
+      state == webrtc::PeerConnectionInterface::kIceConnectionCompleted) {
+    Mark(SetupTiming::kIceConnected);
+    rtc::scoped_refptr<SetupTiming> current = timing();
+    if(current.get()) {
+      current->StartProbing();
+    }
+  }
+  int previous = ice_connection_state_.exchange(state);
+  if(tracked_ && previous != state) {
+    Metrics::Add(static_cast<Metrics::Counter>(
+      Metrics::kPeerConnectionsNew + previous), -1);
+    Metrics::Add(static_cast<Metrics::Counter>(
+      Metrics::kPeerConnectionsNew + state));
+  }
+  // The state may change again before the event is dispatched.
+  Emit(kPeerConnectionIceChange, state);
 }
 
 void PeerConnectionObserver::OnIceGatheringChange(
     webrtc::PeerConnectionInterface::IceGatheringState state) {
+  TRACE_EVENT0("webrtcjs", "PeerConnectionObserver::OnIceGatheringChange");
   LOG(LS_INFO) << __FUNCTION__;
+  ice_gathering_state_ = state;
   Emit(kPeerConnectionIceGathering);
 }
 
 void PeerConnectionObserver::OnDataChannel(
     webrtc::DataChannelInterface *channel) {
+  TRACE_EVENT0("webrtcjs", "PeerConnectionObserver::OnDataChannel");
   LOG(LS_INFO) << __FUNCTION__;
   rtc::scoped_refptr<webrtc::DataChannelInterface> dataChannel = channel;
   if(dataChannel.get()) {
@@ -142,15 +223,21 @@ void PeerConnectionObserver::OnDataChannel(
 }
 
 void PeerConnectionObserver::OnAddStream(webrtc::MediaStreamInterface* stream) {
+  TRACE_EVENT0("webrtcjs", "PeerConnectionObserver::OnAddStream");
   LOG(LS_INFO) << __FUNCTION__;
   rtc::scoped_refptr<webrtc::MediaStreamInterface> media_stream = stream;
   if(media_stream.get()) {
+    rtc::scoped_refptr<SetupTiming> current = timing();
+    if(current.get()) {
+      current->Watch(media_stream.get());
+    }
     Emit(kPeerConnectionAddStream, media_stream);
   }
 }
 
 void PeerConnectionObserver::OnRemoveStream(
     webrtc::MediaStreamInterface *stream) {
+  TRACE_EVENT0("webrtcjs", "PeerConnectionObserver::OnRemoveStream");
   LOG(LS_INFO) << __FUNCTION__;
   rtc::scoped_refptr<webrtc::MediaStreamInterface> media_stream = stream;
   if(media_stream.get()) {
@@ -159,13 +246,16 @@ void PeerConnectionObserver::OnRemoveStream(
 }
 
 void PeerConnectionObserver::OnRenegotiationNeeded() {
+  TRACE_EVENT0("webrtcjs", "PeerConnectionObserver::OnRenegotiationNeeded");
   LOG(LS_INFO) << __FUNCTION__;
   Emit(kPeerConnectionRenegotiation);
 }
 
 void PeerConnectionObserver::OnIceCandidate(
     const webrtc::IceCandidateInterface* candidate) {
+  TRACE_EVENT0("webrtcjs", "PeerConnectionObserver::OnIceCandidate");
   LOG(LS_INFO) << __FUNCTION__;
+  Mark(SetupTiming::kFirstCandidate);
   Json::StyledWriter writer;
   Json::Value msg;
   std::string sdp;
@@ -189,6 +279,7 @@ void MediaStreamTrackObserver::On(Event* event) {
 }
 
 void MediaStreamTrackObserver::OnChanged() {
+  TRACE_EVENT0("webrtcjs", "MediaStreamTrackObserver::OnChanged");
   Emit(kMediaStreamTrackChanged);
 }
 
@@ -204,5 +295,6 @@ void MediaStreamObserver::On(Event* event) {
 }
 
 void MediaStreamObserver::OnChanged() {
+  TRACE_EVENT0("webrtcjs", "MediaStreamObserver::OnChanged");
   Emit(kMediaStreamChanged);
 }
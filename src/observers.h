@@ -1,15 +1,24 @@
 #ifndef WEBRTCJS_OBSERVERS_H
 #define WEBRTCJS_OBSERVERS_H
 
+#include <atomic>
+#include <deque>
+#include <string>
+
 #include "webrtc/api/peerconnectioninterface.h"
+#include "webrtc/base/criticalsection.h"
 #include "webrtc/base/json.h"
 
 #include "eventemitter.h"
+#include "compactstats.h"
+#include "metrics.h"
+#include "setuptiming.h"
 
 
 class LocalDescriptionObserver
   : public webrtc::SetSessionDescriptionObserver,
-    public EventEmitter {
+    public EventEmitter,
+    public TimedObserver {
  public:
   LocalDescriptionObserver(EventEmitter* listener=nullptr);
   void On(Event* event) final;
@@ -19,7 +28,8 @@ class LocalDescriptionObserver
 
 class RemoteDescriptionObserver
   : public webrtc::SetSessionDescriptionObserver,
-    public EventEmitter {
+    public EventEmitter,
+    public TimedObserver {
  public:
   RemoteDescriptionObserver(EventEmitter* listener=nullptr);
   void On(Event* event) final;
@@ -29,7 +39,8 @@ class RemoteDescriptionObserver
 
 class OfferObserver
   : public webrtc::CreateSessionDescriptionObserver,
-    public EventEmitter {
+    public EventEmitter,
+    public TimedObserver {
  public:
   OfferObserver(EventEmitter* listener=nullptr);
   virtual void On(Event* event) final;
@@ -39,7 +50,8 @@ class OfferObserver
 
 class AnswerObserver
   : public webrtc::CreateSessionDescriptionObserver,
-    public EventEmitter {
+    public EventEmitter,
+    public TimedObserver {
  public:
   AnswerObserver(EventEmitter* listener=nullptr);
   void On(Event* event) final;
@@ -52,14 +64,28 @@ class StatsObserver : public webrtc::StatsObserver, public EventEmitter {
   StatsObserver(EventEmitter* listener=nullptr);
   void On(Event* event) final;
   void OnComplete(const webrtc::StatsReports& reports) final;
+
+  // Requests complete in order, each one is converted with the filter it
+  // was made with, see CompactStats::Create.
+  void Request(const std::string& filter);
+  // Forgets the last request when GetStats() refused it.
+  void Cancel();
+
+ private:
+  rtc::CriticalSection filters_lock_;
+  std::deque<std::string> filters_;
 };
 
 class PeerConnectionObserver
   : public webrtc::PeerConnectionObserver,
     public rtc::RefCountInterface,
-    public EventEmitter {
+    public EventEmitter,
+    public TimedObserver {
  public:
   PeerConnectionObserver(EventEmitter* listener=nullptr);
+  ~PeerConnectionObserver() override;
+  // Counts the PeerConnection in the metrics once it exists.
+  void Track();
   void On(Event* event) final;
   void OnSignalingChange(
     webrtc::PeerConnectionInterface::SignalingState state) final;
@@ -73,6 +99,29 @@ class PeerConnectionObserver
   void OnRenegotiationNeeded() final;
   void OnAddStream(webrtc::MediaStreamInterface* stream) final;
   void OnRemoveStream(webrtc::MediaStreamInterface* stream) final;
+
+  // Latest states reported by WebRTC, readable from any thread without a
+  // call into the signaling thread.
+  webrtc::PeerConnectionInterface::SignalingState signaling_state() const {
+    return static_cast<webrtc::PeerConnectionInterface::SignalingState>(
+      signaling_state_.load());
+  }
+  webrtc::PeerConnectionInterface::IceConnectionState
+      ice_connection_state() const {
+    return static_cast<webrtc::PeerConnectionInterface::IceConnectionState>(
+      ice_connection_state_.load());
+  }
+  webrtc::PeerConnectionInterface::IceGatheringState
+      ice_gathering_state() const {
+    return static_cast<webrtc::PeerConnectionInterface::IceGatheringState>(
+      ice_gathering_state_.load());
+  }
+
+ private:
+  std::atomic<bool> tracked_;
+  std::atomic<int> signaling_state_;
+  std::atomic<int> ice_connection_state_;
+  std::atomic<int> ice_gathering_state_;
 };
 
 class MediaStreamTrackObserver
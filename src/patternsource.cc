@@ -0,0 +1,310 @@
+#include "patternsource.h"
+#include "isolatedata.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "libyuv/planar_functions.h"
+
+#include "mediastreamtrack.h"
+
+static const int kStampBits = 32;
+static const int kBarCount = 8;
+static const int kBarStep = 4;
+
+// 75% color bars in BT.601 limited range.
+static const uint8_t kBarColors[kBarCount][3] = {
+  { 180, 128, 128 },
+  { 162,  44, 142 },
+  { 131, 156,  44 },
+  { 112,  72,  58 },
+  {  84, 184, 198 },
+  {  65, 100, 212 },
+  {  35, 212, 114 },
+  {  16, 128, 128 },
+};
+
+static inline uint8_t StampCheck(uint32_t sequence) {
+  return (sequence ^ (sequence >> 8) ^ (sequence >> 16) ^ 0xA5) & 0xFF;
+}
+
+static inline int StampBlock(int width, int height) {
+  int block = (width / kStampBits) & ~1;
+  return block <= height ? block : 0;
+}
+
+//
+// PatternVideoCapturer
+//
+PatternVideoCapturer::PatternVideoCapturer(int width, int height,
+    double frame_rate, Pattern pattern) :
+    PushVideoCapturer(width, height, frame_rate),
+    pattern_(pattern),
+    sequence_(0) {
+  chroma_width_ = (width_ + 1) / 2;
+  chroma_height_ = (height_ + 1) / 2;
+  image_.resize(width_ * height_ + 2 * chroma_width_ * chroma_height_);
+  y_ = &image_[0];
+  u_ = y_ + width_ * height_;
+  v_ = u_ + chroma_width_ * chroma_height_;
+
+  libyuv::SetPlane(u_, chroma_width_, chroma_width_, chroma_height_, 128);
+  libyuv::SetPlane(v_, chroma_width_, chroma_width_, chroma_height_, 128);
+
+  if(pattern_ == kPatternNoise) {
+    // Twice the luma plane so every frame can copy a window at a new offset
+    // instead of generating fresh noise.
+    noise_.resize(2 * width_ * height_ + sizeof(uint64_t));
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    uint64_t* words = reinterpret_cast<uint64_t*>(&noise_[0]);
+    size_t count = noise_.size() / sizeof(uint64_t);
+    for(size_t index = 0; index < count; index++) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      words[index] = state;
+    }
+  } else if(pattern_ == kPatternCounter) {
+    libyuv::SetPlane(y_, width_, width_, height_, 128);
+  }
+}
+
+PatternVideoCapturer::~PatternVideoCapturer() {
+  Halt();
+}
+
+void PatternVideoCapturer::OnTick(int64_t time_ns) {
+  uint32_t sequence = sequence_++ & 0xFFFFFF;
+  switch(pattern_) {
+    case kPatternBars:
+      RenderBars(sequence);
+      break;
+    case kPatternNoise:
+      RenderNoise(sequence);
+      break;
+    case kPatternCounter:
+      RenderCounter(sequence);
+      break;
+  }
+  WriteStamp(y_, width_, width_, height_, sequence);
+  DeliverFrame(&image_[0], image_.size(), time_ns);
+}
+
+void PatternVideoCapturer::RenderBars(uint32_t sequence) {
+  int bar_width = ((width_ / kBarCount) + 1) & ~1;
+  int shift = (sequence * kBarStep) % width_ & ~1;
+  for(int index = 0; index < kBarCount; index++) {
+    int x = (index * bar_width + shift) % width_ & ~1;
+    int w = std::min(bar_width, width_ - index * bar_width);
+    const uint8_t* color = kBarColors[index];
+    if(w <= 0) {
+      break;
+    }
+    int first = std::min(w, width_ - x);
+    libyuv::I420Rect(y_, width_, u_, chroma_width_, v_, chroma_width_,
+      x, 0, first, height_, color[0], color[1], color[2]);
+    if(first < w) {
+      libyuv::I420Rect(y_, width_, u_, chroma_width_, v_, chroma_width_,
+        0, 0, w - first, height_, color[0], color[1], color[2]);
+    }
+  }
+}
+
+void PatternVideoCapturer::RenderNoise(uint32_t sequence) {
+  size_t plane = width_ * height_;
+  size_t offset = (static_cast<size_t>(sequence) * 4099 * 8) % plane;
+  memcpy(y_, &noise_[offset], plane);
+}
+
+void PatternVideoCapturer::RenderCounter(uint32_t sequence) {
+  // Background stays flat, only the stamp changes between frames.
+}
+
+void PatternVideoCapturer::WriteStamp(uint8_t* y, int stride, int width,
+    int height, uint32_t sequence) {
+  int block = StampBlock(width, height);
+  if(!block) {
+    return;
+  }
+  uint32_t value = ((sequence & 0xFFFFFF) << 8) | StampCheck(sequence);
+  for(int bit = 0; bit < kStampBits; bit++) {
+    bool set = value & (1u << (kStampBits - 1 - bit));
+    libyuv::SetPlane(y + bit * block, stride, block, block, set ? 235 : 16);
+  }
+}
+
+bool PatternVideoCapturer::ReadStamp(const uint8_t* y, int stride, int width,
+    int height, uint32_t* sequence) {
+  int block = StampBlock(width, height);
+  if(!block) {
+    return false;
+  }
+  const uint8_t* row = y + (block / 2) * stride + block / 2;
+  uint32_t value = 0;
+  for(int bit = 0; bit < kStampBits; bit++) {
+    value = (value << 1) | (row[bit * block] >= 128 ? 1 : 0);
+  }
+  uint32_t candidate = value >> 8;
+  if((value & 0xFF) != StampCheck(candidate)) {
+    return false;
+  }
+  *sequence = candidate;
+  return true;
+}
+
+//
+// PatternSource
+//
+NAN_MODULE_INIT(PatternSource::Init) {
+  v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
+  tpl->SetClassName(Nan::New("PatternSource").ToLocalChecked());
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  Nan::SetPrototypeMethod(tpl, "createTrack", PatternSource::CreateTrack);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("width").ToLocalChecked(),
+    PatternSource::GetWidth);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("height").ToLocalChecked(),
+    PatternSource::GetHeight);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("frameRate").ToLocalChecked(),
+    PatternSource::GetFrameRate);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("frames").ToLocalChecked(),
+    PatternSource::GetFrames);
+
+  IsolateData::Current()->SetConstructor(IsolateData::kPatternSource,
+    Nan::GetFunction(tpl).ToLocalChecked());
+  Nan::Set(target, Nan::New("PatternSource").ToLocalChecked(),
+    Nan::GetFunction(tpl).ToLocalChecked());
+}
+
+PatternSource::PatternSource(
+    rtc::scoped_refptr<webrtc::VideoSourceInterface> source,
+    PatternVideoCapturer* capturer, const WebRtcJs::FactoryId& factory) :
+    source_(source), capturer_(capturer), factory_(factory) { }
+
+PatternSource::~PatternSource() { }
+
+NAN_METHOD(PatternSource::New) {
+  if(!info.IsConstructCall()) {
+    return Nan::ThrowError("Use new operator");
+  }
+
+  int width = 640;
+  int height = 480;
+  double frame_rate = 30;
+  PatternVideoCapturer::Pattern pattern = PatternVideoCapturer::kPatternBars;
+  v8::Local<v8::Value> factory_value = Nan::Undefined();
+
+  if(info.Length() >= 1 && info[0]->IsObject()) {
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[0]);
+    v8::Local<v8::Value> width_value =
+      options->Get(Nan::New("width").ToLocalChecked());
+    v8::Local<v8::Value> height_value =
+      options->Get(Nan::New("height").ToLocalChecked());
+    v8::Local<v8::Value> frame_rate_value =
+      options->Get(Nan::New("frameRate").ToLocalChecked());
+    v8::Local<v8::Value> pattern_value =
+      options->Get(Nan::New("pattern").ToLocalChecked());
+
+    if(width_value->IsUint32()) {
+      width = width_value->Uint32Value();
+    }
+    if(height_value->IsUint32()) {
+      height = height_value->Uint32Value();
+    }
+    if(frame_rate_value->IsNumber()) {
+      frame_rate = frame_rate_value->NumberValue();
+    }
+    if(pattern_value->IsString()) {
+      v8::String::Utf8Value name(pattern_value->ToString());
+      std::string pattern_name(*name);
+      if(pattern_name == "bars") {
+        pattern = PatternVideoCapturer::kPatternBars;
+      } else if(pattern_name == "noise") {
+        pattern = PatternVideoCapturer::kPatternNoise;
+      } else if(pattern_name == "counter") {
+        pattern = PatternVideoCapturer::kPatternCounter;
+      } else {
+        return Nan::ThrowError("Unknown pattern");
+      }
+    }
+    factory_value = options->Get(Nan::New("factory").ToLocalChecked());
+  }
+
+  if(width < 16 || height < 16 || width > 4096 || height > 4096 ||
+      (width & 1) || (height & 1)) {
+    return Nan::ThrowError("Invalid frame size");
+  }
+  if(frame_rate <= 0 || frame_rate > 120) {
+    return Nan::ThrowError("Invalid frameRate");
+  }
+  WebRtcJs::FactoryId factory;
+  if(!WebRtcJs::ParseFactory(factory_value, &factory)) {
+    return Nan::ThrowError("Invalid factory");
+  }
+
+  std::unique_ptr<PatternVideoCapturer> capturer(
+    new PatternVideoCapturer(width, height, frame_rate, pattern));
+  webrtc::PeerConnectionFactoryInterface* pc_factory =
+    WebRtcJs::GetPeerConnectionFactory(factory);
+  rtc::scoped_refptr<webrtc::VideoSourceInterface> source;
+  if(pc_factory) {
+    source = pc_factory->CreateVideoSource(capturer.get(), nullptr);
+  }
+  if(!source.get()) {
+    return Nan::ThrowError("Could not create webrtc::VideoSourceInterface");
+  }
+
+  // The source owns the capturer from here on.
+  PatternSource* self =
+    new PatternSource(source, capturer.release(), factory);
+  self->Wrap(info.This());
+  info.GetReturnValue().Set(info.This());
+}
+
+NAN_METHOD(PatternSource::CreateTrack) {
+  PatternSource* self = Nan::ObjectWrap::Unwrap<PatternSource>(info.Holder());
+  std::string id("video");
+  if(info.Length() >= 1 && info[0]->IsString()) {
+    v8::String::Utf8Value id_value(info[0]->ToString());
+    id = *id_value;
+  }
+  webrtc::PeerConnectionFactoryInterface* factory =
+    WebRtcJs::GetPeerConnectionFactory(self->factory_);
+  rtc::scoped_refptr<webrtc::VideoTrackInterface> track;
+  if(factory) {
+    track = factory->CreateVideoTrack(id, self->source_.get());
+  }
+  if(!track.get()) {
+    return Nan::ThrowError("Could not create webrtc::VideoTrackInterface");
+  }
+  info.GetReturnValue().Set(MediaStreamTrack::New(track.get(),
+    self->factory_));
+}
+
+NAN_GETTER(PatternSource::GetWidth) {
+  PatternSource* self = Nan::ObjectWrap::Unwrap<PatternSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->capturer_->width()));
+}
+
+NAN_GETTER(PatternSource::GetHeight) {
+  PatternSource* self = Nan::ObjectWrap::Unwrap<PatternSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->capturer_->height()));
+}
+
+NAN_GETTER(PatternSource::GetFrameRate) {
+  PatternSource* self = Nan::ObjectWrap::Unwrap<PatternSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->capturer_->frame_rate()));
+}
+
+NAN_GETTER(PatternSource::GetFrames) {
+  PatternSource* self = Nan::ObjectWrap::Unwrap<PatternSource>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->capturer_->frames()));
+}
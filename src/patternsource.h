@@ -0,0 +1,73 @@
+#ifndef WEBRTCJS_PATTERNSOURCE_H
+#define WEBRTCJS_PATTERNSOURCE_H
+
+#include <nan.h>
+#include <vector>
+
+#include "webrtc/api/videosourceinterface.h"
+
+#include "videocapturer.h"
+
+// Generates I420 test frames without any input media. Every frame carries a
+// stamp in its top rows with the frame number, which VideoSink reads back to
+// detect lost or damaged frames on the receiving side.
+class PatternVideoCapturer : public PushVideoCapturer {
+ public:
+  enum Pattern {
+    kPatternBars,
+    kPatternNoise,
+    kPatternCounter,
+  };
+
+  PatternVideoCapturer(int width, int height, double frame_rate,
+    Pattern pattern);
+  ~PatternVideoCapturer() override;
+
+  static void WriteStamp(uint8_t* y, int stride, int width, int height,
+    uint32_t sequence);
+  static bool ReadStamp(const uint8_t* y, int stride, int width, int height,
+    uint32_t* sequence);
+
+ protected:
+  void OnTick(int64_t time_ns) final;
+
+ private:
+  void RenderBars(uint32_t sequence);
+  void RenderNoise(uint32_t sequence);
+  void RenderCounter(uint32_t sequence);
+
+  Pattern pattern_;
+  uint32_t sequence_;
+  std::vector<uint8_t> image_;
+  std::vector<uint8_t> noise_;
+  uint8_t* y_;
+  uint8_t* u_;
+  uint8_t* v_;
+  int chroma_width_;
+  int chroma_height_;
+};
+
+class PatternSource : public Nan::ObjectWrap {
+  explicit PatternSource(
+    rtc::scoped_refptr<webrtc::VideoSourceInterface> source,
+    PatternVideoCapturer* capturer, const WebRtcJs::FactoryId& factory);
+  ~PatternSource();
+
+  static NAN_METHOD(New);
+  static NAN_METHOD(CreateTrack);
+
+  static NAN_GETTER(GetWidth);
+  static NAN_GETTER(GetHeight);
+  static NAN_GETTER(GetFrameRate);
+  static NAN_GETTER(GetFrames);
+
+  rtc::scoped_refptr<webrtc::VideoSourceInterface> source_;
+  PatternVideoCapturer* capturer_;
+  // The source and its tracks live on this factory.
+  WebRtcJs::FactoryId factory_;
+
+ public:
+  static NAN_MODULE_INIT(Init);
+};
+
+#endif
@@ -1,9 +1,112 @@
 #include "peerconnection.h"
+#include "isolatedata.h"
+#include "statssampler.h"
+
+#include <unistd.h>
+#include <sstream>
+
+#include "webrtc/base/trace_event.h"
+
+#include "blockingcall.h"
+
+// Proxy calls, they wait for the signaling thread.
+static BlockingCallSite create_offer_call("RTCPeerConnection.createOffer");
+static BlockingCallSite create_answer_call("RTCPeerConnection.createAnswer");
+static BlockingCallSite set_local_description_call(
+  "RTCPeerConnection.setLocalDescription");
+static BlockingCallSite set_remote_description_call(
+  "RTCPeerConnection.setRemoteDescription");
+static BlockingCallSite add_ice_candidate_call(
+  "RTCPeerConnection.addIceCandidate");
+static BlockingCallSite get_stats_call("RTCPeerConnection.getStats");
+static BlockingCallSite add_stream_call("RTCPeerConnection.addStream");
+static BlockingCallSite remove_stream_call("RTCPeerConnection.removeStream");
+static BlockingCallSite close_call("RTCPeerConnection.close");
+static BlockingCallSite start_event_log_call(
+  "RTCPeerConnection.startEventLog");
+static BlockingCallSite stop_event_log_call("RTCPeerConnection.stopEventLog");
+
+static const char* SignalingStateName(
+    webrtc::PeerConnectionInterface::SignalingState state) {
+  switch(state) {
+    case webrtc::PeerConnectionInterface::kStable:
+      return "stable";
+    case webrtc::PeerConnectionInterface::kHaveLocalOffer:
+      return "have-local-offer";
+    case webrtc::PeerConnectionInterface::kHaveLocalPrAnswer:
+      return "have-local-pranswer";
+    case webrtc::PeerConnectionInterface::kHaveRemoteOffer:
+      return "have-remote-offer";
+    case webrtc::PeerConnectionInterface::kHaveRemotePrAnswer:
+      return "have-remote-pranswer";
+    default:
+      return "closed";
+  }
+}
+
+static const char* IceConnectionStateName(
+    webrtc::PeerConnectionInterface::IceConnectionState state) {
+  switch(state) {
+    case webrtc::PeerConnectionInterface::kIceConnectionNew:
+      return "new";
+    case webrtc::PeerConnectionInterface::kIceConnectionChecking:
+      return "checking";
+    case webrtc::PeerConnectionInterface::kIceConnectionConnected:
+      return "connected";
+    case webrtc::PeerConnectionInterface::kIceConnectionCompleted:
+      return "completed";
+    case webrtc::PeerConnectionInterface::kIceConnectionFailed:
+      return "failed";
+    case webrtc::PeerConnectionInterface::kIceConnectionDisconnected:
+      return "disconnected";
+    default:
+      return "closed";
+  }
+}
+
+static const char* IceGatheringStateName(
+    webrtc::PeerConnectionInterface::IceGatheringState state) {
+  switch(state) {
+    case webrtc::PeerConnectionInterface::kIceGatheringNew:
+      return "new";
+    case webrtc::PeerConnectionInterface::kIceGatheringGathering:
+      return "gathering";
+    default:
+      return "complete";
+  }
+}
 
-Nan::Persistent<v8::Function> PeerConnection::constructor;
+static std::string FactoryMismatch(const WebRtcJs::FactoryId& stream,
+    const WebRtcJs::FactoryId& peer_connection) {
+  std::ostringstream error;
+  error << "The stream was created on factory " << stream.index
+        << ", this PeerConnection runs on factory " << peer_connection.index
+        << ", pass { factory: " << stream.index << " } in the "
+        << "RTCConfiguration of the PeerConnection";
+  return error.str();
+}
+
+// Position of the callback that hears about a failed call, -1 if the
+// method has none. getStats() reports failures with null.
+static int FailureCallback(const std::string& method) {
+  if(method == "createOffer" || method == "createAnswer") {
+    return 1;
+  } else if(method == "setLocalDescription" ||
+      method == "setRemoteDescription" || method == "addIceCandidate") {
+    return 2;
+  } else if(method == "getStats") {
+    return 0;
+  }
+  return -1;
+}
 
 PeerConnection::PeerConnection(const v8::Local<v8::Object> &configuration,
-    const v8::Local<v8::Object> &constraints) {
+    const v8::Local<v8::Object> &constraints) :
+    prewarm_pool_size_(0),
+    creating_(false),
+    failed_(false),
+    stats_id_(0) {
+  WebRtcJs::Pin();
 
   constraints_ = MediaConstraints::New(constraints);
 
@@ -16,6 +119,13 @@ PeerConnection::PeerConnection(const v8::Local<v8::Object> &configuration,
     new rtc::RefCountedObject<RemoteDescriptionObserver>(this);
   peer_connection_observer_ =
     new rtc::RefCountedObject<PeerConnectionObserver>(this);
+
+  timing_ = new rtc::RefCountedObject<SetupTiming>();
+  offer_observer_->set_timing(timing_);
+  answer_observer_->set_timing(timing_);
+  local_description_observer_->set_timing(timing_);
+  remote_description_observer_->set_timing(timing_);
+  peer_connection_observer_->set_timing(timing_);
 }
 
 PeerConnection::~PeerConnection() {
@@ -26,6 +136,17 @@ PeerConnection::~PeerConnection() {
   local_description_observer_->RemoveListener(this);
   remote_description_observer_->RemoveListener(this);
   peer_connection_observer_->RemoveListener(this);
+  while(!stats_callbacks_.empty()) {
+    delete stats_callbacks_.front();
+    stats_callbacks_.pop_front();
+  }
+  EndEventLog(nullptr);
+  timing_->Detach();
+  StatsSampler::Remove(stats_id_);
+  WebRtcJs::ReleaseFactory(factory_);
+  // Released on the signaling thread, before it may go away.
+  peer_connection_ = nullptr;
+  WebRtcJs::Unpin();
 }
 
 NAN_MODULE_INIT(PeerConnection::Init) {
@@ -39,6 +160,9 @@ NAN_MODULE_INIT(PeerConnection::Init) {
   Nan::SetPrototypeMethod(tpl, "addStream", PeerConnection::AddStream);
   Nan::SetPrototypeMethod(tpl, "removeStream", PeerConnection::RemoveStream);
   Nan::SetPrototypeMethod(tpl, "close", PeerConnection::Close);
+  Nan::SetPrototypeMethod(tpl, "startEventLog",
+    PeerConnection::StartEventLog);
+  Nan::SetPrototypeMethod(tpl, "stopEventLog", PeerConnection::StopEventLog);
   Nan::SetPrototypeMethod(tpl, "setLocalDescription",
     PeerConnection::SetLocalDescription);
   Nan::SetPrototypeMethod(tpl, "setRemoteDescription",
@@ -46,6 +170,11 @@ NAN_MODULE_INIT(PeerConnection::Init) {
   Nan::SetPrototypeMethod(tpl, "addIceCandidate",
     PeerConnection::AddIceCandidate);
 
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("onerror").ToLocalChecked(),
+    PeerConnection::GetOnError,
+    PeerConnection::SetOnError);
+
   Nan::SetAccessor(tpl->InstanceTemplate(),
     Nan::New("onnegotiationneeded").ToLocalChecked(),
     PeerConnection::GetOnNegotiationNeeded,
@@ -79,7 +208,28 @@ NAN_MODULE_INIT(PeerConnection::Init) {
     Nan::New("signalingState").ToLocalChecked(),
     PeerConnection::GetSignalingState);
 
-  constructor.Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("iceConnectionState").ToLocalChecked(),
+    PeerConnection::GetIceConnectionState);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("iceGatheringState").ToLocalChecked(),
+    PeerConnection::GetIceGatheringState);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("statsId").ToLocalChecked(),
+    PeerConnection::GetStatsId);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("factory").ToLocalChecked(),
+    PeerConnection::GetFactory);
+
+  Nan::SetAccessor(tpl->InstanceTemplate(),
+    Nan::New("setupTiming").ToLocalChecked(),
+    PeerConnection::GetSetupTiming);
+
+  IsolateData::Current()->SetConstructor(IsolateData::kPeerConnection,
+    Nan::GetFunction(tpl).ToLocalChecked());
   Nan::Set(target, Nan::New("RTCPeerConnection").ToLocalChecked(),
     Nan::GetFunction(tpl).ToLocalChecked());
 }
@@ -98,19 +248,32 @@ NAN_METHOD(PeerConnection::New) {
     }
   }
 
+  RTCConfiguration rtc_configuration;
+  std::string error;
+  if(!rtc_configuration.Parse(configuration, &error)) {
+    return Nan::ThrowError(error.c_str());
+  }
+
   PeerConnection* self = new PeerConnection(configuration, constraints);
+  self->config_ = rtc_configuration.config;
+  self->prewarm_pool_size_ = rtc_configuration.prewarm_pool_size;
+  self->requested_factory_ = rtc_configuration.factory;
   self->Wrap(info.This());
+  self->Create();
   info.GetReturnValue().Set(info.This());
 }
 
 NAN_METHOD(PeerConnection::CreateOffer) {
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  if(self->Defer("createOffer", info)) {
+    return;
+  }
   self->offer_cb_.Reset();
   self->offer_err_cb_.Reset();
 
   webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
   if(!peer_connection) {
-    Nan::ThrowError("Bad pointer to PeerConnectionInterface");
+    return Nan::ThrowError("Bad pointer to PeerConnectionInterface");
   }
 
   MediaConstraints* constraints = self->GetConstraints();
@@ -127,20 +290,26 @@ NAN_METHOD(PeerConnection::CreateOffer) {
       info[1]));
   }
 
-  peer_connection->CreateOffer(self->offer_observer_.get(),
-    constraints->ToConstraints());
+  {
+    BlockingCall call(&create_offer_call);
+    peer_connection->CreateOffer(self->offer_observer_.get(),
+      constraints->ToConstraints());
+  }
 
   info.GetReturnValue().SetUndefined();
 }
 
 NAN_METHOD(PeerConnection::CreateAnswer) {
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  if(self->Defer("createAnswer", info)) {
+    return;
+  }
   self->answer_cb_.Reset();
   self->answer_err_cb_.Reset();
 
   webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
   if(!peer_connection) {
-    Nan::ThrowError("Bad pointer to PeerConnectionInterface");
+    return Nan::ThrowError("Bad pointer to PeerConnectionInterface");
   }
 
   MediaConstraints* constraints = self->GetConstraints();
@@ -157,8 +326,11 @@ NAN_METHOD(PeerConnection::CreateAnswer) {
       info[1]));
   }
 
-  peer_connection->CreateAnswer(self->answer_observer_.get(),
-    constraints->ToConstraints());
+  {
+    BlockingCall call(&create_answer_call);
+    peer_connection->CreateAnswer(self->answer_observer_.get(),
+      constraints->ToConstraints());
+  }
 
   info.GetReturnValue().SetUndefined();
 }
@@ -167,16 +339,8 @@ NAN_METHOD(PeerConnection::SetLocalDescription) {
   LOG(LS_INFO) << __FUNCTION__;
 
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
-  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
-  self->local_sdp_cb_.Reset();
-  self->local_sdp_err_cb_.Reset();
-
-  if(!peer_connection) {
-    Nan::ThrowError("Internal error");
-  }
-
   if(info[0].IsEmpty() || !info[0]->IsObject()) {
-    Nan::ThrowError("Invalid SessionDescription");
+    return Nan::ThrowError("Invalid SessionDescription");
   }
 
   v8::Local<v8::Object> desc_obj = v8::Local<v8::Object>::Cast(info[0]);
@@ -186,11 +350,23 @@ NAN_METHOD(PeerConnection::SetLocalDescription) {
     .ToLocalChecked());
 
   if(type_value.IsEmpty() || !type_value->IsString()) {
-    Nan::ThrowError("Invalid SessionDescription type");
+    return Nan::ThrowError("Invalid SessionDescription type");
   }
 
   if(sdp_value.IsEmpty() || !sdp_value->IsString()) {
-    Nan::ThrowError("Invalid SessionDescription");
+    return Nan::ThrowError("Invalid SessionDescription");
+  }
+
+  // Checked before deferring, the caller sees the throw.
+  if(self->Defer("setLocalDescription", info)) {
+    return;
+  }
+  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
+  self->local_sdp_cb_.Reset();
+  self->local_sdp_err_cb_.Reset();
+
+  if(!peer_connection) {
+    return Nan::ThrowError("Internal error");
   }
 
   if(!info[1].IsEmpty() && info[1]->IsFunction()) {
@@ -209,12 +385,15 @@ NAN_METHOD(PeerConnection::SetLocalDescription) {
     webrtc::CreateSessionDescription(*type, *sdp, 0));
 
   if(!desc) {
-    Nan::ThrowError("webrtc::CreateSessionDescription failure");
+    return Nan::ThrowError("webrtc::CreateSessionDescription failure");
   }
 
   self->local_sdp_.Reset<v8::Object>(desc_obj);
-  peer_connection->SetLocalDescription(self->local_description_observer_.get(),
-    desc);
+  {
+    BlockingCall call(&set_local_description_call);
+    peer_connection->SetLocalDescription(
+      self->local_description_observer_.get(), desc);
+  }
 
   info.GetReturnValue().SetUndefined();
 }
@@ -223,16 +402,8 @@ NAN_METHOD(PeerConnection::SetRemoteDescription) {
   LOG(LS_INFO) << "-------------------------------------------" << __FUNCTION__;
 
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
-  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
-  self->remote_sdp_cb_.Reset();
-  self->remote_sdp_err_cb_.Reset();
-
-  if(!peer_connection) {
-    Nan::ThrowError("Internal error");
-  }
-
   if(info[0].IsEmpty() || !info[0]->IsObject()) {
-    Nan::ThrowError("Invalid SessionDescription");
+    return Nan::ThrowError("Invalid SessionDescription");
   }
 
   v8::Local<v8::Object> desc_obj = v8::Local<v8::Object>::Cast(info[0]);
@@ -242,11 +413,23 @@ NAN_METHOD(PeerConnection::SetRemoteDescription) {
     .ToLocalChecked());
 
   if(type_value.IsEmpty() || !type_value->IsString()) {
-    Nan::ThrowError("Invalid SessionDescription type");
+    return Nan::ThrowError("Invalid SessionDescription type");
   }
 
   if(sdp_value.IsEmpty() || !sdp_value->IsString()) {
-    Nan::ThrowError("Invalid SessionDescription");
+    return Nan::ThrowError("Invalid SessionDescription");
+  }
+
+  // Checked before deferring, the caller sees the throw.
+  if(self->Defer("setRemoteDescription", info)) {
+    return;
+  }
+  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
+  self->remote_sdp_cb_.Reset();
+  self->remote_sdp_err_cb_.Reset();
+
+  if(!peer_connection) {
+    return Nan::ThrowError("Internal error");
   }
 
   if(!info[1].IsEmpty() && info[1]->IsFunction()) {
@@ -265,28 +448,23 @@ NAN_METHOD(PeerConnection::SetRemoteDescription) {
     webrtc::CreateSessionDescription(*type, *sdp, nullptr));
 
   if(!desc) {
-    Nan::ThrowError("webrtc::CreateSessionDescription failure");
+    return Nan::ThrowError("webrtc::CreateSessionDescription failure");
   }
 
   self->remote_sdp_.Reset<v8::Object>(desc_obj);
-  peer_connection->SetRemoteDescription(
-    self->remote_description_observer_.get(), desc);
+  {
+    BlockingCall call(&set_remote_description_call);
+    peer_connection->SetRemoteDescription(
+      self->remote_description_observer_.get(), desc);
+  }
 
   info.GetReturnValue().SetUndefined();
 }
 
 NAN_METHOD(PeerConnection::AddIceCandidate) {
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
-  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
-
-  v8::Local<v8::Value> argv[1];
-
-  if(!peer_connection) {
-    Nan::ThrowError("Internal error");
-  }
-
   if(info[0].IsEmpty() || !info[0]->IsObject()) {
-    Nan::ThrowError("Invalid SDP");
+    return Nan::ThrowError("Invalid SDP");
   }
 
   v8::Local<v8::Object> desc = v8::Local<v8::Object>::Cast(info[0]);
@@ -295,21 +473,33 @@ NAN_METHOD(PeerConnection::AddIceCandidate) {
     .ToLocalChecked());
 
   if(sdpMid_value.IsEmpty() || !sdpMid_value->IsString()) {
-    Nan::ThrowError("Invalid sdpMid");
+    return Nan::ThrowError("Invalid sdpMid");
   }
 
   v8::Local<v8::Value> sdpMLineIndex_value = desc->Get(
     Nan::New("sdpMLineIndex").ToLocalChecked());
 
   if(sdpMLineIndex_value.IsEmpty() || !sdpMLineIndex_value->IsInt32()) {
-    Nan::ThrowError("Invalid sdpMLineIndex");
+    return Nan::ThrowError("Invalid sdpMLineIndex");
   }
 
   v8::Local<v8::Value> sdp_value = desc->Get(Nan::New("candidate")
     .ToLocalChecked());
 
   if(sdp_value.IsEmpty() || !sdp_value->IsString()) {
-    Nan::ThrowError("Invalid SDP");
+    return Nan::ThrowError("Invalid SDP");
+  }
+
+  // Checked before deferring, the caller sees the throw.
+  if(self->Defer("addIceCandidate", info)) {
+    return;
+  }
+  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
+
+  v8::Local<v8::Value> argv[1];
+
+  if(!peer_connection) {
+    return Nan::ThrowError("Internal error");
   }
 
   v8::Local<v8::Int32> sdpMLineIndex(sdpMLineIndex_value->ToInt32());
@@ -319,11 +509,16 @@ NAN_METHOD(PeerConnection::AddIceCandidate) {
     webrtc::CreateIceCandidate(*sdpMid, sdpMLineIndex->Value(), *sdp, 0));
 
   if(!candidate.get()) {
-    Nan::ThrowError("Invalid ICE candidate");
+    return Nan::ThrowError("Invalid ICE candidate");
   }
 
-  if(!peer_connection->AddIceCandidate(candidate.get())) {
-    Nan::ThrowError("Failed to add ICE candidate");
+  bool added;
+  {
+    BlockingCall call(&add_ice_candidate_call);
+    added = peer_connection->AddIceCandidate(candidate.get());
+  }
+  if(!added) {
+    return Nan::ThrowError("Failed to add ICE candidate");
   }
 
   if(!info[1].IsEmpty() && info[1]->IsFunction()) {
@@ -334,24 +529,53 @@ NAN_METHOD(PeerConnection::AddIceCandidate) {
   info.GetReturnValue().SetUndefined();
 }
 
+// getStats(callback[, selector]), selector is a MediaStreamTrack, or the id
+// or type of a report such as a transport. The callback gets the stats in
+// the layout of CompactStats, or null when they cannot be collected.
 NAN_METHOD(PeerConnection::GetStats) {
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  if(self->Defer("getStats", info)) {
+    return;
+  }
   webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
 
   if(!peer_connection) {
-    Nan::ThrowError("Internal error");
+    return Nan::ThrowError("Internal error");
   }
 
-  if(!info[0].IsEmpty() && info[0]->IsFunction()) {
-    self->onstats_.Reset<v8::Function>(v8::Local<v8::Function>::Cast(info[0]));
+  if(info.Length() == 0 || !info[0]->IsFunction()) {
+    return Nan::ThrowError("Callback is required");
+  }
+
+  rtc::scoped_refptr<webrtc::MediaStreamTrackInterface> track;
+  std::string filter;
+  if(info.Length() >= 2 && info[1]->IsString()) {
+    v8::String::Utf8Value selector(info[1]->ToString());
+    filter = *selector;
+  } else if(info.Length() >= 2 && !info[1]->IsNullOrUndefined()) {
+    track = MediaStreamTrack::Unwrap(info[1]);
+    if(!track.get()) {
+      return Nan::ThrowError("Invalid selector");
+    }
   }
 
-  if(!peer_connection->GetStats(self->stats_observer_.get(), 0,
-      webrtc::PeerConnectionInterface::kStatsOutputLevelStandard)) {
-    v8::Local<v8::Function> callback = Nan::New<v8::Function>(self->onstats_);
+  Nan::Callback* callback =
+    new Nan::Callback(v8::Local<v8::Function>::Cast(info[0]));
+
+  self->stats_observer_->Request(filter);
+  bool requested;
+  {
+    BlockingCall call(&get_stats_call);
+    requested = peer_connection->GetStats(self->stats_observer_.get(),
+      track.get(), webrtc::PeerConnectionInterface::kStatsOutputLevelStandard);
+  }
+  if(!requested) {
+    self->stats_observer_->Cancel();
     v8::Local<v8::Value> argv[1] = { Nan::Null() };
     callback->Call(info.This(), 1, argv);
-    self->onstats_.Reset();
+    delete callback;
+  } else {
+    self->stats_callbacks_.push_back(callback);
   }
 
   info.GetReturnValue().SetUndefined();
@@ -362,16 +586,32 @@ NAN_METHOD(PeerConnection::AddStream) {
   LOG(LS_INFO) << __FUNCTION__;
 
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  WebRtcJs::FactoryId factory;
   rtc::scoped_refptr<webrtc::MediaStreamInterface> media_stream =
-    MediaStream::Unwrap(info[0]);
-  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
+    MediaStream::Unwrap(info[0], &factory);
   info.GetReturnValue().SetUndefined();
   if(!media_stream.get()) {
     return Nan::ThrowError("Bad pointer to MediaStreamInterface");
   }
+  // The PeerConnection would use the stream off its signaling thread. While
+  // it is created only a requested factory is known up front, the replay
+  // reports other mismatches.
+  if(self->creating_ && self->requested_factory_.index >= 0 &&
+      factory != self->requested_factory_) {
+    return Nan::ThrowError(
+      FactoryMismatch(factory, self->requested_factory_).c_str());
+  }
+  if(self->Defer("addStream", info)) {
+    return;
+  }
+  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
   if(!peer_connection) {
     return Nan::ThrowError("Bad pointer to PeerConnectionInterface");
   }
+  if(factory != self->factory_) {
+    return Nan::ThrowError(FactoryMismatch(factory, self->factory_).c_str());
+  }
+  BlockingCall call(&add_stream_call);
   if(!peer_connection->AddStream(media_stream)) {
     return Nan::ThrowError("AddStream Failed");
   }
@@ -381,54 +621,185 @@ NAN_METHOD(PeerConnection::RemoveStream) {
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
   rtc::scoped_refptr<webrtc::MediaStreamInterface> media_stream =
     MediaStream::Unwrap(info[0]);
-  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
   info.GetReturnValue().SetUndefined();
   if(!media_stream.get()) {
     return Nan::ThrowError("Bad pointer to MediaStreamInterface");
   }
+  if(self->Defer("removeStream", info)) {
+    return;
+  }
+  webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
   if(!peer_connection) {
     return Nan::ThrowError("Bad pointer to PeerConnectionInterface");
   }
+  BlockingCall call(&remove_stream_call);
   peer_connection->RemoveStream(media_stream);
 }
 
 NAN_METHOD(PeerConnection::Close) {
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  if(self->Defer("close", info)) {
+    return;
+  }
   webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
   if(!peer_connection) {
     return;
   }
-  peer_connection->Close();
+  self->EndEventLog(nullptr);
+  self->timing_->Detach();
+  {
+    BlockingCall call(&close_call);
+    peer_connection->Close();
+  }
+  StatsSampler::Remove(self->stats_id_);
+  WebRtcJs::ReleaseFactory(self->factory_);
+  self->factory_ = WebRtcJs::FactoryId();
   info.GetReturnValue().SetUndefined();
 }
 
-NAN_GETTER(PeerConnection::GetSignalingState) {
+// startEventLog(path[, maxBytes]) records the RtcEventLog of this session,
+// WebRTC itself stops after maxBytes.
+NAN_METHOD(PeerConnection::StartEventLog) {
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  if(self->Defer("startEventLog", info)) {
+    return;
+  }
   webrtc::PeerConnectionInterface* peer_connection = self->GetPeerConnection();
-  info.GetReturnValue().SetUndefined();
   if(!peer_connection) {
+    return Nan::ThrowError("Internal error");
+  }
+  if(info.Length() == 0 || !info[0]->IsString()) {
+    return Nan::ThrowError("Invalid path");
+  }
+  int64_t max_bytes = -1;
+  if(info.Length() >= 2 && !info[1]->IsUndefined()) {
+    if(!info[1]->IsNumber() || info[1]->IntegerValue() <= 0) {
+      return Nan::ThrowError("Invalid maxBytes");
+    }
+    max_bytes = info[1]->IntegerValue();
+  }
+  if(self->event_log_.get()) {
+    return Nan::ThrowError("Event log already started");
+  }
+
+  v8::String::Utf8Value path(info[0]->ToString());
+  std::unique_ptr<EventLogWriter> writer(EventLogWriter::Open(*path));
+  if(!writer.get()) {
+    return Nan::ThrowError((std::string("Could not open ") + *path).c_str());
+  }
+  int fd = writer->TakeFd();
+  bool started;
+  {
+    BlockingCall call(&start_event_log_call);
+    started = peer_connection->StartRtcEventLog(fd, max_bytes);
+  }
+  if(!started) {
+    close(fd);
+    EventLogWriter::Close(writer.release(), nullptr);
+    return Nan::ThrowError("Could not start the event log");
+  }
+  self->event_log_ = std::move(writer);
+  info.GetReturnValue().SetUndefined();
+}
+
+// stopEventLog([callback]), callback(error, {bytesWritten, bytesDropped})
+// runs once the file is complete.
+NAN_METHOD(PeerConnection::StopEventLog) {
+  PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  if(self->Defer("stopEventLog", info)) {
     return;
   }
-  webrtc::PeerConnectionInterface::SignalingState
-    state(peer_connection->signaling_state());
-  switch(state) {
-    case webrtc::PeerConnectionInterface::kStable:
-      return info.GetReturnValue().Set(Nan::New("stable").ToLocalChecked());
-    case webrtc::PeerConnectionInterface::kHaveLocalOffer:
-      return info.GetReturnValue().Set(Nan::New("have-local-offer")
-        .ToLocalChecked());
-    case webrtc::PeerConnectionInterface::kHaveLocalPrAnswer:
-      return info.GetReturnValue().Set(Nan::New("have-local-pranswer")
-        .ToLocalChecked());
-    case webrtc::PeerConnectionInterface::kHaveRemoteOffer:
-      return info.GetReturnValue().Set(Nan::New("have-remote-offer")
-        .ToLocalChecked());
-    case webrtc::PeerConnectionInterface::kHaveRemotePrAnswer:
-      return info.GetReturnValue().Set(Nan::New("have-remote-pranswer")
-        .ToLocalChecked());
-    default:
-      return info.GetReturnValue().Set(Nan::New("closed").ToLocalChecked());
+  Nan::Callback* callback = nullptr;
+  if(info.Length() >= 1 && info[0]->IsFunction()) {
+    callback = new Nan::Callback(v8::Local<v8::Function>::Cast(info[0]));
+  }
+  self->EndEventLog(callback);
+  info.GetReturnValue().SetUndefined();
+}
+
+void PeerConnection::EndEventLog(Nan::Callback* callback) {
+  if(!event_log_.get()) {
+    if(callback) {
+      Nan::HandleScope scope;
+      v8::Local<v8::Value> argv[1] = { Nan::Error("No event log started") };
+      callback->Call(1, argv);
+      delete callback;
+    }
+    return;
+  }
+  // Closes the pipe, the rest of the log drains off the JS thread.
+  if(peer_connection_.get()) {
+    BlockingCall call(&stop_event_log_call);
+    peer_connection_->StopRtcEventLog();
+  }
+  EventLogWriter::Close(event_log_.release(), callback);
+}
+
+NAN_GETTER(PeerConnection::GetSetupTiming) {
+  PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  info.GetReturnValue().Set(self->timing_->ToObject());
+}
+
+NAN_GETTER(PeerConnection::GetStatsId) {
+  PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  info.GetReturnValue().Set(Nan::New(self->stats_id_));
+}
+
+// Index of the factory the PeerConnection runs on, undefined until it is
+// created and after close(). Streams sent on it have to use the same one,
+// the factory member of the RTCConfiguration picks it up front.
+NAN_GETTER(PeerConnection::GetFactory) {
+  PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  info.GetReturnValue().SetUndefined();
+  if(self->factory_.index >= 0) {
+    info.GetReturnValue().Set(Nan::New(self->factory_.index));
+  }
+}
+
+// The state getters read what the observer cached from its callbacks, they
+// never wait for the signaling thread. Until the PeerConnection exists they
+// report the initial states, closed and failed once its creation failed.
+NAN_GETTER(PeerConnection::GetSignalingState) {
+  PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  info.GetReturnValue().SetUndefined();
+  if(self->failed_) {
+    info.GetReturnValue().Set(Nan::New(SignalingStateName(
+      webrtc::PeerConnectionInterface::kClosed)).ToLocalChecked());
+    return;
+  }
+  if(!self->creating_ && !self->GetPeerConnection()) {
+    return;
   }
+  info.GetReturnValue().Set(Nan::New(SignalingStateName(
+    self->peer_connection_observer_->signaling_state())).ToLocalChecked());
+}
+
+NAN_GETTER(PeerConnection::GetIceConnectionState) {
+  PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  info.GetReturnValue().SetUndefined();
+  if(self->failed_) {
+    info.GetReturnValue().Set(Nan::New(IceConnectionStateName(
+      webrtc::PeerConnectionInterface::kIceConnectionFailed))
+      .ToLocalChecked());
+    return;
+  }
+  if(!self->creating_ && !self->GetPeerConnection()) {
+    return;
+  }
+  info.GetReturnValue().Set(Nan::New(IceConnectionStateName(
+    self->peer_connection_observer_->ice_connection_state()))
+    .ToLocalChecked());
+}
+
+NAN_GETTER(PeerConnection::GetIceGatheringState) {
+  PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  info.GetReturnValue().SetUndefined();
+  if(!self->creating_ && !self->GetPeerConnection()) {
+    return;
+  }
+  info.GetReturnValue().Set(Nan::New(IceGatheringStateName(
+    self->peer_connection_observer_->ice_gathering_state()))
+    .ToLocalChecked());
 }
 
 
@@ -439,6 +810,22 @@ NAN_GETTER(PeerConnection::GetOnRemoveStream) {
 }
 
 
+// Hears about calls made while the PeerConnection was created that failed
+// once replayed and have no error callback of their own.
+NAN_GETTER(PeerConnection::GetOnError) {
+  PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  return info.GetReturnValue().Set(Nan::New<v8::Function>(self->onerror_));
+}
+
+NAN_SETTER(PeerConnection::SetOnError) {
+  PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
+  self->onerror_.Reset();
+  if(!value.IsEmpty() && value->IsFunction()) {
+    self->onerror_.Reset<v8::Function>(v8::Local<v8::Function>::Cast(value));
+  }
+}
+
+
 NAN_GETTER(PeerConnection::GetOnNegotiationNeeded) {
   PeerConnection* self = Nan::ObjectWrap::Unwrap<PeerConnection>(info.Holder());
   return info.GetReturnValue().Set(Nan::New<v8::Function>(
@@ -519,13 +906,168 @@ NAN_SETTER(PeerConnection::SetOnAddStream) {
 }
 
 webrtc::PeerConnectionInterface* PeerConnection::GetPeerConnection() {
+  return peer_connection_.get();
+}
+
+void PeerConnection::Create() {
+  EventEmitter::SetReference(true);
+
+  PeerConnectionPool::Entry entry;
+  if(PeerConnectionPool::Take(
+      PeerConnectionPool::Key(config_, constraints_.get(),
+        requested_factory_), &entry)) {
+    OnCreated(entry);
+  } else {
+    creating_ = true;
+    pending_.Reset(Nan::New<v8::Array>());
+    PeerConnectionPool::Create(config_, constraints_, requested_factory_,
+      peer_connection_observer_, handle(),
+      [this](const PeerConnectionPool::Entry& entry) {
+        OnCreated(entry);
+      });
+  }
+
+  // Keeps connections with the same configuration ready for the next ones,
+  // the pool drains again once none is created for a while.
+  if(prewarm_pool_size_) {
+    PeerConnectionPool::Reserve(config_, constraints_, requested_factory_,
+      prewarm_pool_size_);
+  }
+}
+
+void PeerConnection::OnCreated(const PeerConnectionPool::Entry& entry) {
+  Nan::HandleScope scope;
+
+  if(entry.observer.get() != peer_connection_observer_.get()) {
+    // Adopted from the pool.
+    peer_connection_observer_->RemoveListener(this);
+    peer_connection_observer_ = entry.observer;
+    peer_connection_observer_->AddListener(this);
+    peer_connection_observer_->set_timing(timing_);
+  }
+  peer_connection_ = entry.peer_connection;
+  factory_ = entry.factory;
+  creating_ = false;
   if(!peer_connection_.get()) {
-    EventEmitter::SetReference(true);
-    peer_connection_ = WebRtcJs::GetPeerConnectionFactory()->
-      CreatePeerConnection(config_, constraints_->ToConstraints(), nullptr,
-        nullptr, peer_connection_observer_.get());
+    failed_ = true;
+    FailPending();
+    return;
+  }
+  stats_id_ = StatsSampler::Add(peer_connection_);
+  timing_->Attach(peer_connection_);
+  timing_->Mark(SetupTiming::kCreated);
+
+  if(pending_.IsEmpty()) {
+    return;
+  }
+  v8::Local<v8::Array> pending = Nan::New(pending_);
+  pending_.Reset();
+  for(uint32_t index = 0; index < pending->Length(); index++) {
+    v8::Local<v8::Array> call = v8::Local<v8::Array>::Cast(pending->Get(index));
+    v8::Local<v8::Array> args = v8::Local<v8::Array>::Cast(call->Get(1));
+    v8::Local<v8::Value> method = Nan::Get(handle(), call->Get(0))
+      .ToLocalChecked();
+    if(!method->IsFunction()) {
+      continue;
+    }
+    std::vector<v8::Local<v8::Value>> argv;
+    for(uint32_t arg = 0; arg < args->Length(); arg++) {
+      argv.push_back(args->Get(arg));
+    }
+    // The caller is gone, a throw goes to the failure callback of the call
+    // or to onerror instead of becoming an uncaught exception.
+    Nan::TryCatch try_catch;
+    v8::Local<v8::Function>::Cast(method)->Call(handle(),
+      static_cast<int>(argv.size()), argv.empty() ? nullptr : &argv[0]);
+    if(!try_catch.HasCaught()) {
+      continue;
+    }
+    v8::Local<v8::Value> error = try_catch.Exception();
+    try_catch.Reset();
+    v8::String::Utf8Value name(call->Get(0));
+    if(FailCall(*name, args, error)) {
+      continue;
+    }
+    v8::Local<v8::Function> onerror = Nan::New<v8::Function>(onerror_);
+    if(!onerror.IsEmpty() && onerror->IsFunction()) {
+      v8::Local<v8::Value> error_argv[1] = { error };
+      Nan::Callback callback(onerror);
+      callback.Call(1, error_argv);
+    } else {
+      v8::String::Utf8Value message(error);
+      LOG(LS_ERROR) << __FUNCTION__ << ": Deferred " << *name
+                    << "() failed: " << *message;
+    }
   }
-  return peer_connection_.get();
+}
+
+// Hands a deferred call that failed its error callback, getStats() its
+// callback with null. False if the call has none.
+bool PeerConnection::FailCall(const std::string& method,
+    v8::Local<v8::Array> args, v8::Local<v8::Value> error) {
+  int position = FailureCallback(method);
+  if(position < 0) {
+    return false;
+  }
+  v8::Local<v8::Value> handler = args->Get(position);
+  if(handler.IsEmpty() || !handler->IsFunction()) {
+    return false;
+  }
+  v8::Local<v8::Value> argv[1] = {
+    method == "getStats" ? v8::Local<v8::Value>(Nan::Null()) : error
+  };
+  Nan::Callback callback(v8::Local<v8::Function>::Cast(handler));
+  callback.Call(1, argv);
+  return true;
+}
+
+// Fires oniceconnectionstatechange with "failed", then fails the calls
+// made meanwhile, see FailCall(). Calls without a callback are dropped,
+// nothing would report their failure.
+void PeerConnection::FailPending() {
+  EventEmitter::SetReference(false);
+
+  v8::Local<v8::Function> fn = Nan::New<v8::Function>(
+    oniceconnectionstatechange_);
+  if(!fn.IsEmpty() && fn->IsFunction()) {
+    v8::Local<v8::Value> argv[1] = {
+      Nan::New(IceConnectionStateName(
+        webrtc::PeerConnectionInterface::kIceConnectionFailed))
+        .ToLocalChecked()
+    };
+    Nan::Callback callback(fn);
+    callback.Call(1, argv);
+  }
+
+  if(pending_.IsEmpty()) {
+    return;
+  }
+  v8::Local<v8::Array> pending = Nan::New(pending_);
+  pending_.Reset();
+  for(uint32_t index = 0; index < pending->Length(); index++) {
+    v8::Local<v8::Array> call = v8::Local<v8::Array>::Cast(pending->Get(index));
+    v8::Local<v8::Array> args = v8::Local<v8::Array>::Cast(call->Get(1));
+    v8::String::Utf8Value method(call->Get(0));
+    FailCall(*method, args, Nan::Error("Failed to create the PeerConnection"));
+  }
+}
+
+bool PeerConnection::Defer(const char* method,
+    Nan::NAN_METHOD_ARGS_TYPE info) {
+  if(!creating_) {
+    return false;
+  }
+  v8::Local<v8::Array> args = Nan::New<v8::Array>(info.Length());
+  for(int index = 0; index < info.Length(); index++) {
+    args->Set(index, info[index]);
+  }
+  v8::Local<v8::Array> call = Nan::New<v8::Array>(2);
+  call->Set(0, Nan::New(method).ToLocalChecked());
+  call->Set(1, args);
+  v8::Local<v8::Array> pending = Nan::New(pending_);
+  pending->Set(pending->Length(), call);
+  info.GetReturnValue().SetUndefined();
+  return true;
 }
 
 MediaConstraints* PeerConnection::GetConstraints() {
@@ -545,25 +1087,32 @@ void PeerConnection::On(Event *event) {
   v8::Local<v8::Object> container;
   bool isError = false;
   std::string data;
+  rtc::scoped_ptr<Nan::Callback> stats;
 
   switch(type) {
     case kPeerConnectionAddStream:
       fn = Nan::New<v8::Function>(onaddstream_);
       argv[0] = MediaStream::New(
-        event->Unwrap<rtc::scoped_refptr<webrtc::MediaStreamInterface>>());
+        event->Unwrap<rtc::scoped_refptr<webrtc::MediaStreamInterface>>(),
+        factory_);
       argc = 1;
       break;
 
     case kPeerConnectionRemoveStream:
       fn = Nan::New<v8::Function>(onremovestream_);
       argv[0] = MediaStream::New(
-        event->Unwrap<rtc::scoped_refptr<webrtc::MediaStreamInterface>>());
+        event->Unwrap<rtc::scoped_refptr<webrtc::MediaStreamInterface>>(),
+        factory_);
       argc = 1;
       break;
 
     case kPeerConnectionStats:
-      fn = Nan::New<v8::Function>(onstats_);
-      argv[0] = { Nan::Null() };
+      if(!stats_callbacks_.empty()) {
+        stats.reset(stats_callbacks_.front());
+        stats_callbacks_.pop_front();
+        fn = stats->GetFunction();
+      }
+      argv[0] = event->Unwrap<rtc::scoped_refptr<CompactStats>>()->ToObject();
       argc = 1;
       break;
 
@@ -609,6 +1158,10 @@ void PeerConnection::On(Event *event) {
 
     case kPeerConnectionIceChange:
       fn = Nan::New<v8::Function>(oniceconnectionstatechange_);
+      argv[0] = Nan::New(IceConnectionStateName(event->Unwrap<
+        webrtc::PeerConnectionInterface::IceConnectionState>()))
+        .ToLocalChecked();
+      argc = 1;
       break;
 
     case kPeerConnectionIceCandidate:
@@ -673,6 +1226,8 @@ void PeerConnection::On(Event *event) {
   }
 
   if(!fn.IsEmpty() && fn->IsFunction()) {
+    TRACE_EVENT1("webrtcjs", "PeerConnection callback", "type",
+      static_cast<int>(type));
     Nan::Callback cb(fn);
     cb.Call(argc, argv);
   } else if(isError) {
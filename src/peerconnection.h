@@ -2,6 +2,9 @@
 #define WEBRTCJS_PEERCONNECTION_H
 
 #include <nan.h>
+#include <deque>
+#include <memory>
+#include <string>
 
 #include "webrtc/base/scoped_ptr.h"
 #include "webrtc/api/videosourceinterface.h"
@@ -10,9 +13,13 @@
 
 #include "webrtcjs.h"
 #include "eventemitter.h"
+#include "eventlogwriter.h"
 #include "observers.h"
 #include "mediastream.h"
 #include "mediaconstraints.h"
+#include "peerconnectionpool.h"
+#include "rtcconfiguration.h"
+#include "setuptiming.h"
 
 class PeerConnection : public Nan::ObjectWrap, public EventEmitter {
  public:
@@ -22,6 +29,10 @@ class PeerConnection : public Nan::ObjectWrap, public EventEmitter {
   MediaConstraints* GetConstraints();
 
   webrtc::PeerConnectionInterface::RTCConfiguration config_;
+  uint32_t prewarm_pool_size_;
+  // The factory option of the RTCConfiguration, unset to leave it to the
+  // pool.
+  WebRtcJs::FactoryId requested_factory_;
 
   Nan::Persistent<v8::Function> offer_cb_;
   Nan::Persistent<v8::Function> offer_err_cb_;
@@ -35,7 +46,9 @@ class PeerConnection : public Nan::ObjectWrap, public EventEmitter {
   Nan::Persistent<v8::Function> remote_sdp_cb_;
   Nan::Persistent<v8::Function> remote_sdp_err_cb_;
 
-  Nan::Persistent<v8::Function> onstats_;
+  // One per getStats() in flight, in the order they complete.
+  std::deque<Nan::Callback*> stats_callbacks_;
+
   Nan::Persistent<v8::Function> ondatachannel_;
 
  //  Nan::Persistent<v8::Function> _onstats;
@@ -54,7 +67,6 @@ class PeerConnection : public Nan::ObjectWrap, public EventEmitter {
   explicit PeerConnection(const v8::Local<v8::Object> &configuration,
     const v8::Local<v8::Object> &constraints);
   ~PeerConnection();
-  static Nan::Persistent<v8::Function> constructor;
 
   static NAN_METHOD(New);
   static NAN_METHOD(CreateOffer);
@@ -67,6 +79,12 @@ class PeerConnection : public Nan::ObjectWrap, public EventEmitter {
   static NAN_METHOD(RemoveStream);
   static NAN_METHOD(IsStable);
   static NAN_METHOD(Close);
+  static NAN_METHOD(StartEventLog);
+  static NAN_METHOD(StopEventLog);
+
+  Nan::Persistent<v8::Function> onerror_;
+  static NAN_GETTER(GetOnError);
+  static NAN_SETTER(SetOnError);
 
   Nan::Persistent<v8::Function> onnegotiationneeded_;
   static NAN_GETTER(GetOnNegotiationNeeded);
@@ -92,13 +110,39 @@ class PeerConnection : public Nan::ObjectWrap, public EventEmitter {
   static NAN_GETTER(GetOnRemoveStream);
 
   static NAN_GETTER(GetSignalingState);
+  static NAN_GETTER(GetIceConnectionState);
+  static NAN_GETTER(GetIceGatheringState);
+  static NAN_GETTER(GetStatsId);
+  static NAN_GETTER(GetFactory);
+  static NAN_GETTER(GetSetupTiming);
 
   void On(Event* event) final;
 
+  void Create();
+  void OnCreated(const PeerConnectionPool::Entry& entry);
+  bool Defer(const char* method, Nan::NAN_METHOD_ARGS_TYPE info);
+  bool FailCall(const std::string& method, v8::Local<v8::Array> args,
+    v8::Local<v8::Value> error);
+  void FailPending();
+
+  // Calls made before the PeerConnection exists, replayed in order.
+  Nan::Persistent<v8::Array> pending_;
+  bool creating_;
+  // The asynchronous creation failed, the states read closed and failed.
+  bool failed_;
+
   rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection_;
   rtc::scoped_refptr<MediaConstraints> constraints_;
-  rtc::scoped_ptr<rtc::Thread> signaling_thread_;
-  rtc::scoped_ptr<rtc::Thread> worker_thread_;
+  WebRtcJs::FactoryId factory_;
+  // Tells this PeerConnection's getSampledStats() entries apart, 0 until
+  // it exists.
+  uint32_t stats_id_;
+
+  rtc::scoped_refptr<SetupTiming> timing_;
+
+  // Set while startEventLog() records this PeerConnection.
+  std::unique_ptr<EventLogWriter> event_log_;
+  void EndEventLog(Nan::Callback* callback);
 
 
   // static void CreateDataChannel(const Nan::FunctionCallbackInfo<v8::Value> &info);
@@ -0,0 +1,333 @@
+#include "peerconnectionpool.h"
+
+#include <memory>
+#include <sstream>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+
+#include "webrtcjs.h"
+#include "certificatepool.h"
+#include "metrics.h"
+#include "rtcconfiguration.h"
+
+static const uint32_t kMaxPoolSize = 256;
+
+class CreatePeerConnectionWorker : public Nan::AsyncWorker {
+ public:
+  CreatePeerConnectionWorker(
+      rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory,
+      const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+      rtc::scoped_refptr<MediaConstraints> constraints,
+      const PeerConnectionPool::Entry& entry,
+      PeerConnectionPool::CreateCallback callback) :
+      Nan::AsyncWorker(nullptr),
+      factory_(factory),
+      config_(config),
+      constraints_(constraints),
+      entry_(entry),
+      callback_(callback) { }
+
+  void Execute() override {
+    // Blocks on the signaling thread of the factory, off the JS thread.
+    std::unique_ptr<cricket::PortAllocator> allocator(
+      WebRtcJs::CreatePortAllocator(entry_.factory));
+    entry_.peer_connection = factory_->CreatePeerConnection(config_,
+      constraints_->ToConstraints(), std::move(allocator), nullptr,
+      entry_.observer.get());
+    if(entry_.peer_connection.get()) {
+      entry_.observer->Track();
+    }
+  }
+
+  void HandleOKCallback() override {
+    PeerConnectionPool::in_flight_--;
+    if(!entry_.peer_connection.get()) {
+      LOG(LS_ERROR) << __FUNCTION__ << ": CreatePeerConnection failed";
+      WebRtcJs::ReleaseFactory(entry_.factory);
+      entry_.factory = WebRtcJs::FactoryId();
+    }
+    callback_(entry_);
+  }
+
+ private:
+  rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory_;
+  webrtc::PeerConnectionInterface::RTCConfiguration config_;
+  rtc::scoped_refptr<MediaConstraints> constraints_;
+  PeerConnectionPool::Entry entry_;
+  PeerConnectionPool::CreateCallback callback_;
+};
+
+rtc::CriticalSection PeerConnectionPool::lock_;
+std::map<v8::Isolate*, std::map<std::string, PeerConnectionPool::Pool>>
+  PeerConnectionPool::pools_;
+std::atomic<uint32_t> PeerConnectionPool::next_generation_(1);
+std::atomic<int> PeerConnectionPool::in_flight_(0);
+std::map<v8::Isolate*, uv_timer_t*> PeerConnectionPool::timers_;
+
+NAN_MODULE_INIT(PeerConnectionPool::Init) {
+  Nan::SetMethod(target, "prewarmPeerConnections",
+    PeerConnectionPool::Prewarm);
+}
+
+void PeerConnectionPool::Create(
+    const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+    rtc::scoped_refptr<MediaConstraints> constraints,
+    const WebRtcJs::FactoryId& factory,
+    rtc::scoped_refptr<PeerConnectionObserver> observer,
+    v8::Local<v8::Object> owner, CreateCallback callback) {
+  Entry entry;
+  entry.observer = observer;
+  entry.factory = WebRtcJs::AcquireFactory(factory.index >= 0 ? &factory :
+    nullptr);
+  in_flight_++;
+
+  webrtc::PeerConnectionInterface::RTCConfiguration pc_config(config);
+  if(pc_config.certificates.empty()) {
+    rtc::scoped_refptr<rtc::RTCCertificate> certificate =
+      CertificatePool::Acquire();
+    if(certificate.get()) {
+      pc_config.certificates.push_back(certificate);
+    }
+  }
+
+  CreatePeerConnectionWorker* worker = new CreatePeerConnectionWorker(
+    WebRtcJs::GetPeerConnectionFactory(entry.factory), pc_config, constraints,
+    entry, callback);
+  if(!owner.IsEmpty()) {
+    worker->SaveToPersistent("owner", owner);
+  }
+  Nan::AsyncQueueWorker(worker);
+}
+
+std::string PeerConnectionPool::Key(
+    const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+    MediaConstraints* constraints, const WebRtcJs::FactoryId& factory) {
+  std::ostringstream key;
+  // Placed connections only serve their factory.
+  if(factory.index >= 0) {
+    key << "f:" << factory.index << ";";
+  }
+  key << config.type << ";" << config.bundle_policy << ";"
+      << config.rtcp_mux_policy << ";" << config.tcp_candidate_policy << ";"
+      << config.continual_gathering_policy << ";" << config.disable_ipv6
+      << ";";
+
+  webrtc::PeerConnectionInterface::IceServers::const_iterator server;
+  for(server = config.servers.begin(); server != config.servers.end();
+      server++) {
+    key << "[" << server->uri;
+    std::vector<std::string>::const_iterator url;
+    for(url = server->urls.begin(); url != server->urls.end(); url++) {
+      key << "," << *url;
+    }
+    key << "|" << server->username << "|" << server->password << "]";
+  }
+  key << ";";
+
+  if(constraints) {
+    webrtc::MediaConstraintsInterface::Constraints::const_iterator constraint;
+    const webrtc::MediaConstraintsInterface::Constraints& mandatory =
+      constraints->GetMandatory();
+    for(constraint = mandatory.begin(); constraint != mandatory.end();
+        constraint++) {
+      key << "m:" << constraint->key << "=" << constraint->value << ";";
+    }
+    const webrtc::MediaConstraintsInterface::Constraints& optional =
+      constraints->GetOptional();
+    for(constraint = optional.begin(); constraint != optional.end();
+        constraint++) {
+      key << "o:" << constraint->key << "=" << constraint->value << ";";
+    }
+  }
+  return key.str();
+}
+
+bool PeerConnectionPool::Take(const std::string& key, Entry* entry) {
+  std::map<std::string, Pool>& pools = Pools();
+  std::map<std::string, Pool>::iterator pool = pools.find(key);
+  if(pool == pools.end() || pool->second.entries.empty()) {
+    return false;
+  }
+  *entry = pool->second.entries.front();
+  pool->second.entries.pop_front();
+  Metrics::Add(Metrics::kPoolPeerConnectionsReady, -1);
+  Refill(key);
+  return true;
+}
+
+std::map<std::string, PeerConnectionPool::Pool>& PeerConnectionPool::Pools() {
+  // Other isolates only add their own entries, references stay valid.
+  rtc::CritScope lock(&lock_);
+  return pools_[v8::Isolate::GetCurrent()];
+}
+
+PeerConnectionPool::Pool& PeerConnectionPool::GetPool(
+    const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+    rtc::scoped_refptr<MediaConstraints> constraints,
+    const WebRtcJs::FactoryId& factory, std::string* key) {
+  *key = Key(config, constraints.get(), factory);
+  Pool& pool = Pools()[*key];
+  if(!pool.generation) {
+    pool.generation = next_generation_++;
+    pool.config = config;
+    pool.constraints = constraints;
+    pool.factory = factory;
+  }
+  return pool;
+}
+
+void PeerConnectionPool::Reserve(
+    const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+    rtc::scoped_refptr<MediaConstraints> constraints,
+    const WebRtcJs::FactoryId& factory, size_t size) {
+  std::string key;
+  Pool& pool = GetPool(config, constraints, factory, &key);
+  pool.used_ms = rtc::TimeMillis();
+  {
+    rtc::CritScope lock(&lock_);
+    uv_timer_t*& timer = timers_[v8::Isolate::GetCurrent()];
+    if(!timer) {
+      timer = new uv_timer_t();
+      uv_timer_init(Nan::GetCurrentEventLoop(), timer);
+      uv_timer_start(timer, PeerConnectionPool::Expire, kIdleTimeoutMs,
+        kIdleTimeoutMs);
+      uv_unref(reinterpret_cast<uv_handle_t*>(timer));
+    }
+  }
+  if(pool.target < size) {
+    pool.target = size;
+    Refill(key);
+  }
+}
+
+void PeerConnectionPool::Refill(const std::string& key) {
+  std::map<std::string, Pool>& pools = Pools();
+  std::map<std::string, Pool>::iterator index = pools.find(key);
+  if(index == pools.end()) {
+    return;
+  }
+  Pool& pool = index->second;
+  while(pool.entries.size() + pool.pending < pool.target) {
+    pool.pending++;
+    Metrics::Add(Metrics::kPoolPeerConnectionsPending);
+    // Nothing listens until a PeerConnection adopts the entry.
+    rtc::scoped_refptr<PeerConnectionObserver> observer =
+      new rtc::RefCountedObject<PeerConnectionObserver>();
+    uint32_t generation = pool.generation;
+    Create(pool.config, pool.constraints, pool.factory, observer,
+      v8::Local<v8::Object>(),
+      [key, generation](const Entry& entry) {
+        Metrics::Add(Metrics::kPoolPeerConnectionsPending, -1);
+        std::map<std::string, Pool>& pools = Pools();
+        std::map<std::string, Pool>::iterator index = pools.find(key);
+        if(index == pools.end() || index->second.generation != generation) {
+          Release(entry);
+          return;
+        }
+        index->second.pending--;
+        if(!entry.peer_connection.get()) {
+          return;
+        }
+        if(index->second.entries.size() >= index->second.target) {
+          Release(entry);
+          return;
+        }
+        index->second.entries.push_back(entry);
+        Metrics::Add(Metrics::kPoolPeerConnectionsReady);
+      });
+  }
+}
+
+void PeerConnectionPool::Resize(Pool* pool, size_t target) {
+  pool->target = target;
+  while(pool->entries.size() > pool->target) {
+    Release(pool->entries.back());
+    pool->entries.pop_back();
+    Metrics::Add(Metrics::kPoolPeerConnectionsReady, -1);
+  }
+}
+
+void PeerConnectionPool::Expire(uv_timer_t* timer) {
+  int64_t now_ms = rtc::TimeMillis();
+  std::map<std::string, Pool>& pools = Pools();
+  std::map<std::string, Pool>::iterator pool;
+  for(pool = pools.begin(); pool != pools.end(); pool++) {
+    if(pool->second.target > pool->second.prewarmed &&
+        now_ms - pool->second.used_ms >= kIdleTimeoutMs) {
+      Resize(&pool->second, pool->second.prewarmed);
+    }
+  }
+}
+
+void PeerConnectionPool::Release(const Entry& entry) {
+  if(entry.peer_connection.get()) {
+    entry.peer_connection->Close();
+    WebRtcJs::ReleaseFactory(entry.factory);
+  }
+}
+
+void PeerConnectionPool::Clear(v8::Isolate* isolate) {
+  std::map<std::string, Pool> pools;
+  {
+    rtc::CritScope lock(&lock_);
+    std::map<v8::Isolate*, uv_timer_t*>::iterator timer =
+      timers_.find(isolate);
+    if(timer != timers_.end()) {
+      uv_close(reinterpret_cast<uv_handle_t*>(timer->second),
+        [](uv_handle_t* handle) {
+          delete reinterpret_cast<uv_timer_t*>(handle);
+        });
+      timers_.erase(timer);
+    }
+
+    std::map<v8::Isolate*, std::map<std::string, Pool>>::iterator index =
+      pools_.find(isolate);
+    if(index == pools_.end()) {
+      return;
+    }
+    pools.swap(index->second);
+    pools_.erase(index);
+  }
+
+  std::map<std::string, Pool>::iterator pool;
+  for(pool = pools.begin(); pool != pools.end(); pool++) {
+    std::deque<Entry>::iterator entry;
+    for(entry = pool->second.entries.begin();
+        entry != pool->second.entries.end(); entry++) {
+      Release(*entry);
+    }
+    Metrics::Add(Metrics::kPoolPeerConnectionsReady,
+      -static_cast<int64_t>(pool->second.entries.size()));
+  }
+  // Creations still in flight are released when they complete, see
+  // InFlight().
+}
+
+int PeerConnectionPool::InFlight() {
+  return in_flight_;
+}
+
+NAN_METHOD(PeerConnectionPool::Prewarm) {
+  RTCConfiguration configuration;
+  std::string error;
+  if(info.Length() >= 1 && !configuration.Parse(info[0], &error)) {
+    return Nan::ThrowError(error.c_str());
+  }
+  v8::Local<v8::Object> constraints;
+  if(info.Length() >= 2 && info[1]->IsObject()) {
+    constraints = v8::Local<v8::Object>::Cast(info[1]);
+  }
+  if(info.Length() < 3 || !info[2]->IsUint32() ||
+      info[2]->Uint32Value() > kMaxPoolSize) {
+    return Nan::ThrowError("Invalid pool size");
+  }
+
+  std::string key;
+  Pool& pool = GetPool(configuration.config, MediaConstraints::New(constraints),
+    configuration.factory, &key);
+  pool.prewarmed = info[2]->Uint32Value();
+  Resize(&pool, pool.prewarmed);
+  Refill(key);
+  info.GetReturnValue().SetUndefined();
+}
@@ -0,0 +1,105 @@
+#ifndef WEBRTCJS_PEERCONNECTIONPOOL_H
+#define WEBRTCJS_PEERCONNECTIONPOOL_H
+
+#include <nan.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "webrtc/api/peerconnectioninterface.h"
+#include "webrtc/base/criticalsection.h"
+
+#include "webrtcjs.h"
+#include "observers.h"
+#include "mediaconstraints.h"
+
+// Creates PeerConnections on the libuv thread pool so the JS thread never
+// waits for the signaling thread, and keeps pre-created ones around for
+// configurations registered with prewarmPeerConnections() or with the
+// prewarmPoolSize member of their RTCConfiguration.
+class PeerConnectionPool {
+ public:
+  struct Entry {
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection;
+    rtc::scoped_refptr<PeerConnectionObserver> observer;
+    WebRtcJs::FactoryId factory;
+  };
+
+  typedef std::function<void(const Entry& entry)> CreateCallback;
+
+  // Runs callback on the JS thread once the PeerConnection exists. On
+  // failure entry.peer_connection is empty and the factory is released.
+  // owner is kept alive until then.
+  // An unset factory means the least loaded one.
+  static void Create(
+    const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+    rtc::scoped_refptr<MediaConstraints> constraints,
+    const WebRtcJs::FactoryId& factory,
+    rtc::scoped_refptr<PeerConnectionObserver> observer,
+    v8::Local<v8::Object> owner, CreateCallback callback);
+
+  static std::string Key(
+    const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+    MediaConstraints* constraints, const WebRtcJs::FactoryId& factory);
+  static bool Take(const std::string& key, Entry* entry);
+  // Grows the pool for this configuration to at least size entries. Unlike
+  // prewarmPeerConnections(), a reservation lapses once the pool went
+  // kIdleTimeoutMs without a Take() or Reserve().
+  static void Reserve(
+    const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+    rtc::scoped_refptr<MediaConstraints> constraints,
+    const WebRtcJs::FactoryId& factory, size_t size);
+  // Drops the pools of an isolate, before shutdown() or when it goes away.
+  static void Clear(v8::Isolate* isolate);
+  // Creations of every isolate still on the thread pool, they cannot be
+  // cancelled once queued.
+  static int InFlight();
+
+  static NAN_MODULE_INIT(Init);
+
+ private:
+  friend class CreatePeerConnectionWorker;
+
+  static const int64_t kIdleTimeoutMs = 30000;
+
+  struct Pool {
+    Pool() : target(0), prewarmed(0), pending(0), used_ms(0), generation(0) { }
+    webrtc::PeerConnectionInterface::RTCConfiguration config;
+    rtc::scoped_refptr<MediaConstraints> constraints;
+    WebRtcJs::FactoryId factory;
+    std::deque<Entry> entries;
+    size_t target;
+    // The part of target set by prewarmPeerConnections(), never expires.
+    size_t prewarmed;
+    size_t pending;
+    int64_t used_ms;
+    // Tells creations for a cleared pool apart from the current ones.
+    uint32_t generation;
+  };
+
+  static std::map<std::string, Pool>& Pools();
+  static Pool& GetPool(
+    const webrtc::PeerConnectionInterface::RTCConfiguration& config,
+    rtc::scoped_refptr<MediaConstraints> constraints,
+    const WebRtcJs::FactoryId& factory, std::string* key);
+  static void Refill(const std::string& key);
+  static void Resize(Pool* pool, size_t target);
+  static void Release(const Entry& entry);
+  // Drops the lapsed reservations of this isolate, from its idle timer.
+  static void Expire(uv_timer_t* timer);
+
+  static NAN_METHOD(Prewarm);
+
+  // Every isolate keeps its own pools, the observers of the entries deliver
+  // events to the loop of the isolate that created them.
+  static rtc::CriticalSection lock_;
+  static std::map<v8::Isolate*, std::map<std::string, Pool>> pools_;
+  // Started by the first Reserve() of an isolate, unreferenced.
+  static std::map<v8::Isolate*, uv_timer_t*> timers_;
+  static std::atomic<uint32_t> next_generation_;
+  static std::atomic<int> in_flight_;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef WEBRTCJS_RINGBUFFER_H
+#define WEBRTCJS_RINGBUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <stddef.h>
+
+// Single producer / single consumer ring. The read and write counters run
+// freely and are masked on access, so the capacity is always a power of two.
+template<class T> class RingBuffer {
+ public:
+  explicit RingBuffer(size_t capacity=0) : read_(0), write_(0) {
+    Reset(capacity);
+  }
+
+  // Not thread safe, only call while neither side is active.
+  void Reset(size_t capacity) {
+    size_t size = 1;
+    while(size < capacity) {
+      size <<= 1;
+    }
+    buffer_.assign(size, T());
+    mask_ = size - 1;
+    read_.store(0, std::memory_order_relaxed);
+    write_.store(0, std::memory_order_relaxed);
+  }
+
+  inline size_t Capacity() const {
+    return buffer_.size();
+  }
+
+  inline size_t Size() const {
+    return write_.load(std::memory_order_acquire) -
+      read_.load(std::memory_order_acquire);
+  }
+
+  inline size_t Available() const {
+    return Capacity() - Size();
+  }
+
+  // Producer side. Returns the number of elements actually written.
+  size_t Write(const T* data, size_t count) {
+    size_t write = write_.load(std::memory_order_relaxed);
+    size_t read = read_.load(std::memory_order_acquire);
+    size_t space = Capacity() - (write - read);
+    if(count > space) {
+      count = space;
+    }
+    size_t offset = write & mask_;
+    size_t first = std::min(count, Capacity() - offset);
+    memcpy(&buffer_[offset], data, first * sizeof(T));
+    memcpy(&buffer_[0], data + first, (count - first) * sizeof(T));
+    write_.store(write + count, std::memory_order_release);
+    return count;
+  }
+
+  // Consumer side. Returns the number of elements actually read.
+  size_t Read(T* data, size_t count) {
+    size_t read = read_.load(std::memory_order_relaxed);
+    size_t write = write_.load(std::memory_order_acquire);
+    if(count > write - read) {
+      count = write - read;
+    }
+    size_t offset = read & mask_;
+    size_t first = std::min(count, Capacity() - offset);
+    memcpy(data, &buffer_[offset], first * sizeof(T));
+    memcpy(data + first, &buffer_[0], (count - first) * sizeof(T));
+    read_.store(read + count, std::memory_order_release);
+    return count;
+  }
+
+ private:
+  std::vector<T> buffer_;
+  size_t mask_;
+  std::atomic<size_t> read_;
+  std::atomic<size_t> write_;
+};
+
+#endif
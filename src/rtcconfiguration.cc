@@ -0,0 +1,180 @@
+#include "rtcconfiguration.h"
+
+#include <algorithm>
+
+static const uint32_t kMaxIceCandidatePoolSize = 255;
+static const uint32_t kMaxPrewarmPoolSize = 16;
+
+static std::string ToString(v8::Local<v8::Value> value) {
+  v8::String::Utf8Value utf8(value->ToString());
+  return std::string(*utf8);
+}
+
+bool RTCConfiguration::Parse(v8::Local<v8::Value> value, std::string* error) {
+  if(value.IsEmpty() || value->IsUndefined() || value->IsNull()) {
+    return true;
+  }
+  if(!value->IsObject()) {
+    *error = "Invalid RTCConfiguration";
+    return false;
+  }
+  v8::Local<v8::Object> object = v8::Local<v8::Object>::Cast(value);
+
+  if(!ParseIceServers(object->Get(Nan::New("iceServers").ToLocalChecked()),
+      error)) {
+    return false;
+  }
+
+  v8::Local<v8::Value> transport_value =
+    object->Get(Nan::New("iceTransportPolicy").ToLocalChecked());
+  if(transport_value->IsString()) {
+    std::string policy = ToString(transport_value);
+    if(policy == "all") {
+      config.type = webrtc::PeerConnectionInterface::kAll;
+    } else if(policy == "relay") {
+      config.type = webrtc::PeerConnectionInterface::kRelay;
+    } else if(policy == "nohost") {
+      config.type = webrtc::PeerConnectionInterface::kNoHost;
+    } else if(policy == "none") {
+      config.type = webrtc::PeerConnectionInterface::kNone;
+    } else {
+      *error = "Invalid iceTransportPolicy";
+      return false;
+    }
+  } else if(!transport_value->IsUndefined()) {
+    *error = "Invalid iceTransportPolicy";
+    return false;
+  }
+
+  v8::Local<v8::Value> bundle_value =
+    object->Get(Nan::New("bundlePolicy").ToLocalChecked());
+  if(bundle_value->IsString()) {
+    std::string policy = ToString(bundle_value);
+    if(policy == "balanced") {
+      config.bundle_policy =
+        webrtc::PeerConnectionInterface::kBundlePolicyBalanced;
+    } else if(policy == "max-compat") {
+      config.bundle_policy =
+        webrtc::PeerConnectionInterface::kBundlePolicyMaxCompat;
+    } else if(policy == "max-bundle") {
+      config.bundle_policy =
+        webrtc::PeerConnectionInterface::kBundlePolicyMaxBundle;
+    } else {
+      *error = "Invalid bundlePolicy";
+      return false;
+    }
+  } else if(!bundle_value->IsUndefined()) {
+    *error = "Invalid bundlePolicy";
+    return false;
+  }
+
+  v8::Local<v8::Value> rtcp_mux_value =
+    object->Get(Nan::New("rtcpMuxPolicy").ToLocalChecked());
+  if(rtcp_mux_value->IsString()) {
+    std::string policy = ToString(rtcp_mux_value);
+    if(policy == "negotiate") {
+      config.rtcp_mux_policy =
+        webrtc::PeerConnectionInterface::kRtcpMuxPolicyNegotiate;
+    } else if(policy == "require") {
+      config.rtcp_mux_policy =
+        webrtc::PeerConnectionInterface::kRtcpMuxPolicyRequire;
+    } else {
+      *error = "Invalid rtcpMuxPolicy";
+      return false;
+    }
+  } else if(!rtcp_mux_value->IsUndefined()) {
+    *error = "Invalid rtcpMuxPolicy";
+    return false;
+  }
+
+  // This WebRTC release cannot gather candidates ahead of a PeerConnection,
+  // prewarmed PeerConnections are the closest thing it has.
+  v8::Local<v8::Value> pool_value =
+    object->Get(Nan::New("iceCandidatePoolSize").ToLocalChecked());
+  if(pool_value->IsUint32() &&
+      pool_value->Uint32Value() <= kMaxIceCandidatePoolSize) {
+    prewarm_pool_size =
+      std::min(pool_value->Uint32Value(), kMaxPrewarmPoolSize);
+  } else if(!pool_value->IsUndefined()) {
+    *error = "Invalid iceCandidatePoolSize";
+    return false;
+  }
+
+  // Wins over iceCandidatePoolSize.
+  v8::Local<v8::Value> prewarm_value =
+    object->Get(Nan::New("prewarmPoolSize").ToLocalChecked());
+  if(prewarm_value->IsUint32() &&
+      prewarm_value->Uint32Value() <= kMaxPrewarmPoolSize) {
+    prewarm_pool_size = prewarm_value->Uint32Value();
+  } else if(!prewarm_value->IsUndefined()) {
+    *error = "Invalid prewarmPoolSize";
+    return false;
+  }
+
+  v8::Local<v8::Value> factory_value =
+    object->Get(Nan::New("factory").ToLocalChecked());
+  if(!factory_value->IsUndefined() &&
+      !WebRtcJs::ParseFactory(factory_value, &factory)) {
+    *error = "Invalid factory";
+    return false;
+  }
+  return true;
+}
+
+bool RTCConfiguration::ParseIceServers(v8::Local<v8::Value> value,
+    std::string* error) {
+  if(value->IsUndefined()) {
+    return true;
+  }
+  if(!value->IsArray()) {
+    *error = "Invalid iceServers";
+    return false;
+  }
+  v8::Local<v8::Array> servers = v8::Local<v8::Array>::Cast(value);
+  for(uint32_t index = 0; index < servers->Length(); index++) {
+    v8::Local<v8::Value> server_value = servers->Get(index);
+    if(!server_value->IsObject()) {
+      *error = "Invalid RTCIceServer";
+      return false;
+    }
+    v8::Local<v8::Object> server_object =
+      v8::Local<v8::Object>::Cast(server_value);
+    v8::Local<v8::Value> urls_value =
+      server_object->Get(Nan::New("urls").ToLocalChecked());
+    v8::Local<v8::Value> url_value =
+      server_object->Get(Nan::New("url").ToLocalChecked());
+    v8::Local<v8::Value> username_value =
+      server_object->Get(Nan::New("username").ToLocalChecked());
+    v8::Local<v8::Value> credential_value =
+      server_object->Get(Nan::New("credential").ToLocalChecked());
+
+    webrtc::PeerConnectionInterface::IceServer server;
+    if(urls_value->IsString()) {
+      server.urls.push_back(ToString(urls_value));
+    } else if(urls_value->IsArray()) {
+      v8::Local<v8::Array> urls = v8::Local<v8::Array>::Cast(urls_value);
+      for(uint32_t url = 0; url < urls->Length(); url++) {
+        if(!urls->Get(url)->IsString()) {
+          *error = "Invalid RTCIceServer.urls";
+          return false;
+        }
+        server.urls.push_back(ToString(urls->Get(url)));
+      }
+    } else if(url_value->IsString()) {
+      // Deprecated spelling, still used by older clients.
+      server.uri = ToString(url_value);
+    } else {
+      *error = "RTCIceServer.urls is required";
+      return false;
+    }
+
+    if(username_value->IsString()) {
+      server.username = ToString(username_value);
+    }
+    if(credential_value->IsString()) {
+      server.password = ToString(credential_value);
+    }
+    config.servers.push_back(server);
+  }
+  return true;
+}
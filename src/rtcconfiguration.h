@@ -0,0 +1,36 @@
+#ifndef WEBRTCJS_RTCCONFIGURATION_H
+#define WEBRTCJS_RTCCONFIGURATION_H
+
+#include <nan.h>
+#include <string>
+
+#include "webrtc/api/peerconnectioninterface.h"
+
+#include "webrtcjs.h"
+
+// Reads the RTCConfiguration dictionary of the WebRTC spec: iceServers,
+// iceTransportPolicy, bundlePolicy, rtcpMuxPolicy and iceCandidatePoolSize,
+// plus the prewarmPoolSize and factory extensions.
+class RTCConfiguration {
+ public:
+  RTCConfiguration() : prewarm_pool_size(0) { }
+
+  // Leaves the defaults for missing members, returns false with a message
+  // for malformed ones.
+  bool Parse(v8::Local<v8::Value> value, std::string* error);
+
+  webrtc::PeerConnectionInterface::RTCConfiguration config;
+  // PeerConnections with this configuration kept created ahead of time,
+  // see PeerConnectionPool::Reserve(). This WebRTC release cannot gather
+  // before a PeerConnection exists, so iceCandidatePoolSize sets this too,
+  // capped at 16, unless prewarmPoolSize is given.
+  uint32_t prewarm_pool_size;
+  // The factory to create the PeerConnection on, so it can send the streams
+  // made there. Unset (index -1) lets the pool pick the least loaded one.
+  WebRtcJs::FactoryId factory;
+
+ private:
+  bool ParseIceServers(v8::Local<v8::Value> value, std::string* error);
+};
+
+#endif
@@ -0,0 +1,249 @@
+#include "setuptiming.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "webrtc/base/messagequeue.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/base/timeutils.h"
+
+#include "metrics.h"
+
+// Probes back off from the first interval to the last, a stats collection
+// costs the signaling thread about as much as a small offer.
+static const int kProbeIntervalMs = 100;
+static const int kMaxProbeIntervalMs = 1600;
+static const int64_t kProbeTimeoutMs = 30 * 1000;
+
+enum {
+  kMessageProbe,
+  kMessageUnwatch,
+};
+
+static const char* kPhaseNames[] = {
+  "created",
+  "offerCreated",
+  "answerCreated",
+  "localDescription",
+  "remoteDescription",
+  "firstCandidate",
+  "iceChecking",
+  "iceConnected",
+  "dtlsConnected",
+  "firstRtp",
+  "firstFrame",
+};
+
+static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) ==
+  SetupTiming::kPhaseCount, "kPhaseNames must match SetupTiming::Phase");
+
+static std::vector<std::unique_ptr<Histogram>> CreateHistograms() {
+  std::vector<std::unique_ptr<Histogram>> histograms;
+  for(int phase = 0; phase < SetupTiming::kPhaseCount; phase++) {
+    histograms.push_back(std::unique_ptr<Histogram>(new Histogram(
+      "webrtcjs_setup_seconds",
+      "Time from new RTCPeerConnection() until each setup phase.",
+      std::string("phase=\"") + kPhaseNames[phase] + "\"",
+      Histogram::LatencyBounds())));
+  }
+  return histograms;
+}
+
+static std::vector<std::unique_ptr<Histogram>> histograms_ =
+  CreateHistograms();
+
+static bool HasValue(const webrtc::StatsReport* report,
+    webrtc::StatsReport::StatsValueName name) {
+  const webrtc::StatsReport::Value* value = report->FindValue(name);
+  return value && !value->ToString().empty();
+}
+
+static bool IsPositive(const webrtc::StatsReport* report,
+    webrtc::StatsReport::StatsValueName name) {
+  const webrtc::StatsReport::Value* value = report->FindValue(name);
+  return value && value->ToString() != "0";
+}
+
+//
+// SetupTiming::Handler
+//
+// Posted messages carry a reference, the timing may be detached meanwhile.
+class SetupTiming::Handler : public rtc::MessageHandler {
+ public:
+  void OnMessage(rtc::Message* msg) override {
+    rtc::scoped_ptr<rtc::ScopedRefMessageData<SetupTiming>> data(
+      static_cast<rtc::ScopedRefMessageData<SetupTiming>*>(msg->pdata));
+    if(msg->message_id == kMessageUnwatch) {
+      data->data()->Unwatch();
+    } else {
+      data->data()->Probe();
+    }
+  }
+};
+
+rtc::MessageHandler* SetupTiming::handler() {
+  static Handler* handler = new Handler();
+  return handler;
+}
+
+//
+// SetupTiming
+//
+SetupTiming::SetupTiming() :
+    start_us_(rtc::TimeMicros()),
+    watch_thread_(nullptr),
+    probing_(false),
+    probe_interval_ms_(kProbeIntervalMs),
+    probe_deadline_ms_(0) {
+  for(int phase = 0; phase < kPhaseCount; phase++) {
+    phases_[phase] = -1;
+  }
+}
+
+bool SetupTiming::Mark(Phase phase) {
+  if(phases_[phase].load(std::memory_order_relaxed) >= 0) {
+    return false;
+  }
+  int64_t elapsed_us = rtc::TimeMicros() - start_us_;
+  int64_t unset = -1;
+  if(!phases_[phase].compare_exchange_strong(unset, elapsed_us)) {
+    return false;
+  }
+  histograms_[phase]->Observe(
+    static_cast<double>(elapsed_us) / rtc::kNumMicrosecsPerSec);
+  return true;
+}
+
+void SetupTiming::Attach(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection) {
+  rtc::CritScope lock(&lock_);
+  peer_connection_ = peer_connection;
+}
+
+void SetupTiming::Detach() {
+  {
+    rtc::CritScope lock(&lock_);
+    peer_connection_ = nullptr;
+  }
+  Unwatch();
+}
+
+void SetupTiming::Unwatch() {
+  std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>> tracks;
+  {
+    rtc::CritScope lock(&lock_);
+    tracks.swap(tracks_);
+  }
+  std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>>::iterator
+    track;
+  for(track = tracks.begin(); track != tracks.end(); track++) {
+    (*track)->RemoveSink(this);
+  }
+}
+
+void SetupTiming::StartProbing() {
+  {
+    rtc::CritScope lock(&lock_);
+    if(probing_ || !peer_connection_.get()) {
+      return;
+    }
+    probing_ = true;
+    probe_interval_ms_ = kProbeIntervalMs;
+    probe_deadline_ms_ = rtc::TimeMillis() + kProbeTimeoutMs;
+  }
+  Probe();
+}
+
+void SetupTiming::Probe() {
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection;
+  {
+    rtc::CritScope lock(&lock_);
+    peer_connection = peer_connection_;
+  }
+  if(!peer_connection.get() || !peer_connection->GetStats(this, nullptr,
+      webrtc::PeerConnectionInterface::kStatsOutputLevelStandard)) {
+    rtc::CritScope lock(&lock_);
+    probing_ = false;
+  }
+}
+
+void SetupTiming::OnComplete(const webrtc::StatsReports& reports) {
+  // Without SSRC reports nothing was negotiated that could carry RTP, e.g.
+  // a data channel only session.
+  bool has_media = false;
+  webrtc::StatsReports::const_iterator index;
+  for(index = reports.begin(); index != reports.end(); index++) {
+    const webrtc::StatsReport* report = *index;
+    if(report->type() == webrtc::StatsReport::kStatsReportTypeComponent &&
+        (HasValue(report, webrtc::StatsReport::kStatsValueNameDtlsCipher) ||
+        HasValue(report, webrtc::StatsReport::kStatsValueNameSrtpCipher))) {
+      Mark(kDtlsConnected);
+    } else if(report->type() == webrtc::StatsReport::kStatsReportTypeSsrc) {
+      has_media = true;
+      if(IsPositive(report,
+            webrtc::StatsReport::kStatsValueNamePacketsReceived) ||
+          IsPositive(report,
+            webrtc::StatsReport::kStatsValueNamePacketsSent)) {
+        Mark(kFirstRtp);
+      }
+    }
+  }
+
+  bool done = phases_[kDtlsConnected] >= 0 &&
+    (phases_[kFirstRtp] >= 0 || !has_media);
+  rtc::CritScope lock(&lock_);
+  if(done || !peer_connection_.get() ||
+      rtc::TimeMillis() >= probe_deadline_ms_) {
+    probing_ = false;
+    return;
+  }
+  rtc::Thread::Current()->PostDelayed(probe_interval_ms_, handler(),
+    kMessageProbe, new rtc::ScopedRefMessageData<SetupTiming>(this));
+  probe_interval_ms_ = std::min(probe_interval_ms_ * 2, kMaxProbeIntervalMs);
+}
+
+void SetupTiming::Watch(webrtc::MediaStreamInterface* stream) {
+  if(phases_[kFirstFrame] >= 0) {
+    return;
+  }
+  webrtc::VideoTrackVector tracks = stream->GetVideoTracks();
+  webrtc::VideoTrackVector::iterator track;
+  // Under the lock, so Detach() finds every sink that was added.
+  rtc::CritScope lock(&lock_);
+  if(!peer_connection_.get()) {
+    return;
+  }
+  watch_thread_ = rtc::Thread::Current();
+  for(track = tracks.begin(); track != tracks.end(); track++) {
+    tracks_.push_back(*track);
+    (*track)->AddOrUpdateSink(this, rtc::VideoSinkWants());
+  }
+}
+
+void SetupTiming::OnFrame(const cricket::VideoFrame& frame) {
+  if(!Mark(kFirstFrame)) {
+    return;
+  }
+  // Not from inside the broadcaster delivering this frame, the sinks go on
+  // the thread that added them. No lock_ either, Watch() holds it while it
+  // adds sinks.
+  rtc::Thread* thread = watch_thread_;
+  if(thread) {
+    thread->Post(handler(), kMessageUnwatch,
+      new rtc::ScopedRefMessageData<SetupTiming>(this));
+  }
+}
+
+v8::Local<v8::Object> SetupTiming::ToObject() const {
+  Nan::EscapableHandleScope scope;
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  for(int phase = 0; phase < kPhaseCount; phase++) {
+    int64_t elapsed_us = phases_[phase];
+    if(elapsed_us >= 0) {
+      result->Set(Nan::New(kPhaseNames[phase]).ToLocalChecked(),
+        Nan::New(static_cast<double>(elapsed_us) /
+          rtc::kNumMicrosecsPerMillisec));
+    }
+  }
+  return scope.Escape(result);
+}
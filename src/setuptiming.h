@@ -0,0 +1,112 @@
+#ifndef WEBRTCJS_SETUPTIMING_H
+#define WEBRTCJS_SETUPTIMING_H
+
+#include <nan.h>
+#include <atomic>
+#include <vector>
+
+#include "webrtc/api/peerconnectioninterface.h"
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/media/base/videoframe.h"
+#include "webrtc/media/base/videosinkinterface.h"
+
+// When the phases of a PeerConnection's setup were reached, relative to its
+// construction. The observers mark the phases as the callbacks arrive, each
+// one only the first time, and every mark also goes into the process-wide
+// webrtcjs_setup_seconds histogram of the phase.
+//
+// WebRTC has no callbacks for DTLS, RTP and decoded frames. From ICE
+// connected on the stats are polled on the signaling thread, backing off,
+// until DTLS and RTP show up or DTLS did and no media was negotiated. A
+// sink on each remote video track catches the first decoded frame and is
+// removed again after it.
+class SetupTiming : public webrtc::StatsObserver,
+    public rtc::VideoSinkInterface<cricket::VideoFrame> {
+ public:
+  enum Phase {
+    kCreated,
+    kOfferCreated,
+    kAnswerCreated,
+    kLocalDescription,
+    kRemoteDescription,
+    kFirstCandidate,
+    kIceChecking,
+    kIceConnected,
+    kDtlsConnected,
+    kFirstRtp,
+    kFirstFrame,
+    kPhaseCount,
+  };
+
+  // True if this call reached the phase.
+  bool Mark(Phase phase);
+
+  // On the JS thread, from creation until the PeerConnection goes away.
+  void Attach(rtc::scoped_refptr<webrtc::PeerConnectionInterface>
+    peer_connection);
+  void Detach();
+
+  // On the signaling thread.
+  void StartProbing();
+  void Watch(webrtc::MediaStreamInterface* stream);
+
+  void OnComplete(const webrtc::StatsReports& reports) override;
+  void OnFrame(const cricket::VideoFrame& frame) override;
+
+  // Milliseconds after construction per phase that was reached.
+  v8::Local<v8::Object> ToObject() const;
+
+ protected:
+  SetupTiming();
+  ~SetupTiming() override { }
+
+ private:
+  class Handler;
+  static rtc::MessageHandler* handler();
+  void Probe();
+  void Unwatch();
+
+  int64_t start_us_;
+  // Microseconds after start_us_, -1 until reached.
+  std::atomic<int64_t> phases_[kPhaseCount];
+
+  rtc::CriticalSection lock_;
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection_;
+  std::vector<rtc::scoped_refptr<webrtc::VideoTrackInterface>> tracks_;
+  // Where Watch() added the sinks.
+  std::atomic<rtc::Thread*> watch_thread_;
+  bool probing_;
+  int probe_interval_ms_;
+  int64_t probe_deadline_ms_;
+};
+
+// Observers that mark setup phases once a PeerConnection set the timing.
+class TimedObserver {
+ public:
+  // Pooled observers are adopted while their callbacks may already run.
+  void set_timing(rtc::scoped_refptr<SetupTiming> timing) {
+    rtc::CritScope lock(&timing_lock_);
+    timing_ = timing;
+  }
+
+ protected:
+  rtc::scoped_refptr<SetupTiming> timing() {
+    rtc::CritScope lock(&timing_lock_);
+    return timing_;
+  }
+
+  void Mark(SetupTiming::Phase phase) {
+    rtc::scoped_refptr<SetupTiming> current = timing();
+    if(current.get()) {
+      current->Mark(phase);
+    }
+  }
+
+ private:
+  rtc::CriticalSection timing_lock_;
+  rtc::scoped_refptr<SetupTiming> timing_;
+};
+
+#endif
@@ -0,0 +1,480 @@
+#include "sharedencoder.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/modules/video_coding/codecs/vp8/include/vp8.h"
+
+#include "forwarding.h"
+#include "metrics.h"
+
+// Send streams hand their encoders a frame a little after the source
+// delivered it, members look their source up among its last few buffers.
+static const size_t kRecentFrames = 8;
+
+// Spread of member bitrates a group accepts when a member joins, and the
+// spread after which a member moves out. The gap keeps members from going
+// back and forth, every move costs a key frame.
+static const uint32_t kJoinRateRatio = 2;
+static const uint32_t kLeaveRateRatio = 3;
+
+static bool IsCompatible(const webrtc::VideoCodec& a,
+    const webrtc::VideoCodec& b) {
+  // Bitrates are left out on purpose, the group follows its members.
+  if(a.codecType != b.codecType || a.width != b.width ||
+      a.height != b.height || a.maxFramerate != b.maxFramerate ||
+      a.qpMax != b.qpMax || a.mode != b.mode ||
+      a.numberOfSimulcastStreams != b.numberOfSimulcastStreams) {
+    return false;
+  }
+  if(a.codecType == webrtc::kVideoCodecVP8) {
+    const webrtc::VideoCodecVP8& vp8a = a.codecSpecific.VP8;
+    const webrtc::VideoCodecVP8& vp8b = b.codecSpecific.VP8;
+    return vp8a.complexity == vp8b.complexity &&
+      vp8a.numberOfTemporalLayers == vp8b.numberOfTemporalLayers &&
+      vp8a.denoisingOn == vp8b.denoisingOn &&
+      vp8a.automaticResizeOn == vp8b.automaticResizeOn &&
+      vp8a.frameDroppingOn == vp8b.frameDroppingOn &&
+      vp8a.keyFrameInterval == vp8b.keyFrameInterval;
+  }
+  return true;
+}
+
+//
+// SharedEncoderGroup
+//
+SharedEncoderGroup::SharedEncoderGroup(const webrtc::VideoCodec& settings) :
+    settings(settings),
+    number_of_cores(1),
+    max_payload_size(0),
+    key_frame_pending(true) { }
+
+SharedEncoderGroup::~SharedEncoderGroup() {
+  if(encoder_.get()) {
+    encoder_->Release();
+  }
+}
+
+bool SharedEncoderGroup::Init(int32_t number_of_cores,
+    size_t max_payload_size) {
+  this->number_of_cores = number_of_cores;
+  this->max_payload_size = max_payload_size;
+  encoder_.reset(webrtc::VP8Encoder::Create());
+  if(encoder_->InitEncode(&settings, number_of_cores,
+      max_payload_size) != WEBRTC_VIDEO_CODEC_OK) {
+    LOG(LS_ERROR) << __FUNCTION__ << ": Could not initialize encoder";
+    encoder_.reset();
+    return false;
+  }
+  encoder_->RegisterEncodeCompleteCallback(this);
+  return true;
+}
+
+rtc::scoped_refptr<SharedEncoderGroup::Output> SharedEncoderGroup::Encode(
+    const webrtc::VideoFrame& frame) {
+  std::vector<webrtc::FrameType> types(1,
+    key_frame_pending ? webrtc::kVideoFrameKey : webrtc::kVideoFrameDelta);
+
+  pending_ = new rtc::RefCountedObject<Output>();
+  pending_->dropped = true;
+  int64_t start_ns = rtc::TimeNanos();
+  int32_t result = encoder_->Encode(frame, nullptr, &types);
+  Metrics::encode_time.Observe(
+    static_cast<double>(rtc::TimeNanos() - start_ns) /
+    rtc::kNumNanosecsPerSec);
+  if(result == WEBRTC_VIDEO_CODEC_OK) {
+    key_frame_pending = false;
+  }
+
+  rtc::scoped_refptr<Output> output = pending_;
+  pending_ = nullptr;
+  return output;
+}
+
+int32_t SharedEncoderGroup::Encoded(const webrtc::EncodedImage& encoded_image,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const webrtc::RTPFragmentationHeader* fragmentation) {
+  // Called from inside encoder_->Encode().
+  if(!pending_.get()) {
+    return 0;
+  }
+  Output* output = pending_.get();
+  output->payload.assign(encoded_image._buffer,
+    encoded_image._buffer + encoded_image._length);
+  output->image = encoded_image;
+  output->image._buffer = output->payload.empty() ? nullptr :
+    &output->payload[0];
+  output->image._size = output->payload.size();
+  if(codec_specific_info) {
+    output->info = *codec_specific_info;
+  } else {
+    memset(&output->info, 0, sizeof(output->info));
+    output->info.codecType = settings.codecType;
+  }
+  if(fragmentation) {
+    output->fragmentation.CopyFrom(*fragmentation);
+  } else {
+    output->fragmentation.VerifyAndAllocateFragmentationHeader(1);
+    output->fragmentation.fragmentationOffset[0] = 0;
+    output->fragmentation.fragmentationLength[0] = encoded_image._length;
+    output->fragmentation.fragmentationPlType[0] = 0;
+    output->fragmentation.fragmentationTimeDiff[0] = 0;
+  }
+  output->dropped = false;
+  return 0;
+}
+
+void SharedEncoderGroup::UpdateRates() {
+  uint32_t bitrate = 0;
+  uint32_t framerate = 0;
+  std::vector<rtc::scoped_refptr<Member>>::iterator index;
+  for(index = members.begin(); index != members.end(); index++) {
+    if(!(*index)->bitrate) {
+      continue;
+    }
+    // The slowest member sets the pace, Fits() keeps the others close.
+    if(!bitrate || (*index)->bitrate < bitrate) {
+      bitrate = (*index)->bitrate;
+    }
+    framerate = std::max(framerate, (*index)->framerate);
+  }
+  if(bitrate) {
+    encoder_->SetRates(bitrate, framerate);
+  }
+}
+
+bool SharedEncoderGroup::Fits(uint32_t bitrate, uint32_t ratio,
+    const Member* exclude) const {
+  uint32_t lowest = bitrate;
+  uint32_t highest = bitrate;
+  std::vector<rtc::scoped_refptr<Member>>::const_iterator index;
+  for(index = members.begin(); index != members.end(); index++) {
+    uint32_t rate = (*index)->bitrate;
+    if(index->get() == exclude || !rate) {
+      continue;
+    }
+    if(!lowest || rate < lowest) {
+      lowest = rate;
+    }
+    highest = std::max(highest, rate);
+  }
+  return !lowest || highest <= lowest * ratio;
+}
+
+//
+// SharedEncoderSource
+//
+rtc::CriticalSection SharedEncoderSource::sources_lock_;
+std::map<webrtc::VideoSourceInterface*, SharedEncoderSource*>
+  SharedEncoderSource::sources_;
+rtc::CriticalSection SharedEncoderSource::buffers_lock_;
+std::map<const webrtc::VideoFrameBuffer*, SharedEncoderSource*>
+  SharedEncoderSource::buffers_;
+std::atomic<uint32_t> SharedEncoderSource::frames_encoded_(0);
+std::atomic<uint32_t> SharedEncoderSource::frames_shared_(0);
+
+NAN_MODULE_INIT(SharedEncoderSource::Init) {
+  Nan::SetMethod(target, "getSharedEncoderStats",
+    SharedEncoderSource::GetSharedEncoderStats);
+}
+
+SharedEncoderSource::SharedEncoderSource() :
+    key_(nullptr),
+    attachments_(0) { }
+
+SharedEncoderSource::~SharedEncoderSource() {
+  std::vector<SharedEncoderGroup*>::iterator index;
+  for(index = groups_.begin(); index != groups_.end(); index++) {
+    delete *index;
+  }
+}
+
+rtc::scoped_refptr<SharedEncoderSource> SharedEncoderSource::Attach(
+    webrtc::VideoTrackInterface* track) {
+  // Tracks made from one source, e.g. by importTrack(), share the encoders.
+  webrtc::VideoSourceInterface* key = track->GetSource();
+  if(!key) {
+    return nullptr;
+  }
+  rtc::CritScope lock(&sources_lock_);
+  rtc::scoped_refptr<SharedEncoderSource> source;
+  std::map<webrtc::VideoSourceInterface*, SharedEncoderSource*>::iterator
+    index = sources_.find(key);
+  if(index != sources_.end()) {
+    source = index->second;
+  } else {
+    source = new rtc::RefCountedObject<SharedEncoderSource>();
+    source->key_ = key;
+    sources_[key] = source.get();
+  }
+  source->attachments_++;
+  return source;
+}
+
+void SharedEncoderSource::Detach(
+    const rtc::scoped_refptr<SharedEncoderSource>& source) {
+  rtc::CritScope lock(&sources_lock_);
+  if(--source->attachments_ > 0) {
+    return;
+  }
+  sources_.erase(source->key_);
+  // Members notice the buffers stop coming and fall back to encoding alone.
+  source->ClearBuffers();
+}
+
+rtc::scoped_refptr<SharedEncoderSource> SharedEncoderSource::Find(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer) {
+  // Only attached sources are indexed, and their tracks keep them alive.
+  rtc::CritScope lock(&buffers_lock_);
+  std::map<const webrtc::VideoFrameBuffer*, SharedEncoderSource*>::iterator
+    index = buffers_.find(buffer.get());
+  if(index == buffers_.end()) {
+    return nullptr;
+  }
+  return index->second;
+}
+
+void SharedEncoderSource::ClearBuffers() {
+  rtc::CritScope lock(&lock_);
+  rtc::CritScope buffers_lock(&buffers_lock_);
+  std::deque<rtc::scoped_refptr<webrtc::VideoFrameBuffer>>::iterator index;
+  for(index = recent_.begin(); index != recent_.end(); index++) {
+    buffers_.erase(index->get());
+  }
+  recent_.clear();
+}
+
+bool SharedEncoderSource::HasBuffer(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer) {
+  rtc::CritScope lock(&lock_);
+  return std::find(recent_.begin(), recent_.end(), buffer) != recent_.end();
+}
+
+bool SharedEncoderSource::Join(RelayEncoder* member,
+    const webrtc::VideoCodec& settings, int32_t number_of_cores,
+    size_t max_payload_size, uint32_t bitrate, uint32_t framerate) {
+  rtc::scoped_refptr<SharedEncoderGroup::Member> entry =
+    new rtc::RefCountedObject<SharedEncoderGroup::Member>(member);
+  entry->bitrate = bitrate;
+  entry->framerate = framerate;
+  rtc::CritScope lock(&lock_);
+  return AddToGroup(entry, settings, number_of_cores,
+    max_payload_size) != nullptr;
+}
+
+void SharedEncoderSource::Leave(RelayEncoder* member) {
+  rtc::scoped_refptr<SharedEncoderGroup::Member> entry;
+  {
+    rtc::CritScope lock(&lock_);
+    SharedEncoderGroup* group = FindGroup(member, &entry);
+    if(group) {
+      RemoveFromGroup(group, entry.get());
+    }
+  }
+  if(entry.get()) {
+    // Waits for a delivery still sending to the member.
+    rtc::CritScope lock(&entry->lock);
+    entry->encoder = nullptr;
+  }
+}
+
+bool SharedEncoderSource::SetRates(RelayEncoder* member, uint32_t bitrate,
+    uint32_t framerate) {
+  rtc::CritScope lock(&lock_);
+  rtc::scoped_refptr<SharedEncoderGroup::Member> entry;
+  SharedEncoderGroup* group = FindGroup(member, &entry);
+  if(!group) {
+    return false;
+  }
+  entry->bitrate = bitrate;
+  entry->framerate = framerate;
+  if(group->members.size() == 1 ||
+      group->Fits(bitrate, kLeaveRateRatio, entry.get())) {
+    group->UpdateRates();
+    return false;
+  }
+
+  // Too far from the others, better served by a group of its own rate.
+  webrtc::VideoCodec settings = group->settings;
+  int32_t number_of_cores = group->number_of_cores;
+  size_t max_payload_size = group->max_payload_size;
+  RemoveFromGroup(group, entry.get());
+  if(AddToGroup(entry, settings, number_of_cores, max_payload_size)) {
+    return true;
+  }
+  // The group still has the others, stay there rather than stall.
+  group->members.push_back(entry);
+  group->UpdateRates();
+  return false;
+}
+
+void SharedEncoderSource::RequestKeyFrame(RelayEncoder* member) {
+  rtc::CritScope lock(&lock_);
+  SharedEncoderGroup* group = FindGroup(member, nullptr);
+  if(group) {
+    group->key_frame_pending = true;
+  }
+}
+
+SharedEncoderGroup* SharedEncoderSource::FindGroup(RelayEncoder* member,
+    rtc::scoped_refptr<SharedEncoderGroup::Member>* entry) {
+  std::vector<SharedEncoderGroup*>::iterator group;
+  for(group = groups_.begin(); group != groups_.end(); group++) {
+    std::vector<rtc::scoped_refptr<SharedEncoderGroup::Member>>::iterator
+      index;
+    for(index = (*group)->members.begin(); index != (*group)->members.end();
+        index++) {
+      if((*index)->encoder == member) {
+        if(entry) {
+          *entry = *index;
+        }
+        return *group;
+      }
+    }
+  }
+  return nullptr;
+}
+
+SharedEncoderGroup* SharedEncoderSource::AddToGroup(
+    const rtc::scoped_refptr<SharedEncoderGroup::Member>& entry,
+    const webrtc::VideoCodec& settings, int32_t number_of_cores,
+    size_t max_payload_size) {
+  SharedEncoderGroup* group = nullptr;
+  std::vector<SharedEncoderGroup*>::iterator index;
+  for(index = groups_.begin(); index != groups_.end(); index++) {
+    if(IsCompatible((*index)->settings, settings) &&
+        (*index)->Fits(entry->bitrate, kJoinRateRatio, nullptr)) {
+      group = *index;
+      break;
+    }
+  }
+  if(!group) {
+    group = new SharedEncoderGroup(settings);
+    if(!group->Init(number_of_cores, max_payload_size)) {
+      delete group;
+      return nullptr;
+    }
+    groups_.push_back(group);
+  }
+  group->members.push_back(entry);
+  // A new member can only start at a key frame.
+  group->key_frame_pending = true;
+  group->UpdateRates();
+  return group;
+}
+
+void SharedEncoderSource::RemoveFromGroup(SharedEncoderGroup* group,
+    const SharedEncoderGroup::Member* entry) {
+  std::vector<rtc::scoped_refptr<SharedEncoderGroup::Member>>::iterator
+    index;
+  for(index = group->members.begin(); index != group->members.end();
+      index++) {
+    if(index->get() == entry) {
+      group->members.erase(index);
+      break;
+    }
+  }
+  if(group->members.empty()) {
+    groups_.erase(std::remove(groups_.begin(), groups_.end(), group),
+      groups_.end());
+    delete group;
+  } else {
+    group->UpdateRates();
+  }
+}
+
+void SharedEncoderSource::OnFrame(const cricket::VideoFrame& frame) {
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+    frame.video_frame_buffer();
+  uint32_t route;
+  // Forwarded streams are never encoded, their placeholders carry no image.
+  if(!buffer.get() || ForwardingRouter::IsPlaceholder(buffer, &route)) {
+    return;
+  }
+
+  std::vector<rtc::scoped_refptr<SharedEncoderGroup::Output>> outputs;
+  std::vector<std::vector<rtc::scoped_refptr<SharedEncoderGroup::Member>>>
+    receivers;
+  {
+    rtc::CritScope lock(&lock_);
+    // Every attached track of the source delivers the same buffer.
+    if(std::find(recent_.begin(), recent_.end(), buffer) != recent_.end()) {
+      return;
+    }
+    recent_.push_back(buffer);
+    {
+      rtc::CritScope buffers_lock(&buffers_lock_);
+      buffers_[buffer.get()] = this;
+      if(recent_.size() > kRecentFrames) {
+        buffers_.erase(recent_.front().get());
+        recent_.pop_front();
+      }
+    }
+
+    int64_t render_time_ms =
+      frame.GetTimeStamp() / rtc::kNumNanosecsPerMillisec;
+    webrtc::VideoFrame input(buffer,
+      static_cast<uint32_t>(render_time_ms * 90), render_time_ms,
+      frame.rotation());
+    std::vector<SharedEncoderGroup*>::iterator group;
+    for(group = groups_.begin(); group != groups_.end(); group++) {
+      rtc::scoped_refptr<SharedEncoderGroup::Output> output =
+        (*group)->Encode(input);
+      frames_encoded_++;
+      if(output.get() && !output->dropped) {
+        outputs.push_back(output);
+        receivers.push_back((*group)->members);
+      }
+    }
+  }
+
+  // Sending runs the packetizer of every member, Join() and SetRates() of
+  // the others must not wait for that.
+  for(size_t index = 0; index < outputs.size(); index++) {
+    const SharedEncoderGroup::Output* output = outputs[index].get();
+    std::vector<rtc::scoped_refptr<SharedEncoderGroup::Member>>::iterator
+      member;
+    for(member = receivers[index].begin(); member != receivers[index].end();
+        member++) {
+      rtc::CritScope lock(&(*member)->lock);
+      if((*member)->encoder) {
+        (*member)->encoder->OnSharedFrame(output->image, output->info,
+          output->fragmentation);
+      }
+    }
+    frames_shared_ += receivers[index].size() - 1;
+  }
+}
+
+NAN_METHOD(SharedEncoderSource::GetSharedEncoderStats) {
+  uint32_t sources = 0;
+  uint32_t groups = 0;
+  uint32_t members = 0;
+  {
+    rtc::CritScope lock(&sources_lock_);
+    std::map<webrtc::VideoSourceInterface*, SharedEncoderSource*>::iterator
+      index;
+    for(index = sources_.begin(); index != sources_.end(); index++) {
+      rtc::CritScope source_lock(&index->second->lock_);
+      sources++;
+      std::vector<SharedEncoderGroup*>::iterator group;
+      for(group = index->second->groups_.begin();
+          group != index->second->groups_.end(); group++) {
+        groups++;
+        members += (*group)->members.size();
+      }
+    }
+  }
+
+  v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+  stats->Set(Nan::New("sources").ToLocalChecked(), Nan::New(sources));
+  stats->Set(Nan::New("groups").ToLocalChecked(), Nan::New(groups));
+  stats->Set(Nan::New("members").ToLocalChecked(), Nan::New(members));
+  stats->Set(Nan::New("framesEncoded").ToLocalChecked(),
+    Nan::New(frames_encoded_.load()));
+  stats->Set(Nan::New("framesShared").ToLocalChecked(),
+    Nan::New(frames_shared_.load()));
+  info.GetReturnValue().Set(stats);
+}
@@ -0,0 +1,145 @@
+#ifndef WEBRTCJS_SHAREDENCODER_H
+#define WEBRTCJS_SHAREDENCODER_H
+
+#include <nan.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "webrtc/api/mediastreaminterface.h"
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/refcount.h"
+#include "webrtc/base/scoped_ptr.h"
+#include "webrtc/base/scoped_ref_ptr.h"
+#include "webrtc/common_video/include/video_frame_buffer.h"
+#include "webrtc/media/base/videoframe.h"
+#include "webrtc/media/base/videosinkinterface.h"
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+
+class RelayEncoder;
+
+// One real encoder and the RelayEncoders that send its output. Only used by
+// SharedEncoderSource.
+class SharedEncoderGroup : public webrtc::EncodedImageCallback {
+ public:
+  class Output : public rtc::RefCountInterface {
+   public:
+    std::vector<uint8_t> payload;
+    webrtc::EncodedImage image;
+    webrtc::CodecSpecificInfo info;
+    webrtc::RTPFragmentationHeader fragmentation;
+    bool dropped;
+  };
+
+  // A RelayEncoder as seen by its group. Deliveries happen outside the
+  // source lock, Leave() clears encoder under lock after any of them. The
+  // rates belong to the source lock.
+  class Member : public rtc::RefCountInterface {
+   public:
+    explicit Member(RelayEncoder* encoder) :
+        encoder(encoder), bitrate(0), framerate(0) { }
+    rtc::CriticalSection lock;
+    RelayEncoder* encoder;
+    uint32_t bitrate;
+    uint32_t framerate;
+  };
+
+  explicit SharedEncoderGroup(const webrtc::VideoCodec& settings);
+  ~SharedEncoderGroup();
+
+  bool Init(int32_t number_of_cores, size_t max_payload_size);
+  rtc::scoped_refptr<Output> Encode(const webrtc::VideoFrame& frame);
+  void UpdateRates();
+  // Whether a member asking for bitrate fits into the group, ignoring
+  // exclude. ratio is the spread allowed between the members.
+  bool Fits(uint32_t bitrate, uint32_t ratio, const Member* exclude) const;
+
+  int32_t Encoded(const webrtc::EncodedImage& encoded_image,
+    const webrtc::CodecSpecificInfo* codec_specific_info,
+    const webrtc::RTPFragmentationHeader* fragmentation) override;
+
+  webrtc::VideoCodec settings;
+  int32_t number_of_cores;
+  size_t max_payload_size;
+  std::vector<rtc::scoped_refptr<Member>> members;
+  bool key_frame_pending;
+
+ private:
+  rtc::scoped_ptr<webrtc::VideoEncoder> encoder_;
+  rtc::scoped_refptr<Output> pending_;
+};
+
+// Lets every RelayEncoder that sends one video source reuse the output of a
+// single real encoder. track.setSharedEncoding(true) attaches the
+// SharedEncoderSource of the track's source as a sink: it encodes each frame
+// of the source once per group and hands the result to the members of the
+// group, whatever frames their own send streams keep or drop.
+//
+// RelayEncoders find their source by the frame buffers it saw last, then
+// join the group with their codec settings and a similar bitrate. The group
+// encodes at the lowest bitrate of its members, so a member whose bitrate
+// drifts too far from the others moves to a group of its own. Packetization,
+// SRTP and congestion control stay per PeerConnection.
+class SharedEncoderSource :
+    public rtc::VideoSinkInterface<cricket::VideoFrame>,
+    public rtc::RefCountInterface {
+ public:
+  // One attachment per track object, the caller adds the source as a sink
+  // of the track and removes it before Detach().
+  static rtc::scoped_refptr<SharedEncoderSource> Attach(
+    webrtc::VideoTrackInterface* track);
+  static void Detach(const rtc::scoped_refptr<SharedEncoderSource>& source);
+
+  // The attached source that delivered buffer recently, if any.
+  static rtc::scoped_refptr<SharedEncoderSource> Find(
+    const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer);
+
+  bool HasBuffer(const rtc::scoped_refptr<webrtc::VideoFrameBuffer>& buffer);
+  bool Join(RelayEncoder* member, const webrtc::VideoCodec& settings,
+    int32_t number_of_cores, size_t max_payload_size, uint32_t bitrate,
+    uint32_t framerate);
+  void Leave(RelayEncoder* member);
+  // True if the member moved to another group and waits for a key frame.
+  bool SetRates(RelayEncoder* member, uint32_t bitrate, uint32_t framerate);
+  void RequestKeyFrame(RelayEncoder* member);
+
+  void OnFrame(const cricket::VideoFrame& frame) override;
+
+  static NAN_MODULE_INIT(Init);
+
+ protected:
+  SharedEncoderSource();
+  ~SharedEncoderSource() override;
+
+ private:
+  SharedEncoderGroup* FindGroup(RelayEncoder* member,
+    rtc::scoped_refptr<SharedEncoderGroup::Member>* entry);
+  SharedEncoderGroup* AddToGroup(
+    const rtc::scoped_refptr<SharedEncoderGroup::Member>& entry,
+    const webrtc::VideoCodec& settings, int32_t number_of_cores,
+    size_t max_payload_size);
+  void RemoveFromGroup(SharedEncoderGroup* group,
+    const SharedEncoderGroup::Member* entry);
+  void ClearBuffers();
+
+  static NAN_METHOD(GetSharedEncoderStats);
+
+  static rtc::CriticalSection sources_lock_;
+  static std::map<webrtc::VideoSourceInterface*, SharedEncoderSource*>
+    sources_;
+  static rtc::CriticalSection buffers_lock_;
+  static std::map<const webrtc::VideoFrameBuffer*, SharedEncoderSource*>
+    buffers_;
+  static std::atomic<uint32_t> frames_encoded_;
+  static std::atomic<uint32_t> frames_shared_;
+
+  webrtc::VideoSourceInterface* key_;
+  int attachments_;
+
+  rtc::CriticalSection lock_;
+  std::deque<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> recent_;
+  std::vector<SharedEncoderGroup*> groups_;
+};
+
+#endif
@@ -0,0 +1,363 @@
+#include "statssampler.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+
+#include "compactstats.h"
+#include "metrics.h"
+
+static const int kMinInterval = 100;
+static const size_t kMaxHistory = 1 << 20;
+
+enum {
+  kMessageSample,
+};
+
+static double Number(const webrtc::StatsReport* report,
+    webrtc::StatsReport::StatsValueName name) {
+  const webrtc::StatsReport::Value* value = report->FindValue(name);
+  if(!value) {
+    return 0;
+  }
+  switch(value->type()) {
+    case webrtc::StatsReport::Value::kInt:
+      return value->int_val();
+    case webrtc::StatsReport::Value::kInt64:
+      return static_cast<double>(value->int64_val());
+    case webrtc::StatsReport::Value::kFloat:
+      return value->float_val();
+    default:
+      return strtod(value->ToString().c_str(), nullptr);
+  }
+}
+
+// Grows the counter by what it advanced, a counter that went back, e.g.
+// because a stream was removed, counts as no progress.
+static double Delta(double current, double previous) {
+  return std::max(current - previous, 0.0);
+}
+
+//
+// StatsSampler::Collector
+//
+class StatsSampler::Collector : public webrtc::StatsObserver {
+ public:
+  explicit Collector(uint32_t id) : id_(id), has_previous_(false) { }
+
+  // Runs on the signaling thread of the PeerConnection, one at a time.
+  void OnComplete(const webrtc::StatsReports& reports) override {
+    Totals totals;
+    totals.time_ms = rtc::TimeMillis();
+
+    webrtc::StatsReports::const_iterator index;
+    for(index = reports.begin(); index != reports.end(); index++) {
+      const webrtc::StatsReport* report = *index;
+      if(report->type() != webrtc::StatsReport::kStatsReportTypeSsrc) {
+        continue;
+      }
+      if(report->FindValue(webrtc::StatsReport::kStatsValueNameBytesSent)) {
+        totals.bytes_sent +=
+          Number(report, webrtc::StatsReport::kStatsValueNameBytesSent);
+        totals.sent_framerate +=
+          Number(report, webrtc::StatsReport::kStatsValueNameFrameRateSent);
+        totals.rtt_ms = std::max(totals.rtt_ms,
+          Number(report, webrtc::StatsReport::kStatsValueNameRtt));
+      } else {
+        totals.bytes_received +=
+          Number(report, webrtc::StatsReport::kStatsValueNameBytesReceived);
+        totals.packets_received += Number(report,
+          webrtc::StatsReport::kStatsValueNamePacketsReceived);
+        totals.packets_lost +=
+          Number(report, webrtc::StatsReport::kStatsValueNamePacketsLost);
+        totals.received_framerate += Number(report,
+          webrtc::StatsReport::kStatsValueNameFrameRateReceived);
+      }
+    }
+
+    if(has_previous_ && totals.time_ms > previous_.time_ms) {
+      double seconds = (totals.time_ms - previous_.time_ms) / 1000.0;
+      double lost = Delta(totals.packets_lost, previous_.packets_lost);
+      double received =
+        Delta(totals.packets_received, previous_.packets_received);
+
+      double sent_bytes = Delta(totals.bytes_sent, previous_.bytes_sent);
+      double received_bytes =
+        Delta(totals.bytes_received, previous_.bytes_received);
+      Metrics::Add(Metrics::kBytesSent, static_cast<int64_t>(sent_bytes));
+      Metrics::Add(Metrics::kBytesReceived,
+        static_cast<int64_t>(received_bytes));
+
+      StatsSampler::Sample sample;
+      sample.id = id_;
+      sample.time_ms = static_cast<double>(totals.time_ms);
+      sample.send_bitrate = sent_bytes * 8 / seconds;
+      sample.receive_bitrate = received_bytes * 8 / seconds;
+      sample.packet_loss = lost + received > 0 ? lost / (lost + received) : 0;
+      sample.sent_framerate = totals.sent_framerate;
+      sample.received_framerate = totals.received_framerate;
+      sample.rtt_ms = totals.rtt_ms;
+      StatsSampler::Record(sample);
+    }
+
+    previous_ = totals;
+    has_previous_ = true;
+  }
+
+ private:
+  struct Totals {
+    Totals() :
+        time_ms(0),
+        bytes_sent(0),
+        bytes_received(0),
+        packets_received(0),
+        packets_lost(0),
+        sent_framerate(0),
+        received_framerate(0),
+        rtt_ms(0) { }
+    int64_t time_ms;
+    double bytes_sent;
+    double bytes_received;
+    double packets_received;
+    double packets_lost;
+    double sent_framerate;
+    double received_framerate;
+    double rtt_ms;
+  };
+
+  uint32_t id_;
+  bool has_previous_;
+  Totals previous_;
+};
+
+//
+// StatsSampler
+//
+rtc::CriticalSection StatsSampler::sampler_lock_;
+rtc::scoped_ptr<StatsSampler> StatsSampler::sampler_;
+rtc::CriticalSection StatsSampler::sessions_lock_;
+std::map<uint32_t, StatsSampler::Session> StatsSampler::sessions_;
+uint32_t StatsSampler::next_id_ = 1;
+
+NAN_MODULE_INIT(StatsSampler::Init) {
+  Nan::SetMethod(target, "configureStatsSampler",
+    StatsSampler::ConfigureStatsSampler);
+  Nan::SetMethod(target, "getSampledStats", StatsSampler::GetSampledStats);
+}
+
+StatsSampler::StatsSampler(const Options& options) :
+    options_(options),
+    ring_(options.history),
+    next_(0) {
+  thread_.reset(new rtc::Thread());
+  thread_->SetName("WebRTC Stats", NULL);
+  thread_->Start();
+  thread_->PostDelayed(options_.interval_ms, this, kMessageSample);
+}
+
+StatsSampler::~StatsSampler() {
+  thread_->Clear(this);
+  thread_->Stop();
+}
+
+void StatsSampler::Configure(const Options& options) {
+  rtc::scoped_ptr<StatsSampler> sampler(new StatsSampler(options));
+  {
+    rtc::CritScope lock(&sampler_lock_);
+    sampler_.swap(sampler);
+  }
+  // The old sampler stops outside the lock. Its thread may be waiting on a
+  // signaling thread that waits in Record().
+}
+
+void StatsSampler::Disable() {
+  rtc::scoped_ptr<StatsSampler> sampler;
+  {
+    rtc::CritScope lock(&sampler_lock_);
+    sampler_.swap(sampler);
+  }
+}
+
+uint32_t StatsSampler::Add(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection) {
+  rtc::CritScope lock(&sessions_lock_);
+  uint32_t id = next_id_++;
+  Session& session = sessions_[id];
+  session.peer_connection = peer_connection;
+  session.collector = new rtc::RefCountedObject<Collector>(id);
+  return id;
+}
+
+void StatsSampler::Remove(uint32_t id) {
+  rtc::CritScope lock(&sessions_lock_);
+  sessions_.erase(id);
+}
+
+void StatsSampler::Shutdown() {
+  // Stopping the thread waits for GetStats() calls that block on the
+  // signaling threads, they must finish while those threads still run.
+  rtc::scoped_ptr<StatsSampler> sampler;
+  {
+    rtc::CritScope lock(&sampler_lock_);
+    sampler_.swap(sampler);
+  }
+  bool running = sampler.get() != nullptr;
+  Options options = running ? sampler->options_ : Options();
+  sampler.reset();
+
+  // Released outside the lock, the proxies of the PeerConnections call
+  // into the signaling threads too.
+  std::map<uint32_t, Session> sessions;
+  {
+    rtc::CritScope lock(&sessions_lock_);
+    sessions_.swap(sessions);
+  }
+  sessions.clear();
+
+  if(!running) {
+    return;
+  }
+  // Unless somebody configured a new one meanwhile.
+  sampler.reset(new StatsSampler(options));
+  rtc::CritScope lock(&sampler_lock_);
+  if(!sampler_.get()) {
+    sampler_.swap(sampler);
+  }
+}
+
+void StatsSampler::OnMessage(rtc::Message* msg) {
+  switch(msg->message_id) {
+    case kMessageSample:
+      Sample();
+      thread_->PostDelayed(options_.interval_ms, this, kMessageSample);
+      break;
+  }
+}
+
+void StatsSampler::Sample() {
+  std::vector<Session> sessions;
+  {
+    rtc::CritScope lock(&sessions_lock_);
+    sessions.reserve(sessions_.size());
+    std::map<uint32_t, Session>::iterator index;
+    for(index = sessions_.begin(); index != sessions_.end(); index++) {
+      sessions.push_back(index->second);
+    }
+  }
+
+  // Each call hops to the signaling thread of that PeerConnection, the
+  // results arrive there in Collector::OnComplete().
+  std::vector<Session>::iterator session;
+  for(session = sessions.begin(); session != sessions.end(); session++) {
+    if(!session->peer_connection->GetStats(session->collector.get(), nullptr,
+        webrtc::PeerConnectionInterface::kStatsOutputLevelStandard)) {
+      LOG(LS_VERBOSE) << __FUNCTION__ << ": Could not get stats";
+    }
+  }
+}
+
+void StatsSampler::Record(const Sample& sample) {
+  rtc::CritScope lock(&sampler_lock_);
+  if(!sampler_.get()) {
+    return;
+  }
+  std::vector<Sample>& ring = sampler_->ring_;
+  ring[sampler_->next_++ % ring.size()] = sample;
+}
+
+NAN_METHOD(StatsSampler::ConfigureStatsSampler) {
+  if(info.Length() == 0 || info[0]->IsNull() || info[0]->IsUndefined() ||
+      (info[0]->IsBoolean() && !info[0]->BooleanValue())) {
+    Disable();
+    return info.GetReturnValue().SetUndefined();
+  }
+  if(!info[0]->IsObject()) {
+    return Nan::ThrowError("Invalid stats sampler options");
+  }
+
+  Options options;
+  v8::Local<v8::Object> object = v8::Local<v8::Object>::Cast(info[0]);
+  v8::Local<v8::Value> interval_value =
+    object->Get(Nan::New("interval").ToLocalChecked());
+  v8::Local<v8::Value> history_value =
+    object->Get(Nan::New("history").ToLocalChecked());
+
+  if(interval_value->IsUint32()) {
+    options.interval_ms = interval_value->Uint32Value();
+  }
+  if(options.interval_ms < kMinInterval) {
+    return Nan::ThrowError("Invalid interval");
+  }
+  if(history_value->IsUint32()) {
+    options.history = history_value->Uint32Value();
+  }
+  if(options.history < 1 || options.history > kMaxHistory) {
+    return Nan::ThrowError("Invalid history");
+  }
+
+  Configure(options);
+  info.GetReturnValue().SetUndefined();
+}
+
+// getSampledStats([since]) returns the samples from sequence number since
+// onwards that are still in the history, one typed array per field, and
+// next to pass to the following call.
+NAN_METHOD(StatsSampler::GetSampledStats) {
+  double since = 0;
+  if(info.Length() >= 1 && info[0]->IsNumber()) {
+    since = std::max(info[0]->NumberValue(), 0.0);
+  }
+
+  std::vector<uint32_t> ids;
+  std::vector<double> times;
+  std::vector<double> send_bitrates;
+  std::vector<double> receive_bitrates;
+  std::vector<double> packet_losses;
+  std::vector<double> sent_framerates;
+  std::vector<double> received_framerates;
+  std::vector<double> rtts;
+  uint64_t next = 0;
+  {
+    rtc::CritScope lock(&sampler_lock_);
+    if(sampler_.get()) {
+      const std::vector<Sample>& ring = sampler_->ring_;
+      next = sampler_->next_;
+      uint64_t first = next > ring.size() ? next - ring.size() : 0;
+      first = std::max(first, static_cast<uint64_t>(since));
+      for(uint64_t index = first; index < next; index++) {
+        const Sample& sample = ring[index % ring.size()];
+        ids.push_back(sample.id);
+        times.push_back(sample.time_ms);
+        send_bitrates.push_back(sample.send_bitrate);
+        receive_bitrates.push_back(sample.receive_bitrate);
+        packet_losses.push_back(sample.packet_loss);
+        sent_framerates.push_back(sample.sent_framerate);
+        received_framerates.push_back(sample.received_framerate);
+        rtts.push_back(sample.rtt_ms);
+      }
+    }
+  }
+
+  v8::Local<v8::Object> result = Nan::New<v8::Object>();
+  result->Set(Nan::New("next").ToLocalChecked(),
+    Nan::New(static_cast<double>(next)));
+  result->Set(Nan::New("ids").ToLocalChecked(),
+    NewTypedArray<v8::Uint32Array>(ids));
+  result->Set(Nan::New("times").ToLocalChecked(),
+    NewTypedArray<v8::Float64Array>(times));
+  result->Set(Nan::New("sendBitrate").ToLocalChecked(),
+    NewTypedArray<v8::Float64Array>(send_bitrates));
+  result->Set(Nan::New("receiveBitrate").ToLocalChecked(),
+    NewTypedArray<v8::Float64Array>(receive_bitrates));
+  result->Set(Nan::New("packetLoss").ToLocalChecked(),
+    NewTypedArray<v8::Float64Array>(packet_losses));
+  result->Set(Nan::New("sentFramerate").ToLocalChecked(),
+    NewTypedArray<v8::Float64Array>(sent_framerates));
+  result->Set(Nan::New("receivedFramerate").ToLocalChecked(),
+    NewTypedArray<v8::Float64Array>(received_framerates));
+  result->Set(Nan::New("rtt").ToLocalChecked(),
+    NewTypedArray<v8::Float64Array>(rtts));
+  info.GetReturnValue().Set(result);
+}
@@ -0,0 +1,89 @@
+#ifndef WEBRTCJS_STATSSAMPLER_H
+#define WEBRTCJS_STATSSAMPLER_H
+
+#include <nan.h>
+#include <map>
+#include <vector>
+
+#include "webrtc/api/peerconnectioninterface.h"
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/scoped_ptr.h"
+#include "webrtc/base/thread.h"
+
+// Samples the stats of every live PeerConnection at a fixed interval. Each
+// PeerConnection's stats are collected on its signaling thread, which also
+// turns the counters into rates against the previous sample. The results
+// go into one ring buffer that JS drains with getSampledStats().
+class StatsSampler : public rtc::MessageHandler {
+ public:
+  struct Options {
+    Options() : interval_ms(1000), history(600) { }
+    int interval_ms;
+    // Samples kept, across all PeerConnections.
+    size_t history;
+  };
+
+  struct Sample {
+    uint32_t id;
+    double time_ms;
+    // Bits per second.
+    double send_bitrate;
+    double receive_bitrate;
+    // Fraction of the packets expected since the last sample that were lost.
+    double packet_loss;
+    double sent_framerate;
+    double received_framerate;
+    double rtt_ms;
+  };
+
+  static void Configure(const Options& options);
+  static void Disable();
+
+  // Registers a PeerConnection until Remove(), returns the id its samples
+  // carry. Sampling may be enabled later on.
+  static uint32_t Add(
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection);
+  static void Remove(uint32_t id);
+  // From shutdown(), before the factories go. Waits for a running sample
+  // and drops every PeerConnection, a configured sampler keeps going.
+  static void Shutdown();
+
+  ~StatsSampler() override;
+
+  void OnMessage(rtc::Message* msg) final;
+
+  static NAN_MODULE_INIT(Init);
+
+ private:
+  class Collector;
+
+  struct Session {
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection;
+    rtc::scoped_refptr<Collector> collector;
+  };
+
+  explicit StatsSampler(const Options& options);
+
+  void Sample();
+  static void Record(const Sample& sample);
+
+  static NAN_METHOD(ConfigureStatsSampler);
+  static NAN_METHOD(GetSampledStats);
+
+  static rtc::CriticalSection sampler_lock_;
+  static rtc::scoped_ptr<StatsSampler> sampler_;
+
+  static rtc::CriticalSection sessions_lock_;
+  static std::map<uint32_t, Session> sessions_;
+  static uint32_t next_id_;
+
+  Options options_;
+  rtc::scoped_ptr<rtc::Thread> thread_;
+
+  // Guarded by sampler_lock_, sample next_ - 1 is the newest.
+  std::vector<Sample> ring_;
+  uint64_t next_;
+};
+
+#endif
@@ -0,0 +1,446 @@
+#include "tracing.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <mutex>
+
+#include "webrtc/base/event_tracer.h"
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+
+static const char kDisabledByDefault[] = "disabled-by-default-";
+
+static void WriteString(FILE* file, const char* value) {
+  fputc('"', file);
+  for(const unsigned char* c =
+        reinterpret_cast<const unsigned char*>(value); *c; c++) {
+    switch(*c) {
+      case '"':
+        fputs("\\\"", file);
+        break;
+      case '\\':
+        fputs("\\\\", file);
+        break;
+      case '\n':
+        fputs("\\n", file);
+        break;
+      case '\r':
+        fputs("\\r", file);
+        break;
+      case '\t':
+        fputs("\\t", file);
+        break;
+      default:
+        if(*c < 0x20) {
+          fprintf(file, "\\u%04x", *c);
+        } else {
+          fputc(*c, file);
+        }
+    }
+  }
+  fputc('"', file);
+}
+
+class WriteTraceWorker : public Nan::AsyncWorker {
+ public:
+  WriteTraceWorker(FILE* file,
+      const std::vector<Tracing::ThreadBuffer*>& buffers, uint32_t session,
+      int64_t start_us, Nan::Callback* callback) :
+      Nan::AsyncWorker(callback),
+      file_(file),
+      buffers_(buffers),
+      session_(session),
+      start_us_(start_us),
+      events_(0),
+      dropped_(0),
+      error_(0) { }
+
+  void Execute() override {
+    if(!Tracing::Write(file_, buffers_, session_, start_us_, &events_,
+        &dropped_)) {
+      error_ = errno;
+    }
+    if(fclose(file_) && !error_) {
+      error_ = errno;
+    }
+    rtc::CritScope lock(&Tracing::lock_);
+    Tracing::writing_ = false;
+  }
+
+  void HandleOKCallback() override {
+    if(!callback) {
+      return;
+    }
+    Nan::HandleScope scope;
+    v8::Local<v8::Object> result = Nan::New<v8::Object>();
+    result->Set(Nan::New("events").ToLocalChecked(),
+      Nan::New(static_cast<double>(events_)));
+    result->Set(Nan::New("eventsDropped").ToLocalChecked(),
+      Nan::New(static_cast<double>(dropped_)));
+    v8::Local<v8::Value> argv[2] = { Nan::Null(), result };
+    if(error_) {
+      argv[0] = Nan::Error(strerror(error_));
+    }
+    callback->Call(2, argv);
+  }
+
+ private:
+  FILE* file_;
+  std::vector<Tracing::ThreadBuffer*> buffers_;
+  uint32_t session_;
+  int64_t start_us_;
+  uint64_t events_;
+  uint64_t dropped_;
+  int error_;
+};
+
+//
+// Tracing::ThreadBuffer
+//
+Tracing::ThreadBuffer::ThreadBuffer() :
+    session(0),
+    tid(static_cast<int>(syscall(SYS_gettid))),
+    orphaned(false),
+    dropped(0),
+    size_(0) {
+  for(size_t index = 0; index < kMaxChunks; index++) {
+    chunks_[index] = nullptr;
+  }
+}
+
+Tracing::ThreadBuffer::~ThreadBuffer() {
+  for(size_t index = 0; index < kMaxChunks; index++) {
+    delete[] chunks_[index].load();
+  }
+}
+
+Tracing::TraceEvent* Tracing::ThreadBuffer::Next() {
+  size_t size = size_.load(std::memory_order_relaxed);
+  size_t chunk = size / kChunkSize;
+  if(chunk >= kMaxChunks) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  TraceEvent* events = chunks_[chunk].load(std::memory_order_relaxed);
+  if(!events) {
+    events = new TraceEvent[kChunkSize];
+    chunks_[chunk].store(events, std::memory_order_release);
+  }
+  return &events[size % kChunkSize];
+}
+
+void Tracing::ThreadBuffer::Commit() {
+  size_.store(size_.load(std::memory_order_relaxed) + 1,
+    std::memory_order_release);
+}
+
+void Tracing::ThreadBuffer::Reset(uint32_t new_session) {
+  // Chunks are kept for the next session.
+  size_.store(0, std::memory_order_relaxed);
+  dropped = 0;
+  char thread_name[16];
+  if(!pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name))) {
+    name = thread_name;
+  }
+  session.store(new_session, std::memory_order_release);
+}
+
+const Tracing::TraceEvent& Tracing::ThreadBuffer::at(size_t index) const {
+  return chunks_[index / kChunkSize].load(std::memory_order_acquire)[
+    index % kChunkSize];
+}
+
+//
+// Tracing
+//
+rtc::CriticalSection Tracing::lock_;
+std::vector<Tracing::ThreadBuffer*> Tracing::buffers_;
+std::map<std::string, Tracing::Category*> Tracing::categories_;
+std::vector<std::string> Tracing::enabled_categories_;
+FILE* Tracing::file_ = nullptr;
+int64_t Tracing::start_us_ = 0;
+bool Tracing::writing_ = false;
+std::atomic<bool> Tracing::enabled_(false);
+std::atomic<uint32_t> Tracing::session_(0);
+
+NAN_MODULE_INIT(Tracing::Init) {
+  // Call sites cache their category on first use, this has to happen before
+  // any WebRTC thread runs.
+  static std::once_flag setup;
+  std::call_once(setup, []() {
+    webrtc::SetupEventTracer(Tracing::GetCategoryEnabled,
+      Tracing::AddTraceEvent);
+  });
+
+  Nan::SetMethod(target, "startTracing", Tracing::Start);
+  Nan::SetMethod(target, "stopTracing", Tracing::Stop);
+}
+
+const unsigned char* Tracing::GetCategoryEnabled(const char* name) {
+  rtc::CritScope lock(&lock_);
+  std::map<std::string, Category*>::iterator index = categories_.find(name);
+  if(index != categories_.end()) {
+    return &index->second->enabled;
+  }
+  // Never freed, WebRTC keeps the pointer for good.
+  Category* category = new Category();
+  category->name = name;
+  category->enabled = enabled_ && IsEnabled(name);
+  categories_[name] = category;
+  return &category->enabled;
+}
+
+void Tracing::AddTraceEvent(char phase, const unsigned char* category_enabled,
+    const char* name, unsigned long long id, int num_args,
+    const char** arg_names, const unsigned char* arg_types,
+    const unsigned long long* arg_values, unsigned char flags) {
+  if(!enabled_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  ThreadBuffer* buffer = CurrentBuffer();
+  TraceEvent* event = buffer->Next();
+  if(!event) {
+    return;
+  }
+  event->time_us = rtc::TimeMicros();
+  event->phase = phase;
+  event->flags = flags;
+  event->category = reinterpret_cast<const Category*>(category_enabled);
+  event->name = name;
+  if(flags & TRACE_EVENT_FLAG_COPY) {
+    event->copies[0] = name;
+    event->name = event->copies[0].c_str();
+  }
+  event->id = id;
+  event->num_args = num_args < 2 ? num_args : 2;
+  for(int index = 0; index < event->num_args; index++) {
+    event->arg_names[index] = arg_names[index];
+    event->arg_types[index] = arg_types[index];
+    event->arg_values[index] = arg_values[index];
+    if(arg_types[index] == TRACE_VALUE_TYPE_STRING ||
+        arg_types[index] == TRACE_VALUE_TYPE_COPY_STRING) {
+      const char* value = reinterpret_cast<const char*>(arg_values[index]);
+      event->copies[index + 1] = value ? value : "";
+      event->arg_values[index] = reinterpret_cast<unsigned long long>(
+        event->copies[index + 1].c_str());
+    }
+  }
+  buffer->Commit();
+}
+
+Tracing::ThreadBuffer* Tracing::CurrentBuffer() {
+  // Marks the buffer of a thread that exits, the next session frees it.
+  struct Owner {
+    Owner() : buffer(nullptr) { }
+    ~Owner() {
+      if(buffer) {
+        buffer->orphaned = true;
+      }
+    }
+    ThreadBuffer* buffer;
+  };
+  static thread_local Owner owner;
+
+  uint32_t session = session_.load(std::memory_order_acquire);
+  if(!owner.buffer) {
+    owner.buffer = new ThreadBuffer();
+    rtc::CritScope lock(&lock_);
+    buffers_.push_back(owner.buffer);
+  }
+  if(owner.buffer->session.load(std::memory_order_relaxed) != session) {
+    owner.buffer->Reset(session);
+  }
+  return owner.buffer;
+}
+
+bool Tracing::IsEnabled(const char* category) {
+  if(enabled_categories_.empty()) {
+    return strncmp(category, kDisabledByDefault,
+      sizeof(kDisabledByDefault) - 1) != 0;
+  }
+  std::vector<std::string>::const_iterator index;
+  for(index = enabled_categories_.begin(); index != enabled_categories_.end();
+      index++) {
+    if(*index == category) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Tracing::UpdateCategories() {
+  std::map<std::string, Category*>::iterator index;
+  for(index = categories_.begin(); index != categories_.end(); index++) {
+    index->second->enabled = enabled_ && IsEnabled(index->second->name);
+  }
+}
+
+bool Tracing::Write(FILE* file, const std::vector<ThreadBuffer*>& buffers,
+    uint32_t session, int64_t start_us, uint64_t* events, uint64_t* dropped) {
+  int pid = static_cast<int>(getpid());
+  bool first = true;
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+
+  std::vector<ThreadBuffer*>::const_iterator buffer;
+  for(buffer = buffers.begin(); buffer != buffers.end(); buffer++) {
+    if((*buffer)->session.load(std::memory_order_acquire) != session) {
+      continue;
+    }
+    size_t size = (*buffer)->size();
+    *dropped += (*buffer)->dropped;
+    if(!size) {
+      continue;
+    }
+
+    fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+      "\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", pid,
+      (*buffer)->tid);
+    WriteString(file, (*buffer)->name.c_str());
+    fputs("}}", file);
+    first = false;
+
+    for(size_t index = 0; index < size; index++) {
+      const TraceEvent& event = (*buffer)->at(index);
+      fputs(",\n{\"name\":", file);
+      WriteString(file, event.name);
+      fputs(",\"cat\":", file);
+      WriteString(file, event.category->name);
+      fprintf(file, ",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%d,\"tid\":%d",
+        event.phase, static_cast<long long>(event.time_us - start_us), pid,
+        (*buffer)->tid);
+      if(event.flags & TRACE_EVENT_FLAG_HAS_ID) {
+        fprintf(file, ",\"id\":\"0x%llx\"", event.id);
+      }
+      if(event.phase == TRACE_EVENT_PHASE_INSTANT) {
+        fputs(",\"s\":\"t\"", file);
+      }
+      if(event.num_args) {
+        fputs(",\"args\":{", file);
+        for(int arg = 0; arg < event.num_args; arg++) {
+          if(arg) {
+            fputc(',', file);
+          }
+          WriteString(file, event.arg_names[arg]);
+          fputc(':', file);
+          unsigned long long value = event.arg_values[arg];
+          switch(event.arg_types[arg]) {
+            case TRACE_VALUE_TYPE_BOOL:
+              fputs(value ? "true" : "false", file);
+              break;
+            case TRACE_VALUE_TYPE_UINT:
+              fprintf(file, "%llu", value);
+              break;
+            case TRACE_VALUE_TYPE_INT:
+              fprintf(file, "%lld", static_cast<long long>(value));
+              break;
+            case TRACE_VALUE_TYPE_DOUBLE: {
+              double number;
+              memcpy(&number, &value, sizeof(number));
+              if(isfinite(number)) {
+                fprintf(file, "%.17g", number);
+              } else {
+                fputs("null", file);
+              }
+              break;
+            }
+            case TRACE_VALUE_TYPE_STRING:
+            case TRACE_VALUE_TYPE_COPY_STRING:
+              WriteString(file, reinterpret_cast<const char*>(value));
+              break;
+            default:
+              fprintf(file, "\"0x%llx\"", value);
+          }
+        }
+        fputc('}', file);
+      }
+      fputc('}', file);
+    }
+    *events += size;
+  }
+
+  fputs("\n]}\n", file);
+  return !ferror(file);
+}
+
+// startTracing(path[, { categories }]) records trace events until
+// stopTracing(), all categories but the disabled-by-default ones when none
+// are given.
+NAN_METHOD(Tracing::Start) {
+  if(info.Length() < 1 || !info[0]->IsString()) {
+    return Nan::ThrowError("Invalid path");
+  }
+  std::string path(*Nan::Utf8String(info[0]));
+
+  std::vector<std::string> categories;
+  if(info.Length() >= 2 && info[1]->IsObject()) {
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[1]);
+    v8::Local<v8::Value> value =
+      options->Get(Nan::New("categories").ToLocalChecked());
+    if(value->IsArray()) {
+      v8::Local<v8::Array> list = v8::Local<v8::Array>::Cast(value);
+      for(uint32_t index = 0; index < list->Length(); index++) {
+        categories.push_back(*Nan::Utf8String(list->Get(index)));
+      }
+    } else if(!value->IsUndefined()) {
+      return Nan::ThrowError("Invalid categories");
+    }
+  }
+
+  rtc::CritScope lock(&lock_);
+  if(enabled_) {
+    return Nan::ThrowError("Tracing is already running");
+  }
+  if(writing_) {
+    return Nan::ThrowError("The last trace is still being written");
+  }
+  file_ = fopen(path.c_str(), "we");
+  if(!file_) {
+    return Nan::ThrowError(("Could not open " + path).c_str());
+  }
+
+  // Nothing reads the buffers between two sessions.
+  std::vector<ThreadBuffer*>::iterator buffer = buffers_.begin();
+  while(buffer != buffers_.end()) {
+    if((*buffer)->orphaned) {
+      delete *buffer;
+      buffer = buffers_.erase(buffer);
+    } else {
+      buffer++;
+    }
+  }
+
+  enabled_categories_.swap(categories);
+  start_us_ = rtc::TimeMicros();
+  session_++;
+  enabled_ = true;
+  UpdateCategories();
+  LOG(LS_INFO) << __FUNCTION__ << ": Tracing to " << path;
+  info.GetReturnValue().SetUndefined();
+}
+
+// stopTracing([callback]) writes the trace off the JS thread, callback gets
+// (error, { events, eventsDropped }).
+NAN_METHOD(Tracing::Stop) {
+  Nan::Callback* callback = nullptr;
+  if(info.Length() >= 1 && info[0]->IsFunction()) {
+    callback = new Nan::Callback(info[0].As<v8::Function>());
+  }
+
+  rtc::CritScope lock(&lock_);
+  if(!enabled_) {
+    delete callback;
+    return Nan::ThrowError("Tracing is not running");
+  }
+  enabled_ = false;
+  UpdateCategories();
+  writing_ = true;
+  // Events still being added are left out.
+  Nan::AsyncQueueWorker(new WriteTraceWorker(file_, buffers_, session_,
+    start_us_, callback));
+  file_ = nullptr;
+  info.GetReturnValue().SetUndefined();
+}
@@ -0,0 +1,108 @@
+#ifndef WEBRTCJS_TRACING_H
+#define WEBRTCJS_TRACING_H
+
+#include <nan.h>
+#include <stdio.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/trace_event.h"
+
+// Records trace events between startTracing() and stopTracing(), the ones
+// of the addon and the TRACE_EVENTs inside WebRTC, and writes them as Chrome
+// trace JSON for chrome://tracing. Every thread appends to a buffer only it
+// writes to, recording an event takes no lock.
+class Tracing {
+ public:
+  static NAN_MODULE_INIT(Init);
+
+ private:
+  friend class WriteTraceWorker;
+
+  // Events per chunk, and chunks a thread may fill during one session.
+  static const size_t kChunkSize = 4096;
+  static const size_t kMaxChunks = 256;
+
+  struct Category {
+    // First member, WebRTC only sees a pointer to it.
+    unsigned char enabled;
+    const char* name;
+  };
+
+  struct TraceEvent {
+    int64_t time_us;
+    char phase;
+    unsigned char flags;
+    const Category* category;
+    const char* name;
+    unsigned long long id;
+    int num_args;
+    const char* arg_names[2];
+    unsigned char arg_types[2];
+    unsigned long long arg_values[2];
+    // Copies of names and strings that may not outlive the call.
+    std::string copies[3];
+  };
+
+  class ThreadBuffer {
+   public:
+    ThreadBuffer();
+    ~ThreadBuffer();
+
+    // Only called by the thread owning the buffer.
+    TraceEvent* Next();
+    void Commit();
+    void Reset(uint32_t session);
+
+    // Events committed so far, safe from any thread.
+    size_t size() const { return size_.load(std::memory_order_acquire); }
+    const TraceEvent& at(size_t index) const;
+
+    // Stored after the rest of a reset, read it before size().
+    std::atomic<uint32_t> session;
+    int tid;
+    std::string name;
+    std::atomic<bool> orphaned;
+    std::atomic<uint64_t> dropped;
+
+   private:
+    std::atomic<TraceEvent*> chunks_[kMaxChunks];
+    std::atomic<size_t> size_;
+  };
+
+  static const unsigned char* GetCategoryEnabled(const char* name);
+  static void AddTraceEvent(char phase, const unsigned char* category_enabled,
+    const char* name, unsigned long long id, int num_args,
+    const char** arg_names, const unsigned char* arg_types,
+    const unsigned long long* arg_values, unsigned char flags);
+
+  static ThreadBuffer* CurrentBuffer();
+  static bool IsEnabled(const char* category);
+  static void UpdateCategories();
+
+  // Writes the events of session as JSON, on the libuv thread pool.
+  static bool Write(FILE* file, const std::vector<ThreadBuffer*>& buffers,
+    uint32_t session, int64_t start_us, uint64_t* events,
+    uint64_t* dropped);
+
+  static NAN_METHOD(Start);
+  static NAN_METHOD(Stop);
+
+  static rtc::CriticalSection lock_;
+  static std::vector<ThreadBuffer*> buffers_;
+  static std::map<std::string, Category*> categories_;
+  // Empty traces every category but the disabled-by-default ones.
+  static std::vector<std::string> enabled_categories_;
+  static FILE* file_;
+  static int64_t start_us_;
+  // A new session cannot start while the last one is being written.
+  static bool writing_;
+
+  static std::atomic<bool> enabled_;
+  static std::atomic<uint32_t> session_;
+};
+
+#endif
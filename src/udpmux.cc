@@ -0,0 +1,483 @@
+#include "udpmux.h"
+
+#include <errno.h>
+#include <algorithm>
+
+#include "webrtc/base/byteorder.h"
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/p2p/base/stun.h"
+
+// Requests a member keeps routable, older ones have long timed out.
+static const size_t kMaxTransactions = 64;
+static const size_t kStunTransactionIdOffset = 8;
+static const uint16_t kStunResponseBit = 0x0100;
+static const uint16_t kStunClassMask = 0x0110;
+
+static bool IsStun(const char* data, size_t size) {
+  return size >= cricket::kStunHeaderSize && (data[0] & 0xC0) == 0 &&
+    rtc::GetBE32(data + 4) == cricket::kStunMagicCookie &&
+    rtc::GetBE16(data + 2) + cricket::kStunHeaderSize == size;
+}
+
+static std::string GetTransactionId(const char* data) {
+  return std::string(data + kStunTransactionIdOffset,
+    cricket::kStunTransactionIdLength);
+}
+
+// Walks the attributes without a full StunMessage parse, this runs for
+// every binding request on the port.
+static bool FindAttribute(const char* data, size_t size, uint16_t type,
+    const char** value, uint16_t* length) {
+  size_t offset = cricket::kStunHeaderSize;
+  while(offset + 4 <= size) {
+    uint16_t attribute = rtc::GetBE16(data + offset);
+    *length = rtc::GetBE16(data + offset + 2);
+    offset += 4;
+    if(offset + *length > size) {
+      break;
+    }
+    if(attribute == type) {
+      *value = data + offset;
+      return true;
+    }
+    offset += (*length + 3) & ~3;
+  }
+  return false;
+}
+
+static std::string GetUsername(const char* data, size_t size) {
+  const char* value;
+  uint16_t length;
+  if(!FindAttribute(data, size, cricket::STUN_ATTR_USERNAME, &value,
+      &length)) {
+    return std::string();
+  }
+  return std::string(value, length);
+}
+
+// The low byte of PRIORITY is 256 minus the component of the sender, which
+// is the component the check is meant for (RFC 5245 4.1.2.1).
+static int GetComponent(const char* data, size_t size) {
+  const char* value;
+  uint16_t length;
+  if(!FindAttribute(data, size, cricket::STUN_ATTR_PRIORITY, &value,
+      &length) || length != 4) {
+    return -1;
+  }
+  return 256 - static_cast<uint8_t>(value[3]);
+}
+
+//
+// UdpMux
+//
+
+UdpMux::UdpMux(rtc::AsyncPacketSocket* socket) :
+    socket_(socket),
+    address_(socket->GetLocalAddress()),
+    sockets_(0),
+    received_(0),
+    sent_(0),
+    unmatched_(0) {
+  socket_->SignalReadPacket.connect(this, &UdpMux::OnReadPacket);
+  socket_->SignalReadyToSend.connect(this, &UdpMux::OnReadyToSend);
+}
+
+UdpMux::~UdpMux() {
+  RTC_DCHECK(members_.empty());
+}
+
+void UdpMux::GetStats(Stats* stats) const {
+  stats->address = address_;
+  stats->sockets = sockets_;
+  stats->received = received_;
+  stats->sent = sent_;
+  stats->unmatched = unmatched_;
+}
+
+void UdpMux::Add(UdpMuxSocket* socket) {
+  members_.push_back(socket);
+  sockets_++;
+}
+
+void UdpMux::Remove(UdpMuxSocket* socket) {
+  std::vector<UdpMuxSocket*>::iterator member =
+    std::find(members_.begin(), members_.end(), socket);
+  if(member == members_.end()) {
+    return;
+  }
+  members_.erase(member);
+  sockets_--;
+
+  RemoveUfrag(socket);
+  // Another member may have taken over an entry in the meantime.
+  std::deque<std::string>::iterator id;
+  for(id = socket->transactions_.begin(); id != socket->transactions_.end();
+      id++) {
+    std::unordered_map<std::string, UdpMuxSocket*>::iterator transaction =
+      transactions_.find(*id);
+    if(transaction != transactions_.end() && transaction->second == socket) {
+      transactions_.erase(transaction);
+    }
+  }
+  std::vector<rtc::SocketAddress>::iterator address;
+  for(address = socket->addresses_.begin();
+      address != socket->addresses_.end(); address++) {
+    std::map<rtc::SocketAddress, UdpMuxSocket*>::iterator entry =
+      addresses_.find(*address);
+    if(entry != addresses_.end() && entry->second == socket) {
+      addresses_.erase(entry);
+    }
+  }
+  std::vector<CheckKey>::iterator key;
+  for(key = socket->checks_.begin(); key != socket->checks_.end(); key++) {
+    std::map<CheckKey, UdpMuxSocket*>::iterator check = checks_.find(*key);
+    if(check != checks_.end() && check->second == socket) {
+      checks_.erase(check);
+    }
+  }
+  socket->transactions_.clear();
+  socket->addresses_.clear();
+  socket->checks_.clear();
+}
+
+int UdpMux::SendTo(UdpMuxSocket* socket, const void* data, size_t size,
+    const rtc::SocketAddress& address, const rtc::PacketOptions& options) {
+  const char* bytes = static_cast<const char*>(data);
+  if(IsStun(bytes, size) &&
+      (rtc::GetBE16(bytes) & kStunClassMask) == 0) {
+    // Connectivity checks carry "remote:local" and tell us our ufrag and
+    // the peer address. Other requests go to STUN servers that are shared
+    // by all members, they are not tied to their address.
+    std::string username = GetUsername(bytes, size);
+    size_t colon = username.find(':');
+    if(colon != std::string::npos) {
+      std::string ufrag = username.substr(colon + 1);
+      if(socket->ufrag_ != ufrag) {
+        SetUfrag(socket, ufrag, GetComponent(bytes, size));
+      }
+      LearnCheck(socket, address, ufrag);
+      if(addresses_.find(address) == addresses_.end()) {
+        Learn(socket, address);
+      }
+    }
+    std::string id = GetTransactionId(bytes);
+    if(transactions_.find(id) == transactions_.end()) {
+      transactions_[id] = socket;
+      socket->transactions_.push_back(id);
+      if(socket->transactions_.size() > kMaxTransactions) {
+        std::unordered_map<std::string, UdpMuxSocket*>::iterator oldest =
+          transactions_.find(socket->transactions_.front());
+        if(oldest != transactions_.end() && oldest->second == socket) {
+          transactions_.erase(oldest);
+        }
+        socket->transactions_.pop_front();
+      }
+    }
+  } else if(addresses_.find(address) == addresses_.end()) {
+    Learn(socket, address);
+  }
+
+  int result = socket_->SendTo(data, size, address, options);
+  if(result < 0) {
+    socket->error_ = socket_->GetError();
+    return result;
+  }
+  sent_++;
+  socket->SignalSentPacket(socket,
+    rtc::SentPacket(options.packet_id, rtc::TimeMillis()));
+  return result;
+}
+
+UdpMuxSocket* UdpMux::Match(const char* data, size_t size,
+    const rtc::SocketAddress& address) {
+  if(IsStun(data, size)) {
+    uint16_t type = rtc::GetBE16(data);
+    if(type & kStunResponseBit) {
+      std::unordered_map<std::string, UdpMuxSocket*>::iterator transaction =
+        transactions_.find(GetTransactionId(data));
+      if(transaction != transactions_.end()) {
+        return transaction->second;
+      }
+    } else if((type & kStunClassMask) == 0) {
+      std::string username = GetUsername(data, size);
+      UdpMuxSocket* socket = MatchUfrag(
+        username.substr(0, username.find(':')), GetComponent(data, size),
+        address);
+      if(socket) {
+        return socket;
+      }
+    }
+  }
+
+  std::map<rtc::SocketAddress, UdpMuxSocket*>::iterator entry =
+    addresses_.find(address);
+  if(entry != addresses_.end()) {
+    return entry->second;
+  }
+  return nullptr;
+}
+
+UdpMuxSocket* UdpMux::MatchUfrag(const std::string& ufrag, int component,
+    const rtc::SocketAddress& address) {
+  // The member that already checked this address with the ufrag, else the
+  // member of the ufrag that serves the component.
+  UdpMuxSocket* socket = nullptr;
+  std::map<CheckKey, UdpMuxSocket*>::iterator check =
+    checks_.find(CheckKey(address, ufrag));
+  if(check != checks_.end()) {
+    socket = check->second;
+  } else {
+    std::unordered_map<std::string, std::vector<UdpMuxSocket*>>::iterator
+      sockets = ufrags_.find(ufrag);
+    if(sockets == ufrags_.end()) {
+      return nullptr;
+    }
+    socket = sockets->second.front();
+    std::vector<UdpMuxSocket*>::iterator member;
+    for(member = sockets->second.begin(); member != sockets->second.end();
+        member++) {
+      if((*member)->component_ == component) {
+        socket = *member;
+        break;
+      }
+    }
+    LearnCheck(socket, address, ufrag);
+  }
+
+  // A check that names us is the best proof of who talks from there.
+  std::map<rtc::SocketAddress, UdpMuxSocket*>::iterator entry =
+    addresses_.find(address);
+  if(entry == addresses_.end()) {
+    Learn(socket, address);
+  } else if(entry->second != socket) {
+    entry->second = socket;
+    socket->addresses_.push_back(address);
+  }
+  return socket;
+}
+
+void UdpMux::Learn(UdpMuxSocket* socket, const rtc::SocketAddress& address) {
+  addresses_[address] = socket;
+  socket->addresses_.push_back(address);
+}
+
+void UdpMux::LearnCheck(UdpMuxSocket* socket,
+    const rtc::SocketAddress& address, const std::string& ufrag) {
+  CheckKey key(address, ufrag);
+  std::map<CheckKey, UdpMuxSocket*>::iterator check = checks_.find(key);
+  if(check == checks_.end()) {
+    checks_[key] = socket;
+    socket->checks_.push_back(key);
+  } else if(check->second != socket) {
+    check->second = socket;
+    socket->checks_.push_back(key);
+  }
+}
+
+void UdpMux::SetUfrag(UdpMuxSocket* socket, const std::string& ufrag,
+    int component) {
+  // An ICE restart, checks of the old ufrag no longer arrive.
+  RemoveUfrag(socket);
+  std::vector<CheckKey>::iterator key = socket->checks_.begin();
+  while(key != socket->checks_.end()) {
+    if(key->second != socket->ufrag_) {
+      key++;
+      continue;
+    }
+    std::map<CheckKey, UdpMuxSocket*>::iterator check = checks_.find(*key);
+    if(check != checks_.end() && check->second == socket) {
+      checks_.erase(check);
+    }
+    key = socket->checks_.erase(key);
+  }
+
+  socket->ufrag_ = ufrag;
+  if(socket->component_ < 0) {
+    socket->component_ = component;
+  }
+  ufrags_[ufrag].push_back(socket);
+}
+
+void UdpMux::RemoveUfrag(UdpMuxSocket* socket) {
+  std::unordered_map<std::string, std::vector<UdpMuxSocket*>>::iterator
+    ufrag = ufrags_.find(socket->ufrag_);
+  if(ufrag == ufrags_.end()) {
+    return;
+  }
+  std::vector<UdpMuxSocket*>& sockets = ufrag->second;
+  sockets.erase(std::remove(sockets.begin(), sockets.end(), socket),
+    sockets.end());
+  if(sockets.empty()) {
+    ufrags_.erase(ufrag);
+  }
+}
+
+void UdpMux::OnReadPacket(rtc::AsyncPacketSocket* socket, const char* data,
+    size_t size, const rtc::SocketAddress& address,
+    const rtc::PacketTime& time) {
+  received_++;
+  UdpMuxSocket* member = Match(data, size, address);
+  if(!member) {
+    // Usually a check that came before our own, the remote retransmits it.
+    unmatched_++;
+    return;
+  }
+  member->SignalReadPacket(member, data, size, address, time);
+}
+
+void UdpMux::OnReadyToSend(rtc::AsyncPacketSocket* socket) {
+  // Copied, a handler may create new members.
+  std::vector<UdpMuxSocket*> members(members_);
+  std::vector<UdpMuxSocket*>::iterator member;
+  for(member = members.begin(); member != members.end(); member++) {
+    (*member)->SignalReadyToSend(*member);
+  }
+}
+
+//
+// UdpMuxSocket
+//
+
+UdpMuxSocket::UdpMuxSocket(rtc::scoped_refptr<UdpMux> mux) :
+    mux_(mux),
+    closed_(false),
+    error_(0),
+    component_(-1) {
+  mux_->Add(this);
+}
+
+UdpMuxSocket::~UdpMuxSocket() {
+  Close();
+}
+
+rtc::SocketAddress UdpMuxSocket::GetLocalAddress() const {
+  return mux_->address();
+}
+
+rtc::SocketAddress UdpMuxSocket::GetRemoteAddress() const {
+  return rtc::SocketAddress();
+}
+
+int UdpMuxSocket::Send(const void* data, size_t size,
+    const rtc::PacketOptions& options) {
+  error_ = ENOTCONN;
+  return -1;
+}
+
+int UdpMuxSocket::SendTo(const void* data, size_t size,
+    const rtc::SocketAddress& address, const rtc::PacketOptions& options) {
+  if(closed_) {
+    error_ = EBADF;
+    return -1;
+  }
+  return mux_->SendTo(this, data, size, address, options);
+}
+
+int UdpMuxSocket::Close() {
+  if(!closed_) {
+    closed_ = true;
+    mux_->Remove(this);
+  }
+  return 0;
+}
+
+rtc::AsyncPacketSocket::State UdpMuxSocket::GetState() const {
+  return closed_ ? STATE_CLOSED : STATE_BOUND;
+}
+
+int UdpMuxSocket::GetOption(rtc::Socket::Option option, int* value) {
+  return mux_->socket()->GetOption(option, value);
+}
+
+int UdpMuxSocket::SetOption(rtc::Socket::Option option, int value) {
+  // Every member asks for the same buffer sizes and DSCP.
+  return mux_->socket()->SetOption(option, value);
+}
+
+int UdpMuxSocket::GetError() const {
+  return error_;
+}
+
+void UdpMuxSocket::SetError(int error) {
+  error_ = error;
+}
+
+//
+// UdpMuxSocketFactory
+//
+
+UdpMuxSocketFactory::UdpMuxSocketFactory(rtc::Thread* thread, uint16_t port,
+    int ports) :
+    fallback_(thread),
+    port_(port),
+    ports_(ports) {
+}
+
+UdpMuxSocketFactory::~UdpMuxSocketFactory() {
+}
+
+rtc::AsyncPacketSocket* UdpMuxSocketFactory::CreateUdpSocket(
+    const rtc::SocketAddress& address, uint16_t min_port, uint16_t max_port) {
+  // The configured ports replace the port range of the allocator.
+  rtc::CritScope lock(&lock_);
+  std::vector<rtc::scoped_refptr<UdpMux>>& muxes = muxes_[address.ipaddr()];
+  if(muxes.empty()) {
+    for(int index = 0; index < ports_; index++) {
+      uint16_t port = port_ + index;
+      rtc::AsyncPacketSocket* socket = fallback_.CreateUdpSocket(
+        rtc::SocketAddress(address.ipaddr(), 0), port, port);
+      if(!socket) {
+        LOG(LS_ERROR) << __FUNCTION__ << ": Could not bind "
+          << address.ipaddr().ToString() << ":" << port;
+        continue;
+      }
+      muxes.push_back(new rtc::RefCountedObject<UdpMux>(socket));
+    }
+    if(muxes.empty()) {
+      muxes_.erase(address.ipaddr());
+      return nullptr;
+    }
+  }
+
+  size_t best = 0;
+  for(size_t index = 1; index < muxes.size(); index++) {
+    if(muxes[index]->sockets() < muxes[best]->sockets()) {
+      best = index;
+    }
+  }
+  return new UdpMuxSocket(muxes[best]);
+}
+
+rtc::AsyncPacketSocket* UdpMuxSocketFactory::CreateServerTcpSocket(
+    const rtc::SocketAddress& local_address, uint16_t min_port,
+    uint16_t max_port, int opts) {
+  return fallback_.CreateServerTcpSocket(local_address, min_port, max_port,
+    opts);
+}
+
+rtc::AsyncPacketSocket* UdpMuxSocketFactory::CreateClientTcpSocket(
+    const rtc::SocketAddress& local_address,
+    const rtc::SocketAddress& remote_address,
+    const rtc::ProxyInfo& proxy_info, const std::string& user_agent,
+    int opts) {
+  return fallback_.CreateClientTcpSocket(local_address, remote_address,
+    proxy_info, user_agent, opts);
+}
+
+rtc::AsyncResolverInterface* UdpMuxSocketFactory::CreateAsyncResolver() {
+  return fallback_.CreateAsyncResolver();
+}
+
+void UdpMuxSocketFactory::GetStats(std::vector<UdpMux::Stats>* stats) {
+  rtc::CritScope lock(&lock_);
+  std::map<rtc::IPAddress,
+    std::vector<rtc::scoped_refptr<UdpMux>>>::const_iterator address;
+  for(address = muxes_.begin(); address != muxes_.end(); address++) {
+    for(size_t index = 0; index < address->second.size(); index++) {
+      UdpMux::Stats mux_stats;
+      address->second[index]->GetStats(&mux_stats);
+      stats->push_back(mux_stats);
+    }
+  }
+}
@@ -0,0 +1,167 @@
+#ifndef WEBRTCJS_UDPMUX_H
+#define WEBRTCJS_UDPMUX_H
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "webrtc/base/asyncpacketsocket.h"
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/ipaddress.h"
+#include "webrtc/base/packetsocketfactory.h"
+#include "webrtc/base/refcount.h"
+#include "webrtc/base/scoped_ptr.h"
+#include "webrtc/base/scoped_ref_ptr.h"
+#include "webrtc/base/sigslot.h"
+#include "webrtc/base/socketaddress.h"
+#include "webrtc/p2p/base/basicpacketsocketfactory.h"
+
+class UdpMuxSocket;
+
+// One bound UDP socket that carries the traffic of many PeerConnections.
+// Incoming packets are handed to the UdpMuxSocket they belong to, looked up
+// by STUN transaction id for responses, by remote address and local ICE
+// ufrag, then ufrag and component for binding requests and by remote
+// address for everything else. Lives on the worker thread of its factory.
+//
+// Media carries no ufrag. When two PeerConnections on one mux talk to the
+// same remote address, e.g. one TURN allocation, DTLS and SRTP from there go
+// to the member that exchanged checks with it last.
+class UdpMux : public rtc::RefCountInterface, public sigslot::has_slots<> {
+ public:
+  struct Stats {
+    rtc::SocketAddress address;
+    uint32_t sockets;
+    uint64_t received;
+    uint64_t sent;
+    uint64_t unmatched;
+  };
+
+  explicit UdpMux(rtc::AsyncPacketSocket* socket);
+
+  rtc::AsyncPacketSocket* socket() const { return socket_.get(); }
+  const rtc::SocketAddress& address() const { return address_; }
+  uint32_t sockets() const { return sockets_; }
+  void GetStats(Stats* stats) const;
+
+ protected:
+  ~UdpMux() override;
+
+ private:
+  friend class UdpMuxSocket;
+
+  void Add(UdpMuxSocket* socket);
+  void Remove(UdpMuxSocket* socket);
+  int SendTo(UdpMuxSocket* socket, const void* data, size_t size,
+    const rtc::SocketAddress& address, const rtc::PacketOptions& options);
+
+  void OnReadPacket(rtc::AsyncPacketSocket* socket, const char* data,
+    size_t size, const rtc::SocketAddress& address,
+    const rtc::PacketTime& time);
+  void OnReadyToSend(rtc::AsyncPacketSocket* socket);
+  UdpMuxSocket* Match(const char* data, size_t size,
+    const rtc::SocketAddress& address);
+  UdpMuxSocket* MatchUfrag(const std::string& ufrag, int component,
+    const rtc::SocketAddress& address);
+  void Learn(UdpMuxSocket* socket, const rtc::SocketAddress& address);
+  void LearnCheck(UdpMuxSocket* socket, const rtc::SocketAddress& address,
+    const std::string& ufrag);
+  void SetUfrag(UdpMuxSocket* socket, const std::string& ufrag,
+    int component);
+  void RemoveUfrag(UdpMuxSocket* socket);
+
+  // Remote address and local ICE ufrag of a check.
+  typedef std::pair<rtc::SocketAddress, std::string> CheckKey;
+
+  rtc::scoped_ptr<rtc::AsyncPacketSocket> socket_;
+  const rtc::SocketAddress address_;
+  std::vector<UdpMuxSocket*> members_;
+  // ICE ufrag of the local side, learned from outgoing binding requests and
+  // changed by ICE restarts. All components and transports of a
+  // PeerConnection share it.
+  std::unordered_map<std::string, std::vector<UdpMuxSocket*>> ufrags_;
+  // Outstanding STUN requests, their responses may come from a server that
+  // every member talks to.
+  std::unordered_map<std::string, UdpMuxSocket*> transactions_;
+  // Checks seen in either direction, they tell members that share a
+  // remote address apart.
+  std::map<CheckKey, UdpMuxSocket*> checks_;
+  std::map<rtc::SocketAddress, UdpMuxSocket*> addresses_;
+
+  std::atomic<uint32_t> sockets_;
+  std::atomic<uint64_t> received_;
+  std::atomic<uint64_t> sent_;
+  std::atomic<uint64_t> unmatched_;
+};
+
+// What a UDPPort sees instead of its own socket. Sends go out through the
+// shared socket, reads arrive once UdpMux has matched them.
+class UdpMuxSocket : public rtc::AsyncPacketSocket {
+ public:
+  explicit UdpMuxSocket(rtc::scoped_refptr<UdpMux> mux);
+  ~UdpMuxSocket() override;
+
+  rtc::SocketAddress GetLocalAddress() const override;
+  rtc::SocketAddress GetRemoteAddress() const override;
+  int Send(const void* data, size_t size,
+    const rtc::PacketOptions& options) override;
+  int SendTo(const void* data, size_t size, const rtc::SocketAddress& address,
+    const rtc::PacketOptions& options) override;
+  int Close() override;
+  State GetState() const override;
+  int GetOption(rtc::Socket::Option option, int* value) override;
+  int SetOption(rtc::Socket::Option option, int value) override;
+  int GetError() const override;
+  void SetError(int error) override;
+
+ private:
+  friend class UdpMux;
+
+  rtc::scoped_refptr<UdpMux> mux_;
+  bool closed_;
+  int error_;
+  std::string ufrag_;
+  // ICE component of the port, -1 until its first check.
+  int component_;
+  std::deque<std::string> transactions_;
+  std::vector<rtc::SocketAddress> addresses_;
+  std::vector<UdpMux::CheckKey> checks_;
+};
+
+// Hands out UdpMuxSockets for UDP and plain sockets for everything else.
+// Each local address gets one shared socket per port of the range, new
+// members go to the least used one.
+class UdpMuxSocketFactory : public rtc::PacketSocketFactory {
+ public:
+  UdpMuxSocketFactory(rtc::Thread* thread, uint16_t port, int ports);
+  ~UdpMuxSocketFactory() override;
+
+  rtc::AsyncPacketSocket* CreateUdpSocket(const rtc::SocketAddress& address,
+    uint16_t min_port, uint16_t max_port) override;
+  rtc::AsyncPacketSocket* CreateServerTcpSocket(
+    const rtc::SocketAddress& local_address, uint16_t min_port,
+    uint16_t max_port, int opts) override;
+  rtc::AsyncPacketSocket* CreateClientTcpSocket(
+    const rtc::SocketAddress& local_address,
+    const rtc::SocketAddress& remote_address,
+    const rtc::ProxyInfo& proxy_info, const std::string& user_agent,
+    int opts) override;
+  rtc::AsyncResolverInterface* CreateAsyncResolver() override;
+
+  // Safe to call from any thread.
+  void GetStats(std::vector<UdpMux::Stats>* stats);
+
+ private:
+  rtc::BasicPacketSocketFactory fallback_;
+  uint16_t port_;
+  int ports_;
+
+  rtc::CriticalSection lock_;
+  std::map<rtc::IPAddress, std::vector<rtc::scoped_refptr<UdpMux>>> muxes_;
+};
+
+#endif
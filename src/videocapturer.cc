@@ -0,0 +1,116 @@
+#include "videocapturer.h"
+
+#include "webrtc/base/bind.h"
+#include "webrtc/base/timeutils.h"
+
+#include "metrics.h"
+
+static const int kMaxLagFrames = 5;
+
+PushVideoCapturer::PushVideoCapturer(int width, int height,
+    double frame_rate) :
+    width_(width),
+    height_(height),
+    frame_rate_(frame_rate),
+    interval_ns_(static_cast<int64_t>(rtc::kNumNanosecsPerSec / frame_rate)),
+    next_tick_ns_(0),
+    running_(false),
+    frames_(0) {
+  std::vector<cricket::VideoFormat> formats;
+  formats.push_back(cricket::VideoFormat(width_, height_, interval_ns_,
+    cricket::FOURCC_I420));
+  SetSupportedFormats(formats);
+  WebRtcJs::Pin();
+}
+
+PushVideoCapturer::~PushVideoCapturer() {
+  Halt();
+  WebRtcJs::Unpin();
+}
+
+cricket::CaptureState PushVideoCapturer::Start(
+    const cricket::VideoFormat& format) {
+  SetCaptureFormat(&format);
+  WebRtcJs::GetMediaThreadIfRunning()->Invoke<void>(
+    rtc::Bind(&PushVideoCapturer::StartOnMediaThread, this));
+  SetCaptureState(cricket::CS_RUNNING);
+  return cricket::CS_RUNNING;
+}
+
+void PushVideoCapturer::Stop() {
+  Halt();
+  SetCaptureFormat(NULL);
+  SetCaptureState(cricket::CS_STOPPED);
+}
+
+bool PushVideoCapturer::IsRunning() {
+  return capture_state() == cricket::CS_RUNNING;
+}
+
+bool PushVideoCapturer::IsScreencast() const {
+  return false;
+}
+
+bool PushVideoCapturer::GetPreferredFourccs(std::vector<uint32_t>* fourccs) {
+  if(!fourccs) {
+    return false;
+  }
+  fourccs->push_back(cricket::FOURCC_I420);
+  return true;
+}
+
+void PushVideoCapturer::Halt() {
+  WebRtcJs::GetMediaThreadIfRunning()->Invoke<void>(
+    rtc::Bind(&PushVideoCapturer::StopOnMediaThread, this));
+}
+
+void PushVideoCapturer::StartOnMediaThread() {
+  if(!running_) {
+    running_ = true;
+    next_tick_ns_ = rtc::TimeNanos();
+    WebRtcJs::GetMediaThreadIfRunning()->Post(this);
+  }
+}
+
+void PushVideoCapturer::StopOnMediaThread() {
+  running_ = false;
+  WebRtcJs::GetMediaThreadIfRunning()->Clear(this);
+}
+
+void PushVideoCapturer::OnMessage(rtc::Message* msg) {
+  if(!running_) {
+    return;
+  }
+
+  int64_t now = rtc::TimeNanos();
+  if(now - next_tick_ns_ > kMaxLagFrames * interval_ns_) {
+    next_tick_ns_ = now;
+  }
+
+  // Only the latest due frame is produced, late ticks are dropped.
+  if(next_tick_ns_ <= now) {
+    OnTick(next_tick_ns_);
+    while(next_tick_ns_ <= now) {
+      next_tick_ns_ += interval_ns_;
+    }
+  }
+
+  int delay = static_cast<int>((next_tick_ns_ - now) /
+    rtc::kNumNanosecsPerMillisec);
+  WebRtcJs::GetMediaThreadIfRunning()->PostDelayed(delay, this);
+}
+
+void PushVideoCapturer::DeliverFrame(const uint8_t* data, size_t size,
+    int64_t time_ns) {
+  cricket::CapturedFrame frame;
+  frame.width = width_;
+  frame.height = height_;
+  frame.fourcc = cricket::FOURCC_I420;
+  frame.data_size = static_cast<uint32_t>(size);
+  frame.time_stamp = time_ns;
+  frame.rotation = webrtc::kVideoRotation_0;
+  frame.data = const_cast<uint8_t*>(data);
+  frames_++;
+  Metrics::Add(Metrics::kFramesCaptured);
+  SignalFrameCaptured(this, &frame);
+}
@@ -0,0 +1,59 @@
+#ifndef WEBRTCJS_VIDEOCAPTURER_H
+#define WEBRTCJS_VIDEOCAPTURER_H
+
+#include <atomic>
+#include <vector>
+
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/media/base/videocapturer.h"
+#include "webrtc/media/base/videocommon.h"
+
+#include "webrtcjs.h"
+
+// Base for the native video sources that are not backed by a device. The
+// media thread calls OnTick() once per frame interval and the subclass hands
+// a contiguous I420 image back through DeliverFrame().
+class PushVideoCapturer
+  : public cricket::VideoCapturer,
+    public rtc::MessageHandler {
+ public:
+  PushVideoCapturer(int width, int height, double frame_rate);
+  ~PushVideoCapturer() override;
+
+  cricket::CaptureState Start(const cricket::VideoFormat& format) override;
+  void Stop() override;
+  bool IsRunning() override;
+  bool IsScreencast() const override;
+  bool GetPreferredFourccs(std::vector<uint32_t>* fourccs) override;
+
+  void OnMessage(rtc::Message* msg) final;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  double frame_rate() const { return frame_rate_; }
+  uint32_t frames() const { return frames_.load(); }
+
+ protected:
+  virtual void OnTick(int64_t time_ns) = 0;
+  void DeliverFrame(const uint8_t* data, size_t size, int64_t time_ns);
+
+  // Stops the clock synchronously. Subclasses call this from their destructor
+  // so OnTick() never runs on a partially destroyed object.
+  void Halt();
+
+  int width_;
+  int height_;
+  double frame_rate_;
+
+ private:
+  void StartOnMediaThread();
+  void StopOnMediaThread();
+
+  int64_t interval_ns_;
+  int64_t next_tick_ns_;
+  bool running_;
+  std::atomic<uint32_t> frames_;
+};
+
+#endif
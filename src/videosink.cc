@@ -1,6 +1,10 @@
 #include "videosink.h"
 
-Nan::Persistent<v8::Function> VideoSink::constructor;
+#include "webrtc/base/trace_event.h"
+
+#include "isolatedata.h"
+#include "metrics.h"
+#include "patternsource.h"
 
 NAN_MODULE_INIT(VideoSink::Init) {
   v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(New);
@@ -12,18 +16,53 @@ NAN_MODULE_INIT(VideoSink::Init) {
     VideoSink::GetOnFrame,
     VideoSink::SetOnFrame);
 
-  constructor.Reset(Nan::GetFunction(tpl).ToLocalChecked());
+  IsolateData::Current()->SetConstructor(IsolateData::kVideoSink,
+    Nan::GetFunction(tpl).ToLocalChecked());
   Nan::Set(target, Nan::New("VideoSink").ToLocalChecked(),
     Nan::GetFunction(tpl).ToLocalChecked());
 }
 
-VideoSink::VideoSink() { }
+VideoSink::VideoSink(bool check_pattern) :
+    check_pattern_(check_pattern),
+    has_sequence_(false) { }
 
 VideoSink::~VideoSink() { }
 
 void VideoSink::OnFrame(const cricket::VideoFrame& frame) {
-  // ++number_of_rendered_frames_;
-  Emit(kVideoSinkOnFrame, number_of_rendered_frames_);
+  ++number_of_rendered_frames_;
+  Metrics::Add(Metrics::kFramesRendered);
+
+  uint32_t sequence = 0;
+  bool stamped = false;
+  if(check_pattern_) {
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer =
+      frame.video_frame_buffer();
+    stamped = buffer.get() && PatternVideoCapturer::ReadStamp(
+      buffer->data(webrtc::kYPlane), buffer->stride(webrtc::kYPlane),
+      buffer->width(), buffer->height(), &sequence);
+  }
+
+  if(stamped) {
+    if(has_sequence_) {
+      uint32_t gap = (sequence - last_sequence_ - 1) & 0xFFFFFF;
+      // Anything "ahead" by more than half the range is a reordered frame.
+      if(gap < 0x800000) {
+        lost_frames_ += gap;
+      }
+    }
+    has_sequence_ = true;
+    last_sequence_ = sequence;
+  } else if(has_sequence_) {
+    ++corrupt_frames_;
+  }
+
+  VideoSinkStats stats;
+  stats.frames = number_of_rendered_frames_;
+  stats.sequence = last_sequence_;
+  stats.lost = lost_frames_;
+  stats.corrupt = corrupt_frames_;
+  stats.stamped = stamped;
+  Emit(kVideoSinkOnFrame, stats);
 }
 
 void VideoSink::On(Event* event) {
@@ -34,14 +73,25 @@ void VideoSink::On(Event* event) {
   if(onframe_.IsEmpty()) {
     return;
   }
-  int32_t n = event->Unwrap<int32_t>();
+  const VideoSinkStats& stats = event->Unwrap<VideoSinkStats>();
   Nan::HandleScope scope;
   v8::Local<v8::Value> argv[1];
   v8::Local<v8::Object> container = Nan::New<v8::Object>();
   container->Set(Nan::New("framesRendered").ToLocalChecked(),
-    Nan::New<v8::Int32>(n));
+    Nan::New<v8::Int32>(stats.frames));
+  if(has_sequence_) {
+    container->Set(Nan::New("sequence").ToLocalChecked(),
+      Nan::New<v8::Uint32>(stats.sequence));
+    container->Set(Nan::New("framesLost").ToLocalChecked(),
+      Nan::New<v8::Uint32>(stats.lost));
+    container->Set(Nan::New("framesCorrupt").ToLocalChecked(),
+      Nan::New<v8::Uint32>(stats.corrupt));
+    container->Set(Nan::New("stamped").ToLocalChecked(),
+      Nan::New(stats.stamped));
+  }
   v8::Local<v8::Function> fn = Nan::New<v8::Function>(onframe_);
   argv[0] = container;
+  TRACE_EVENT0("webrtcjs", "VideoSink callback");
   Nan::Callback cb(fn);
   cb.Call(1, argv);
 }
@@ -50,7 +100,18 @@ NAN_METHOD(VideoSink::New) {
   if(!info.IsConstructCall()) {
     return Nan::ThrowError("Use new operator");
   }
-  VideoSink* self = new VideoSink();
+  // new VideoSink({ checkPattern: true }) reports the sequence, lost and
+  // corrupt frames of a PatternSource.
+  bool check_pattern = false;
+  if(info.Length() >= 1 && info[0]->IsObject()) {
+    v8::Local<v8::Object> options = v8::Local<v8::Object>::Cast(info[0]);
+    v8::Local<v8::Value> check_pattern_value =
+      options->Get(Nan::New("checkPattern").ToLocalChecked());
+    if(check_pattern_value->IsBoolean()) {
+      check_pattern = check_pattern_value->BooleanValue();
+    }
+  }
+  VideoSink* self = new VideoSink(check_pattern);
   self->Wrap(info.This());
   info.GetReturnValue().Set(info.This());
 }
@@ -2,6 +2,7 @@
 #define WEBRTCJS_VIDEOSINK_H
 
 #include <nan.h>
+#include <atomic>
 
 #include "webrtc/base/scoped_ptr.h"
 #include "webrtc/media/base/videoframe.h"
@@ -9,12 +10,19 @@
 
 #include "eventemitter.h"
 
+struct VideoSinkStats {
+  int32_t frames;
+  uint32_t sequence;
+  uint32_t lost;
+  uint32_t corrupt;
+  bool stamped;
+};
+
 class VideoSink : public Nan::ObjectWrap,
     public rtc::VideoSinkInterface<cricket::VideoFrame>,
     public EventEmitter {
-  explicit VideoSink();
+  explicit VideoSink(bool check_pattern);
   ~VideoSink();
-  static Nan::Persistent<v8::Function> constructor;
   static NAN_METHOD(New);
 
   Nan::Persistent<v8::Function> onframe_;
@@ -23,6 +31,15 @@ class VideoSink : public Nan::ObjectWrap,
 
   int32_t number_of_rendered_frames_ = 0;
 
+  // Frame stamps written by PatternSource, used to check delivery. Only
+  // read with checkPattern, it costs a look at every frame.
+  const bool check_pattern_;
+  // Set on the thread delivering frames, read on the JS thread.
+  std::atomic<bool> has_sequence_;
+  uint32_t last_sequence_ = 0;
+  uint32_t lost_frames_ = 0;
+  uint32_t corrupt_frames_ = 0;
+
  public:
   static NAN_MODULE_INIT(Init);
   void OnFrame(const cricket::VideoFrame& frame) override;
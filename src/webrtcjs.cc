@@ -1,25 +1,678 @@
 #include "webrtcjs.h"
+#include "certificatepool.h"
+#include "forwarding.h"
+#include "mediastreamtrack.h"
+#include "peerconnectionpool.h"
+#include "statssampler.h"
 
-rtc::scoped_ptr<rtc::Thread> signaling_thread_;
-rtc::scoped_ptr<rtc::Thread> worker_thread_;
-rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> pc_factory_;
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sstream>
+
+#include "webrtc/base/bind.h"
+#include "webrtc/base/logging.h"
+#include "webrtc/p2p/client/basicportallocator.h"
+
+static const int kMaxFactories = 64;
+static const int kMaxUdpMuxPorts = 256;
+
+static const struct {
+  const char* name;
+  int policy;
+} kPolicies[] = {
+  { "other", SCHED_OTHER },
+  { "fifo", SCHED_FIFO },
+  { "rr", SCHED_RR },
+  { "batch", SCHED_BATCH },
+  { "idle", SCHED_IDLE },
+};
+
+rtc::scoped_ptr<rtc::Thread> media_thread_;
+
+std::vector<std::unique_ptr<WebRtcJs::Factory>> WebRtcJs::factories_;
+std::atomic<bool> WebRtcJs::in_use_(false);
+std::atomic<int> WebRtcJs::pins_(0);
+uint32_t WebRtcJs::generation_ = 0;
+rtc::CriticalSection WebRtcJs::lock_;
+bool WebRtcJs::ssl_initialized_ = false;
+std::atomic<bool> WebRtcJs::initializing_(false);
+
+// Allocator of the PeerConnections on a UDP multiplexing factory. It only
+// holds raw pointers to the shared sockets, the pin keeps shutdown() from
+// releasing them while it exists.
+class MuxPortAllocator : public cricket::BasicPortAllocator {
+ public:
+  MuxPortAllocator(rtc::NetworkManager* network_manager,
+      rtc::PacketSocketFactory* socket_factory) :
+      cricket::BasicPortAllocator(network_manager, socket_factory) {
+    WebRtcJs::Pin();
+    // A TURN allocation over UDP needs a 5-tuple of its own, the shared
+    // ports cannot tell its traffic apart. TCP and TLS relays still work.
+    set_flags(flags() | cricket::PORTALLOCATOR_DISABLE_UDP_RELAY);
+  }
+
+  ~MuxPortAllocator() override {
+    WebRtcJs::Unpin();
+  }
+};
+
+// Runs init() off the JS thread, starting threads and building the
+// factories with their codecs takes a while.
+class InitWorker : public Nan::AsyncWorker {
+ public:
+  InitWorker(Nan::Callback* callback, const WebRtcJs::Options& options) :
+      Nan::AsyncWorker(callback), options_(options) { }
+
+  void Execute() override {
+    if(!WebRtcJs::Init(options_)) {
+      SetErrorMessage("WebRTC was used before init() completed");
+    }
+  }
+
+  void HandleOKCallback() override {
+    WebRtcJs::initializing_ = false;
+    Nan::AsyncWorker::HandleOKCallback();
+  }
+
+  void HandleErrorCallback() override {
+    WebRtcJs::initializing_ = false;
+    Nan::AsyncWorker::HandleErrorCallback();
+  }
+
+ private:
+  WebRtcJs::Options options_;
+};
+
+bool WebRtcJs::Init(const Options& options) {
+  rtc::CritScope lock(&lock_);
+  if(in_use_) {
+    return false;
+  }
+  InitLocked(options);
+  return true;
+}
+
+void WebRtcJs::InitLocked(const Options& options) {
+  ShutdownLocked();
 
-void WebRtcJs::Init() {
   RTC_CHECK(rtc::InitializeSSL()) << "Failed to InitializeSSL()";
+  ssl_initialized_ = true;
+  // A pool configured before init() or the first use waited for this.
+  CertificatePool::Start();
+  generation_++;
 
-  worker_thread_.reset(new rtc::Thread());
-  worker_thread_->SetName("WebRTC Worker", NULL);
-  worker_thread_->Start();
+  // Clocks the programmatic sources (AudioSource etc.) that are fed from JS.
+  media_thread_.reset(new rtc::Thread());
+  media_thread_->SetName("WebRTC Media", NULL);
+  media_thread_->Start();
+  ApplyThreadOptions(media_thread_.get(), options.media, 0);
 
-  signaling_thread_.reset(new rtc::Thread());
-  signaling_thread_->SetName("WebRTC Signaling", NULL);
-  signaling_thread_->Start();
+  for(int index = 0; index < options.factories; index++) {
+    std::unique_ptr<Factory> factory(new Factory());
+    std::ostringstream suffix;
+    if(index) {
+      suffix << " " << index;
+    }
+
+    if(options.epoll) {
+      factory->socket_server.reset(new EpollSocketServer());
+    }
+    // A null socket server makes the thread create a PhysicalSocketServer.
+    factory->worker_thread.reset(
+      new rtc::Thread(factory->socket_server.get()));
+    factory->worker_thread->SetName("WebRTC Worker" + suffix.str(), NULL);
+    factory->worker_thread->Start();
+    ApplyThreadOptions(factory->worker_thread.get(), options.worker, index);
+
+    factory->signaling_thread.reset(new rtc::Thread());
+    factory->signaling_thread->SetName("WebRTC Signaling" + suffix.str(),
+      NULL);
+    factory->signaling_thread->Start();
+    ApplyThreadOptions(factory->signaling_thread.get(), options.signaling,
+      index);
+
+    // The factory takes ownership of the codec factories.
+    factory->factory = webrtc::CreatePeerConnectionFactory(
+      factory->signaling_thread.get(), factory->worker_thread.get(), nullptr,
+      new RelayEncoderFactory(), new RelayDecoderFactory());
+    factory->load = 0;
+    factory->created = 0;
+
+    if(options.udp_mux_port) {
+      factory->network_manager.reset(new rtc::BasicNetworkManager());
+      factory->socket_factory.reset(new UdpMuxSocketFactory(
+        factory->worker_thread.get(),
+        options.udp_mux_port + index * options.udp_mux_ports,
+        options.udp_mux_ports));
+    }
+    factories_.push_back(std::move(factory));
+  }
+}
+
+void WebRtcJs::Shutdown() {
+  rtc::CritScope lock(&lock_);
+  ShutdownLocked();
+}
+
+void WebRtcJs::ShutdownLocked() {
+  // Exported tracks hold no pin, only their handles keep them.
+  MediaStreamTrack::ClearExports();
+  // Its sessions hold PeerConnections of the factories.
+  StatsSampler::Shutdown();
+  std::vector<std::unique_ptr<Factory>>::reverse_iterator index;
+  for(index = factories_.rbegin(); index != factories_.rend(); index++) {
+    // The factory has to go before the threads it runs on.
+    (*index)->factory = nullptr;
+    (*index)->worker_thread->Invoke<void>(
+      rtc::Bind(&WebRtcJs::ReleaseNetworking, index->get()));
+    (*index)->signaling_thread.reset();
+    (*index)->worker_thread.reset();
+    (*index)->socket_server.reset();
+  }
+  factories_.clear();
+  media_thread_.reset();
+  // Its thread generates keys with the OpenSSL cleaned up below, the next
+  // init() starts it again.
+  CertificatePool::Stop();
+  if(ssl_initialized_) {
+    rtc::CleanupSSL();
+    ssl_initialized_ = false;
+  }
+  in_use_ = false;
+}
+
+void WebRtcJs::ReleaseNetworking(Factory* factory) {
+  // The shared sockets are registered with the worker thread.
+  factory->socket_factory.reset();
+  factory->network_manager.reset();
+}
+
+void WebRtcJs::MarkInUse() {
+  if(in_use_) {
+    return;
+  }
+  // Nothing is created at require() time, the first user pays for it unless
+  // init() got there before.
+  rtc::CritScope lock(&lock_);
+  if(factories_.empty()) {
+    InitLocked(Options());
+  }
+  in_use_ = true;
+}
+
+void WebRtcJs::ApplyThreadOptions(rtc::Thread* thread,
+    const ThreadOptions& options, int index) {
+  pthread_t handle = thread->GetPThread();
+
+  if(!options.cpus.empty()) {
+    const std::vector<int>& cpus = options.cpus[index % options.cpus.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    std::vector<int>::const_iterator cpu;
+    for(cpu = cpus.begin(); cpu != cpus.end(); cpu++) {
+      CPU_SET(*cpu, &set);
+    }
+    int error = pthread_setaffinity_np(handle, sizeof(set), &set);
+    if(error) {
+      LOG(LS_WARNING) << __FUNCTION__ << ": Could not pin " << thread->name()
+        << ", error " << error;
+    }
+  }
+
+  if(options.policy >= 0) {
+    sched_param param;
+    param.sched_priority = options.priority;
+    int error = pthread_setschedparam(handle, options.policy, &param);
+    if(error) {
+      // Real-time policies need CAP_SYS_NICE or an RLIMIT_RTPRIO.
+      LOG(LS_WARNING) << __FUNCTION__ << ": Could not set policy of "
+        << thread->name() << ", error " << error;
+    }
+  }
+}
+
+bool WebRtcJs::ParseThreadOptions(v8::Local<v8::Value> value,
+    ThreadOptions* options) {
+  if(value->IsUndefined()) {
+    return true;
+  }
+  if(!value->IsObject()) {
+    return false;
+  }
+  v8::Local<v8::Object> object = v8::Local<v8::Object>::Cast(value);
+  v8::Local<v8::Value> cpus_value =
+    object->Get(Nan::New("cpus").ToLocalChecked());
+  v8::Local<v8::Value> policy_value =
+    object->Get(Nan::New("policy").ToLocalChecked());
+  v8::Local<v8::Value> priority_value =
+    object->Get(Nan::New("priority").ToLocalChecked());
+
+  // Either one CPU set for all threads, [0, 1], or one set per thread,
+  // [[0], [1]].
+  if(cpus_value->IsArray()) {
+    v8::Local<v8::Array> list = v8::Local<v8::Array>::Cast(cpus_value);
+    std::vector<int> shared;
+    for(uint32_t index = 0; index < list->Length(); index++) {
+      v8::Local<v8::Value> entry = list->Get(index);
+      if(entry->IsUint32() && entry->Uint32Value() < CPU_SETSIZE) {
+        shared.push_back(entry->Uint32Value());
+      } else if(entry->IsArray()) {
+        v8::Local<v8::Array> set = v8::Local<v8::Array>::Cast(entry);
+        std::vector<int> cpus;
+        for(uint32_t cpu = 0; cpu < set->Length(); cpu++) {
+          v8::Local<v8::Value> cpu_value = set->Get(cpu);
+          if(!cpu_value->IsUint32() ||
+              cpu_value->Uint32Value() >= CPU_SETSIZE) {
+            return false;
+          }
+          cpus.push_back(cpu_value->Uint32Value());
+        }
+        if(cpus.empty()) {
+          return false;
+        }
+        options->cpus.push_back(cpus);
+      } else {
+        return false;
+      }
+    }
+    if(!shared.empty()) {
+      if(!options->cpus.empty()) {
+        return false;
+      }
+      options->cpus.push_back(shared);
+    }
+  } else if(!cpus_value->IsUndefined()) {
+    return false;
+  }
+
+  if(policy_value->IsString()) {
+    v8::String::Utf8Value name(policy_value->ToString());
+    std::string policy_name(*name);
+    size_t count = sizeof(kPolicies) / sizeof(kPolicies[0]);
+    size_t index;
+    for(index = 0; index < count; index++) {
+      if(policy_name == kPolicies[index].name) {
+        options->policy = kPolicies[index].policy;
+        break;
+      }
+    }
+    if(index == count) {
+      return false;
+    }
+  } else if(!policy_value->IsUndefined()) {
+    return false;
+  }
+
+  if(priority_value->IsInt32()) {
+    options->priority = priority_value->Int32Value();
+    if(options->policy < 0) {
+      options->policy = SCHED_OTHER;
+    }
+  } else if(!priority_value->IsUndefined()) {
+    return false;
+  }
+  if(options->policy >= 0 &&
+      (options->priority < sched_get_priority_min(options->policy) ||
+       options->priority > sched_get_priority_max(options->policy))) {
+    return false;
+  }
+  return true;
+}
+
+bool WebRtcJs::ParseFactory(v8::Local<v8::Value> value, FactoryId* id) {
+  MarkInUse();
+  rtc::CritScope lock(&lock_);
+  int index = 0;
+  if(value->IsUint32() &&
+      value->Uint32Value() < static_cast<uint32_t>(factories_.size())) {
+    index = value->Uint32Value();
+  } else if(!value->IsUndefined()) {
+    return false;
+  }
+  *id = FactoryId(index, generation_);
+  return true;
+}
 
-  pc_factory_ = webrtc::CreatePeerConnectionFactory(signaling_thread_.get(),
-    worker_thread_.get(), nullptr, nullptr, nullptr);
+WebRtcJs::Factory* WebRtcJs::FindLocked(const FactoryId& id) {
+  if(id.generation != generation_ || id.index < 0 ||
+     id.index >= static_cast<int>(factories_.size())) {
+    return nullptr;
+  }
+  return factories_[id.index].get();
 }
 
-webrtc::PeerConnectionFactoryInterface* WebRtcJs::GetPeerConnectionFactory() {
-  return pc_factory_.get();
+webrtc::PeerConnectionFactoryInterface* WebRtcJs::GetPeerConnectionFactory(
+    const FactoryId& id) {
+  rtc::CritScope lock(&lock_);
+  Factory* factory = FindLocked(id);
+  return factory ? factory->factory.get() : nullptr;
 }
 
+rtc::Thread* WebRtcJs::GetMediaThreadIfRunning() {
+  return media_thread_.get();
+}
+
+void WebRtcJs::Pin() {
+  // Taken under the lock so shutdown() either sees the pin or finishes
+  // before the threads are started again.
+  rtc::CritScope lock(&lock_);
+  if(factories_.empty()) {
+    InitLocked(Options());
+  }
+  in_use_ = true;
+  pins_++;
+}
+
+void WebRtcJs::Unpin() {
+  int pins = --pins_;
+  RTC_DCHECK_GE(pins, 0);
+}
+
+WebRtcJs::FactoryId WebRtcJs::AcquireFactory(const FactoryId* factory) {
+  MarkInUse();
+  // Worker threads create PeerConnections too, one at a time keeps the
+  // loads balanced.
+  rtc::CritScope lock(&lock_);
+  int best = 0;
+  if(factory && FindLocked(*factory)) {
+    best = factory->index;
+  } else {
+    for(size_t index = 1; index < factories_.size(); index++) {
+      if(factories_[index]->load < factories_[best]->load) {
+        best = index;
+      }
+    }
+  }
+  factories_[best]->load++;
+  factories_[best]->created++;
+  return FactoryId(best, generation_);
+}
+
+void WebRtcJs::ReleaseFactory(const FactoryId& id) {
+  rtc::CritScope lock(&lock_);
+  Factory* factory = FindLocked(id);
+  if(factory) {
+    factory->load--;
+  }
+}
+
+cricket::PortAllocator* WebRtcJs::CreatePortAllocator(const FactoryId& id) {
+  rtc::CritScope lock(&lock_);
+  Factory* factory = FindLocked(id);
+  if(!factory || !factory->socket_factory.get()) {
+    return nullptr;
+  }
+  return new MuxPortAllocator(factory->network_manager.get(),
+    factory->socket_factory.get());
+}
+
+NAN_MODULE_INIT(WebRtcJs::InitBindings) {
+  Nan::SetMethod(target, "init", WebRtcJs::Configure);
+  Nan::SetMethod(target, "shutdown", WebRtcJs::Close);
+  Nan::SetMethod(target, "getFactoryLoad", WebRtcJs::GetFactoryLoad);
+  Nan::SetMethod(target, "getThreadStats", WebRtcJs::GetThreadStats);
+}
+
+NAN_METHOD(WebRtcJs::Configure) {
+  Options options;
+  if(info.Length() >= 1 && info[0]->IsObject() && !info[0]->IsFunction()) {
+    v8::Local<v8::Object> object = v8::Local<v8::Object>::Cast(info[0]);
+    v8::Local<v8::Value> factories_value =
+      object->Get(Nan::New("factories").ToLocalChecked());
+    if(factories_value->IsUint32()) {
+      options.factories = factories_value->Uint32Value();
+    }
+
+    v8::Local<v8::Value> socket_server_value =
+      object->Get(Nan::New("socketServer").ToLocalChecked());
+    if(socket_server_value->IsString()) {
+      v8::String::Utf8Value name(socket_server_value->ToString());
+      std::string socket_server(*name);
+      if(socket_server == "epoll") {
+        options.epoll = true;
+      } else if(socket_server != "default") {
+        return Nan::ThrowError("Invalid socketServer");
+      }
+    } else if(!socket_server_value->IsUndefined()) {
+      return Nan::ThrowError("Invalid socketServer");
+    }
+    if(!ParseThreadOptions(object->Get(Nan::New("worker").ToLocalChecked()),
+        &options.worker) ||
+       !ParseThreadOptions(object->Get(Nan::New("signaling").ToLocalChecked()),
+        &options.signaling) ||
+       !ParseThreadOptions(object->Get(Nan::New("media").ToLocalChecked()),
+        &options.media)) {
+      return Nan::ThrowError("Invalid thread options");
+    }
+
+    v8::Local<v8::Value> udp_mux_value =
+      object->Get(Nan::New("udpMux").ToLocalChecked());
+    if(udp_mux_value->IsObject()) {
+      v8::Local<v8::Object> udp_mux =
+        v8::Local<v8::Object>::Cast(udp_mux_value);
+      v8::Local<v8::Value> port_value =
+        udp_mux->Get(Nan::New("port").ToLocalChecked());
+      v8::Local<v8::Value> ports_value =
+        udp_mux->Get(Nan::New("ports").ToLocalChecked());
+      if(!port_value->IsUint32() || port_value->Uint32Value() == 0 ||
+         port_value->Uint32Value() > 65535) {
+        return Nan::ThrowError("Invalid udpMux.port");
+      }
+      options.udp_mux_port = port_value->Uint32Value();
+      if(ports_value->IsUint32()) {
+        options.udp_mux_ports = ports_value->Uint32Value();
+      } else if(!ports_value->IsUndefined()) {
+        return Nan::ThrowError("Invalid udpMux.ports");
+      }
+    } else if(!udp_mux_value->IsUndefined()) {
+      return Nan::ThrowError("Invalid udpMux");
+    }
+  }
+
+  if(options.factories < 1 || options.factories > kMaxFactories) {
+    return Nan::ThrowError("Invalid factories");
+  }
+  if(options.udp_mux_ports < 1 || options.udp_mux_ports > kMaxUdpMuxPorts ||
+     options.udp_mux_port +
+       options.factories * options.udp_mux_ports - 1 > 65535) {
+    return Nan::ThrowError("Invalid udpMux.ports");
+  }
+  if(initializing_) {
+    return Nan::ThrowError("init() is already in progress");
+  }
+  if(in_use_) {
+    return Nan::ThrowError("init() must be called before WebRTC is used");
+  }
+
+  if(info.Length() >= 1 && info[info.Length() - 1]->IsFunction()) {
+    v8::Local<v8::Function> callback =
+      v8::Local<v8::Function>::Cast(info[info.Length() - 1]);
+    // Another isolate may be starting init() at the same time.
+    if(initializing_.exchange(true)) {
+      return Nan::ThrowError("init() is already in progress");
+    }
+    Nan::AsyncQueueWorker(new InitWorker(new Nan::Callback(callback),
+      options));
+  } else {
+    Init(options);
+  }
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(WebRtcJs::Close) {
+  if(initializing_) {
+    return Nan::ThrowError("init() is in progress");
+  }
+  PeerConnectionPool::Clear(v8::Isolate::GetCurrent());
+  // Every creation holds a factory until its callback ran on the loop of
+  // its isolate, refuse rather than wait here and block that loop.
+  if(PeerConnectionPool::InFlight() > 0) {
+    return Nan::ThrowError(
+      "PeerConnections are still being created, retry shutdown() once "
+      "they are");
+  }
+  rtc::CritScope lock(&lock_);
+  for(size_t index = 0; index < factories_.size(); index++) {
+    if(factories_[index]->load > 0) {
+      return Nan::ThrowError("Close all PeerConnections before shutdown()");
+    }
+  }
+  // Counts the objects of every isolate, closed PeerConnections and unused
+  // sources still live on these threads until they are collected.
+  if(pins_ > 0) {
+    return Nan::ThrowError(
+      "Release all sources, tracks, streams and PeerConnections before "
+      "shutdown()");
+  }
+  ShutdownLocked();
+  info.GetReturnValue().SetUndefined();
+}
+
+NAN_METHOD(WebRtcJs::GetFactoryLoad) {
+  rtc::CritScope lock(&lock_);
+  v8::Local<v8::Array> list = Nan::New<v8::Array>(factories_.size());
+  for(size_t index = 0; index < factories_.size(); index++) {
+    v8::Local<v8::Object> load = Nan::New<v8::Object>();
+    load->Set(Nan::New("peerConnections").ToLocalChecked(),
+      Nan::New(factories_[index]->load.load()));
+    load->Set(Nan::New("created").ToLocalChecked(),
+      Nan::New(factories_[index]->created.load()));
+
+    if(factories_[index]->socket_factory.get()) {
+      std::vector<UdpMux::Stats> stats;
+      factories_[index]->socket_factory->GetStats(&stats);
+      v8::Local<v8::Array> muxes = Nan::New<v8::Array>(stats.size());
+      for(size_t mux = 0; mux < stats.size(); mux++) {
+        v8::Local<v8::Object> mux_stats = Nan::New<v8::Object>();
+        mux_stats->Set(Nan::New("address").ToLocalChecked(),
+          Nan::New(stats[mux].address.ToString()).ToLocalChecked());
+        mux_stats->Set(Nan::New("sockets").ToLocalChecked(),
+          Nan::New(stats[mux].sockets));
+        mux_stats->Set(Nan::New("packetsReceived").ToLocalChecked(),
+          Nan::New(static_cast<double>(stats[mux].received)));
+        mux_stats->Set(Nan::New("packetsSent").ToLocalChecked(),
+          Nan::New(static_cast<double>(stats[mux].sent)));
+        mux_stats->Set(Nan::New("packetsUnmatched").ToLocalChecked(),
+          Nan::New(static_cast<double>(stats[mux].unmatched)));
+        muxes->Set(mux, mux_stats);
+      }
+      load->Set(Nan::New("udpMux").ToLocalChecked(), muxes);
+    }
+    list->Set(index, load);
+  }
+  info.GetReturnValue().Set(list);
+}
+
+static bool ThreadCpuTime(rtc::Thread* thread, double* ms) {
+  clockid_t clock;
+  timespec time;
+  if(pthread_getcpuclockid(thread->GetPThread(), &clock) ||
+      clock_gettime(clock, &time)) {
+    return false;
+  }
+  *ms = time.tv_sec * 1000.0 + time.tv_nsec / 1e6;
+  return true;
+}
+
+static v8::Local<v8::Object> ThreadStats(rtc::Thread* thread, int factory) {
+  v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+  pthread_t handle = thread->GetPThread();
+
+  stats->Set(Nan::New("name").ToLocalChecked(),
+    Nan::New(thread->name()).ToLocalChecked());
+  if(factory >= 0) {
+    stats->Set(Nan::New("factory").ToLocalChecked(), Nan::New(factory));
+  }
+
+  double cpu_time;
+  if(ThreadCpuTime(thread, &cpu_time)) {
+    stats->Set(Nan::New("cpuTime").ToLocalChecked(), Nan::New(cpu_time));
+  }
+
+  cpu_set_t set;
+  if(!pthread_getaffinity_np(handle, sizeof(set), &set)) {
+    v8::Local<v8::Array> cpus = Nan::New<v8::Array>();
+    uint32_t count = 0;
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if(CPU_ISSET(cpu, &set)) {
+        cpus->Set(count++, Nan::New(cpu));
+      }
+    }
+    stats->Set(Nan::New("cpus").ToLocalChecked(), cpus);
+  }
+
+  int policy;
+  sched_param param;
+  if(!pthread_getschedparam(handle, &policy, &param)) {
+    size_t count = sizeof(kPolicies) / sizeof(kPolicies[0]);
+    for(size_t index = 0; index < count; index++) {
+      if(kPolicies[index].policy == policy) {
+        stats->Set(Nan::New("policy").ToLocalChecked(),
+          Nan::New(kPolicies[index].name).ToLocalChecked());
+      }
+    }
+    stats->Set(Nan::New("priority").ToLocalChecked(),
+      Nan::New(param.sched_priority));
+  }
+  return stats;
+}
+
+NAN_METHOD(WebRtcJs::GetThreadStats) {
+  rtc::CritScope lock(&lock_);
+  v8::Local<v8::Array> list = Nan::New<v8::Array>();
+  uint32_t count = 0;
+  for(size_t index = 0; index < factories_.size(); index++) {
+    list->Set(count++,
+      ThreadStats(factories_[index]->signaling_thread.get(), index));
+    v8::Local<v8::Object> worker =
+      ThreadStats(factories_[index]->worker_thread.get(), index);
+    if(factories_[index]->socket_server.get()) {
+      EpollSocketServer::Stats stats;
+      static_cast<EpollSocketServer*>(
+        factories_[index]->socket_server.get())->GetStats(&stats);
+      v8::Local<v8::Object> server = Nan::New<v8::Object>();
+      server->Set(Nan::New("receiveCalls").ToLocalChecked(),
+        Nan::New(static_cast<double>(stats.receive_calls)));
+      server->Set(Nan::New("packetsReceived").ToLocalChecked(),
+        Nan::New(static_cast<double>(stats.packets_received)));
+      server->Set(Nan::New("sendCalls").ToLocalChecked(),
+        Nan::New(static_cast<double>(stats.send_calls)));
+      server->Set(Nan::New("packetsSent").ToLocalChecked(),
+        Nan::New(static_cast<double>(stats.packets_sent)));
+      server->Set(Nan::New("packetsDropped").ToLocalChecked(),
+        Nan::New(static_cast<double>(stats.packets_dropped)));
+      worker->Set(Nan::New("socketServer").ToLocalChecked(), server);
+    }
+    list->Set(count++, worker);
+  }
+  if(media_thread_.get()) {
+    list->Set(count++, ThreadStats(media_thread_.get(), -1));
+  }
+  info.GetReturnValue().Set(list);
+}
+
+static void WriteThreadMetrics(MetricsWriter* writer, rtc::Thread* thread) {
+  double cpu_time;
+  if(thread && ThreadCpuTime(thread, &cpu_time)) {
+    writer->Write("webrtcjs_thread_cpu_seconds_total", "counter",
+      "CPU time of the WebRTC threads.", "thread=\"" + thread->name() + "\"",
+      cpu_time / 1000);
+  }
+}
+
+void WebRtcJs::WriteMetrics(MetricsWriter* writer) {
+  rtc::CritScope lock(&lock_);
+  for(size_t index = 0; index < factories_.size(); index++) {
+    std::ostringstream labels;
+    labels << "factory=\"" << index << "\"";
+    writer->Write("webrtcjs_factory_peer_connections", "gauge",
+      "PeerConnections per factory.", labels.str(),
+      factories_[index]->load.load());
+  }
+  for(size_t index = 0; index < factories_.size(); index++) {
+    WriteThreadMetrics(writer, factories_[index]->signaling_thread.get());
+    WriteThreadMetrics(writer, factories_[index]->worker_thread.get());
+  }
+  WriteThreadMetrics(writer, media_thread_.get());
+}
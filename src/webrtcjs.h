@@ -2,16 +2,141 @@
 #define WEBRTCJS_H
 
 #include <nan.h>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 #include "webrtc/base/checks.h"
+#include "webrtc/base/criticalsection.h"
 #include "webrtc/base/ssladapter.h"
 #include "webrtc/media/devices/devicemanager.h"
 #include "webrtc/api/peerconnectionfactory.h"
+#include "webrtc/base/network.h"
+#include "webrtc/p2p/base/portallocator.h"
+
+#include "epollsocketserver.h"
+#include "metrics.h"
+#include "udpmux.h"
 
 class WebRtcJs {
  public:
-  static void Init();
-  static webrtc::PeerConnectionFactoryInterface* GetPeerConnectionFactory();
+  struct ThreadOptions {
+    ThreadOptions() : policy(-1), priority(0) { }
+    // CPU sets, thread i of a kind is pinned to cpus[i % cpus.size()].
+    std::vector<std::vector<int>> cpus;
+    // SCHED_* policy, -1 leaves the scheduling untouched.
+    int policy;
+    int priority;
+  };
+
+  struct Options {
+    Options() :
+        factories(1), epoll(false), udp_mux_port(0), udp_mux_ports(1) { }
+    // Every factory gets its own signaling and worker thread.
+    int factories;
+    // Runs the worker threads on EpollSocketServer instead of the select()
+    // based PhysicalSocketServer.
+    bool epoll;
+    // With a port set, all PeerConnections of factory i share the UDP ports
+    // udp_mux_port + i * udp_mux_ports onwards instead of one socket each.
+    int udp_mux_port;
+    int udp_mux_ports;
+    ThreadOptions worker;
+    ThreadOptions signaling;
+    ThreadOptions media;
+  };
+
+  // Replaces the factories and threads, fails once WebRTC is in use.
+  // Without an explicit Init() the defaults are created on first use.
+  static bool Init(const Options& options);
+  static void Shutdown();
+
+  // A factory of one init(). An id kept across shutdown() and the next
+  // init() no longer names any factory instead of a new one.
+  struct FactoryId {
+    FactoryId() : index(-1), generation(0) { }
+    FactoryId(int index, uint32_t generation) :
+        index(index), generation(generation) { }
+    bool operator==(const FactoryId& other) const {
+      return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const FactoryId& other) const {
+      return !(*this == other);
+    }
+    int index;
+    uint32_t generation;
+  };
+
+  // Local media is created on one factory and can only be sent by the
+  // PeerConnections of that factory. Index 0 unless value names another
+  // one, false when it is out of range. Starts the threads on first use.
+  static bool ParseFactory(v8::Local<v8::Value> value, FactoryId* id);
+  // Null once the factory is gone.
+  static webrtc::PeerConnectionFactoryInterface* GetPeerConnectionFactory(
+    const FactoryId& id);
+  // Null before the first use and after shutdown, never starts the threads.
+  // Only for objects that hold a Pin().
+  static rtc::Thread* GetMediaThreadIfRunning();
+
+  // Every native object holding WebRTC objects that live on the factory
+  // threads pins them from construction to destruction, shutdown() refuses
+  // while any is left. Pin() starts the threads on first use.
+  static void Pin();
+  static void Unpin();
+
+  // Picks factory, or the one with the fewest PeerConnections when it is
+  // null or gone, and counts one more on it. Every AcquireFactory() must be
+  // paired with a ReleaseFactory().
+  static FactoryId AcquireFactory(const FactoryId* factory=nullptr);
+  static void ReleaseFactory(const FactoryId& id);
+  // Null unless the factory multiplexes UDP, CreatePeerConnection() then
+  // uses the default allocator.
+  static cricket::PortAllocator* CreatePortAllocator(const FactoryId& id);
+  // Factory loads and thread CPU time for getMetrics().
+  static void WriteMetrics(MetricsWriter* writer);
+
+  static NAN_MODULE_INIT(InitBindings);
+
+ private:
+  friend class InitWorker;
+
+  struct Factory {
+    // Declared first, the worker thread must go before its socket server.
+    rtc::scoped_ptr<rtc::SocketServer> socket_server;
+    rtc::scoped_ptr<rtc::Thread> signaling_thread;
+    rtc::scoped_ptr<rtc::Thread> worker_thread;
+    rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory;
+    // Both only used on the worker thread.
+    rtc::scoped_ptr<rtc::BasicNetworkManager> network_manager;
+    rtc::scoped_ptr<UdpMuxSocketFactory> socket_factory;
+    std::atomic<int> load;
+    std::atomic<uint32_t> created;
+  };
+
+  static void InitLocked(const Options& options);
+  static void ShutdownLocked();
+  static void MarkInUse();
+  // Null unless id names a factory of the current init(), lock_ held.
+  static Factory* FindLocked(const FactoryId& id);
+  static void ReleaseNetworking(Factory* factory);
+  static void ApplyThreadOptions(rtc::Thread* thread,
+    const ThreadOptions& options, int index);
+  static bool ParseThreadOptions(v8::Local<v8::Value> value,
+    ThreadOptions* options);
+
+  static NAN_METHOD(Configure);
+  static NAN_METHOD(Close);
+  static NAN_METHOD(GetFactoryLoad);
+  static NAN_METHOD(GetThreadStats);
+
+  static std::vector<std::unique_ptr<Factory>> factories_;
+  static std::atomic<bool> in_use_;
+  static std::atomic<int> pins_;
+  // Counts init()s, see FactoryId.
+  static uint32_t generation_;
+  static rtc::CriticalSection lock_;
+  static bool ssl_initialized_;
+  static std::atomic<bool> initializing_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,117 @@
+'use strict';
+// Measures PeerConnection setup time for different prewarmPoolSize values
+// of the RTCConfiguration, using loopback pairs inside this process. The
+// sizes only grow, a pool keeps its target until it idles out.
+//
+//   node test/bench_setup.js [iterations]
+//
+// Reported per pool size, median and 90th percentile in milliseconds:
+//   signaled   new RTCPeerConnection() until the answer is applied
+//   candidate  new RTCPeerConnection() until the first local candidate
+var webrtcjs = require('../build/Release/webrtcjs.node');
+
+var POOL_SIZES = [0, 1, 4];
+var ITERATIONS = parseInt(process.argv[2], 10) || 20;
+var PAUSE_MS = 200;
+
+var constraints = {
+  mandatory: {
+    OfferToReceiveAudio: true,
+    OfferToReceiveVideo: true
+  }
+};
+
+function now() {
+  var time = process.hrtime();
+  return time[0] * 1e3 + time[1] / 1e6;
+}
+
+function percentile(values, p) {
+  var sorted = values.slice().sort(function(a, b) { return a - b; });
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+function setup(config, callback) {
+  var start = now();
+  var result = {};
+  var offerer = new webrtcjs.RTCPeerConnection(config, constraints);
+  var answerer = new webrtcjs.RTCPeerConnection(config, constraints);
+
+  function done() {
+    if(result.signaled !== undefined && result.candidate !== undefined) {
+      offerer.close();
+      answerer.close();
+      callback(result);
+    }
+  }
+
+  offerer.onicecandidate = function(e) {
+    if(e.candidate && result.candidate === undefined) {
+      result.candidate = now() - start;
+      done();
+    }
+  };
+
+  offerer.createOffer(function(offer) {
+    offerer.setLocalDescription(offer, function() {
+      answerer.setRemoteDescription(offer, function() {
+        answerer.createAnswer(function(answer) {
+          answerer.setLocalDescription(answer, function() {
+            offerer.setRemoteDescription(answer, function() {
+              result.signaled = now() - start;
+              done();
+            });
+          });
+        });
+      });
+    });
+  });
+}
+
+function run(poolSize, callback) {
+  var config = {
+    iceServers: [],
+    bundlePolicy: 'max-bundle',
+    rtcpMuxPolicy: 'require',
+    prewarmPoolSize: poolSize
+  };
+  var signaled = [];
+  var candidate = [];
+
+  // The first PeerConnection reserves the pool, let it fill before
+  // measuring.
+  new webrtcjs.RTCPeerConnection(config, constraints).close();
+  setTimeout(function next() {
+    if(signaled.length === ITERATIONS) {
+      return callback({
+        poolSize: poolSize,
+        signaled: signaled,
+        candidate: candidate
+      });
+    }
+    setup(config, function(result) {
+      signaled.push(result.signaled);
+      candidate.push(result.candidate);
+      setTimeout(next, PAUSE_MS);
+    });
+  }, 1000);
+}
+
+console.log('pool  signaled p50/p90      candidate p50/p90');
+(function next(index) {
+  if(index === POOL_SIZES.length) {
+    return process.exit(0);
+  }
+  run(POOL_SIZES[index], function(result) {
+    console.log(
+      ('    ' + result.poolSize).slice(-4) + '  ' +
+      ('        ' + percentile(result.signaled, 0.5).toFixed(1)).slice(-8) +
+      ' /' +
+      ('        ' + percentile(result.signaled, 0.9).toFixed(1)).slice(-8) +
+      '  ' +
+      ('        ' + percentile(result.candidate, 0.5).toFixed(1)).slice(-8) +
+      ' /' +
+      ('        ' + percentile(result.candidate, 0.9).toFixed(1)).slice(-8));
+    next(index + 1);
+  });
+})(0);
@@ -0,0 +1,142 @@
+'use strict';
+// Measures process CPU while one PatternSource track is sent to 1, 10 and
+// 100 local viewers, with and without shared encoding.
+//
+//   node test/bench_shared_encoder.js [seconds]
+//
+// Receivers turn on encoded forwarding for their tracks so they only copy
+// payloads instead of decoding, which keeps the numbers about the sending
+// side.
+var webrtcjs = require('../build/Release/webrtcjs.node');
+
+var VIEWERS = [1, 10, 100];
+var SECONDS = parseInt(process.argv[2], 10) || 10;
+var WARMUP_MS = 3000;
+
+var pcConstraints = {
+  mandatory: {
+    OfferToReceiveAudio: false,
+    OfferToReceiveVideo: false
+  }
+};
+var viewerConstraints = {
+  mandatory: {
+    OfferToReceiveAudio: false,
+    OfferToReceiveVideo: true
+  }
+};
+
+function connect(stream, callback) {
+  var sender = new webrtcjs.RTCPeerConnection({iceServers: []}, pcConstraints);
+  var viewer = new webrtcjs.RTCPeerConnection({iceServers: []},
+    viewerConstraints);
+
+  sender.onicecandidate = function(e) {
+    if(e.candidate) {
+      viewer.addIceCandidate(e.candidate);
+    }
+  };
+  viewer.onicecandidate = function(e) {
+    if(e.candidate) {
+      sender.addIceCandidate(e.candidate);
+    }
+  };
+  // Forwarding lasts as long as the track objects, keep them.
+  viewer.onaddstream = function(remote) {
+    viewer.tracks = remote.getVideoTracks();
+    viewer.tracks.forEach(function(track) {
+      track.setEncodedForwarding(true);
+    });
+  };
+
+  sender.addStream(stream);
+  sender.createOffer(function(offer) {
+    sender.setLocalDescription(offer, function() {
+      viewer.setRemoteDescription(offer, function() {
+        viewer.createAnswer(function(answer) {
+          viewer.setLocalDescription(answer, function() {
+            sender.setRemoteDescription(answer, function() {
+              callback({sender: sender, viewer: viewer});
+            });
+          });
+        });
+      });
+    });
+  });
+}
+
+function run(viewers, shared, callback) {
+  var source = new webrtcjs.PatternSource({
+    width: 1280,
+    height: 720,
+    frameRate: 30,
+    pattern: 'bars'
+  });
+  var stream = new webrtcjs.MediaStream('bench');
+  var track = source.createTrack('bench-video');
+  track.setSharedEncoding(shared);
+  stream.addTrack(track);
+
+  var pairs = [];
+  (function next() {
+    if(pairs.length < viewers) {
+      return connect(stream, function(pair) {
+        pairs.push(pair);
+        next();
+      });
+    }
+
+    setTimeout(function() {
+      var start = process.cpuUsage();
+      var startTime = process.hrtime();
+      var startStats = webrtcjs.getSharedEncoderStats();
+
+      setTimeout(function() {
+        var usage = process.cpuUsage(start);
+        var elapsed = process.hrtime(startTime);
+        var stats = webrtcjs.getSharedEncoderStats();
+        var wall = elapsed[0] * 1e6 + elapsed[1] / 1e3;
+
+        pairs.forEach(function(pair) {
+          pair.sender.close();
+          pair.viewer.close();
+        });
+        track.setSharedEncoding(false);
+
+        callback({
+          viewers: viewers,
+          shared: shared,
+          cpu: (usage.user + usage.system) / wall * 100,
+          encoded: stats.framesEncoded - startStats.framesEncoded,
+          reused: stats.framesShared - startStats.framesShared,
+          groups: stats.groups
+        });
+      }, SECONDS * 1000);
+    }, WARMUP_MS);
+  })();
+}
+
+var runs = [];
+VIEWERS.forEach(function(viewers) {
+  runs.push([viewers, false]);
+  runs.push([viewers, true]);
+});
+
+console.log('viewers  shared  cpu%     encoded  reused   groups');
+(function next() {
+  var params = runs.shift();
+  if(!params) {
+    return process.exit(0);
+  }
+  run(params[0], params[1], function(result) {
+    console.log(
+      ('       ' + result.viewers).slice(-7) + '  ' +
+      (result.shared ? 'yes   ' : 'no    ') + '  ' +
+      ('       ' + result.cpu.toFixed(1)).slice(-7) + '  ' +
+      ('       ' + result.encoded).slice(-7) + '  ' +
+      ('       ' + result.reused).slice(-7) + '  ' +
+      ('       ' + result.groups).slice(-7));
+    // Give the closed connections time to tear down before the next run.
+    setTimeout(next, 1000);
+  });
+})();
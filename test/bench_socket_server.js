@@ -0,0 +1,39 @@
+'use strict';
+// Compares the default PhysicalSocketServer with EpollSocketServer by
+// flooding UDP over loopback between socket pairs on a single thread.
+//
+//   node test/bench_socket_server.js [seconds] [pairs]
+//
+// Reported per server: received packets per second and thread CPU time per
+// received packet in microseconds.
+var webrtcjs = require('../build/Release/webrtcjs.node');
+
+var SERVERS = ['default', 'epoll'];
+var SECONDS = parseInt(process.argv[2], 10) || 5;
+var PAIRS = parseInt(process.argv[3], 10) || 8;
+var SIZE = 200;
+var BURST = 64;
+
+console.log('server     pps        cpu/packet');
+(function next(index) {
+  if(index === SERVERS.length) {
+    return;
+  }
+  webrtcjs.benchmarkSocketServer({
+    server: SERVERS[index],
+    pairs: PAIRS,
+    size: SIZE,
+    burst: BURST,
+    duration: SECONDS * 1000
+  }, function(error, result) {
+    if(error) {
+      throw error;
+    }
+    console.log(
+      (result.server + '          ').slice(0, 10) + ' ' +
+      ('          ' + Math.round(result.packetsPerSecond)).slice(-10) + ' ' +
+      ('          ' + (result.cpuPerPacket || 0).toFixed(2)).slice(-10) +
+      ' us');
+    next(index + 1);
+  });
+})(0);
@@ -0,0 +1,46 @@
+'use strict';
+// Checks that a certificate pool configured before WebRTC starts survives
+// the lazy initialization and hands its certificates to PeerConnections.
+//
+//   node test/certificate_pool.js
+var assert = require('assert');
+var webrtcjs = require('../build/Release/webrtcjs.node');
+
+var TIMEOUT_MS = 30000;
+var POLL_MS = 100;
+
+var pcConstraints = {
+  mandatory: {
+    OfferToReceiveAudio: true,
+    OfferToReceiveVideo: false
+  }
+};
+
+// Nothing has initialized WebRTC yet, the first PeerConnection does.
+webrtcjs.configureCertificatePool({size: 2, keyType: 'ecdsa'});
+assert.ok(webrtcjs.getCertificatePoolStats().enabled);
+
+var first = new webrtcjs.RTCPeerConnection({iceServers: []}, pcConstraints);
+var start = Date.now();
+
+(function poll() {
+  var stats = webrtcjs.getCertificatePoolStats();
+  assert.ok(stats.enabled, 'init kept the pool');
+  if(!stats.available) {
+    assert.ok(Date.now() - start < TIMEOUT_MS, 'the pool generated nothing');
+    return setTimeout(poll, POLL_MS);
+  }
+
+  var pc = new webrtcjs.RTCPeerConnection({iceServers: []}, pcConstraints);
+  pc.createOffer(function() {
+    stats = webrtcjs.getCertificatePoolStats();
+    assert.ok(stats.generated + stats.loaded > 0);
+    assert.ok(stats.acquired > 0, 'the PeerConnection took a certificate');
+    first.close();
+    pc.close();
+    console.log('ok');
+    process.exit(0);
+  }, function(error) {
+    assert.fail(error);
+  });
+})();
@@ -0,0 +1,57 @@
+'use strict';
+// Checks that a PeerConnection can be placed on the factory its streams
+// were created on when init() starts several of them.
+//
+//   node test/factories.js
+var assert = require('assert');
+var webrtcjs = require('../build/Release/webrtcjs.node');
+
+var FACTORIES = 2;
+
+var pcConstraints = {
+  mandatory: {
+    OfferToReceiveAudio: false,
+    OfferToReceiveVideo: false
+  }
+};
+
+webrtcjs.init({factories: FACTORIES});
+
+assert.throws(function() {
+  new webrtcjs.RTCPeerConnection({iceServers: [], factory: FACTORIES},
+    pcConstraints);
+}, /Invalid factory/);
+
+function check(factory, callback) {
+  var source = new webrtcjs.PatternSource({
+    width: 320,
+    height: 240,
+    frameRate: 15,
+    factory: factory
+  });
+  var stream = new webrtcjs.MediaStream('factory' + factory,
+    {factory: factory});
+  stream.addTrack(source.createTrack('factory' + factory + '-video'));
+
+  var pc = new webrtcjs.RTCPeerConnection({iceServers: [], factory: factory},
+    pcConstraints);
+  // Deferred until the PeerConnection exists, on the same factory.
+  pc.addStream(stream);
+  pc.createOffer(function(offer) {
+    assert.strictEqual(pc.factory, factory);
+    assert.ok(/m=video/.test(offer.sdp), 'the offer sends the stream');
+    pc.close();
+    callback();
+  }, function(error) {
+    assert.fail(error);
+  });
+}
+
+var factory = 0;
+(function next() {
+  if(factory === FACTORIES) {
+    console.log('ok');
+    return process.exit(0);
+  }
+  check(factory++, next);
+})();